@@ -0,0 +1,677 @@
+//
+// alps_bench - per packet cost of the ALPS decoders and finger tracking on the host
+//
+// Runs every decoder in VoodooPS2Trackpad/alps_decode.cpp over a set of
+// synthetic packets and, with -t, over packets recorded from a device. It
+// also runs AlpsTracker (VoodooPS2Trackpad/alps_tracker.cpp) over a synthetic
+// gesture, a frame counting as a packet, and times 5x5 FingerAssignment
+// solves. For each case it reports ns, cycles and branch misses per packet
+// and the number of heap allocations made, as JSON on stdout so that runs can
+// be compared and gated on. Any allocation fails the run.
+//
+// The synthetic packets are random, but built byte by byte so that each one
+// passes alps_check_packet_sync for the device it is decoded as, like the
+// packets the driver hands over. Recorded packets come from a "PS2Trace"
+// snapshot of the controller (PS2TraceRecord array, saved as raw bytes):
+//
+//   make -C Host bench
+//   build/alps_bench [-r rounds] [-t v3|rushmore|v4|v5|v7|ss4|ss4_plus trace.bin]
+//
+// Cycles and branch misses come from perf_event_open where the kernel allows
+// it; otherwise cycles fall back to the time stamp counter and branch misses
+// are reported as null.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <new>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "alps_decode.h"
+#include "alps_tracker.h"
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Heap allocation counting
+//
+// Every operator new counts, and on glibc so does every malloc family call,
+// which covers anything the decoders could reach.
+
+static volatile unsigned long allocations;
+
+void *operator new(size_t size)
+{
+    allocations++;
+    if (void *p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+#if defined(__GLIBC__)
+extern "C" {
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+
+void *malloc(size_t size)
+{
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    allocations++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *p, size_t size)
+{
+    allocations++;
+    return __libc_realloc(p, size);
+}
+}
+#endif
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Counters
+
+#define kCounterCycles          0
+#define kCounterBranchMisses    1
+
+struct counters {
+    uint64_t ns;
+    uint64_t cycles;
+    uint64_t branchMisses;
+};
+
+static int perfFd[2] = { -1, -1 };
+
+static void openCounters()
+{
+#if defined(__linux__)
+    static const uint64_t config[2] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_BRANCH_MISSES };
+    for (int i = 0; i < 2; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = config[i];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        perfFd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#endif
+}
+
+static uint64_t readCounter(int i)
+{
+#if defined(__linux__)
+    uint64_t value;
+    if (perfFd[i] >= 0 && read(perfFd[i], &value, sizeof(value)) == sizeof(value))
+        return value;
+#else
+    (void)i;
+#endif
+    return 0;
+}
+
+static uint64_t timeStamp()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static uint64_t nowNS()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sample(struct counters *c)
+{
+    c->ns = nowNS();
+    c->cycles = perfFd[kCounterCycles] >= 0 ? readCounter(kCounterCycles) : timeStamp();
+    c->branchMisses = readCounter(kCounterBranchMisses);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Results
+
+static bool firstResult = true;
+static unsigned long failedCases;
+
+static void report(const char *name, const char *source, unsigned packets,
+                   const struct counters &start, const struct counters &end, unsigned long allocs)
+{
+    double n = packets ? packets : 1;
+    printf("%s\n    { \"name\": \"%s\", \"source\": \"%s\", \"packets\": %u, "
+           "\"ns_per_packet\": %.2f, \"cycles_per_packet\": ",
+           firstResult ? "" : ",", name, source, packets, (end.ns - start.ns) / n);
+    if (perfFd[kCounterCycles] >= 0 || timeStamp())
+        printf("%.2f", (end.cycles - start.cycles) / n);
+    else
+        printf("null");
+    printf(", \"branch_misses_per_packet\": ");
+    if (perfFd[kCounterBranchMisses] >= 0)
+        printf("%.4f", (end.branchMisses - start.branchMisses) / n);
+    else
+        printf("null");
+    printf(", \"allocations\": %lu }", allocs);
+    firstResult = false;
+    if (allocs)
+        failedCases++;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Synthetic packets
+
+#define kBenchPackets   4096
+#define kPacketBytes    8
+
+typedef uint8_t packet_t[kPacketBytes];
+
+static uint32_t rngState = 0x2545f491;
+
+static uint32_t rng()
+{
+    // xorshift32, fixed seed so that runs compare
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+static bool inSync(const alps_data &priv, const uint8_t *p)
+{
+    for (int n = 0; n < priv.pktsize; n++) {
+        if (alps_check_packet_sync(&priv, p, n + 1) != ALPS_SYNC_OK)
+            return false;
+    }
+    return true;
+}
+
+static void makePacket(const alps_data &priv, uint8_t *p)
+{
+    memset(p, 0, kPacketBytes);
+    for (int n = 0; n < priv.pktsize; n++) {
+        do
+            p[n] = (uint8_t)rng();
+        while (alps_check_packet_sync(&priv, p, n + 1) != ALPS_SYNC_OK);
+    }
+}
+
+static void makePackets(const alps_data &priv, packet_t *packets, int count)
+{
+    for (int i = 0; i < count; i++)
+        makePacket(priv, packets[i]);
+}
+
+// SS4 packets of one SS4_PACKET_ID, which byte 3 selects
+static void makePacketsSS4(const alps_data &priv, unsigned char id, packet_t *packets, int count)
+{
+    static const uint8_t idle[6] = { 0x18, 0x10, 0x00, 0x08, 0x10, 0x00 };
+    for (int i = 0; i < count; i++) {
+        uint8_t *p = packets[i];
+        if (id == SS4_PACKET_ID_IDLE) {
+            memset(p, 0, kPacketBytes);
+            memcpy(p, idle, sizeof(idle));
+            continue;
+        }
+        do
+            makePacket(priv, p);
+        while (alps_get_pkt_id_ss4_v2(p) != id);
+    }
+}
+
+// V4 packets with the bitmap sync bit on every third one, as the device sends them
+static void makePacketsV4(const alps_data &priv, packet_t *packets, int count)
+{
+    for (int i = 0; i < count; i++) {
+        uint8_t *p = packets[i];
+        uint8_t sync = i % 3 ? 0x00 : 0x40;
+        do {
+            makePacket(priv, p);
+            p[6] = (p[6] & ~0x40) | sync;
+        } while (!inSync(priv, p));
+    }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Devices, with the parameters set_protocol gives them
+
+static alps_data makeDevice(uint16_t version, bool ss4plus = false)
+{
+    alps_data priv = alps_data();
+    priv.proto_version = version;
+    priv.byte0 = 0x8f;
+    priv.mask0 = 0x8f;
+    priv.x_max = 2000;
+    priv.y_max = 1400;
+    priv.x_bits = 15;
+    priv.y_bits = 11;
+    priv.pktsize = 6;
+    switch (version) {
+        case ALPS_PROTO_V3_RUSHMORE:
+            priv.x_bits = 16;
+            priv.y_bits = 12;
+            break;
+        case ALPS_PROTO_V4:
+            priv.pktsize = 8;
+            break;
+        case ALPS_PROTO_V5:
+            priv.byte0 = 0xc8;
+            priv.mask0 = 0xc8;
+            priv.x_bits = 23;
+            priv.y_bits = 12;
+            break;
+        case ALPS_PROTO_V7:
+            priv.byte0 = 0x48;
+            priv.mask0 = 0x48;
+            priv.x_max = 0xfff;
+            priv.y_max = 0x7ff;
+            break;
+        case ALPS_PROTO_V8:
+            priv.byte0 = 0x18;
+            priv.mask0 = 0x18;
+            priv.x_max = 8176;
+            priv.y_max = 4088;
+            priv.flags = ALPS_BUTTONPAD;
+            if (ss4plus) {
+                static const uint8_t plus[3] = { 0x73, 0x03, 0x28 };
+                memcpy(priv.dev_id, plus, sizeof(plus));
+                priv.x_max = SS4_PLUS_MFPACKET_NO_AX_BL;
+            }
+            break;
+    }
+    alps_set_bitmap_scale(&priv);
+    return priv;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Cases
+
+// keeps the decoded fields alive so the decoders are not optimized out
+static volatile unsigned sink;
+
+static void timeDecoder(const char *name, const char *source, const alps_data &device,
+                        alps_decoder decode, const packet_t *packets, unsigned count, int rounds)
+{
+    alps_data priv = device;
+    alps_fields f;
+    unsigned acc = 0;
+    struct counters start, end;
+    unsigned long allocs = allocations;
+    sample(&start);
+    for (int r = 0; r < rounds; r++) {
+        for (unsigned i = 0; i < count; i++) {
+            memset(&f, 0, sizeof(f));
+            decode(&priv, &f, packets[i]);
+            acc += f.fingers + f.mt[0].x + f.st.y + f.pressure;
+        }
+    }
+    sample(&end);
+    sink = acc;
+    report(name, source, rounds * count, start, end, allocations - allocs);
+}
+
+static void timeCoordinateV7(const packet_t *packets, unsigned count, int rounds)
+{
+    struct input_mt_pos mt[MAX_TOUCHES];
+    unsigned acc = 0;
+    struct counters start, end;
+    unsigned long allocs = allocations;
+    sample(&start);
+    for (int r = 0; r < rounds; r++) {
+        for (unsigned i = 0; i < count; i++) {
+            const uint8_t *p = packets[i];
+            alps_get_finger_coordinate_v7(mt, p, alps_get_packet_id_v7(p));
+            acc += mt[0].x + mt[1].y;
+        }
+    }
+    sample(&end);
+    sink = acc;
+    report("v7_coordinates", "synthetic", rounds * count, start, end, allocations - allocs);
+}
+
+static void timeBitmap(const alps_data &device, int rounds)
+{
+    // one or two contact runs on each axis, as the MP packets carry them
+    static alps_fields fields[kBenchPackets];
+    for (int i = 0; i < kBenchPackets; i++) {
+        alps_fields &f = fields[i];
+        memset(&f, 0, sizeof(f));
+        for (int run = 0; run < 1 + (int)(rng() & 1); run++) {
+            int x = rng() % (device.x_bits - 3), y = rng() % (device.y_bits - 2);
+            f.x_map |= 0x7u << x;
+            f.y_map |= 0x3u << y;
+        }
+        f.st.x = rng() % device.x_max;
+        f.st.y = rng() % device.y_max;
+    }
+
+    alps_data priv = device;
+    alps_fields f;
+    unsigned acc = 0;
+    struct counters start, end;
+    unsigned long allocs = allocations;
+    sample(&start);
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < kBenchPackets; i++) {
+            f = fields[i];
+            acc += alps_process_bitmap(&priv, &f) + f.mt[1].x;
+        }
+    }
+    sample(&end);
+    sink = acc;
+    report("bitmap", "synthetic", rounds * kBenchPackets, start, end, allocations - allocs);
+}
+
+static void timeV4(const char *source, const alps_data &device, const packet_t *packets,
+                   unsigned count, int rounds)
+{
+    alps_data priv = device;
+    unsigned acc = 0;
+    struct counters start, end;
+    unsigned long allocs = allocations;
+    sample(&start);
+    for (int r = 0; r < rounds; r++) {
+        for (unsigned i = 0; i < count; i++) {
+            if (alps_decode_v4(&priv, packets[i]))
+                acc += priv.f.fingers + priv.f.mt[0].x;
+        }
+    }
+    sample(&end);
+    sink = acc;
+    report("v4_assembly", source, rounds * count, start, end, allocations - allocs);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Finger tracking
+//
+// Frames as alps_parse_hw_state hands them to AlpsTracker: a gesture that
+// goes 1, 2, 3, 4, 3, 2, 1 and 0 fingers, 25 frames each, 10 ms apart, with
+// the two reported (semi-MT) positions drifting and now and then coming in
+// the other order.
+
+struct tracker_frame {
+    int fingers;
+    int16_t x[2], y[2], z[2];
+};
+
+static void makeFrames(struct tracker_frame *frames, int count)
+{
+    static const int counts[] = { 1, 2, 3, 4, 3, 2, 1, 0 };
+    int x0 = 1500, y0 = 1500, x1 = 3500, y1 = 2500;
+    for (int i = 0; i < count; i++) {
+        struct tracker_frame &f = frames[i];
+        f.fingers = counts[i / 25 % (sizeof(counts) / sizeof(counts[0]))];
+        x0 += 3 + (int)(rng() % 17) - 8;
+        y0 += 2 + (int)(rng() % 17) - 8;
+        x1 += 3 + (int)(rng() % 17) - 8;
+        y1 += 2 + (int)(rng() % 17) - 8;
+        if (i % 200 == 0) {
+            x0 = 1500; y0 = 1500; x1 = 3500; y1 = 2500;
+        }
+        bool swapped = f.fingers >= 2 && i % 7 == 0;
+        f.x[swapped] = x0;
+        f.y[swapped] = y0;
+        f.x[!swapped] = x1;
+        f.y[!swapped] = y1;
+        f.z[0] = f.z[1] = f.fingers ? 40 : 0;
+    }
+}
+
+static void timeTracker(int rounds)
+{
+    static struct tracker_frame frames[kBenchPackets];
+    makeFrames(frames, kBenchPackets);
+
+    // the plist defaults, as setParamPropertiesGated converts them
+    static AlpsTracker tracker;
+    tracker.smoothing.min_cutoff = 1000;
+    tracker.smoothing.beta = 7;
+    tracker.smoothing.d_tau = 159154943 / 1000;
+    tracker.smoothing.alpha = 500 * 65536 / 1000;
+    tracker.smoothing.ab_beta = 100 * 65536 / 1000;
+    tracker.min_x = tracker.min_y = 0;
+    tracker.max_x = tracker.max_y = 6000;
+    tracker.margin_x = tracker.margin_y = 0;
+
+    alps_hw_state &fs = tracker.fingerStates;
+    uint64_t now = 0;
+    unsigned acc = 0;
+    struct counters start, end;
+    unsigned long allocs = allocations;
+    sample(&start);
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < kBenchPackets; i++) {
+            const struct tracker_frame &f = frames[i];
+            now += 10000;
+            for (int k = 0; k < 2; k++) {
+                fs.x[k] = f.x[k];
+                fs.y[k] = f.y[k];
+                fs.z[k] = f.z[k];
+            }
+            tracker.clampedFingerCount = f.fingers;
+            if (tracker.renumberFingers(now, false))
+                tracker.lastFingerCount = tracker.clampedFingerCount;
+            acc += fs.virtualFingerIndex[0] + tracker.virtualFingers.touch;
+        }
+    }
+    sample(&end);
+    sink = acc;
+    report("tracker_frame", "synthetic", rounds * kBenchPackets, start, end, allocations - allocs);
+    if (tracker.errors)
+        fprintf(stderr, "alps_bench: tracker repaired %u state(s)\n", tracker.errors);
+}
+
+static void timeAssignment(int rounds)
+{
+    // squared distances of 5 fingers to 5 virtual fingers, every other
+    // problem solved with the default gate
+    static int64_t costs[64][MAX_TOUCHES][MAX_TOUCHES];
+    for (int n = 0; n < 64; n++)
+        for (int i = 0; i < MAX_TOUCHES; i++)
+            for (int j = 0; j < MAX_TOUCHES; j++)
+                costs[n][i][j] = rng() % 2000000;
+
+    FingerAssignment assignment(MAX_TOUCHES, MAX_TOUCHES);
+    int match[MAX_TOUCHES];
+    int64_t acc = 0;
+    struct counters start, end;
+    unsigned long allocs = allocations;
+    sample(&start);
+    for (int r = 0; r < rounds; r++) {
+        for (int n = 0; n < 64; n++) {
+            memcpy(assignment.cost, costs[n], sizeof(assignment.cost));
+            acc += assignment.solve(n & 1 ? 1000000 : FingerAssignment::kForced, match);
+            acc += match[0];
+        }
+    }
+    sample(&end);
+    sink = (unsigned)acc;
+    report("assignment_5x5", "synthetic", rounds * 64, start, end, allocations - allocs);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Recorded packets
+
+struct trace_record {               // PS2TraceRecord in ApplePS2Device.h
+    uint64_t time;
+    uint32_t seq;
+    uint8_t data;
+    uint8_t status;
+    uint8_t flags;
+    uint8_t reserved;
+};
+
+#define kTraceMouse     0x01        // kPS2TF_Mouse
+#define kTraceRequest   0x02        // kPS2TF_Request
+#define kTraceTimeout   0x04        // kPS2TF_Timeout
+
+// Splits the mouse stream of a trace into packets the way interruptOccurred
+// does for in sync streams; bytes that break sync restart the packet.
+static unsigned loadTrace(const char *path, const alps_data &priv, packet_t *packets, unsigned cap)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "alps_bench: cannot open %s\n", path);
+        exit(2);
+    }
+
+    struct trace_record record;
+    uint8_t packet[kPacketBytes + 1];
+    unsigned count = 0, bytes = 0;
+    while (count < cap && fread(&record, sizeof(record), 1, file) == 1) {
+        if ((record.flags & (kTraceMouse | kTraceRequest | kTraceTimeout)) != kTraceMouse)
+            continue;
+        packet[bytes++] = record.data;
+        if (alps_check_packet_sync(&priv, packet, bytes) != ALPS_SYNC_OK) {
+            bytes = 0;
+            continue;
+        }
+        if (bytes == (unsigned)priv.pktsize) {
+            memset(packets[count], 0, kPacketBytes);
+            memcpy(packets[count++], packet, bytes);
+            bytes = 0;
+        }
+    }
+    fclose(file);
+    return count;
+}
+
+static void benchTrace(const char *proto, const char *path, int rounds)
+{
+    static packet_t packets[1 << 16];
+    static const struct {
+        const char *name;
+        uint16_t version;
+        bool plus;
+        alps_decoder decode;
+    } protos[] = {
+        { "v3",       ALPS_PROTO_V3,          false, alps_decode_pinnacle },
+        { "rushmore", ALPS_PROTO_V3_RUSHMORE, false, alps_decode_rushmore },
+        { "v4",       ALPS_PROTO_V4,          false, NULL },
+        { "v5",       ALPS_PROTO_V5,          false, alps_decode_dolphin },
+        { "v7",       ALPS_PROTO_V7,          false, alps_decode_packet_v7 },
+        { "ss4",      ALPS_PROTO_V8,          false, NULL },
+        { "ss4_plus", ALPS_PROTO_V8,          true,  NULL },
+    };
+
+    for (unsigned i = 0; i < sizeof(protos) / sizeof(protos[0]); i++) {
+        if (strcmp(protos[i].name, proto))
+            continue;
+        alps_data device = makeDevice(protos[i].version, protos[i].plus);
+        unsigned count = loadTrace(path, device, packets, sizeof(packets) / sizeof(packets[0]));
+        if (!count) {
+            fprintf(stderr, "alps_bench: no %s packets in %s\n", proto, path);
+            exit(2);
+        }
+        if (protos[i].version == ALPS_PROTO_V4) {
+            timeV4("recorded", device, packets, count, rounds);
+        } else {
+            alps_decoder decode = protos[i].decode ? protos[i].decode : alps_select_decode_ss4_v2(&device);
+            timeDecoder(proto, "recorded", device, decode, packets, count, rounds);
+        }
+        return;
+    }
+    fprintf(stderr, "alps_bench: unknown protocol %s\n", proto);
+    exit(2);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+int main(int argc, char **argv)
+{
+    static packet_t packets[kBenchPackets];
+    static const char *ss4Names[] = { "ss4_idle", "ss4_one", "ss4_two", "ss4_multi", "ss4_stick" };
+    const char *traceProto = NULL, *tracePath = NULL;
+    int rounds = 200;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            rounds = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-t") && i + 2 < argc) {
+            traceProto = argv[++i];
+            tracePath = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [-r rounds] [-t protocol trace.bin]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (rounds <= 0)
+        rounds = 1;
+
+    alps_data v3 = makeDevice(ALPS_PROTO_V3);
+    alps_data rushmore = makeDevice(ALPS_PROTO_V3_RUSHMORE);
+    alps_data v4 = makeDevice(ALPS_PROTO_V4);
+    alps_data v5 = makeDevice(ALPS_PROTO_V5);
+    alps_data v7 = makeDevice(ALPS_PROTO_V7);
+    alps_data v8 = makeDevice(ALPS_PROTO_V8);
+    alps_data v8plus = makeDevice(ALPS_PROTO_V8, true);
+
+    openCounters();
+    // what the tracking loops walk every frame (alps_hw_state and virtual_finger_set)
+    unsigned stateBytes = sizeof(alps_hw_state) + sizeof(virtual_finger_set);
+    printf("{\n  \"rounds\": %d,\n  \"perf_counters\": %s,\n  \"tracker_state_bytes\": %u,\n"
+           "  \"results\": [", rounds, perfFd[kCounterCycles] >= 0 ? "true" : "false", stateBytes);
+
+    makePackets(v3, packets, kBenchPackets);
+    timeDecoder("pinnacle", "synthetic", v3, alps_decode_pinnacle, packets, kBenchPackets, rounds);
+    makePackets(rushmore, packets, kBenchPackets);
+    timeDecoder("rushmore", "synthetic", rushmore, alps_decode_rushmore, packets, kBenchPackets, rounds);
+    makePackets(v5, packets, kBenchPackets);
+    timeDecoder("dolphin", "synthetic", v5, alps_decode_dolphin, packets, kBenchPackets, rounds);
+    makePackets(v7, packets, kBenchPackets);
+    timeDecoder("v7", "synthetic", v7, alps_decode_packet_v7, packets, kBenchPackets, rounds);
+    timeCoordinateV7(packets, kBenchPackets, rounds);
+    for (unsigned char id = SS4_PACKET_ID_IDLE; id <= SS4_PACKET_ID_STICK; id++) {
+        makePacketsSS4(v8, id, packets, kBenchPackets);
+        timeDecoder(ss4Names[id], "synthetic", v8, alps_select_decode_ss4_v2(&v8), packets, kBenchPackets, rounds);
+    }
+    makePacketsSS4(v8plus, SS4_PACKET_ID_TWO, packets, kBenchPackets);
+    timeDecoder("ss4_plus_two", "synthetic", v8plus, alps_select_decode_ss4_v2(&v8plus), packets, kBenchPackets, rounds);
+    timeBitmap(v3, rounds);
+    makePacketsV4(v4, packets, kBenchPackets);
+    timeV4("synthetic", v4, packets, kBenchPackets, rounds);
+    timeTracker(rounds);
+    timeAssignment(rounds);
+
+    if (traceProto)
+        benchTrace(traceProto, tracePath, rounds);
+
+    printf("\n  ]\n}\n");
+    if (failedCases)
+        fprintf(stderr, "alps_bench: %lu case(s) allocated on the heap\n", failedCases);
+    return failedCases ? 1 : 0;
+}
@@ -0,0 +1,293 @@
+//
+// alps_emulator - an ALPS touchpad on the far side of the PS/2 port
+//
+// The command mode protocol follows Linux alps.c: EC EC EC E9 enters it (and
+// returns the EC report), the address command followed by four nibbles sets
+// the register address, E9 reads the register at it and two more nibbles
+// write it, and EA leaves command mode.
+//
+
+#include <string.h>
+
+#include "alps_emulator.h"
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Device profiles, one per signature alps_identify knows
+
+const struct alps_emu_profile alps_emu_profiles[] = {
+    { "v3_pinnacle",  ALPS_PROTO_V3,          { 0x73, 0x02, 0x64 }, { 0x88, 0x07, 0x9d },
+      { { 0 }, { 0 } },                                     0x0008, 0x80, 0 },
+    { "v3_rushmore",  ALPS_PROTO_V3_RUSHMORE, { 0x73, 0x02, 0x64 }, { 0x88, 0x08, 0x1d },
+      { { 0 }, { 0 } },                                     0xc2c8, 0x80, 0 },
+    { "v4",           ALPS_PROTO_V4,          { 0x73, 0x02, 0x64 }, { 0x73, 0x01, 0x8a },
+      { { 0 }, { 0 } },                                     -1,     0,    0 },
+    { "v5_dolphin",   ALPS_PROTO_V5,          { 0x73, 0x03, 0x50 }, { 0x73, 0x01, 0x0d },
+      { { 0 }, { 0 } },                                     -1,     0,    0x8b },
+    { "v7",           ALPS_PROTO_V7,          { 0x73, 0x03, 0x0a }, { 0x88, 0xb3, 0x22 },
+      { { 0 }, { 0 } },                                     0xc2c8, 0x80, 0 },
+    { "v8_ss4",       ALPS_PROTO_V8,          { 0x73, 0x03, 0x14 }, { 0x88, 0x01, 0x2c },
+      { { 0x00, 0x00, 0x00 }, { 0x5c, 0x08, 0x24 } },       -1,     0,    0 },
+    { "v8_ss4_plus",  ALPS_PROTO_V8,          { 0x73, 0x03, 0x28 }, { 0x73, 0x02, 0x2c },
+      { { 0x00, 0x45, 0x49 }, { 0x02, 0x00, 0x00 } },       0x00d7, 0x1d, 0 },
+};
+
+const unsigned alps_emu_profile_count = sizeof(alps_emu_profiles) / sizeof(alps_emu_profiles[0]);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Nibble command tables
+
+static const struct alps_emu_nibble alps_emu_v3_nibbles[16] = {
+    { 0xf0, -1,   0 }, { 0xf6, -1,   0 }, { 0xe7, -1,   0 }, { 0xf3, 0x0a, 0 },
+    { 0xf3, 0x14, 0 }, { 0xf3, 0x28, 0 }, { 0xf3, 0x3c, 0 }, { 0xf3, 0x50, 0 },
+    { 0xf3, 0x64, 0 }, { 0xf3, 0xc8, 0 }, { 0xf2, -1,   1 }, { 0xe8, 0x00, 0 },
+    { 0xe8, 0x01, 0 }, { 0xe8, 0x02, 0 }, { 0xe8, 0x03, 0 }, { 0xe6, -1,   0 },
+};
+
+static const struct alps_emu_nibble alps_emu_v4_nibbles[16] = {
+    { 0xf4, -1,   0 }, { 0xf6, -1,   0 }, { 0xe7, -1,   0 }, { 0xf3, 0x0a, 0 },
+    { 0xf3, 0x14, 0 }, { 0xf3, 0x28, 0 }, { 0xf3, 0x3c, 0 }, { 0xf3, 0x50, 0 },
+    { 0xf3, 0x64, 0 }, { 0xf3, 0xc8, 0 }, { 0xf2, -1,   1 }, { 0xe8, 0x00, 0 },
+    { 0xe8, 0x01, 0 }, { 0xe8, 0x02, 0 }, { 0xe8, 0x03, 0 }, { 0xe6, -1,   0 },
+};
+
+const struct alps_emu_nibble *alps_emu_nibbles(uint16_t version)
+{
+    return version == ALPS_PROTO_V4 ? alps_emu_v4_nibbles : alps_emu_v3_nibbles;
+}
+
+uint8_t alps_emu_addr_command(uint16_t version)
+{
+    return version == ALPS_PROTO_V4 ? 0xf5 : 0xec;
+}
+
+bool alps_emu_touch(const struct alps_data &priv, const struct alps_emu_contact *contacts,
+                    unsigned count, uint8_t buttons, uint8_t out[8])
+{
+    static const struct alps_emu_contact lifted = { 0, 0 };
+    const struct alps_emu_contact &c0 = count > 0 ? contacts[0] : lifted;
+    const struct alps_emu_contact &c1 = count > 1 ? contacts[1] : lifted;
+
+    // V7_PACKET_ID_TWO: the first touch at full resolution, the second to 16
+    // units; y is sent from the bottom edge, and a lifted touch is 0,0 after
+    // the flip. Clickpads take the right and middle bits as extra fingers.
+    if (priv.proto_version != ALPS_PROTO_V7 || count > 2 ||
+        (priv.flags & ALPS_BUTTONPAD && buttons & 0x06))
+        return false;
+    unsigned y0 = count > 0 ? 0x7ff - c0.y : 0x7ff;
+    unsigned y1 = count > 1 ? 0x7ff - c1.y : 0x7ff;
+    out[0] = 0x48 | (y0 & 0x07) | (buttons & 0x01) << 7 |
+             (buttons & 0x02) << 4 | (buttons & 0x04) << 2;
+    out[1] = (y0 >> 3) & 0xff;
+    out[2] = 0x40 | ((c0.x >> 11) & 0x01) << 7 | ((c0.x >> 5) & 0x3f);
+    out[3] = 0x48 | ((c1.x >> 11) & 0x01) << 7 | ((c0.x >> 3) & 0x03) << 4 | (c0.x & 0x07);
+    out[4] = 0x40 | ((c1.x >> 10) & 0x01) << 7 | ((c1.x >> 4) & 0x3f);
+    out[5] = ((y1 >> 10) & 0x01) << 7 | ((y1 >> 4) & 0x3f);
+    return true;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+AlpsEmulator::AlpsEmulator(const struct alps_emu_profile &profile)
+    : _profile(profile),
+      _nibbles(alps_emu_nibbles(profile.version)),
+      _addrCommand(alps_emu_addr_command(profile.version)),
+      _outHead(0), _outCount(0),
+      _pendingArg(-1),
+      _commandMode(false), _streaming(false),
+      _addrNibbles(0), _dataNibbles(0), _addr(0), _data(0),
+      _rng(0x2545f491), _streamTime(0),
+      _written(0), _read(0)
+{
+    memset(_history, 0, sizeof(_history));
+    memset(_regs, 0, sizeof(_regs));
+    if (profile.trackstick_reg >= 0)
+        _regs[profile.trackstick_reg] = profile.trackstick_val;
+    _regs[0x0033] = profile.dolphin_area;
+}
+
+void AlpsEmulator::reply(uint8_t byte)
+{
+    if (_outCount < sizeof(_out))
+        _out[(_outHead + _outCount++) % sizeof(_out)] = byte;
+}
+
+void AlpsEmulator::report(const uint8_t bytes[3])
+{
+    reply(bytes[0]);
+    reply(bytes[1]);
+    reply(bytes[2]);
+}
+
+bool AlpsEmulator::read(uint8_t *byte)
+{
+    if (!_outCount)
+        return false;
+    *byte = _out[_outHead];
+    _outHead = (_outHead + 1) % sizeof(_out);
+    _outCount--;
+    _read++;
+    return true;
+}
+
+void AlpsEmulator::write(uint8_t byte)
+{
+    _written++;
+    // a new command flushes whatever the driver did not read
+    _outCount = 0;
+
+    if (_commandMode) {
+        commandModeByte(byte);
+        return;
+    }
+
+    reply(kEmuACK);
+    if (_pendingArg >= 0) {
+        _pendingArg = -1;
+        return;
+    }
+
+    switch (byte) {
+        case 0xe8:  // set resolution
+        case 0xf3:  // set sample rate
+            _pendingArg = byte;
+            return;
+
+        case 0xe9: {
+            static const uint8_t e6[3] = { 0x00, 0x00, 0x64 };
+            static const uint8_t status[3] = { 0x00, 0x02, 0x64 };
+            const uint8_t *h = _history;
+            if (h[0] == 0xe6 && h[1] == 0xe6 && h[2] == 0xe6) {
+                report(e6);
+            } else if (h[0] == 0xe7 && h[1] == 0xe7 && h[2] == 0xe7) {
+                report(_profile.e7);
+            } else if (h[0] == 0xec && h[1] == 0xec && h[2] == 0xec) {
+                report(_profile.ec);
+                _commandMode = true;
+                _addrNibbles = _dataNibbles = 0;
+            } else if (h[1] == 0xea && h[2] == 0xea) {
+                report(_profile.otp[1]);
+            } else if (h[1] == 0xf0 && h[2] == 0xf0) {
+                report(_profile.otp[0]);
+            } else {
+                report(status);
+            }
+            memset(_history, 0, sizeof(_history));
+            return;
+        }
+
+        case 0xf2:  // get id
+            reply(0x00);
+            break;
+
+        case 0xf4:  // enable
+            _streaming = true;
+            break;
+
+        case 0xf5:  // disable
+            _streaming = false;
+            break;
+
+        case 0xff:  // reset
+            _streaming = false;
+            reply(0xaa);
+            reply(0x00);
+            break;
+    }
+    _history[0] = _history[1];
+    _history[1] = _history[2];
+    _history[2] = byte;
+}
+
+void AlpsEmulator::commandModeByte(uint8_t byte)
+{
+    reply(kEmuACK);
+
+    if (_pendingArg >= 0) {
+        uint8_t command = (uint8_t)_pendingArg;
+        _pendingArg = -1;
+        for (int n = 0; n < 16; n++) {
+            if (_nibbles[n].command == command && _nibbles[n].arg == byte) {
+                nibble(n);
+                return;
+            }
+        }
+        return;
+    }
+
+    if (byte == _addrCommand) {
+        _addrNibbles = 4;
+        _dataNibbles = 0;
+        _addr = 0;
+        return;
+    }
+
+    switch (byte) {
+        case 0xe8:
+        case 0xf3:
+            _pendingArg = byte;
+            return;
+
+        case 0xe9:
+            reply(_addr >> 8);
+            reply(_addr & 0xff);
+            reply(_regs[_addr]);
+            return;
+
+        case 0xea:
+            _commandMode = false;
+            return;
+    }
+
+    for (int n = 0; n < 16; n++) {
+        if (_nibbles[n].command == byte && _nibbles[n].arg < 0) {
+            if (_nibbles[n].recv)
+                reply(0x00);
+            nibble(n);
+            return;
+        }
+    }
+}
+
+void AlpsEmulator::nibble(int value)
+{
+    if (_addrNibbles) {
+        _addr = (uint16_t)(_addr << 4 | value);
+        _addrNibbles--;
+        return;
+    }
+    // value nibbles write the register at the current address, high first
+    _data = (uint8_t)(_data << 4 | value);
+    if (++_dataNibbles == 2) {
+        _regs[_addr] = _data;
+        _dataNibbles = 0;
+    }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Packet stream
+
+unsigned AlpsEmulator::stream(const struct alps_data &priv, unsigned hz, uint64_t ns,
+                              uint8_t (*out)[8], unsigned cap)
+{
+    if (!_streaming || !hz)
+        return 0;
+
+    uint64_t period = 1000000000ULL / hz;
+    _streamTime += ns;
+    unsigned count = 0;
+    while (_streamTime >= period && count < cap) {
+        _streamTime -= period;
+        uint8_t *p = out[count++];
+        memset(p, 0, 8);
+        for (int n = 0; n < priv.pktsize; n++) {
+            do {
+                // xorshift32
+                _rng ^= _rng << 13;
+                _rng ^= _rng >> 17;
+                _rng ^= _rng << 5;
+                p[n] = (uint8_t)_rng;
+            } while (alps_check_packet_sync(&priv, p, n + 1) != ALPS_SYNC_OK);
+        }
+    }
+    return count;
+}
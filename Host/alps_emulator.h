@@ -0,0 +1,109 @@
+//
+// alps_emulator - an ALPS touchpad on the far side of the PS/2 port
+//
+// Answers the byte level PS/2 protocol the driver speaks to the touchpad: the
+// E6/E7/EC reports, the OTP reads of SS4, and the nibble command mode with its
+// register file. It can also stream finger packets at a set rate. Each byte
+// written is answered with the bytes the touchpad would send back (ACK plus
+// any data), so the driver's command sequences can be replayed and counted on
+// the host.
+//
+
+#ifndef _ALPS_EMULATOR_H
+#define _ALPS_EMULATOR_H
+
+#include <stdint.h>
+
+#include "alps_decode.h"
+
+#define kEmuACK     0xfa
+
+struct alps_emu_profile {
+    const char *name;
+    uint16_t version;           /* protocol the signature should identify as */
+    uint8_t e7[3];
+    uint8_t ec[3];
+    uint8_t otp[2][3];          /* SS4 OTP pages, read by EA EA E9 / F0 F0 E9 */
+    int trackstick_reg;         /* trackstick presence register, or -1 */
+    uint8_t trackstick_val;     /* its value when a trackstick is fitted */
+    uint8_t dolphin_area;       /* V5 electrode counts at register 0x0033 */
+};
+
+extern const struct alps_emu_profile alps_emu_profiles[];
+extern const unsigned alps_emu_profile_count;
+
+// One entry of a nibble command table: @command, followed by @arg when it is
+// not -1, with @recv bytes read back (the alps_*_nibble_commands of the driver)
+struct alps_emu_nibble {
+    uint8_t command;
+    int16_t arg;
+    uint8_t recv;
+};
+
+const struct alps_emu_nibble *alps_emu_nibbles(uint16_t version);
+uint8_t alps_emu_addr_command(uint16_t version);
+
+// A finger on the pad, in the units the decoder hands to alps.cpp
+struct alps_emu_contact {
+    unsigned x, y;
+};
+
+// Encodes a position report of @count contacts (0 when all are lifted) and
+// the @buttons bitmask (left, right, middle) into @out. Only V7 is done, as
+// TWO packets of up to two touches: the single touch reports of the other
+// protocols carry a pressure, and alps_parse_hw_state only counts contacts
+// reported without one. Returns false when @priv's protocol is not V7.
+bool alps_emu_touch(const struct alps_data &priv, const struct alps_emu_contact *contacts,
+                    unsigned count, uint8_t buttons, uint8_t out[8]);
+
+class AlpsEmulator {
+public:
+    explicit AlpsEmulator(const struct alps_emu_profile &profile);
+
+    // the driver writes one byte to the device
+    void write(uint8_t byte);
+    // the driver reads the next byte; false when the device sent nothing
+    bool read(uint8_t *byte);
+
+    uint8_t reg(int addr) const { return _regs[addr & 0xffff]; }
+    bool commandMode() const { return _commandMode; }
+    bool streaming() const { return _streaming; }
+
+    // Streams @ns worth of packets at @hz into @out (at most @cap packets of
+    // priv.pktsize bytes each). Packets are random but pass
+    // alps_check_packet_sync for @priv byte by byte, like real position reports.
+    unsigned stream(const struct alps_data &priv, unsigned hz, uint64_t ns,
+                    uint8_t (*out)[8], unsigned cap);
+
+    unsigned bytesWritten() const { return _written; }
+    unsigned bytesRead() const { return _read; }
+
+private:
+    void reply(uint8_t byte);
+    void report(const uint8_t bytes[3]);
+    void commandModeByte(uint8_t byte);
+    void nibble(int value);
+
+    const struct alps_emu_profile &_profile;
+    const struct alps_emu_nibble *_nibbles;
+    uint8_t _addrCommand;
+
+    uint8_t _out[8];
+    unsigned _outHead, _outCount;
+
+    int _pendingArg;            /* command waiting for its argument, or -1 */
+    uint8_t _history[3];        /* last commands before E9, newest last */
+    bool _commandMode;
+    bool _streaming;
+    int _addrNibbles;           /* nibbles of the address still to come */
+    int _dataNibbles;           /* nibbles of the value received so far */
+    uint16_t _addr;
+    uint8_t _data;
+    uint8_t _regs[0x10000];
+
+    uint32_t _rng;
+    uint64_t _streamTime;       /* ns carried over between stream calls */
+    unsigned _written, _read;
+};
+
+#endif /* _ALPS_EMULATOR_H */
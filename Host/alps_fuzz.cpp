@@ -0,0 +1,191 @@
+//
+// alps_fuzz - the real ALPS driver under fuzzed mouse port bytes
+//
+// Brings the driver up on AlpsHost against one of the emulator's profiles and
+// feeds it arbitrary stream bytes, so that its own interruptOccurred (the
+// packet ring buffer, alps_check_packet_sync and the resync memmove) and
+// packetReady (the protocol's decoder with the V3/V5 and SS4 multi-packet
+// merging and the V4 bitmap assembly, alps_parse_hw_state, AlpsTracker and
+// sendTouchData) run unchanged. The first input byte picks the profile (low
+// nibble) and how many packets at a time arrive before the work loop gets to
+// run (high nibble, in threes, so that the ring buffer fills past its 32
+// packets); the second the packet interval and the smoothing filter; the rest
+// is the stream, one byte every 700 us within a packet.
+//
+// Aborts, with the input's profile, on a bring-up that fails, on any sanity
+// error the driver logs (its WTF and ERROR lines, which AlpsTracker and
+// alps_parse_hw_state write when they had to repair an inconsistency), and on
+// a frame VoodooInput could not take: more contacts than transducers, a
+// secondaryId out of range or used twice, a finger type outside MT2FingerType
+// or shared by two transducers (see AlpsHost::frameError).
+//
+// make builds it, and the kext units under it, with AddressSanitizer and
+// UndefinedBehaviorSanitizer. As a libFuzzer target with clang, from Host:
+//
+//   make CXX=clang++ clean all
+//   clang++ -std=c++11 -g -O1 -fsanitize=fuzzer,address,undefined
+//       -DALPS_FUZZ_LIBFUZZER -I../VoodooPS2Trackpad -Ishim alps_fuzz.cpp
+//       build/fuzz/kext/*.o build/fuzz/alps_emulator.o build/fuzz/i8042_model.o
+//
+// Otherwise (and for AFL, with afl-g++ as CXX) main runs the files given on
+// the command line, or stdin, or with -n a number of random inputs:
+//
+//   make -C Host fuzz
+//   build/fuzz/alps_fuzz [-n count] [file ...]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alps_host.h"
+#include "host_iokit.h"
+
+#define kByteNS         700000ULL
+#define kBurstStep      3
+
+static void check(bool ok, const struct alps_emu_profile &profile, const char *what)
+{
+    if (ok)
+        return;
+    fprintf(stderr, "alps_fuzz: %s: %s\n", profile.name, what);
+    abort();
+}
+
+static void setFilter(AlpsHost &host, unsigned filter)
+{
+    OSDictionary *dict = OSDictionary::withCapacity(1);
+    OSNumber *num = OSNumber::withNumber(filter, 32);
+    dict->setObject("SmoothingFilter", num);
+    host.setProperties(dict);
+    num->release();
+    dict->release();
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size < 2)
+        return 0;
+    const struct alps_emu_profile &profile =
+        alps_emu_profiles[(data[0] & 0x0f) % alps_emu_profile_count];
+    unsigned burst = 1 + (data[0] >> 4) * kBurstStep;
+    uint64_t interval = 1000000ULL * (1 + data[1] % 64);
+
+    AlpsHost host(profile);
+    check(host.start(NULL), profile, "bring-up failed");
+    setFilter(host, (data[1] >> 6) % 3);
+    struct alps_data priv;
+    host.streamFormat(&priv);
+
+    // bytes come in on the wire's clock; the work loop only runs between
+    // bursts, so packetReady finds up to @burst packets queued
+    uint64_t next = HostKernel::now();
+    unsigned packets = 0;
+    for (size_t i = 2; i < size; i++) {
+        if ((i - 2) % priv.pktsize == 0) {
+            if (packets++ % burst == 0)
+                host.run(next);
+            else
+                HostKernel::advance(next - HostKernel::now());
+            next += interval;
+        } else {
+            HostKernel::advance(kByteNS);
+        }
+        host.receive(data[i]);
+    }
+    host.run(HostKernel::now() + 100000000ULL);
+
+    check(!HostKernel::wtfCount(), profile, "driver sanity errors");
+    check(!host.frameError(), profile, host.frameError());
+    host.stop();
+    return 0;
+}
+
+#ifndef ALPS_FUZZ_LIBFUZZER
+
+static uint32_t rngState = 0x2545f491;
+
+static uint32_t rng()
+{
+    // xorshift32, fixed seed so that runs repeat
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+static void runFile(FILE *file)
+{
+    static uint8_t data[1 << 20];
+    size_t size = fread(data, 1, sizeof(data), file);
+    LLVMFuzzerTestOneInput(data, size);
+}
+
+// Random streams, each a run of sync-valid packets for one profile with bytes
+// dropped, repeated and flipped, so that the decoders see real packets as
+// well as sync loss.
+static void runRandom(unsigned count)
+{
+    // the stream format each profile's touchpad ends up in
+    static struct alps_data privs[16];
+    for (unsigned p = 0; p < alps_emu_profile_count; p++) {
+        AlpsHost host(alps_emu_profiles[p]);
+        host.start(NULL);
+        host.streamFormat(&privs[p]);
+        host.stop();
+    }
+
+    static uint8_t data[4096];
+    for (unsigned n = 0; n < count; n++) {
+        unsigned p = n % alps_emu_profile_count;
+        const struct alps_data &priv = privs[p];
+        size_t size = 0;
+        data[size++] = (uint8_t)(p | (rng() & 0xf0));
+        data[size++] = (uint8_t)rng();
+        // a packet and a repeat of each of its bytes
+        while (size + 2 * priv.pktsize <= sizeof(data)) {
+            uint8_t b[8];
+            for (int i = 0; i < priv.pktsize; i++) {
+                do
+                    b[i] = (uint8_t)rng();
+                while (alps_check_packet_sync(&priv, b, i + 1) != ALPS_SYNC_OK);
+            }
+            for (int i = 0; i < priv.pktsize; i++) {
+                uint32_t r = rng();
+                if (r % 97 == 0)
+                    continue;
+                if (r % 89 == 0)
+                    data[size++] = b[i];
+                data[size++] = r % 83 == 0 ? (uint8_t)(b[i] ^ (1 << (r >> 8) % 8)) : b[i];
+            }
+        }
+        LLVMFuzzerTestOneInput(data, size);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int files = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            runRandom((unsigned)atoi(argv[++i]));
+            files++;
+            continue;
+        }
+        FILE *file = fopen(argv[i], "rb");
+        if (!file) {
+            fprintf(stderr, "alps_fuzz: cannot open %s\n", argv[i]);
+            return 2;
+        }
+        runFile(file);
+        fclose(file);
+        files++;
+    }
+    if (!files)
+        runFile(stdin);
+    return 0;
+}
+
+#endif /* ALPS_FUZZ_LIBFUZZER */
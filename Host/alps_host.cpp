@@ -0,0 +1,739 @@
+//
+// alps_host - the real ALPS driver on the host, behind an emulated mouse port
+//
+// See alps_host.h. HostMouseDevice carries out PS2Requests the way
+// ApplePS2Controller::processRequest does, one command at a time, with the
+// emulated touchpad on the AUX port and each byte on the wire costing
+// usPerByte of virtual time. With kAlpsPortI8042 the controller itself does
+// that, on an I8042Model.
+//
+
+#include <stdlib.h>
+
+#include "alps.h"
+#include "alps_host.h"
+#include "ApplePS2KeyboardDevice.h"
+#include "i8042_model.h"
+#include "VoodooPS2Controller.h"
+
+#ifndef ALPS_INFO_PLIST
+#define ALPS_INFO_PLIST "../VoodooPS2Trackpad/VoodooPS2Trackpad-Info.plist"
+#endif
+#ifndef PS2_INFO_PLIST
+#define PS2_INFO_PLIST "../VoodooPS2Controller/VoodooPS2Controller-Info.plist"
+#endif
+
+#define kALPSPersonality "ALPS TouchPad"
+#define kControllerPersonality "ApplePS2Controller"
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// HostMouseDevice: ApplePS2MouseDevice without a controller behind it
+
+// PS2Request only lets the controller (or a subclass) allocate one
+struct HostPS2Request : public PS2Request {
+    static PS2Request *allocate(int max) { return new(max) HostPS2Request; }
+    static void free(PS2Request *request) { delete static_cast<HostPS2Request *>(request); }
+};
+
+class HostMouseDevice : public ApplePS2MouseDevice {
+    typedef ApplePS2MouseDevice super;
+    OSDeclareDefaultStructors(HostMouseDevice);
+
+public:
+    static HostMouseDevice *withEmulator(AlpsEmulator *device, unsigned usPerByte);
+
+    void installInterruptAction(OSObject *target, PS2InterruptAction interruptAction,
+                                PS2PacketAction packetAction) override;
+    void uninstallInterruptAction() override;
+
+    PS2Request *allocateRequest(int max = kMaxCommands) override;
+    void freeRequest(PS2Request *request) override;
+    bool submitRequest(PS2Request *request) override;
+    void submitRequestAndBlock(PS2Request *request) override;
+    UInt8 setCommandByte(UInt8 setBits, UInt8 clearBits) override;
+
+    void installPowerControlAction(OSObject *target, PS2PowerControlAction action) override;
+    void uninstallPowerControlAction() override;
+    void installMessageAction(OSObject *target, PS2MessageAction action) override;
+    void uninstallMessageAction() override;
+    void dispatchMouseMessage(int message, void *data) override;
+    void dispatchKeyboardMessage(int message, void *data) override;
+
+    void lock() override;
+    void unlock() override;
+
+    // a stream byte from the touchpad, as handleInterrupt passes it on
+    void receive(UInt8 byte);
+
+    unsigned requests() const { return _requests; }
+    unsigned failedRequests() const { return _failedRequests; }
+
+    void free() override;
+
+private:
+    void processRequest(PS2Request *request);
+    bool writeMouse(UInt8 byte);
+    UInt8 readData(bool *timedOut);
+    void packetReady(IOInterruptEventSource *, int);
+
+    AlpsEmulator *_device;
+    unsigned _usPerByte;
+    IOLock *_lock;
+    UInt8 _commandByte;
+
+    OSObject *_interruptTarget;
+    PS2InterruptAction _interruptAction;
+    PS2PacketAction _packetAction;
+    IOInterruptEventSource *_packetSource;
+
+    OSObject *_powerTarget;
+    PS2PowerControlAction _powerAction;
+    OSObject *_messageTarget;
+    PS2MessageAction _messageAction;
+
+    unsigned _requests;
+    unsigned _failedRequests;
+};
+
+OSDefineMetaClassAndStructors(HostMouseDevice, ApplePS2MouseDevice);
+
+HostMouseDevice *HostMouseDevice::withEmulator(AlpsEmulator *device, unsigned usPerByte)
+{
+    HostMouseDevice *me = new HostMouseDevice;
+    if (!me->init()) {
+        me->release();
+        return NULL;
+    }
+    me->_device = device;
+    me->_usPerByte = usPerByte;
+    me->_lock = IOLockAlloc();
+    me->_commandByte = kCB_EnableKeyboardIRQ | kCB_EnableMouseIRQ | kCB_SystemFlag | kCB_TranslateMode;
+    return me;
+}
+
+void HostMouseDevice::free()
+{
+    uninstallInterruptAction();
+    if (_lock)
+        IOLockFree(_lock);
+    super::free();
+}
+
+void HostMouseDevice::installInterruptAction(OSObject *target, PS2InterruptAction interruptAction,
+                                             PS2PacketAction packetAction)
+{
+    // as the controller does it: the byte goes to the interrupt action at
+    // interrupt time, the packet action runs later on the work loop
+    _packetSource = IOInterruptEventSource::interruptEventSource(this,
+        OSMemberFunctionCast(IOInterruptEventAction, this, &HostMouseDevice::packetReady));
+    if (!_packetSource || getWorkLoop()->addEventSource(_packetSource) != kIOReturnSuccess) {
+        OSSafeReleaseNULL(_packetSource);
+        return;
+    }
+    _interruptTarget = target;
+    _interruptAction = interruptAction;
+    _packetAction = packetAction;
+}
+
+void HostMouseDevice::uninstallInterruptAction()
+{
+    _interruptAction = NULL;
+    _packetAction = NULL;
+    _interruptTarget = NULL;
+    if (_packetSource) {
+        getWorkLoop()->removeEventSource(_packetSource);
+        OSSafeReleaseNULL(_packetSource);
+    }
+}
+
+void HostMouseDevice::receive(UInt8 byte)
+{
+    if (!_interruptAction)
+        return;
+    bool enabled = ml_set_interrupts_enabled(false);
+    if (_interruptAction(_interruptTarget, byte) == kPS2IR_packetReady)
+        _packetSource->interruptOccurred(0, this, 0);
+    ml_set_interrupts_enabled(enabled);
+}
+
+void HostMouseDevice::packetReady(IOInterruptEventSource *, int)
+{
+    if (_packetAction)
+        _packetAction(_interruptTarget);
+}
+
+PS2Request *HostMouseDevice::allocateRequest(int max)
+{
+    return HostPS2Request::allocate(max);
+}
+
+void HostMouseDevice::freeRequest(PS2Request *request)
+{
+    HostPS2Request::free(request);
+}
+
+bool HostMouseDevice::submitRequest(PS2Request *request)
+{
+    // there is no queue to wait in: nothing else talks to this port
+    processRequest(request);
+    return true;
+}
+
+void HostMouseDevice::submitRequestAndBlock(PS2Request *request)
+{
+    processRequest(request);
+}
+
+UInt8 HostMouseDevice::setCommandByte(UInt8 setBits, UInt8 clearBits)
+{
+    UInt8 old = _commandByte;
+    _commandByte = (old | setBits) & ~clearBits;
+    return old;
+}
+
+bool HostMouseDevice::writeMouse(UInt8 byte)
+{
+    IODelay(_usPerByte);
+    _device->write(byte);
+    return true;
+}
+
+UInt8 HostMouseDevice::readData(bool *timedOut)
+{
+    UInt8 byte = 0;
+    IODelay(_usPerByte);
+    *timedOut = !_device->read(&byte);
+    return byte;
+}
+
+void HostMouseDevice::processRequest(PS2Request *request)
+{
+    bool failed = false, timedOut, transmitToMouse = false;
+    unsigned index;
+    UInt8 byte;
+
+    for (index = 0; index < request->commandsCount; index++) {
+        PS2Command &command = request->commands[index];
+        switch (command.command) {
+            case kPS2C_ReadDataPort:
+            case kPS2C_ReadMouseDataPort:
+                command.inOrOut = readData(&timedOut);
+                break;
+
+            case kPS2C_ReadDataPortAndCompare:
+            case kPS2C_ReadMouseDataPortAndCompare:
+                byte = readData(&timedOut);
+                failed = byte != command.inOrOut;
+                if (command.command == kPS2C_ReadDataPortAndCompare)
+                    command.inOrOut = byte;
+                break;
+
+            case kPS2C_WriteDataPort:
+                // only bytes sent on with D4 reach the touchpad
+                if (transmitToMouse)
+                    writeMouse(command.inOrOut);
+                else
+                    IODelay(_usPerByte);
+                transmitToMouse = false;
+                break;
+
+            case kPS2C_WriteCommandPort:
+                transmitToMouse = command.inOrOut == kCP_TransmitToMouse;
+                break;
+
+            case kPS2C_SendMouseCommandAndCompareAck:
+                writeMouse(command.inOrOut);
+                failed = readData(&timedOut) != kSC_Acknowledge;
+                break;
+
+            case kPS2C_FlushDataPort:
+                command.inOrOut32 = 0;
+                while (_device->read(&byte))
+                    command.inOrOut32++;
+                break;
+
+            case kPS2C_SleepMS:
+                IOSleep(command.inOrOut32);
+                break;
+
+            case kPS2C_ModifyCommandByte:
+                command.oldBits = setCommandByte(command.setBits, command.clearBits);
+                break;
+        }
+        if (failed)
+            break;
+    }
+
+    if (failed)
+        request->commandsCount = index;
+    _requests++;
+    _failedRequests += failed;
+
+    if (request->completionTarget != kStackCompletionTarget && request->completionTarget &&
+        request->completionAction)
+        request->completionAction(request->completionTarget, request->completionParam);
+    else if (request->completionTarget != kStackCompletionTarget)
+        freeRequest(request);
+}
+
+void HostMouseDevice::installPowerControlAction(OSObject *target, PS2PowerControlAction action)
+{
+    _powerTarget = target;
+    _powerAction = action;
+}
+
+void HostMouseDevice::uninstallPowerControlAction()
+{
+    _powerTarget = NULL;
+    _powerAction = NULL;
+}
+
+void HostMouseDevice::installMessageAction(OSObject *target, PS2MessageAction action)
+{
+    _messageTarget = target;
+    _messageAction = action;
+}
+
+void HostMouseDevice::uninstallMessageAction()
+{
+    _messageTarget = NULL;
+    _messageAction = NULL;
+}
+
+void HostMouseDevice::dispatchMouseMessage(int message, void *data)
+{
+    if (_messageAction)
+        _messageAction(_messageTarget, message, data);
+}
+
+void HostMouseDevice::dispatchKeyboardMessage(int message, void *data)
+{
+    // there is no keyboard driver on the host
+    (void)message;
+    (void)data;
+}
+
+void HostMouseDevice::lock()
+{
+    IOLockLock(_lock);
+}
+
+void HostMouseDevice::unlock()
+{
+    IOLockUnlock(_lock);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// HostKeyboard: takes the keyboard nub's bytes, so that the controller has a
+// driver to pass them to when they turn up in the middle of a mouse request
+
+class HostKeyboard : public IOService {
+    typedef IOService super;
+    OSDeclareDefaultStructors(HostKeyboard);
+
+public:
+    bool start(IOService *provider) override;
+    void stop(IOService *provider) override;
+
+    unsigned bytes() const { return _bytes; }
+
+private:
+    static PS2InterruptResult interruptOccurred(void *target, UInt8 data);
+    static void packetReady(void *target);
+
+    ApplePS2KeyboardDevice *_nub;
+    unsigned _bytes;
+};
+
+OSDefineMetaClassAndStructors(HostKeyboard, IOService);
+
+bool HostKeyboard::start(IOService *provider)
+{
+    if (!super::start(provider) || !(_nub = OSDynamicCast(ApplePS2KeyboardDevice, provider)))
+        return false;
+    _nub->installInterruptAction(this, interruptOccurred, packetReady);
+    return true;
+}
+
+void HostKeyboard::stop(IOService *provider)
+{
+    if (_nub)
+        _nub->uninstallInterruptAction();
+    _nub = NULL;
+    super::stop(provider);
+}
+
+PS2InterruptResult HostKeyboard::interruptOccurred(void *target, UInt8 data)
+{
+    (void)data;
+    static_cast<HostKeyboard *>(target)->_bytes++;
+    return kPS2IR_packetBuffering;
+}
+
+void HostKeyboard::packetReady(void *target)
+{
+    (void)target;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// HostVoodooInput: the client that receives the driver's frames
+
+class HostVoodooInput : public IOService, public HostKernel::PointerEvents {
+    typedef IOService super;
+    OSDeclareDefaultStructors(HostVoodooInput);
+
+public:
+    static HostVoodooInput *withFile(FILE *out);
+
+    IOReturn message(UInt32 type, IOService *provider, void *argument) override;
+    void relative(IOService *sender, int dx, int dy, UInt32 buttons, AbsoluteTime ts) override;
+    void scroll(IOService *sender, short d1, short d2, short d3, AbsoluteTime ts) override;
+
+    unsigned events() const { return _events; }
+    const char *frameError() const { return _frameError; }
+
+private:
+    void checkFrame(const VoodooInputEvent &event);
+
+    FILE *_out;
+    unsigned _events;
+    const char *_frameError;    /* the first thing wrong with a frame */
+};
+
+OSDefineMetaClassAndStructors(HostVoodooInput, IOService);
+
+HostVoodooInput *HostVoodooInput::withFile(FILE *out)
+{
+    HostVoodooInput *me = new HostVoodooInput;
+    if (!me->init()) {
+        me->release();
+        return NULL;
+    }
+    me->_out = out;
+    // what makes ALPS::handleOpen take this client for VoodooInput
+    me->setProperty(VOODOO_INPUT_IDENTIFIER, kOSBooleanTrue);
+    return me;
+}
+
+IOReturn HostVoodooInput::message(UInt32 type, IOService *provider, void *argument)
+{
+    if (type != kIOMessageVoodooInputMessage || !argument)
+        return super::message(type, provider, argument);
+
+    const VoodooInputEvent &event = *(const VoodooInputEvent *)argument;
+    _events++;
+    checkFrame(event);
+    if (!_out)
+        return kIOReturnSuccess;
+    fprintf(_out, "touch %llu %u", (unsigned long long)(event.timestamp / 1000), event.contact_count);
+    for (int i = 0; i < event.contact_count && i < VOODOO_INPUT_MAX_TRANSDUCERS; i++) {
+        const VoodooInputTransducer &t = event.transducers[i];
+        fprintf(_out, " %u:%u,%u,%u,%u,%d,%c%c%c", t.secondaryId,
+                t.currentCoordinates.x, t.currentCoordinates.y,
+                t.currentCoordinates.pressure, t.currentCoordinates.width, (int)t.fingerType,
+                t.isValid ? 'V' : '-', t.isTransducerActive ? 'A' : '-',
+                t.isPhysicalButtonDown ? 'B' : '-');
+    }
+    fputc('\n', _out);
+    return kIOReturnSuccess;
+}
+
+void HostVoodooInput::checkFrame(const VoodooInputEvent &event)
+{
+    // what VoodooInput would index or trust: the transducer count, one
+    // transducer per virtual finger, and one finger type per transducer
+    const char *error = NULL;
+    unsigned ids = 0, types = 0;
+    if (event.contact_count > VOODOO_INPUT_MAX_TRANSDUCERS)
+        error = "more contacts than transducers";
+    for (int i = 0; !error && i < event.contact_count; i++) {
+        const VoodooInputTransducer &t = event.transducers[i];
+        if (t.secondaryId >= MAX_TOUCHES)
+            error = "secondaryId out of range";
+        else if (ids & (1 << t.secondaryId))
+            error = "secondaryId used twice";
+        else if (t.fingerType <= kMT2FingerTypeUndefined || t.fingerType >= kMT2FingerTypeCount)
+            error = "fingerType out of range";
+        else if (types & (1 << t.fingerType))
+            error = "fingerType used twice";
+        ids |= 1 << t.secondaryId;
+        types |= 1 << t.fingerType;
+    }
+    if (error && !_frameError)
+        _frameError = error;
+}
+
+void HostVoodooInput::relative(IOService *sender, int dx, int dy, UInt32 buttons, AbsoluteTime ts)
+{
+    (void)sender;
+    if (_out)
+        fprintf(_out, "rel %llu %d %d %u\n", (unsigned long long)(ts / 1000), dx, dy, buttons);
+}
+
+void HostVoodooInput::scroll(IOService *sender, short d1, short d2, short d3, AbsoluteTime ts)
+{
+    (void)sender;
+    if (_out)
+        fprintf(_out, "scroll %llu %d %d %d\n", (unsigned long long)(ts / 1000), d1, d2, d3);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// AlpsHost
+
+static OSDictionary *loadPersonality(const char *path, const char *name)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "alps_host: cannot open %s\n", path);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *text = (char *)malloc(size + 1);
+    size_t got = fread(text, 1, size, file);
+    text[got] = 0;
+    fclose(file);
+
+    OSString *error = NULL;
+    OSObject *plist = OSUnserializeXML(text, &error);
+    ::free(text);
+    if (error) {
+        fprintf(stderr, "alps_host: %s: %s\n", path, error->getCStringNoCopy());
+        error->release();
+    }
+
+    OSDictionary *personality = NULL;
+    if (OSDictionary *info = OSDynamicCast(OSDictionary, plist)) {
+        if (OSDictionary *all = OSDynamicCast(OSDictionary, info->getObject("IOKitPersonalities")))
+            personality = OSDynamicCast(OSDictionary, all->getObject(name));
+    }
+    if (personality)
+        personality = OSDictionary::withDictionary(personality);
+    OSSafeReleaseNULL(plist);
+    return personality;
+}
+
+AlpsHost::AlpsHost(const struct alps_emu_profile &profile, unsigned usPerByte, AlpsHostPort port)
+    : _profile(profile), _device(profile), _portType(port), _mouse(NULL), _port(NULL),
+      _platform(NULL), _controller(NULL), _keyboard(NULL), _provider(NULL),
+      _input(NULL), _driver(NULL), _started(false)
+{
+    HostKernel::reset();
+    if (port == kAlpsPortI8042) {
+        _port = new I8042Model(&_device, usPerByte);
+        HostKernel::setPort(_port);
+    } else {
+        _mouse = HostMouseDevice::withEmulator(&_device, usPerByte);
+        _provider = _mouse;
+    }
+}
+
+AlpsHost::~AlpsHost()
+{
+    stop();
+    stopController();
+    OSSafeReleaseNULL(_mouse);
+    if (_port) {
+        HostKernel::setPort(NULL);
+        delete _port;
+    }
+}
+
+bool AlpsHost::startController()
+{
+    if (_portType != kAlpsPortI8042 || _controller)
+        return _provider != NULL;
+    OSDictionary *personality = loadPersonality(PS2_INFO_PLIST, kControllerPersonality);
+    if (!personality)
+        return false;
+
+    // the platform nub the controller registers IRQ 1 and 12 on
+    _platform = new IOService;
+    _platform->init();
+    _port->setNub(_platform);
+
+    _controller = new ApplePS2Controller;
+    bool ok = _controller->init(personality) && _controller->attach(_platform);
+    personality->release();
+    if (!ok || !_controller->start(_platform)) {
+        if (ok)
+            _controller->detach(_platform);
+        OSSafeReleaseNULL(_controller);
+        return false;
+    }
+
+    // the nubs the controller registered, as the drivers would match them
+    if (IOService *nub = HostKernel::findService("ApplePS2KeyboardDevice", _controller)) {
+        _keyboard = new HostKeyboard;
+        if (!_keyboard->init() || !_keyboard->attach(nub) || !_keyboard->start(nub)) {
+            _keyboard->detach(nub);
+            OSSafeReleaseNULL(_keyboard);
+        }
+    }
+    _provider = HostKernel::findService("ApplePS2MouseDevice", _controller);
+    return _provider != NULL;
+}
+
+void AlpsHost::stopController()
+{
+    if (_keyboard) {
+        IOService *nub = _keyboard->getProvider();
+        _keyboard->stop(nub);
+        _keyboard->detach(nub);
+        OSSafeReleaseNULL(_keyboard);
+    }
+    if (_controller) {
+        _controller->stop(_platform);
+        _controller->detach(_platform);
+        OSSafeReleaseNULL(_controller);
+    }
+    OSSafeReleaseNULL(_platform);
+    if (_portType == kAlpsPortI8042)
+        _provider = NULL;
+}
+
+bool AlpsHost::start(FILE *events)
+{
+    if (!startController())
+        return false;
+    OSDictionary *personality = loadPersonality(ALPS_INFO_PLIST, kALPSPersonality);
+    if (!personality || !_provider)
+        return false;
+
+    // what IOKit does on a match: init, attach, probe, start
+    _driver = new ALPS;
+    SInt32 score = 0;
+    bool ok = _driver->init(personality) && _driver->attach(_provider);
+    personality->release();
+    if (ok && !_driver->probe(_provider, &score)) {
+        _driver->detach(_provider);
+        ok = false;
+    }
+    if (!ok || !_driver->start(_provider)) {
+        if (ok)
+            _driver->detach(_provider);
+        OSSafeReleaseNULL(_driver);
+        return false;
+    }
+
+    // VoodooInput attaches to the registered driver and opens it
+    _input = HostVoodooInput::withFile(events);
+    HostKernel::setPointerEvents(_input);
+    _input->attach(_driver);
+    _driver->open(_input);
+    _started = true;
+    return true;
+}
+
+void AlpsHost::stop()
+{
+    if (!_driver)
+        return;
+    if (_started) {
+        _driver->close(_input);
+        _input->detach(_driver);
+        _driver->stop(_provider);
+    }
+    _driver->detach(_provider);
+    HostKernel::setPointerEvents(NULL);
+    OSSafeReleaseNULL(_input);
+    OSSafeReleaseNULL(_driver);
+    _started = false;
+}
+
+void AlpsHost::receive(uint8_t byte)
+{
+    if (_port)
+        _port->aux(byte);
+    else
+        _mouse->receive(byte);
+}
+
+void AlpsHost::run(uint64_t deadline)
+{
+    HostKernel::run(deadline);
+}
+
+int AlpsHost::setProperties(OSDictionary *dict)
+{
+    return _driver ? _driver->setProperties(dict) : kIOReturnNotReady;
+}
+
+uint64_t AlpsHost::number(const char *key) const
+{
+    OSNumber *num = _driver ? OSDynamicCast(OSNumber, _driver->getProperty(key)) : NULL;
+    return num ? num->unsigned64BitValue() : 0;
+}
+
+OSDictionary *AlpsHost::dictionary(const char *key) const
+{
+    return _driver ? OSDynamicCast(OSDictionary, _driver->getProperty(key)) : NULL;
+}
+
+unsigned AlpsHost::events() const
+{
+    return _input ? _input->events() : 0;
+}
+
+const char *AlpsHost::frameError() const
+{
+    return _input ? _input->frameError() : NULL;
+}
+
+unsigned AlpsHost::requests() const
+{
+    return _mouse ? _mouse->requests() : (unsigned)controllerStatistic("Requests");
+}
+
+unsigned AlpsHost::failedRequests() const
+{
+    return _mouse ? _mouse->failedRequests() : (unsigned)controllerStatistic("FailedRequests");
+}
+
+uint64_t AlpsHost::controllerStatistic(const char *key) const
+{
+    if (!_controller)
+        return 0;
+    // published on request, as from user space
+    OSDictionary *dict = OSDictionary::withCapacity(1);
+    dict->setObject(kDumpStatistics, kOSBooleanTrue);
+    _controller->setProperties(dict);
+    dict->release();
+    OSDictionary *stats = OSDynamicCast(OSDictionary, _controller->getProperty(kPS2Statistics));
+    OSNumber *num = stats ? OSDynamicCast(OSNumber, stats->getObject(key)) : NULL;
+    return num ? num->unsigned64BitValue() : 0;
+}
+
+unsigned AlpsHost::keyboardBytes() const
+{
+    return _keyboard ? _keyboard->bytes() : 0;
+}
+
+void AlpsHost::streamFormat(struct alps_data *priv) const
+{
+    // the fields alps_check_packet_sync and the stream need, set as
+    // alps_identify and set_protocol set them for this signature
+    struct alps_protocol_info info;
+    const char *name;
+    memset(priv, 0, sizeof(*priv));
+    alps_identify(_profile.e7, _profile.ec, &info, &name);
+    priv->proto_version = info.version;
+    priv->byte0 = info.byte0 ? info.byte0 : 0x8f;
+    priv->mask0 = info.mask0 ? info.mask0 : 0x8f;
+    priv->flags = info.flags;
+    priv->pktsize = info.version == ALPS_PROTO_V4 ? 8 : 6;
+    switch (info.version) {
+        case ALPS_PROTO_V5:
+            priv->byte0 = priv->mask0 = 0xc8;
+            break;
+        case ALPS_PROTO_V7:
+            priv->byte0 = priv->mask0 = 0x48;
+            break;
+        case ALPS_PROTO_V8:
+            priv->byte0 = priv->mask0 = 0x18;
+            break;
+    }
+    memcpy(priv->dev_id, _profile.e7, 3);
+    memcpy(priv->fw_ver, _profile.ec, 3);
+}
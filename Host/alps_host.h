@@ -0,0 +1,120 @@
+//
+// alps_host - the real ALPS driver on the host, behind an emulated mouse port
+//
+// alps.cpp is compiled unchanged against the IOKit shim in Host/shim and
+// attached to HostMouseDevice, which stands in for ApplePS2MouseDevice: it
+// runs the driver's PS2Request command lists against an AlpsEmulator, and
+// delivers stream bytes the way the controller does, through the driver's
+// interrupt action and then its packet action on the work loop. The frames
+// the driver sends to VoodooInput go to HostVoodooInput, which writes them
+// out one line per event:
+//
+//   touch <us> <contacts> [<id>:<x>,<y>,<z>,<w>,<finger>,<flags>]...
+//   rel <us> <dx> <dy> <buttons>
+//   scroll <us> <d1> <d2> <d3>
+//
+// flags are V (isValid), A (isTransducerActive) and B (isPhysicalButtonDown),
+// or - for each that is off. Times are the virtual clock (HostKernel), in us.
+//
+// With kAlpsPortI8042 the driver is instead attached to the mouse nub of the
+// real ApplePS2Controller, which runs on an I8042Model (i8042_model.h) with
+// the emulator on its AUX port: requests then go through processRequest and
+// the port routines, and stream bytes through the 8042's output buffer, IRQ 12
+// and handleInterrupt.
+//
+// Only this header is needed by the host tools; alps_host.cpp is the one unit
+// that sees alps.h, and is built with the kext's flags.
+//
+
+#ifndef _ALPS_HOST_H
+#define _ALPS_HOST_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "alps_emulator.h"
+
+class ALPS;
+class ApplePS2Controller;
+class HostKeyboard;
+class HostMouseDevice;
+class HostVoodooInput;
+class I8042Model;
+class IOService;
+class OSDictionary;
+
+// how the driver reaches the touchpad
+enum AlpsHostPort {
+    kAlpsPortDirect,            // HostMouseDevice, straight to the emulator
+    kAlpsPortI8042,             // ApplePS2Controller on an emulated 8042
+};
+
+class AlpsHost {
+public:
+    // @usPerByte is the wire time of one byte to or from the touchpad
+    AlpsHost(const struct alps_emu_profile &profile, unsigned usPerByte = 1000,
+             AlpsHostPort port = kAlpsPortDirect);
+    ~AlpsHost();
+
+    // probe and start the driver with its Info.plist personality (and the
+    // controller under it, with its own), and open it for VoodooInput; events
+    // are written to @events when it is not NULL
+    bool start(FILE *events);
+    void stop();
+    // kAlpsPortI8042: start the controller alone, before start(), which
+    // otherwise does it first
+    bool startController();
+
+    // one byte of the touchpad's stream arrives now
+    void receive(uint8_t byte);
+    // lets the work loop run (timers, packetReady) until @deadline (ns)
+    void run(uint64_t deadline);
+
+    // ALPS::setProperties, as from user space
+    int setProperties(OSDictionary *dict);
+    // a property of the driver, or of its merged configuration
+    uint64_t number(const char *key) const;
+    OSDictionary *dictionary(const char *key) const;
+
+    AlpsEmulator &device() { return _device; }
+    const struct alps_emu_profile &profile() const { return _profile; }
+    ALPS *driver() const { return _driver; }
+
+    bool started() const { return _started; }
+    // frames sent to VoodooInput so far, and the first thing found wrong
+    // with one (a transducer count, secondaryId or fingerType VoodooInput
+    // could not take), or NULL
+    unsigned events() const;
+    const char *frameError() const;
+
+    // PS2Request traffic since the host was created
+    unsigned requests() const;
+    unsigned failedRequests() const;
+
+    // the 8042 and the controller's PS2Statistics counters (kAlpsPortI8042;
+    // NULL and 0 otherwise), and the bytes the keyboard nub passed on
+    I8042Model *port() const { return _port; }
+    uint64_t controllerStatistic(const char *key) const;
+    unsigned keyboardBytes() const;
+
+    // the format the emulator streams in, as set_protocol configures it
+    void streamFormat(struct alps_data *priv) const;
+
+private:
+    void stopController();
+
+    const struct alps_emu_profile &_profile;
+    AlpsEmulator _device;
+    AlpsHostPort _portType;
+    HostMouseDevice *_mouse;
+    I8042Model *_port;
+    IOService *_platform;
+    ApplePS2Controller *_controller;
+    HostKeyboard *_keyboard;
+    IOService *_provider;       /* the nub the driver attaches to */
+    HostVoodooInput *_input;
+    ALPS *_driver;
+    bool _started;
+};
+
+#endif /* _ALPS_HOST_H */
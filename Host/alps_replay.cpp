@@ -0,0 +1,431 @@
+//
+// alps_replay - feed a recorded ALPS byte stream through the real driver
+//
+// Brings up alps.cpp against the emulated touchpad the trace names (identify,
+// set_protocol and hw_init run for real), then delivers the trace's bytes at
+// their recorded times through ALPS::interruptOccurred, packetReady on the
+// work loop, and on to sendTouchData. The VoodooInput frames it sends are
+// written one per line (see alps_host.h) to the events file, or stdout.
+//
+// A trace is text: a "profile <name>" line naming the alps_emulator profile,
+// an optional "byte-us <us>" line giving the time between the bytes of one
+// line (700 by default, about one byte at a 15 kHz PS/2 clock), then one line
+// per packet: its time in us from the end of bring-up and its bytes in hex.
+// # starts a comment. -r records such a trace from the emulator's stream, or
+// with -g (V7 only) from a scripted gesture: a one finger swipe, a two finger
+// scroll and a tap, encoded by alps_emu_touch.
+//
+// -c compares the events with those expected for the trace, line by line. It
+// reports the first frame that differs and, over the touch frames at the same
+// position in both, the RMS coordinate delta of each finger (matched by
+// secondaryId), and fails on any difference. Host/traces holds traces
+// recorded this way with their expected events; make golden checks them all.
+//
+// -l replays in HostKernel's timed mode, with the host's real time added to
+// the clock, and prints the driver's LatencyStats histograms afterwards: per
+// stage (Queue, Decode, Track, Send and Total, see ALPS::dumpLatency) the
+// samples, P50, P99 and maximum, and the count in each power-of-two bucket.
+// Event times then vary from run to run, so -l does not go with -c:
+//
+//   make -C Host replay
+//   make -C Host golden
+//   build/alps_replay [-l] [-u us-per-byte] [-o events] [-c expected] trace
+//   build/alps_replay -r ms -p profile [-g] [-o trace]
+//
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "alps_host.h"
+#include "host_iokit.h"
+
+struct TracePacket {
+    uint64_t us;
+    std::vector<uint8_t> bytes;
+};
+
+struct Trace {
+    const struct alps_emu_profile *profile;
+    unsigned byteUS;
+    std::vector<TracePacket> packets;
+};
+
+static const struct alps_emu_profile *findProfile(const char *name)
+{
+    for (unsigned i = 0; i < alps_emu_profile_count; i++) {
+        if (!strcmp(alps_emu_profiles[i].name, name))
+            return &alps_emu_profiles[i];
+    }
+    return NULL;
+}
+
+static bool loadTrace(const char *path, Trace *trace)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "alps_replay: %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    trace->profile = NULL;
+    trace->byteUS = 700;
+    char line[512], name[64];
+    unsigned number = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file)) {
+        number++;
+        if (char *hash = strchr(line, '#'))
+            *hash = 0;
+        char *p = line;
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (!*p || *p == '\n')
+            continue;
+        if (sscanf(p, "profile %63s", name) == 1) {
+            if (!(trace->profile = findProfile(name))) {
+                fprintf(stderr, "alps_replay: %s:%u: unknown profile %s\n", path, number, name);
+                ok = false;
+            }
+            continue;
+        }
+        if (sscanf(p, "byte-us %u", &trace->byteUS) == 1)
+            continue;
+
+        TracePacket packet;
+        char *end;
+        packet.us = strtoull(p, &end, 10);
+        for (p = end; ok; p = end) {
+            unsigned long byte = strtoul(p, &end, 16);
+            if (end == p)
+                break;
+            if (byte > 0xff)
+                ok = false;
+            packet.bytes.push_back((uint8_t)byte);
+        }
+        while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+            p++;
+        if (!ok || *p || packet.bytes.empty() ||
+            (!trace->packets.empty() && packet.us < trace->packets.back().us)) {
+            fprintf(stderr, "alps_replay: %s:%u: bad packet line\n", path, number);
+            ok = false;
+        }
+        trace->packets.push_back(packet);
+    }
+    fclose(file);
+    if (ok && !trace->profile) {
+        fprintf(stderr, "alps_replay: %s: no profile line\n", path);
+        ok = false;
+    }
+    return ok;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// The contacts of the scripted gesture at @t (0..1 of its length), in
+// fractions of the pad; returns how many there are
+static unsigned gestureAt(double t, double pos[2][2])
+{
+    if (t < 0.35) {
+        // swipe left to right across the middle
+        pos[0][0] = 0.2 + 0.6 * t / 0.35;
+        pos[0][1] = 0.5;
+        return 1;
+    }
+    if (t >= 0.45 && t < 0.8) {
+        // two finger scroll down
+        pos[0][0] = 0.35;
+        pos[1][0] = 0.65;
+        pos[0][1] = pos[1][1] = 0.2 + 0.6 * (t - 0.45) / 0.35;
+        return 2;
+    }
+    if (t >= 0.85 && t < 0.9) {
+        // tap
+        pos[0][0] = 0.5;
+        pos[0][1] = 0.4;
+        return 1;
+    }
+    return 0;
+}
+
+static unsigned recordGesture(const struct alps_data &priv, unsigned ms,
+                              uint8_t (*out)[8], unsigned cap)
+{
+    unsigned count = ms / 10 < cap ? ms / 10 : cap;
+    for (unsigned n = 0; n < count; n++) {
+        double pos[2][2];
+        struct alps_emu_contact contacts[2];
+        unsigned fingers = gestureAt((double)n / count, pos);
+        for (unsigned i = 0; i < fingers; i++) {
+            // V7 device units
+            contacts[i].x = (unsigned)(pos[i][0] * 0xfff);
+            contacts[i].y = (unsigned)(pos[i][1] * 0x7ff);
+        }
+        if (!alps_emu_touch(priv, contacts, fingers, 0, out[n]))
+            return 0;
+    }
+    return count;
+}
+
+static int record(const struct alps_emu_profile &profile, unsigned ms, bool gesture, FILE *out)
+{
+    AlpsHost host(profile);
+    if (!host.start(NULL)) {
+        fprintf(stderr, "alps_replay: %s: the driver did not start\n", profile.name);
+        return 1;
+    }
+    struct alps_data priv;
+    host.streamFormat(&priv);
+
+    static uint8_t packets[1000][8];
+    unsigned count;
+    if (gesture) {
+        if (!(count = recordGesture(priv, ms, packets, 1000))) {
+            fprintf(stderr, "alps_replay: %s: gestures are only encoded for V7\n", profile.name);
+            return 1;
+        }
+        fprintf(out, "# %u ms of a swipe, scroll and tap on the %s emulator at 100 Hz\n",
+                ms, profile.name);
+    } else {
+        count = host.device().stream(priv, 100, (uint64_t)ms * 1000000, packets, 1000);
+        fprintf(out, "# %u ms of the %s emulator's stream at 100 Hz\n", ms, profile.name);
+    }
+    fprintf(out, "profile %s\nbyte-us 700\n", profile.name);
+    for (unsigned n = 0; n < count; n++) {
+        fprintf(out, "%u", n * 10000);
+        for (int b = 0; b < priv.pktsize; b++)
+            fprintf(out, " %02x", packets[n][b]);
+        fputc('\n', out);
+    }
+    return 0;
+}
+
+static uint64_t statistic(OSDictionary *dict, const char *key)
+{
+    OSNumber *num = dict ? OSDynamicCast(OSNumber, dict->getObject(key)) : NULL;
+    return num ? num->unsigned64BitValue() : 0;
+}
+
+static void printLatency(AlpsHost &host)
+{
+    // published on request, as from user space
+    OSDictionary *request = OSDictionary::withCapacity(1);
+    request->setObject("DumpLatency", kOSBooleanTrue);
+    host.setProperties(request);
+    request->release();
+
+    static const char *const stages[] = { "Queue", "Decode", "Track", "Send", "Total" };
+    OSDictionary *stats = host.dictionary("LatencyStats");
+    fprintf(stderr, "%-8s %8s %8s %8s %8s  %s\n", "stage", "samples", "p50", "p99", "max",
+            "histogram (us upper bound: count)");
+    for (unsigned i = 0; i < sizeof(stages) / sizeof(stages[0]); i++) {
+        OSDictionary *stage = stats ? OSDynamicCast(OSDictionary, stats->getObject(stages[i])) : NULL;
+        fprintf(stderr, "%-8s %8llu %6lluus %6lluus %6lluus ", stages[i],
+                (unsigned long long)statistic(stage, "Samples"),
+                (unsigned long long)statistic(stage, "P50US"),
+                (unsigned long long)statistic(stage, "P99US"),
+                (unsigned long long)statistic(stage, "MaxUS"));
+        OSArray *buckets = stage ? OSDynamicCast(OSArray, stage->getObject("Histogram")) : NULL;
+        for (unsigned b = 0; buckets && b < buckets->getCount(); b++) {
+            OSNumber *count = OSDynamicCast(OSNumber, buckets->getObject(b));
+            if (count && count->unsigned64BitValue())
+                fprintf(stderr, " %llu:%llu", 1ULL << b, (unsigned long long)count->unsigned64BitValue());
+        }
+        fprintf(stderr, "\n");
+    }
+}
+
+static int replay(const Trace &trace, unsigned usPerByte, bool latency, FILE *out)
+{
+    AlpsHost host(*trace.profile, usPerByte);
+    if (!host.start(out)) {
+        fprintf(stderr, "alps_replay: %s: the driver did not start\n", trace.profile->name);
+        return 1;
+    }
+    // from here on, so that bring-up stays on the virtual clock alone
+    HostKernel::setTimed(latency);
+
+    uint64_t start = HostKernel::now();
+    unsigned bytes = 0;
+    for (size_t n = 0; n < trace.packets.size(); n++) {
+        const TracePacket &packet = trace.packets[n];
+        uint64_t t = start + packet.us * 1000;
+        for (size_t b = 0; b < packet.bytes.size(); b++, t += trace.byteUS * 1000ULL) {
+            host.run(t);
+            host.receive(packet.bytes[b]);
+            bytes++;
+        }
+    }
+    // let a held frame and the recovery timer run out
+    host.run(HostKernel::now() + 1000000000ULL);
+    HostKernel::setTimed(false);
+
+    fprintf(stderr, "%s: %u bytes, %u events, %u requests (%u failed), %u driver errors\n",
+            trace.profile->name, bytes, host.events(), host.requests(), host.failedRequests(),
+            HostKernel::wtfCount());
+    if (latency)
+        printLatency(host);
+    host.stop();
+    return HostKernel::wtfCount() ? 1 : 0;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Comparing with the expected events
+
+struct EventLine {
+    std::string text;
+    bool touch;
+    std::map<unsigned, std::pair<int, int> > fingers;   /* secondaryId: x, y */
+};
+
+static bool readEvents(FILE *file, const char *path, std::vector<EventLine> *events)
+{
+    char line[1024];
+    while (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\r\n")] = 0;
+        EventLine event;
+        event.text = line;
+        event.touch = !strncmp(line, "touch ", 6);
+        if (event.touch) {
+            // touch <us> <contacts> <id>:<x>,<y>,...
+            const char *p = line + 6;
+            for (int field = 0; field < 2 && p; field++)
+                p = strchr(p + 1, ' ');
+            while (p && *p) {
+                unsigned id;
+                int x, y;
+                if (sscanf(p, " %u:%d,%d", &id, &x, &y) != 3) {
+                    fprintf(stderr, "alps_replay: %s:%zu: bad touch line\n", path,
+                            events->size() + 1);
+                    return false;
+                }
+                event.fingers[id] = std::make_pair(x, y);
+                p = strchr(p + 1, ' ');
+            }
+        }
+        events->push_back(event);
+    }
+    return true;
+}
+
+static int compare(const char *name, FILE *actualFile, const char *expectedPath)
+{
+    FILE *expectedFile = fopen(expectedPath, "r");
+    if (!expectedFile) {
+        fprintf(stderr, "alps_replay: %s: %s\n", expectedPath, strerror(errno));
+        return 2;
+    }
+    std::vector<EventLine> actual, expected;
+    rewind(actualFile);
+    bool ok = readEvents(actualFile, "events", &actual) &&
+              readEvents(expectedFile, expectedPath, &expected);
+    fclose(expectedFile);
+    if (!ok)
+        return 2;
+
+    size_t frames = actual.size() < expected.size() ? actual.size() : expected.size();
+    long firstDivergent = actual.size() != expected.size() ? (long)frames : -1;
+    unsigned divergent = 0;
+    std::map<unsigned, std::pair<double, unsigned> > rms;      /* sum of squares, samples */
+    for (size_t n = 0; n < frames; n++) {
+        const EventLine &a = actual[n], &e = expected[n];
+        if (a.text != e.text) {
+            divergent++;
+            if (firstDivergent < 0 || (size_t)firstDivergent > n)
+                firstDivergent = (long)n;
+        }
+        if (!a.touch || !e.touch)
+            continue;
+        std::map<unsigned, std::pair<int, int> >::const_iterator i, k;
+        for (i = a.fingers.begin(); i != a.fingers.end(); ++i) {
+            if ((k = e.fingers.find(i->first)) == e.fingers.end())
+                continue;
+            double dx = i->second.first - k->second.first;
+            double dy = i->second.second - k->second.second;
+            rms[i->first].first += dx * dx + dy * dy;
+            rms[i->first].second++;
+        }
+    }
+
+    fprintf(stderr, "%s: %zu/%zu frames, %u divergent", name, actual.size(), expected.size(),
+            divergent + (actual.size() != expected.size() ? 1 : 0));
+    if (firstDivergent >= 0)
+        fprintf(stderr, ", first at frame %ld", firstDivergent);
+    fputc('\n', stderr);
+    if (firstDivergent >= 0) {
+        size_t n = (size_t)firstDivergent;
+        fprintf(stderr, "  expected: %s\n  actual:   %s\n",
+                n < expected.size() ? expected[n].text.c_str() : "(end)",
+                n < actual.size() ? actual[n].text.c_str() : "(end)");
+        fprintf(stderr, "  finger rms:");
+        std::map<unsigned, std::pair<double, unsigned> >::const_iterator i;
+        for (i = rms.begin(); i != rms.end(); ++i)
+            fprintf(stderr, " %u:%.2f", i->first, sqrt(i->second.first / i->second.second));
+        fputc('\n', stderr);
+    }
+    return firstDivergent >= 0 ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *outPath = NULL, *profileName = NULL, *expectedPath = NULL;
+    unsigned usPerByte = 1000, recordMS = 0;
+    bool gesture = false, latency = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:glo:p:r:u:v")) != -1) {
+        switch (opt) {
+            case 'c': expectedPath = optarg; break;
+            case 'g': gesture = true; break;
+            case 'l': latency = true; break;
+            case 'o': outPath = optarg; break;
+            case 'p': profileName = optarg; break;
+            case 'r': recordMS = (unsigned)atoi(optarg); break;
+            case 'u': usPerByte = (unsigned)atoi(optarg); break;
+            case 'v': HostKernel::setVerbose(true); break;
+            default:
+                fprintf(stderr, "usage: alps_replay [-lv] [-u us-per-byte] [-o events] [-c expected] trace\n"
+                                "       alps_replay -r ms -p profile [-g] [-o trace]\n");
+                return 2;
+        }
+    }
+
+    if (latency && expectedPath) {
+        fprintf(stderr, "alps_replay: -l puts the host's time on the clock, it does not go with -c\n");
+        return 2;
+    }
+
+    // the events are read back to compare them
+    bool comparing = expectedPath && !recordMS;
+    FILE *out = outPath ? fopen(outPath, comparing ? "w+" : "w") : comparing ? tmpfile() : stdout;
+    if (!out) {
+        fprintf(stderr, "alps_replay: %s: %s\n", outPath, strerror(errno));
+        return 2;
+    }
+
+    int result;
+    if (recordMS) {
+        const struct alps_emu_profile *profile = profileName ? findProfile(profileName) : NULL;
+        if (!profile) {
+            fprintf(stderr, "alps_replay: -r needs a known -p profile\n");
+            return 2;
+        }
+        result = record(*profile, recordMS, gesture, out);
+    } else {
+        Trace trace;
+        if (optind != argc - 1 || !loadTrace(argv[optind], &trace))
+            return 2;
+        result = replay(trace, usPerByte, latency, out);
+        if (!result && comparing)
+            result = compare(argv[optind], out, expectedPath);
+    }
+
+    if (out != stdout)
+        fclose(out);
+    return result;
+}
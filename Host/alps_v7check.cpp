@@ -0,0 +1,179 @@
+//
+// alps_v7check - the V7 lookup tables against the formulas they replaced
+//
+// alps_get_packet_id_v7 and alps_get_finger_coordinate_v7 in alps_decode.cpp
+// decode from tables (v7_packet_id, v7_x0_byte2/3, v7_hi6 and the per-ID
+// fixups). This runs them against the branching code they were generated
+// from, kept here. The packet ID and mt[0] are swept over every value of
+// every byte they read; mt[1] reads four bytes, and 2^32 packets per ID take
+// too long for a make target, so bytes 4 and 5 are swept with every value of
+// byte 0 and then with every value of byte 3, the other one at each of four
+// patterns that set and clear the bit (0x20 of byte 0, 0x80 of byte 3) the
+// formulas take from it:
+//
+//   packet ID  bytes 0, 1 and 4                          2 x 2^24
+//   mt[0].x    bytes 2 and 3, for every packet ID         5 x 2 x 2^16
+//   mt[0].y    bytes 0 and 1, for every packet ID         5 x 2 x 2^16
+//   mt[1]      bytes 4, 5 and 0 or 3, for every ID        5 x 8 x 2^24
+//
+// The bytes a sweep does not vary are held at 0x00 and then 0xff (or the
+// patterns above), so that a table reading one of them shows up too. Any
+// difference is reported with the packet, and fails the run.
+//
+//   make -C Host v7check
+//   build/alps_v7check
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "alps_decode.h"
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// The formulas, as alps_decode.cpp had them before the tables
+
+static unsigned char legacyPacketID(const uint8_t *byte)
+{
+    unsigned char packet_id;
+
+    if (byte[4] & 0x40)
+        packet_id = V7_PACKET_ID_TWO;
+    else if (byte[4] & 0x01)
+        packet_id = V7_PACKET_ID_MULTI;
+    else if ((byte[0] & 0x10) && !(byte[4] & 0x43))
+        packet_id = V7_PACKET_ID_NEW;
+    else if (byte[1] == 0x00 && byte[4] == 0x00)
+        packet_id = V7_PACKET_ID_IDLE;
+    else
+        packet_id = V7_PACKET_ID_UNKNOWN;
+
+    return packet_id;
+}
+
+static void legacyCoordinates(struct input_mt_pos *mt, const uint8_t *pkt, uint8_t pkt_id)
+{
+    mt[0].x = ((pkt[2] & 0x80) << 4);
+    mt[0].x |= ((pkt[2] & 0x3F) << 5);
+    mt[0].x |= ((pkt[3] & 0x30) >> 1);
+    mt[0].x |= (pkt[3] & 0x07);
+    mt[0].y = (pkt[1] << 3) | (pkt[0] & 0x07);
+
+    mt[1].x = ((pkt[3] & 0x80) << 4);
+    mt[1].x |= ((pkt[4] & 0x80) << 3);
+    mt[1].x |= ((pkt[4] & 0x3F) << 4);
+    mt[1].y = ((pkt[5] & 0x80) << 3);
+    mt[1].y |= ((pkt[5] & 0x3F) << 4);
+
+    switch (pkt_id) {
+        case V7_PACKET_ID_TWO:
+            mt[1].x &= ~0x000F;
+            mt[1].y |= 0x000F;
+            /* Detect false-positive touches where x & y report max value */
+            if (mt[1].y == 0x7ff && mt[1].x == 0xff0)
+                mt[1].x = 0;
+            break;
+
+        case V7_PACKET_ID_MULTI:
+            mt[1].x &= ~0x003F;
+            mt[1].y &= ~0x0020;
+            mt[1].y |= ((pkt[4] & 0x02) << 4);
+            mt[1].y |= 0x001F;
+            break;
+
+        case V7_PACKET_ID_NEW:
+            mt[1].x &= ~0x003F;
+            mt[1].x |= (pkt[0] & 0x20);
+            mt[1].y |= 0x000F;
+            break;
+    }
+
+    mt[0].y = 0x7FF - mt[0].y;
+    mt[1].y = 0x7FF - mt[1].y;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static const char *const idNames[] = { "IDLE", "TWO", "MULTI", "NEW", "UNKNOWN" };
+
+static unsigned long s_packets, s_differences;
+
+static void report(const char *what, const uint8_t *p, unsigned id)
+{
+    // the first few are enough to go on
+    if (s_differences++ < 10)
+        fprintf(stderr, "alps_v7check: %s differs for %02x %02x %02x %02x %02x %02x (%s)\n",
+                what, p[0], p[1], p[2], p[3], p[4], p[5], idNames[id]);
+}
+
+static void checkPacketID(uint8_t fill)
+{
+    uint8_t p[6];
+    memset(p, fill, sizeof(p));
+    for (unsigned b0 = 0; b0 < 256; b0++)
+        for (unsigned b1 = 0; b1 < 256; b1++)
+            for (unsigned b4 = 0; b4 < 256; b4++) {
+                p[0] = b0, p[1] = b1, p[4] = b4;
+                unsigned id = legacyPacketID(p);
+                if (alps_get_packet_id_v7(p) != id)
+                    report("packet ID", p, id);
+                s_packets++;
+            }
+}
+
+// every value of bytes @a and @b, the rest @fill: mt[0].x for 2 and 3, mt[0].y
+// for 0 and 1
+static void checkPair(unsigned a, unsigned b, uint8_t fill, unsigned id)
+{
+    uint8_t p[6];
+    memset(p, fill, sizeof(p));
+    for (unsigned va = 0; va < 256; va++)
+        for (unsigned vb = 0; vb < 256; vb++) {
+            p[a] = va, p[b] = vb;
+            struct input_mt_pos want[MAX_TOUCHES], got[MAX_TOUCHES];
+            memset(want, 0, sizeof(want));
+            memset(got, 0, sizeof(got));
+            legacyCoordinates(want, p, id);
+            alps_get_finger_coordinate_v7(got, p, id);
+            if (a == 2 ? got[0].x != want[0].x : got[0].y != want[0].y)
+                report(a == 2 ? "mt[0].x" : "mt[0].y", p, id);
+            s_packets++;
+        }
+}
+
+// bytes 4 and 5 and byte @swept, with byte @held at @value
+static void checkSecond(unsigned id, unsigned swept, unsigned held, uint8_t value)
+{
+    uint8_t p[6] = { 0, 0x5a, 0xa5, 0, 0, 0 };
+    p[held] = value;
+    for (unsigned vs = 0; vs < 256; vs++)
+        for (unsigned b4 = 0; b4 < 256; b4++)
+            for (unsigned b5 = 0; b5 < 256; b5++) {
+                p[swept] = vs, p[4] = b4, p[5] = b5;
+                struct input_mt_pos want[2], got[2];
+                legacyCoordinates(want, p, id);
+                alps_get_finger_coordinate_v7(got, p, id);
+                if (got[1].x != want[1].x || got[1].y != want[1].y)
+                    report("mt[1]", p, id);
+                s_packets++;
+            }
+}
+
+int main()
+{
+    checkPacketID(0x00);
+    checkPacketID(0xff);
+    for (unsigned id = V7_PACKET_ID_IDLE; id <= V7_PACKET_ID_UNKNOWN; id++) {
+        checkPair(2, 3, 0x00, id);
+        checkPair(2, 3, 0xff, id);
+        checkPair(0, 1, 0x00, id);
+        checkPair(0, 1, 0xff, id);
+        static const uint8_t held0[] = { 0x00, 0x20, 0xdf, 0xff };
+        static const uint8_t held3[] = { 0x00, 0x80, 0x7f, 0xff };
+        for (unsigned i = 0; i < 4; i++) {
+            checkSecond(id, 0, 3, held3[i]);
+            checkSecond(id, 3, 0, held0[i]);
+        }
+    }
+    printf("%lu packets, %lu differences\n", s_packets, s_differences);
+    return s_differences ? 1 : 0;
+}
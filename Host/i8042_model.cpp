@@ -0,0 +1,293 @@
+//
+// i8042_model - the keyboard controller behind ports 0x60 and 0x64
+//
+// See i8042_model.h. The model is ticked by HostKernel as the virtual clock
+// passes; the controller driver's busy waits (IODelay) are what move it on
+// while a request polls the status register, so an interrupt handler can run
+// in the middle of one, as on the hardware.
+//
+
+#include <string.h>
+
+#include "alps_emulator.h"
+#include "i8042_model.h"
+
+// status register
+#define kStatusOutputFull       0x01
+#define kStatusInputFull        0x02
+#define kStatusSystem           0x04
+#define kStatusCommand          0x08    // A2: last write was to 0x64
+#define kStatusNotInhibited     0x10
+#define kStatusAuxData          0x20
+
+// command byte
+#define kCommandKeyboardIRQ     0x01
+#define kCommandAuxIRQ          0x02
+#define kCommandSystem          0x04
+#define kCommandKeyboardOff     0x10
+#define kCommandAuxOff          0x20
+#define kCommandTranslate       0x40
+
+#define kIRQKeyboard            1
+#define kIRQAux                 12
+
+I8042Model::I8042Model(AlpsEmulator *aux, unsigned usPerByte, unsigned inputUS)
+    : _device(aux), _nub(NULL), _byteNS(usPerByte * 1000ULL), _inputNS(inputUS * 1000ULL),
+      _commandByte(kCommandKeyboardIRQ | kCommandSystem | kCommandTranslate),
+      _output(0), _outputFull(false), _outputAux(false), _outputDue(0),
+      _inputFull(false), _inputCommand(false), _input(0), _inputDue(0), _pendingCommand(-1),
+      _keyboardLine(false), _auxLine(false), _stalled(false), _strays(0), _stray(0)
+{
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+void I8042Model::queue(Queue &q, uint8_t byte, uint64_t after)
+{
+    // one wire time after the byte ahead of it, and not before @after
+    Byte b = { byte, after };
+    if (!q.empty() && q.back().due + _byteNS > b.due)
+        b.due = q.back().due + _byteNS;
+    q.push_back(b);
+}
+
+void I8042Model::reply(uint8_t byte)
+{
+    Byte b = { byte, HostKernel::now() };
+    _replies.push_back(b);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Host side: the ports
+
+UInt8 I8042Model::inb(UInt16 port)
+{
+    if (port == 0x64) {
+        UInt8 status = kStatusSystem | kStatusNotInhibited;
+        if (_outputFull)
+            status |= kStatusOutputFull | (_outputAux ? kStatusAuxData : 0);
+        if (_inputFull)
+            status |= kStatusInputFull;
+        if (_inputCommand)
+            status |= kStatusCommand;
+        return status;
+    }
+    if (port != 0x60)
+        return 0xff;
+
+    // reading an empty buffer gets the last byte again
+    if (!_outputFull) {
+        _stats.emptyReads++;
+        return _output;
+    }
+    _outputFull = false;
+    updateLines();
+    if (_outputAux) {
+        uint64_t latency = HostKernel::now() - _outputDue;
+        _stats.auxBytes++;
+        _stats.auxLatencyTotal += latency;
+        if (latency > _stats.auxLatencyMax)
+            _stats.auxLatencyMax = latency;
+    } else {
+        _stats.keyboardBytes++;
+    }
+    return _output;
+}
+
+void I8042Model::outb(UInt16 port, UInt8 value)
+{
+    if (port != 0x60 && port != 0x64)
+        return;
+    // a write over a full input buffer replaces the byte, as on the part
+    _input = value;
+    _inputFull = true;
+    _inputCommand = port == 0x64;
+    _inputDue = HostKernel::now() + _inputNS;
+    _stats.inputWrites++;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Controller firmware
+
+void I8042Model::command(uint8_t value)
+{
+    _pendingCommand = -1;
+    switch (value) {
+        case 0x20:                          // read command byte
+            reply(_commandByte);
+            break;
+        case 0x60:                          // write command byte
+        case 0xd2:                          // write keyboard output buffer
+        case 0xd3:                          // write AUX output buffer
+        case 0xd4:                          // write to AUX device
+            _pendingCommand = value;
+            break;
+        case 0xa7:
+            _commandByte |= kCommandAuxOff;
+            break;
+        case 0xa8:
+            _commandByte &= ~kCommandAuxOff;
+            break;
+        case 0xa9:                          // test AUX port
+        case 0xab:                          // test keyboard port
+            reply(0x00);
+            break;
+        case 0xaa:                          // self test
+            reply(0x55);
+            break;
+        case 0xad:
+            _commandByte |= kCommandKeyboardOff;
+            break;
+        case 0xae:
+            _commandByte &= ~kCommandKeyboardOff;
+            break;
+    }
+}
+
+void I8042Model::data(uint8_t value)
+{
+    int pending = _pendingCommand;
+    _pendingCommand = -1;
+    switch (pending) {
+        case 0x60:
+            _commandByte = value;
+            break;
+        case 0xd2:
+            queue(_keyboard, value, HostKernel::now());
+            break;
+        case 0xd3:
+            queue(_aux, value, HostKernel::now());
+            break;
+        case 0xd4:
+            auxCommand(value);
+            break;
+        default:
+            keyboardCommand(value);
+            break;
+    }
+}
+
+void I8042Model::keyboardCommand(uint8_t value)
+{
+    // the byte goes out on the wire, the answer comes back on it
+    uint64_t after = HostKernel::now() + 2 * _byteNS;
+    switch (value) {
+        case 0xee:                          // echo
+            queue(_keyboard, 0xee, after);
+            break;
+        case 0xf2:                          // identify: MF2, translated or not
+            queue(_keyboard, 0xfa, after);
+            queue(_keyboard, 0xab, after);
+            queue(_keyboard, _commandByte & kCommandTranslate ? 0x41 : 0x83, after);
+            break;
+        case 0xff:                          // reset: ACK, then BAT passed
+            queue(_keyboard, 0xfa, after);
+            queue(_keyboard, 0xaa, after);
+            break;
+        default:                            // commands and their arguments
+            queue(_keyboard, 0xfa, after);
+            break;
+    }
+}
+
+void I8042Model::auxCommand(uint8_t value)
+{
+    uint64_t after = HostKernel::now() + 2 * _byteNS;
+    uint8_t answer[8], byte;
+    unsigned count = 0;
+    _device->write(value);
+    while (_device->read(&byte)) {
+        if (count < sizeof(answer))
+            answer[count++] = byte;
+    }
+    if (_strays && count == 1) {
+        // a stream byte that was already on its way when a command that is
+        // answered by its ACK alone went out
+        _strays--;
+        queue(_aux, _stray, HostKernel::now() + _byteNS);
+    }
+    for (unsigned i = 0; i < count; i++)
+        queue(_aux, answer[i], after);
+}
+
+bool I8042Model::load(uint64_t now)
+{
+    // the controller's own answers first, then whichever device's byte has
+    // been due the longest; a device whose clock is off keeps its bytes
+    Queue *from = NULL;
+    if (!_replies.empty())
+        from = &_replies;
+    if (!from && !_keyboard.empty() && _keyboard.front().due <= now &&
+        !(_commandByte & kCommandKeyboardOff))
+        from = &_keyboard;
+    if ((!from || from == &_keyboard) && !_aux.empty() && _aux.front().due <= now &&
+        !(_commandByte & kCommandAuxOff) && (!from || _aux.front().due < from->front().due))
+        from = &_aux;
+    if (!from)
+        return false;
+
+    _output = from->front().value;
+    _outputDue = from->front().due;
+    _outputAux = from == &_aux;
+    _outputFull = true;
+    from->pop_front();
+    return true;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// HostDevice
+
+uint64_t I8042Model::nextEvent()
+{
+    uint64_t next = UINT64_MAX;
+    if (_inputFull && !_stalled)
+        next = _inputDue;
+    if (!_outputFull) {
+        if (!_replies.empty() && _replies.front().due < next)
+            next = _replies.front().due;
+        if (!_keyboard.empty() && !(_commandByte & kCommandKeyboardOff) && _keyboard.front().due < next)
+            next = _keyboard.front().due;
+        if (!_aux.empty() && !(_commandByte & kCommandAuxOff) && _aux.front().due < next)
+            next = _aux.front().due;
+    }
+    return next;
+}
+
+void I8042Model::tick(uint64_t now)
+{
+    if (_inputFull && !_stalled && now >= _inputDue) {
+        _inputFull = false;
+        if (_inputCommand)
+            command(_input);
+        else
+            data(_input);
+    }
+    if (!_outputFull)
+        load(now);
+    updateLines();
+}
+
+void I8042Model::updateLines()
+{
+    // IRQ 1 and 12 follow the output buffer while the command byte enables
+    // them; the PIC only sees their rising edges, so a byte that sits in the
+    // buffer with its IRQ disabled interrupts once the IRQ is enabled
+    bool keyboard = _outputFull && !_outputAux && (_commandByte & kCommandKeyboardIRQ);
+    bool aux = _outputFull && _outputAux && (_commandByte & kCommandAuxIRQ);
+    bool raiseKeyboard = keyboard && !_keyboardLine;
+    bool raiseAux = aux && !_auxLine;
+    _keyboardLine = keyboard;
+    _auxLine = aux;
+
+    // the edge goes out last: the handler may run right here, and reads the
+    // state just set up
+    if (!_nub)
+        return;
+    if (raiseKeyboard) {
+        _stats.irqs++;
+        _nub->hostInterrupt(kIRQKeyboard);
+    }
+    if (raiseAux) {
+        _stats.irqs++;
+        _nub->hostInterrupt(kIRQAux);
+    }
+}
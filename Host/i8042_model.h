@@ -0,0 +1,122 @@
+//
+// i8042_model - the keyboard controller behind ports 0x60 and 0x64
+//
+// Stands on the far side of HostKernel's I/O ports so that ApplePS2Controller
+// runs unchanged on the host: its processRequest, both readDataPort variants,
+// writeDataPort/writeCommandPort and handleInterrupt all see a controller that
+// behaves like the 8042 in a laptop's embedded controller:
+//
+// - the status register has OBF, IBF, SYS, A2, the keyboard inhibit bit and
+//   AUXB (output buffer holds AUX data);
+// - a byte written to either port sits in the input buffer (IBF set) until the
+//   controller gets to it, inputUS later;
+// - the keyboard and the AUX device each have a queue of bytes on the way in;
+//   a queued byte is due one wire time (usPerByte) after the one before it,
+//   and moves into the output buffer once it is due and the buffer is empty;
+// - IRQ 1 and IRQ 12 follow the output buffer (and AUXB) while the command
+//   byte enables them, and the nub is interrupted on their rising edges;
+// - the command byte, the port tests, D2/D3/D4 and the clock enables work as
+//   on the real part. Keyboard commands are answered by a minimal MF2
+//   keyboard; AUX bytes go to an AlpsEmulator.
+//
+// Faults can be switched on to test the driver's side of them: a stalled
+// input buffer (IBF never drops), and stray AUX bytes that arrive just ahead
+// of the ACK to the next commands that are answered by an ACK alone.
+//
+
+#ifndef _I8042_MODEL_H
+#define _I8042_MODEL_H
+
+#include <stdint.h>
+
+#include <deque>
+
+#include "host_iokit.h"
+
+class AlpsEmulator;
+
+struct I8042Stats {
+    unsigned irqs;              /* IRQ 1 and 12 rising edges */
+    unsigned keyboardBytes;     /* bytes read from 0x60, keyboard side */
+    unsigned auxBytes;          /* and AUX side */
+    unsigned emptyReads;        /* 0x60 read with the output buffer empty */
+    unsigned inputWrites;       /* bytes written to 0x60 or 0x64 */
+    uint64_t auxLatencyTotal;   /* ns from an AUX byte being due to its read */
+    uint64_t auxLatencyMax;
+};
+
+class I8042Model : public HostPortDevice {
+public:
+    // @aux is the device on the AUX port; @usPerByte is the time one byte takes
+    // on either PS/2 wire
+    I8042Model(AlpsEmulator *aux, unsigned usPerByte = 1000, unsigned inputUS = 20);
+
+    // where IRQ 1 and IRQ 12 are raised (the platform nub the controller
+    // registers its interrupts on)
+    void setNub(IOService *nub) { _nub = nub; }
+
+    // the keyboard sends @byte (already in the set the controller passes on),
+    // now or at @at (ns); the AUX device sends @byte by itself, as a stream
+    // packet
+    void keyboard(uint8_t byte) { queue(_keyboard, byte, HostKernel::now()); }
+    void keyboard(uint8_t byte, uint64_t at) { queue(_keyboard, byte, at); }
+    void aux(uint8_t byte) { queue(_aux, byte, HostKernel::now()); }
+
+    // faults
+    void stallInput(bool stall) { _stalled = stall; }
+    void strayBeforeAck(unsigned commands, uint8_t byte) { _strays = commands; _stray = byte; }
+
+    uint8_t commandByte() const { return _commandByte; }
+    const I8042Stats &stats() const { return _stats; }
+
+    UInt8 inb(UInt16 port) override;
+    void outb(UInt16 port, UInt8 value) override;
+    uint64_t nextEvent() override;
+    void tick(uint64_t now) override;
+
+private:
+    struct Byte {
+        uint8_t value;
+        uint64_t due;
+    };
+    typedef std::deque<Byte> Queue;
+
+    void queue(Queue &q, uint8_t byte, uint64_t after);
+    // the controller's own answer, ahead of anything from the devices
+    void reply(uint8_t byte);
+    void command(uint8_t value);
+    void data(uint8_t value);
+    void keyboardCommand(uint8_t value);
+    void auxCommand(uint8_t value);
+    bool load(uint64_t now);
+    void updateLines();
+
+    AlpsEmulator *_device;
+    IOService *_nub;
+    uint64_t _byteNS;
+    uint64_t _inputNS;
+
+    uint8_t _commandByte;
+    uint8_t _output;
+    bool _outputFull;
+    bool _outputAux;
+    uint64_t _outputDue;        /* when the byte in the output buffer was due */
+
+    bool _inputFull;
+    bool _inputCommand;         /* A2: the input buffer holds a command */
+    uint8_t _input;
+    uint64_t _inputDue;
+    int _pendingCommand;        /* command waiting for its data byte, or -1 */
+
+    bool _keyboardLine;         /* IRQ 1 */
+    bool _auxLine;              /* IRQ 12 */
+
+    Queue _replies, _keyboard, _aux;
+    bool _stalled;
+    unsigned _strays;
+    uint8_t _stray;
+
+    I8042Stats _stats;
+};
+
+#endif /* _I8042_MODEL_H */
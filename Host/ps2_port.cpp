@@ -0,0 +1,230 @@
+//
+// ps2_port - the real ApplePS2Controller against an emulated 8042
+//
+// For every profile in alps_emulator, starts VoodooPS2Controller on an
+// I8042Model and the ALPS driver on the controller's mouse nub, so that
+// bring-up runs through processRequest, both readDataPort variants,
+// writeDataPort/writeCommandPort and, for the stream, IRQ 12 and
+// handleInterrupt. Each profile is run four ways:
+//
+//   clean     bring-up, then a second of the emulator's stream at 100 Hz; the
+//             frames must match those the same bytes give with the driver
+//             straight on the emulator (kAlpsPortDirect)
+//   keyboard  a key pressed and released every 3 ms through the driver's
+//             bring-up; every byte must reach the keyboard nub, and bring-up
+//             go as on the direct port
+//   stray     a stream byte arrives just ahead of the ACK to the first eight
+//             AUX commands answered by an ACK alone; readDataPort must put it
+//             aside and bring-up go as on the direct port
+//   stall     the 8042 never drains its input buffer; bring-up must fail, on
+//             write timeouts, instead of spinning
+//
+// and the controller's PS2Statistics are reported with the 8042's own view of
+// AUX latency (from a byte being due on the wire to the driver reading it).
+// The run fails on any failed check or driver sanity error.
+//
+//   make -C Host port
+//   build/ps2_port [-v] [-u us-per-byte] [profile...]
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "alps_host.h"
+#include "host_iokit.h"
+#include "i8042_model.h"
+
+static unsigned s_usPerByte = 1000;
+
+struct Run {
+    bool started;
+    double bringupMS;
+    unsigned requests, failed;
+    uint64_t readTimeouts, writeTimeouts, outOfOrder, crossStream, maxRequestUS;
+    unsigned keyboardBytes;
+    unsigned events;
+    I8042Stats port;
+    unsigned wtf;
+    std::vector<std::string> frames;
+};
+
+// the event lines without their times, which the port's latency moves
+static void readFrames(FILE *file, std::vector<std::string> *frames)
+{
+    char line[1024];
+    rewind(file);
+    while (fgets(line, sizeof(line), file)) {
+        char kind[16];
+        unsigned long long us;
+        int n;
+        if (sscanf(line, "%15s %llu %n", kind, &us, &n) >= 2)
+            frames->push_back(std::string(kind) + " " + (line + n));
+    }
+}
+
+// @packets are streamed after bring-up, one every 10 ms
+static void stream(AlpsHost &host, const std::vector<std::vector<uint8_t> > &packets)
+{
+    uint64_t t = HostKernel::now();
+    for (size_t n = 0; n < packets.size(); n++, t += 10000000ULL) {
+        host.run(t);
+        for (size_t b = 0; b < packets[n].size(); b++)
+            host.receive(packets[n][b]);
+    }
+    host.run(HostKernel::now() + 1000000000ULL);
+}
+
+static void recordStream(const struct alps_emu_profile &profile,
+                         std::vector<std::vector<uint8_t> > *packets)
+{
+    // as alps_replay -r records it: from a touchpad the driver has set up
+    AlpsHost host(profile);
+    host.start(NULL);
+    struct alps_data priv;
+    host.streamFormat(&priv);
+    static uint8_t out[100][8];
+    unsigned count = host.device().stream(priv, 100, 1000000000ULL, out, 100);
+    for (unsigned n = 0; n < count; n++)
+        packets->push_back(std::vector<uint8_t>(out[n], out[n] + priv.pktsize));
+}
+
+enum Fault { kClean, kKeyboard, kStray, kStall };
+
+static Run run(const struct alps_emu_profile &profile, AlpsHostPort portType, Fault fault,
+               const std::vector<std::vector<uint8_t> > &packets)
+{
+    Run r;
+    memset(&r.port, 0, sizeof(r.port));
+    AlpsHost host(profile, s_usPerByte, portType);
+    I8042Model *port = host.port();
+    uint64_t start = HostKernel::now();
+    // the faults come in once the controller has reset the 8042
+    if (port && host.startController()) {
+        switch (fault) {
+            case kKeyboard:
+                for (unsigned i = 0; i < 200; i++)
+                    port->keyboard(i & 1 ? 0x9e : 0x1e, HostKernel::now() + i * 3000000ULL);
+                break;
+            case kStray:
+                port->strayBeforeAck(8, 0x08);
+                break;
+            case kStall:
+                port->stallInput(true);
+                break;
+            case kClean:
+                break;
+        }
+    }
+
+    FILE *events = tmpfile();
+    r.started = host.start(events);
+    r.bringupMS = (HostKernel::now() - start) / 1e6;
+    if (r.started && fault == kClean)
+        stream(host, packets);
+    else
+        host.run(HostKernel::now() + 1000000000ULL);
+
+    r.requests = host.requests();
+    r.failed = host.failedRequests();
+    r.readTimeouts = host.controllerStatistic("ReadTimeouts");
+    r.writeTimeouts = host.controllerStatistic("WriteTimeouts");
+    r.outOfOrder = host.controllerStatistic("OutOfOrderCorrections");
+    r.crossStream = host.controllerStatistic("CrossStreamBytes");
+    r.maxRequestUS = host.controllerStatistic("RequestTimeMaxUS");
+    r.keyboardBytes = host.keyboardBytes();
+    r.events = host.events();
+    if (port)
+        r.port = port->stats();
+    host.stop();
+    r.wtf = HostKernel::wtfCount();
+    fflush(events);
+    readFrames(events, &r.frames);
+    fclose(events);
+    return r;
+}
+
+static bool check(bool ok, const char *profile, const char *fault, const char *what)
+{
+    if (!ok)
+        fprintf(stderr, "ps2_port: %s %s: %s\n", profile, fault, what);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "u:v")) != -1) {
+        switch (opt) {
+            case 'u': s_usPerByte = (unsigned)atoi(optarg); break;
+            case 'v': HostKernel::setVerbose(true); break;
+            default:
+                fprintf(stderr, "usage: ps2_port [-v] [-u us-per-byte] [profile...]\n");
+                return 2;
+        }
+    }
+
+    static const char *const faults[] = { "clean", "keyboard", "stray", "stall" };
+    bool ok = true;
+    printf("%-12s %-8s %3s %9s %8s %8s %6s %6s %5s %5s %6s %9s %9s\n",
+           "profile", "run", "up", "bring-up", "requests", "failed", "rd-to", "wr-to",
+           "ooo", "cross", "events", "max-req", "aux-lat");
+    for (unsigned i = 0; i < alps_emu_profile_count; i++) {
+        const struct alps_emu_profile &profile = alps_emu_profiles[i];
+        if (optind < argc) {
+            bool wanted = false;
+            for (int a = optind; a < argc; a++)
+                wanted |= !strcmp(argv[a], profile.name);
+            if (!wanted)
+                continue;
+        }
+
+        std::vector<std::vector<uint8_t> > packets;
+        recordStream(profile, &packets);
+        Run direct = run(profile, kAlpsPortDirect, kClean, packets);
+
+        for (unsigned f = kClean; f <= kStall; f++) {
+            Run r = run(profile, kAlpsPortI8042, (Fault)f, packets);
+            unsigned auxBytes = r.port.auxBytes ? r.port.auxBytes : 1;
+            printf("%-12s %-8s %3s %7.1fms %8u %8u %6llu %6llu %5llu %5llu %6u %7lluus %7.1fus\n",
+                   profile.name, faults[f], r.started ? "yes" : "no", r.bringupMS,
+                   r.requests, r.failed, (unsigned long long)r.readTimeouts,
+                   (unsigned long long)r.writeTimeouts, (unsigned long long)r.outOfOrder,
+                   (unsigned long long)r.crossStream, r.events,
+                   (unsigned long long)r.maxRequestUS, r.port.auxLatencyTotal / 1e3 / auxBytes);
+
+            ok &= check(!r.wtf, profile.name, faults[f], "driver sanity errors");
+            switch (f) {
+                case kClean:
+                    ok &= check(r.started == direct.started, profile.name, faults[f],
+                                "bring-up differs from the direct port");
+                    ok &= check(r.frames == direct.frames, profile.name, faults[f],
+                                "frames differ from the direct port");
+                    break;
+                case kKeyboard:
+                    ok &= check(r.started == direct.started, profile.name, faults[f],
+                                "bring-up differs from the direct port");
+                    ok &= check(r.keyboardBytes == 200, profile.name, faults[f],
+                                "keyboard bytes lost");
+                    ok &= check(r.crossStream > 0, profile.name, faults[f],
+                                "no keyboard byte came in during a request");
+                    break;
+                case kStray:
+                    ok &= check(r.started == direct.started, profile.name, faults[f],
+                                "bring-up differs from the direct port");
+                    ok &= check(r.outOfOrder > 0, profile.name, faults[f],
+                                "no out-of-order correction");
+                    break;
+                case kStall:
+                    ok &= check(!r.started, profile.name, faults[f], "bring-up passed");
+                    ok &= check(r.writeTimeouts > 0, profile.name, faults[f],
+                                "no write timeout counted");
+                    break;
+            }
+        }
+    }
+    return ok ? 0 : 1;
+}
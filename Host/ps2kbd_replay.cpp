@@ -0,0 +1,528 @@
+//
+// ps2kbd_replay - the keyboard scan code pipeline on the host
+//
+// Feeds a scan code stream through VoodooPS2Keyboard/ps2_scancode.cpp the way
+// ApplePS2Keyboard does it: every byte goes through interruptOccurred
+// (ps2_scan_byte), every key packet through packetReady, invertMacros
+// (ps2_match_macro, MaximumMacroTime) and dispatchKeyboardEventWithPacket
+// (ps2_translate_key, the PS2 to ADB map and breakless keys). The stubbed
+// dispatchKeyboardEvent records the ADB events instead of sending them.
+//
+// Not modelled are the driver's special cases with side effects outside the
+// event stream: ACPI RKAx calls, keyboard backlight and screen brightness,
+// eject, and the Caps Lock double tap on 10.12 and later. The keys that the
+// driver always swallows (sleep, trackpad and fkey toggles, PrtSc, and
+// Ctrl+Alt+Del) are swallowed here too.
+//
+// The stream is either a "PS2Trace" snapshot of the controller (the
+// PS2TraceRecord array saved as raw bytes; only keyboard bytes that arrived
+// on their own are used, as in replayTrace), or a built-in one with plain,
+// shifted, E0 extended, PrintScreen, Pause, LANG and typematic sequences.
+// The trace is replayed -r times, shifted in time so the rounds follow on.
+//
+// The configuration takes the same entries as the Info.plist profiles, one
+// per line ('#' starts a comment line, ';' entries are skipped like the
+// driver skips them):
+//
+//   ps2 e037=64                  Custom PS2 Map (and Function Keys Standard)
+//   adb e063=3f                  Custom ADB Map
+//   breakless e064               Breakless PS2
+//   inversion //8CZAAAAAABOAE+   Macro Inversion, the base64 <data> of the plist
+//   maxtime 25000000             MaximumMacroTime, ns
+//
+//   make -C Host kbd
+//   build/ps2kbd_replay [-c config] [-t trace.bin] [-r rounds] [-e]
+//
+// Output is JSON: per key (scan code, extended ones at 0x100) the count and
+// the average and maximum ns from packet pickup to its events, the same
+// measure recordKeyTime uses; ns per byte over the whole replay; and the ADB
+// event count with a hash of the stream, or with -e the stream itself.
+//
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ps2_scancode.h"
+
+typedef uint8_t UInt8;
+typedef uint16_t UInt16;
+#include "ApplePS2ToADBMap.h"
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Byte stream
+
+struct trace_record {               // PS2TraceRecord in ApplePS2Device.h
+    uint64_t time;
+    uint32_t seq;
+    uint8_t data;
+    uint8_t status;
+    uint8_t flags;
+    uint8_t reserved;
+};
+
+#define kTraceMouse     0x01        // kPS2TF_Mouse
+#define kTraceRequest   0x02        // kPS2TF_Request
+#define kTraceTimeout   0x04        // kPS2TF_Timeout
+
+struct stream_byte {
+    uint64_t time;                  // ns
+    uint8_t data;
+};
+
+static const uint64_t kKeyGap = 30000000;     // 30 ms between keys
+static const uint64_t kByteGap = 1000000;     // 1 ms between bytes of a key
+
+// scan code sequences, each a key down or up with its prefixes; a leading +
+// sends the key 5 ms after the previous one, inside MaximumMacroTime
+static const char *const builtinKeys[] = {
+    // h e l l o, with a typematic repeat on the last l
+    "23", "a3", "12", "92", "26", "a6", "26", "26", "26", "a6", "18", "98",
+    // Shift+A, left and right shift
+    "2a", "1e", "9e", "aa", "36", "1e", "9e", "b6",
+    // Ctrl+C, right Ctrl+V, left Alt+Tab, right Alt (e0 38)
+    "1d", "2e", "ae", "9d", "e0 1d", "2f", "af", "e0 9d",
+    "38", "0f", "8f", "b8", "e0 38", "e0 b8",
+    // arrows, Home/End, Delete, Windows and Menu keys
+    "e0 48", "e0 c8", "e0 50", "e0 d0", "e0 4b", "e0 cb", "e0 4d", "e0 cd",
+    "e0 47", "e0 c7", "e0 4f", "e0 cf", "e0 53", "e0 d3",
+    "e0 5b", "e0 db", "e0 5d", "e0 dd",
+    // function keys, numpad Enter and /
+    "3b", "bb", "3c", "bc", "3f", "bf", "57", "d7", "e0 1c", "e0 9c", "e0 35", "e0 b5",
+    // PrintScreen, Pause (a single make and break sequence), LANG1 and LANG2
+    "e0 2a e0 37", "e0 b7 e0 aa", "e1 1d 45 e1 9d c5", "f1", "f2",
+    // Fn+F4 and Fn+F10 as the Haswell-Ideapad profile receives them
+    "38", "+3e", "be", "+b8", "e0 5b", "+19", "99", "+e0 db",
+};
+
+static unsigned parseBytes(const char *text, uint8_t *out, unsigned cap)
+{
+    unsigned count = 0;
+    while (*text && count < cap) {
+        char *end;
+        out[count++] = (uint8_t)strtoul(text, &end, 16);
+        if (end == text)
+            break;
+        text = end;
+    }
+    return count;
+}
+
+static unsigned builtinStream(struct stream_byte *out, unsigned cap)
+{
+    unsigned count = 0;
+    uint64_t time = 0;
+    for (unsigned i = 0; i < sizeof(builtinKeys) / sizeof(builtinKeys[0]); i++) {
+        const char *key = builtinKeys[i];
+        bool fast = key[0] == '+';
+        uint8_t bytes[8];
+        unsigned n = parseBytes(key + fast, bytes, sizeof(bytes));
+        time += fast ? kByteGap * 5 : kKeyGap;
+        for (unsigned b = 0; b < n && count < cap; b++) {
+            out[count].time = time + b * kByteGap;
+            out[count++].data = bytes[b];
+        }
+    }
+    return count;
+}
+
+static unsigned loadTrace(const char *path, struct stream_byte *out, unsigned cap)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "ps2kbd_replay: cannot open %s\n", path);
+        exit(2);
+    }
+
+    struct trace_record record;
+    unsigned count = 0;
+    while (count < cap && fread(&record, sizeof(record), 1, file) == 1) {
+        if (record.flags & (kTraceMouse | kTraceRequest | kTraceTimeout))
+            continue;
+        out[count].time = record.time;
+        out[count++].data = record.data;
+    }
+    fclose(file);
+    return count;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// The driver side
+
+#define kPacketLength   (2+6+8)     // as in VoodooPS2Keyboard.h
+#define kPacketTime     8
+#define kMaxMacros      256
+#define kMaxMacroBytes  64
+
+struct adb_event {
+    uint64_t time;
+    uint8_t keyCode;
+    bool goingDown;
+};
+
+struct key_time {
+    unsigned count;
+    uint64_t totalNS;
+    uint64_t maxNS;
+};
+
+class KbdDriver {
+public:
+    KbdDriver()
+        : modifierState(0), macroCount(0), macroMaxTime(25000000ULL),
+          _macroCurrent(0), _events(0), _eventCount(0), _eventCap(0)
+    {
+        memset(&_scan, 0, sizeof(_scan));
+        memcpy(ps2ToADB, PS2ToADBMapStock, sizeof(ps2ToADB));
+        for (unsigned i = 0; i < KBV_NUM_SCANCODES * 2; i++)
+            ps2ToPS2[i] = i;
+        memcpy(flags, _PS2flagsStock, sizeof(flags));
+    }
+
+    void captureEvents(struct adb_event *events, unsigned cap)
+    {
+        _events = events;
+        _eventCap = cap;
+        _eventCount = 0;
+    }
+
+    unsigned eventCount() const { return _eventCount; }
+
+    // interruptOccurred and, for a finished packet, packetReady
+    bool byte(uint8_t data, uint64_t time, uint8_t packet[kPacketLength])
+    {
+        switch (ps2_scan_byte(&_scan, flags, data, packet)) {
+            case PS2_SCAN_KEY:
+                memcpy(&packet[kPacketTime], &time, sizeof(time));
+                return true;
+            default:
+                // the reset packet (00 AA) is not dispatched by packetReady
+                return false;
+        }
+    }
+
+    void packetReady(const uint8_t packet[kPacketLength])
+    {
+        if (!macroCount || !invertMacros(packet))
+            dispatchPacket(packet);
+    }
+
+    // the macro timer, or the end of the replay
+    void flush()
+    {
+        if (_macroCurrent > 0)
+            dispatchInvertBuffer();
+    }
+
+    uint16_t ps2ToPS2[KBV_NUM_SCANCODES * 2];
+    uint16_t flags[KBV_NUM_SCANCODES * 2];
+    uint8_t ps2ToADB[ADB_CONVERTER_LEN];
+    uint16_t modifierState;
+
+    uint8_t macros[kMaxMacros][kMaxMacroBytes];
+    int macroLength[kMaxMacros];
+    unsigned macroCount;
+    uint64_t macroMaxTime;
+
+private:
+    static uint64_t packetTime(const uint8_t *packet)
+    {
+        uint64_t time;
+        memcpy(&time, &packet[kPacketTime], sizeof(time));
+        return time;
+    }
+
+    void dispatchKeyboardEventX(uint8_t keyCode, bool goingDown, uint64_t time)
+    {
+        if (_eventCount < _eventCap) {
+            _events[_eventCount].time = time;
+            _events[_eventCount].keyCode = keyCode;
+            _events[_eventCount].goingDown = goingDown;
+        }
+        _eventCount++;
+    }
+
+    bool invertMacros(const uint8_t *packet)
+    {
+        // cancel macro conversion if packet arrives too late
+        if (_macroCurrent > 0 &&
+            packetTime(packet) - packetTime(_macroBuffer[_macroCurrent - 1]) > macroMaxTime)
+            dispatchInvertBuffer();
+
+        memcpy(_macroBuffer[_macroCurrent], packet, kPacketLength);
+        int buffered = _macroCurrent + 1;
+        for (unsigned i = 0; i < macroCount; i++) {
+            switch (ps2_match_macro(macros[i], macroLength[i], _macroBuffer[0], buffered,
+                                    kPacketLength, modifierState)) {
+                case PS2_MACRO_MATCH:
+                    _macroBuffer[0][0] = macros[i][kOutputBytesOffset + 0];
+                    _macroBuffer[0][1] = macros[i][kOutputBytesOffset + 1];
+                    dispatchPacket(_macroBuffer[0]);
+                    _macroCurrent = 0;
+                    return true;
+
+                case PS2_MACRO_PARTIAL:
+                    _macroCurrent++;
+                    return true;
+
+                case PS2_MACRO_NONE:
+                    break;
+            }
+        }
+        if (_macroCurrent > 0)
+            dispatchInvertBuffer();
+        return false;
+    }
+
+    void dispatchInvertBuffer()
+    {
+        for (int i = 0; i < _macroCurrent; i++)
+            dispatchPacket(_macroBuffer[i]);
+        _macroCurrent = 0;
+    }
+
+    // dispatchKeyboardEventWithPacket, less the side effects
+    bool dispatchPacket(const uint8_t *packet)
+    {
+        uint64_t time = packetTime(packet);
+        ps2_key_event key;
+        switch (ps2_translate_key(packet, ps2ToPS2, flags, &modifierState, &key)) {
+            case PS2_KEY_NONE:
+                return false;
+
+            case PS2_KEY_PULSE:
+                dispatchKeyboardEventX(ps2ToADB[key.keyCode], true, time);
+                dispatchKeyboardEventX(ps2ToADB[key.keyCode], false, time);
+                return true;
+
+            case PS2_KEY_EVENT:
+                break;
+        }
+
+        unsigned keyCode = key.keyCode;
+        switch (keyCode) {
+            case 0x0153:    // delete, Ctrl+Alt+Delete sends the power key
+                if ((modifierState & (kMaskLeftControl | kMaskLeftAlt)) == (kMaskLeftControl | kMaskLeftAlt)) {
+                    keyCode = 0;
+                    if (!key.goingDown) {
+                        dispatchKeyboardEventX(0x37, false, time);
+                        dispatchKeyboardEventX(0x3b, false, time);
+                        dispatchKeyboardEventX(0x7f, true, time);
+                        dispatchKeyboardEventX(0x7f, false, time);
+                    }
+                }
+                break;
+
+            case 0x015f:    // sleep
+            case 0x0127:    // fnkeys toggle
+            case 0x0128:    // trackpad toggle
+            case 0x0137:    // prt sc/sys rq
+                keyCode = 0;
+                break;
+        }
+
+        uint8_t adbKeyCode = ps2ToADB[keyCode];
+        if (keyCode) {
+            if (key.goingDown || !(flags[key.keyCodeRaw] & kBreaklessKey))
+                dispatchKeyboardEventX(adbKeyCode, key.goingDown, time);
+            if (key.goingDown && (flags[key.keyCodeRaw] & kBreaklessKey))
+                dispatchKeyboardEventX(adbKeyCode, false, time);
+        }
+        return true;
+    }
+
+    ps2_scan_state _scan;
+    uint8_t _macroBuffer[kMaxMacroBytes][kPacketLength];
+    int _macroCurrent;
+    struct adb_event *_events;
+    unsigned _eventCount;
+    unsigned _eventCap;
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Configuration
+
+static int decodeBase64(const char *text, uint8_t *out, int cap)
+{
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    unsigned bits = 0, value = 0;
+    int count = 0;
+    for (; *text && *text != '=' && !isspace((unsigned char)*text); text++) {
+        const char *digit = strchr(digits, *text);
+        if (!digit)
+            return -1;
+        value = value << 6 | (unsigned)(digit - digits);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            if (count == cap)
+                return -1;
+            out[count++] = (uint8_t)(value >> bits);
+        }
+    }
+    return count;
+}
+
+static void loadConfig(const char *path, KbdDriver &driver)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "ps2kbd_replay: cannot open %s\n", path);
+        exit(2);
+    }
+
+    char line[256], kind[16];
+    int lineNumber = 0, offset;
+    while (fgets(line, sizeof(line), file)) {
+        lineNumber++;
+        if (line[0] == '#' || sscanf(line, "%15s %n", kind, &offset) != 1)
+            continue;
+        const char *psz = line + offset;
+        // check for comment, as the load functions of the driver do
+        if (*psz == ';')
+            continue;
+
+        enum ps2_entry_result result = PS2_ENTRY_INVALID;
+        if (!strcmp(kind, "ps2")) {
+            result = ps2_load_ps2_entry(psz, driver.ps2ToPS2);
+        } else if (!strcmp(kind, "adb")) {
+            result = ps2_load_adb_entry(psz, driver.ps2ToADB);
+        } else if (!strcmp(kind, "breakless")) {
+            result = ps2_load_breakless_entry(psz, driver.flags);
+        } else if (!strcmp(kind, "maxtime")) {
+            driver.macroMaxTime = strtoull(psz, NULL, 10);
+            result = PS2_ENTRY_OK;
+        } else if (!strcmp(kind, "inversion") && driver.macroCount < kMaxMacros) {
+            uint8_t *macro = driver.macros[driver.macroCount];
+            int length = decodeBase64(psz, macro, kMaxMacroBytes);
+            // loadMacroData skips entries that are not usable
+            if (length > 0 && ps2_valid_macro(macro, length)) {
+                driver.macroLength[driver.macroCount++] = length;
+                result = PS2_ENTRY_OK;
+            }
+        }
+        if (result != PS2_ENTRY_OK)
+            fprintf(stderr, "ps2kbd_replay: %s:%d: invalid %s entry\n", path, lineNumber, kind);
+    }
+    fclose(file);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static uint64_t nowNS()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+    static struct stream_byte stream[1 << 20];
+    static struct adb_event events[1 << 20];
+    static struct key_time keyTime[KBV_NUM_SCANCODES * 2];
+    const char *config = NULL, *trace = NULL;
+    int rounds = 2000;
+    bool listEvents = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+            config = argv[++i];
+        } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            trace = argv[++i];
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            rounds = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-e")) {
+            listEvents = true;
+        } else {
+            fprintf(stderr, "usage: %s [-c config] [-t trace.bin] [-r rounds] [-e]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (rounds < 1)
+        rounds = 1;
+
+    KbdDriver driver;
+    if (config)
+        loadConfig(config, driver);
+    unsigned count = trace ? loadTrace(trace, stream, sizeof(stream) / sizeof(stream[0]))
+                           : builtinStream(stream, sizeof(stream) / sizeof(stream[0]));
+    if (!count) {
+        fprintf(stderr, "ps2kbd_replay: no keyboard bytes to replay\n");
+        return 1;
+    }
+    uint64_t span = stream[count - 1].time - stream[0].time + kKeyGap;
+
+    // the cost of reading the clock, included in every per key time
+    uint64_t start = nowNS();
+    for (int i = 0; i < 1000; i++)
+        nowNS();
+    double clockNS = (nowNS() - start) / 1000.0;
+
+    // events are captured in the first round only, the stream is the same
+    // for every round when the trace leaves all keys up
+    uint8_t packet[kPacketLength];
+    unsigned packets = 0, eventCount = 0;
+    uint64_t total = 0;
+    for (int round = 0; round < rounds; round++) {
+        driver.captureEvents(events, round ? 0 : sizeof(events) / sizeof(events[0]));
+        uint64_t roundStart = nowNS();
+        for (unsigned i = 0; i < count; i++) {
+            uint64_t time = stream[i].time + round * span;
+            if (!driver.byte(stream[i].data, time, packet))
+                continue;
+            uint64_t pickup = nowNS();
+            driver.packetReady(packet);
+            uint64_t ns = nowNS() - pickup;
+
+            struct key_time &stats = keyTime[(packet[0] > 1 ? 0x100 : 0) | (packet[1] & ~kSC_UpBit)];
+            stats.count++;
+            stats.totalNS += ns;
+            if (ns > stats.maxNS)
+                stats.maxNS = ns;
+            packets++;
+        }
+        driver.flush();
+        total += nowNS() - roundStart;
+        if (!round)
+            eventCount = driver.eventCount();
+    }
+    if (eventCount > sizeof(events) / sizeof(events[0]))
+        eventCount = sizeof(events) / sizeof(events[0]);
+
+    uint32_t hash = 2166136261u;
+    for (unsigned i = 0; i < eventCount; i++) {
+        hash = (hash ^ events[i].keyCode) * 16777619u;
+        hash = (hash ^ events[i].goingDown) * 16777619u;
+    }
+
+    printf("{\n  \"source\": \"%s\",\n  \"config\": \"%s\",\n  \"rounds\": %d,\n"
+           "  \"bytes_per_round\": %u,\n  \"macros\": %u,\n  \"clock_ns\": %.1f,\n"
+           "  \"ns_per_byte\": %.2f,\n  \"ns_per_packet\": %.2f,\n  \"keys\": [",
+           trace ? trace : "builtin", config ? config : "", rounds, count, driver.macroCount,
+           clockNS, (double)total / ((double)count * rounds),
+           packets ? (double)total / packets : 0.0);
+    bool first = true;
+    for (unsigned i = 0; i < KBV_NUM_SCANCODES * 2; i++) {
+        if (!keyTime[i].count)
+            continue;
+        printf("%s\n    { \"key\": \"%s%02x\", \"count\": %u, \"avg_ns\": %.1f, \"max_ns\": %llu }",
+               first ? "" : ",", i >= KBV_NUM_SCANCODES ? "e0" : "", i & 0xff, keyTime[i].count,
+               (double)keyTime[i].totalNS / keyTime[i].count, (unsigned long long)keyTime[i].maxNS);
+        first = false;
+    }
+    printf("\n  ],\n  \"events_per_round\": %u,\n  \"event_hash\": \"%08x\"", eventCount, hash);
+    if (listEvents) {
+        printf(",\n  \"events\": [");
+        for (unsigned i = 0; i < eventCount; i++) {
+            printf("%s\n    { \"time_ns\": %llu, \"adb\": \"%02x\", \"down\": %s }",
+                   i ? "," : "", (unsigned long long)events[i].time, events[i].keyCode,
+                   events[i].goingDown ? "true" : "false");
+        }
+        printf("\n  ]");
+    }
+    printf("\n}\n");
+    return 0;
+}
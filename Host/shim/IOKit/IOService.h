@@ -0,0 +1,2 @@
+// host stand-in for <IOKit/IOService.h>, see Host/shim/host_iokit.h
+#include "../host_iokit.h"
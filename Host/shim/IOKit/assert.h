@@ -0,0 +1,6 @@
+// host stand-in for <IOKit/assert.h>: assert compiles out, as in release kexts
+#include "../host_iokit.h"
+
+#ifndef assert
+#define assert(ex)  ((void)0)
+#endif
@@ -0,0 +1,17 @@
+// host stand-in for <IOKit/hidsystem/IOHIDParameter.h>: the keys and device
+// types the drivers publish
+#ifndef _HOST_IOHIDPARAMETER_H
+#define _HOST_IOHIDPARAMETER_H
+
+#define kIOHIDPointerAccelerationTypeKey        "HIDPointerAccelerationType"
+#define kIOHIDTrackpadAccelerationType          "HIDTrackpadAcceleration"
+#define kIOHIDScrollAccelerationTypeKey         "HIDScrollAccelerationType"
+#define kIOHIDTrackpadScrollAccelerationKey     "HIDTrackpadScrollAcceleration"
+#define kIOHIDScrollResolutionKey               "HIDScrollResolution"
+
+#define NX_EVS_DEVICE_TYPE_KEYBOARD             1
+#define NX_EVS_DEVICE_TYPE_MOUSE                2
+#define NX_EVS_DEVICE_INTERFACE_ACE             3
+#define NX_EVS_DEVICE_INTERFACE_BUS_ACE         5
+
+#endif /* _HOST_IOHIDPARAMETER_H */
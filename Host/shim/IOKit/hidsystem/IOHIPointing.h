@@ -0,0 +1,40 @@
+// host stand-in for <IOKit/hidsystem/IOHIPointing.h>: pointer events go to
+// the hooks installed with HostKernel::setPointerEvents
+#ifndef _HOST_IOHIPOINTING_H
+#define _HOST_IOHIPOINTING_H
+
+#include "../../host_iokit.h"
+#include "IOHIDParameter.h"
+
+struct IOGBounds {
+    short minx, maxx, miny, maxy;
+};
+
+class IOHIDevice : public IOService {
+    OSDeclareDefaultStructors(IOHIDevice);
+public:
+    virtual IOReturn setParamProperties(OSDictionary *dict) { (void)dict; return kIOReturnSuccess; }
+    virtual UInt32 deviceType() { return 0; }
+    virtual UInt32 interfaceID() { return 0; }
+};
+
+class IOHIPointing : public IOHIDevice {
+    OSDeclareDefaultStructors(IOHIPointing);
+public:
+    virtual IOItemCount buttonCount() { return 1; }
+    virtual IOFixed resolution() { return 100 << 16; }
+
+protected:
+    void dispatchRelativePointerEvent(int dx, int dy, UInt32 buttonState, AbsoluteTime ts)
+    {
+        if (HostKernel::PointerEvents *events = HostKernel::pointerEvents())
+            events->relative(this, dx, dy, buttonState, ts);
+    }
+    void dispatchScrollWheelEvent(short deltaAxis1, short deltaAxis2, short deltaAxis3, AbsoluteTime ts)
+    {
+        if (HostKernel::PointerEvents *events = HostKernel::pointerEvents())
+            events->scroll(this, deltaAxis1, deltaAxis2, deltaAxis3, ts);
+    }
+};
+
+#endif /* _HOST_IOHIPOINTING_H */
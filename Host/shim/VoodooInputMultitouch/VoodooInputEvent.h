@@ -0,0 +1,15 @@
+// host copy of the VoodooInput frame the driver sends with
+// kIOMessageVoodooInputMessage
+#ifndef _HOST_VOODOOINPUTEVENT_H
+#define _HOST_VOODOOINPUTEVENT_H
+
+#include "VoodooInputMessages.h"
+#include "VoodooInputTransducer.h"
+
+struct VoodooInputEvent {
+    UInt8 contact_count;
+    AbsoluteTime timestamp;
+    VoodooInputTransducer transducers[VOODOO_INPUT_MAX_TRANSDUCERS];
+};
+
+#endif /* _HOST_VOODOOINPUTEVENT_H */
@@ -0,0 +1,29 @@
+// host copy of the VoodooInput messages and registry keys
+#ifndef _HOST_VOODOOINPUTMESSAGES_H
+#define _HOST_VOODOOINPUTMESSAGES_H
+
+#include "VoodooInputTransducer.h"
+
+#define VOODOO_INPUT_IDENTIFIER         "VoodooInput Instance"
+
+#define kIOMessageVoodooInputMessage                    12345
+#define kIOMessageVoodooInputUpdateDimensionsMessage    12346
+#define kIOMessageVoodooInputUpdatePropertiesNotification 12347
+#define kIOMessageVoodooTrackpointMessage               12348
+
+#define VOODOO_INPUT_LOGICAL_MAX_X_KEY  "Logical Max X"
+#define VOODOO_INPUT_LOGICAL_MAX_Y_KEY  "Logical Max Y"
+#define VOODOO_INPUT_PHYSICAL_MAX_X_KEY "Physical Max X"
+#define VOODOO_INPUT_PHYSICAL_MAX_Y_KEY "Physical Max Y"
+#define VOODOO_INPUT_TRANSFORM_KEY      "IOFBTransform"
+
+#define VOODOO_INPUT_MAX_TRANSDUCERS    10
+
+struct VoodooInputDimensions {
+    SInt32 min_x;
+    SInt32 max_x;
+    SInt32 min_y;
+    SInt32 max_y;
+};
+
+#endif /* _HOST_VOODOOINPUTMESSAGES_H */
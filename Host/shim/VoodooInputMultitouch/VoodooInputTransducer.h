@@ -0,0 +1,47 @@
+// host copy of the VoodooInput transducer definitions the driver fills in
+#ifndef _HOST_VOODOOINPUTTRANSDUCER_H
+#define _HOST_VOODOOINPUTTRANSDUCER_H
+
+#include "../host_iokit.h"
+
+enum MT2FingerType {
+    kMT2FingerTypeUndefined = 0,
+    kMT2FingerTypeThumb,
+    kMT2FingerTypeIndexFinger,
+    kMT2FingerTypeMiddleFinger,
+    kMT2FingerTypeRingFinger,
+    kMT2FingerTypeLittleFinger,
+    kMT2FingerTypeCount
+};
+
+typedef enum {
+    STYLUS,
+    FINGER,
+} VoodooInputTransducerType;
+
+struct TouchCoordinates {
+    UInt32 x;
+    UInt32 y;
+    UInt8 pressure;
+    UInt8 width;
+};
+
+struct VoodooInputTransducer {
+    AbsoluteTime timestamp;
+
+    UInt32 secondaryId;
+    VoodooInputTransducerType type;
+
+    bool isValid;
+    bool isPhysicalButtonDown;
+    bool isTransducerActive;
+
+    bool supportsPressure;
+
+    TouchCoordinates currentCoordinates;
+    TouchCoordinates previousCoordinates;
+
+    MT2FingerType fingerType;
+};
+
+#endif /* _HOST_VOODOOINPUTTRANSDUCER_H */
@@ -0,0 +1,13 @@
+// host stand-in for <architecture/i386/pio.h>: port I/O goes to the device
+// installed with HostKernel::setPort
+#ifndef _HOST_PIO_H
+#define _HOST_PIO_H
+
+#include "../../host_iokit.h"
+
+typedef unsigned short i386_ioport_t;
+
+static inline unsigned char inb(i386_ioport_t port) { return HostKernel::inb(port); }
+static inline void outb(i386_ioport_t port, unsigned char datum) { HostKernel::outb(port, datum); }
+
+#endif /* _HOST_PIO_H */
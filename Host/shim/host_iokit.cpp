@@ -0,0 +1,1680 @@
+//
+// host_iokit - the slice of IOKit and libkern the kext sources use, on the host
+//
+// See host_iokit.h. The scheduling model: one thread runs the driver code;
+// hardware interrupts are delivered as soon as a device raises them (unless
+// ml_set_interrupts_enabled turned them off), work loop event sources and
+// thread calls run whenever the thread waits (IOSleep, HostKernel::run)
+// and the work loop's gate is free, as the work loop thread would.
+//
+
+#include <cxxabi.h>
+#include <execinfo.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <map>
+#include <string>
+
+#include "host_iokit.h"
+#include "IOKit/hidsystem/IOHIPointing.h"
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Host kernel state
+
+static uint64_t s_virtual = 10000000000ULL;
+static bool s_timed;
+static uint64_t s_realBase;
+static HostPortDevice *s_port;
+static HostDevice *s_devices[8];
+static unsigned s_deviceCount;
+static bool s_interruptsEnabled = true;
+static bool s_inInterrupt;
+static bool s_verbose;
+static unsigned s_logCount;
+static unsigned s_wtfCount;
+static HostKernel::PointerEvents *s_pointer;
+static IOWorkLoop *s_workLoops[16];
+static unsigned s_workLoopCount;
+static IOWorkLoop *s_defaultWorkLoop;
+static IOService *s_nubs[4];
+static unsigned s_nubCount;
+static IOService *s_services[16];
+static unsigned s_serviceCount;
+
+struct thread_call {
+    thread_call_func_t func;
+    thread_call_param_t param0;
+    thread_call_param_t param1;
+    bool pending;
+};
+static thread_call_t s_threadCalls[8];
+static unsigned s_threadCallCount;
+
+static void fatal(const char *what)
+{
+    void *frames[32];
+    fprintf(stderr, "host_iokit: %s\n", what);
+    backtrace_symbols_fd(frames, backtrace(frames, 32), 2);
+    abort();
+}
+
+static uint64_t realNanoseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// IOLib and libkern functions
+
+void IOLog(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    HostKernel::log(format, args);
+    va_end(args);
+}
+
+void IODelay(unsigned microseconds)
+{
+    // a busy wait: interrupts come in, the work loop does not run here
+    HostKernel::advance((uint64_t)microseconds * 1000);
+}
+
+void IOSleep(unsigned milliseconds)
+{
+    HostKernel::run(HostKernel::now() + (uint64_t)milliseconds * 1000000);
+}
+
+void *IOMalloc(size_t size) { return malloc(size); }
+void *IOMallocZero(size_t size) { return calloc(1, size); }
+void IOFree(void *address, size_t size) { (void)size; free(address); }
+
+void clock_get_uptime(uint64_t *result) { *result = HostKernel::now(); }
+uint64_t mach_absolute_time(void) { return HostKernel::now(); }
+void absolutetime_to_nanoseconds(uint64_t abstime, uint64_t *result) { *result = abstime; }
+void nanoseconds_to_absolutetime(uint64_t nanoseconds, uint64_t *result) { *result = nanoseconds; }
+
+void clock_interval_to_deadline(uint32_t interval, uint32_t scale_factor, uint64_t *result)
+{
+    *result = HostKernel::now() + (uint64_t)interval * scale_factor;
+}
+
+size_t strlcpy(char *dst, const char *src, size_t size)
+{
+    size_t length = strlen(src);
+    if (size) {
+        size_t n = length < size - 1 ? length : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = 0;
+    }
+    return length;
+}
+
+bool ml_set_interrupts_enabled(bool enable)
+{
+    return HostKernel::setInterruptsEnabled(enable);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// OSObject
+
+void *OSObject::operator new(size_t size)
+{
+    // the kernel hands out OSObjects zeroed
+    void *mem = calloc(1, size);
+    if (!mem)
+        fatal("out of memory");
+    return mem;
+}
+
+void OSObject::operator delete(void *mem, size_t size)
+{
+    (void)size;
+    ::free(mem);
+}
+
+void OSObject::free()
+{
+    delete this;
+}
+
+void OSObject::release() const
+{
+    if (_retainCount <= 0)
+        fatal("release of a freed object");
+    if (--_retainCount == 0)
+        const_cast<OSObject *>(this)->free();
+}
+
+const char *OSObject::getClassName() const
+{
+    static std::map<std::string, std::string> names;
+    const char *mangled = typeid(*this).name();
+    std::string &name = names[mangled];
+    if (name.empty()) {
+        int status;
+        char *demangled = abi::__cxa_demangle(mangled, NULL, NULL, &status);
+        name = demangled ? demangled : mangled;
+        ::free(demangled);
+    }
+    return name.c_str();
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// OSString, OSSymbol, OSNumber, OSBoolean, OSData
+
+OSDefineMetaClassAndStructors(OSString, OSObject);
+
+static char *copyString(const char *cString)
+{
+    size_t length = strlen(cString);
+    char *copy = (char *)malloc(length + 1);
+    memcpy(copy, cString, length + 1);
+    return copy;
+}
+
+OSString *OSString::withCString(const char *cString)
+{
+    if (!cString)
+        return NULL;
+    OSString *me = new OSString;
+    me->_string = copyString(cString);
+    return me;
+}
+
+OSString *OSString::withCStringNoCopy(const char *cString)
+{
+    return withCString(cString);
+}
+
+OSString *OSString::withString(const OSString *aString)
+{
+    return aString ? withCString(aString->_string) : NULL;
+}
+
+bool OSString::setChar(char aChar, unsigned index)
+{
+    if (index >= getLength())
+        return false;
+    _string[index] = aChar;
+    return true;
+}
+
+bool OSString::isEqualTo(const char *cString) const
+{
+    return cString && !strcmp(_string, cString);
+}
+
+bool OSString::isEqualTo(const OSString *aString) const
+{
+    return aString && !strcmp(_string, aString->_string);
+}
+
+void OSString::free()
+{
+    ::free(_string);
+    OSObject::free();
+}
+
+OSDefineMetaClassAndStructors(OSSymbol, OSString);
+
+const OSSymbol *OSSymbol::withCString(const char *cString)
+{
+    // symbols are not uniqued here, nothing compares them by pointer
+    if (!cString)
+        return NULL;
+    OSSymbol *me = new OSSymbol;
+    me->_string = copyString(cString);
+    return me;
+}
+
+OSDefineMetaClassAndStructors(OSNumber, OSObject);
+
+OSNumber *OSNumber::withNumber(unsigned long long value, unsigned numberOfBits)
+{
+    OSNumber *me = new OSNumber;
+    me->_bits = numberOfBits ? numberOfBits : 64;
+    me->setValue(value);
+    return me;
+}
+
+void OSNumber::setValue(unsigned long long value)
+{
+    _value = _bits >= 64 ? value : value & ((1ULL << _bits) - 1);
+}
+
+OSDefineMetaClassAndStructors(OSBoolean, OSObject);
+
+OSBoolean *OSBoolean::withBoolean(bool value)
+{
+    static OSBoolean *instances[2];
+    if (!instances[value]) {
+        // the two instances live forever, retain and release do not count
+        instances[value] = new OSBoolean;
+        instances[value]->_value = value;
+        instances[value]->_retainCount = INT_MAX / 2;
+    }
+    return instances[value];
+}
+
+OSBoolean *const kOSBooleanTrue = OSBoolean::withBoolean(true);
+OSBoolean *const kOSBooleanFalse = OSBoolean::withBoolean(false);
+
+OSDefineMetaClassAndStructors(OSData, OSObject);
+
+OSData *OSData::withCapacity(unsigned capacity)
+{
+    OSData *me = new OSData;
+    if (capacity) {
+        me->_data = (UInt8 *)malloc(capacity);
+        me->_capacity = capacity;
+    }
+    return me;
+}
+
+OSData *OSData::withBytes(const void *bytes, unsigned numBytes)
+{
+    OSData *me = withCapacity(numBytes);
+    me->appendBytes(bytes, numBytes);
+    return me;
+}
+
+bool OSData::appendBytes(const void *bytes, unsigned numBytes)
+{
+    if (_length + numBytes > _capacity) {
+        unsigned capacity = _capacity ? _capacity : 64;
+        while (capacity < _length + numBytes)
+            capacity *= 2;
+        UInt8 *data = (UInt8 *)realloc(_data, capacity);
+        if (!data)
+            return false;
+        _data = data;
+        _capacity = capacity;
+    }
+    if (bytes)
+        memcpy(_data + _length, bytes, numBytes);
+    else
+        memset(_data + _length, 0, numBytes);
+    _length += numBytes;
+    return true;
+}
+
+const void *OSData::getBytesNoCopy(unsigned start, unsigned numBytes) const
+{
+    if (!numBytes || start + numBytes > _length || start + numBytes < start)
+        return NULL;
+    return _data + start;
+}
+
+void OSData::free()
+{
+    ::free(_data);
+    OSObject::free();
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Collections
+
+OSDefineMetaClassAndAbstractStructors(OSCollection, OSObject);
+OSDefineMetaClassAndStructors(OSArray, OSCollection);
+
+OSArray *OSArray::withCapacity(unsigned capacity)
+{
+    OSArray *me = new OSArray;
+    me->_capacity = capacity ? capacity : 4;
+    me->_objects = (OSObject **)calloc(me->_capacity, sizeof(OSObject *));
+    return me;
+}
+
+bool OSArray::setObject(const OSMetaClassBase *anObject)
+{
+    return setObject(_count, anObject);
+}
+
+bool OSArray::setObject(unsigned index, const OSMetaClassBase *anObject)
+{
+    if (!anObject || index > _count)
+        return false;
+    if (_count == _capacity) {
+        unsigned capacity = _capacity * 2;
+        OSObject **objects = (OSObject **)realloc(_objects, capacity * sizeof(OSObject *));
+        if (!objects)
+            return false;
+        _objects = objects;
+        _capacity = capacity;
+    }
+    memmove(&_objects[index + 1], &_objects[index], (_count - index) * sizeof(OSObject *));
+    _objects[index] = const_cast<OSObject *>(anObject);
+    anObject->retain();
+    _count++;
+    return true;
+}
+
+void OSArray::removeObject(unsigned index)
+{
+    if (index >= _count)
+        return;
+    OSObject *object = _objects[index];
+    memmove(&_objects[index], &_objects[index + 1], (_count - index - 1) * sizeof(OSObject *));
+    _count--;
+    object->release();
+}
+
+void OSArray::flushCollection()
+{
+    while (_count)
+        removeObject(_count - 1);
+}
+
+void OSArray::free()
+{
+    flushCollection();
+    ::free(_objects);
+    OSCollection::free();
+}
+
+OSDefineMetaClassAndStructors(OSDictionary, OSCollection);
+
+OSDictionary *OSDictionary::withCapacity(unsigned capacity)
+{
+    OSDictionary *me = new OSDictionary;
+    me->_capacity = capacity ? capacity : 4;
+    me->_keys = (OSString **)calloc(me->_capacity, sizeof(OSString *));
+    me->_objects = (OSObject **)calloc(me->_capacity, sizeof(OSObject *));
+    return me;
+}
+
+OSDictionary *OSDictionary::withDictionary(const OSDictionary *dict, unsigned capacity)
+{
+    if (!dict)
+        return NULL;
+    OSDictionary *me = withCapacity(capacity > dict->_count ? capacity : dict->_count);
+    me->merge(dict);
+    return me;
+}
+
+int OSDictionary::find(const char *aKey) const
+{
+    for (unsigned i = 0; aKey && i < _count; i++) {
+        if (_keys[i]->isEqualTo(aKey))
+            return (int)i;
+    }
+    return -1;
+}
+
+OSObject *OSDictionary::getObject(const char *aKey) const
+{
+    int i = find(aKey);
+    return i < 0 ? NULL : _objects[i];
+}
+
+OSObject *OSDictionary::getObject(const OSString *aKey) const
+{
+    return aKey ? getObject(aKey->getCStringNoCopy()) : NULL;
+}
+
+bool OSDictionary::setObject(const char *aKey, const OSMetaClassBase *anObject)
+{
+    if (!aKey || !anObject)
+        return false;
+    anObject->retain();
+    int i = find(aKey);
+    if (i >= 0) {
+        _objects[i]->release();
+        _objects[i] = const_cast<OSObject *>(anObject);
+        return true;
+    }
+    if (_count == _capacity) {
+        unsigned capacity = _capacity * 2;
+        OSString **keys = (OSString **)realloc(_keys, capacity * sizeof(OSString *));
+        OSObject **objects = (OSObject **)realloc(_objects, capacity * sizeof(OSObject *));
+        if (keys)
+            _keys = keys;
+        if (objects)
+            _objects = objects;
+        if (!keys || !objects) {
+            anObject->release();
+            return false;
+        }
+        _capacity = capacity;
+    }
+    _keys[_count] = OSString::withCString(aKey);
+    _objects[_count] = const_cast<OSObject *>(anObject);
+    _count++;
+    return true;
+}
+
+bool OSDictionary::setObject(const OSString *aKey, const OSMetaClassBase *anObject)
+{
+    return aKey && setObject(aKey->getCStringNoCopy(), anObject);
+}
+
+void OSDictionary::removeObject(const char *aKey)
+{
+    int i = find(aKey);
+    if (i < 0)
+        return;
+    _keys[i]->release();
+    _objects[i]->release();
+    memmove(&_keys[i], &_keys[i + 1], (_count - i - 1) * sizeof(OSString *));
+    memmove(&_objects[i], &_objects[i + 1], (_count - i - 1) * sizeof(OSObject *));
+    _count--;
+}
+
+void OSDictionary::removeObject(const OSString *aKey)
+{
+    if (aKey)
+        removeObject(aKey->getCStringNoCopy());
+}
+
+bool OSDictionary::merge(const OSDictionary *otherDictionary)
+{
+    if (!otherDictionary)
+        return false;
+    for (unsigned i = 0; i < otherDictionary->_count; i++) {
+        if (!setObject(otherDictionary->_keys[i], otherDictionary->_objects[i]))
+            return false;
+    }
+    return true;
+}
+
+OSDictionary *OSDictionary::copyCollection() const
+{
+    // collections inside are copied too, the leaves are shared
+    OSDictionary *copy = withCapacity(_count);
+    for (unsigned i = 0; i < _count; i++) {
+        if (OSDictionary *dict = OSDynamicCast(OSDictionary, _objects[i])) {
+            OSDictionary *inner = dict->copyCollection();
+            copy->setObject(_keys[i], inner);
+            inner->release();
+        } else {
+            copy->setObject(_keys[i], _objects[i]);
+        }
+    }
+    return copy;
+}
+
+void OSDictionary::flushCollection()
+{
+    while (_count) {
+        _count--;
+        _keys[_count]->release();
+        _objects[_count]->release();
+    }
+}
+
+void OSDictionary::free()
+{
+    flushCollection();
+    ::free(_keys);
+    ::free(_objects);
+    OSCollection::free();
+}
+
+OSDefineMetaClassAndAbstractStructors(OSIterator, OSObject);
+OSDefineMetaClassAndStructors(OSCollectionIterator, OSIterator);
+
+OSCollectionIterator *OSCollectionIterator::withCollection(const OSCollection *inColl)
+{
+    if (!inColl)
+        return NULL;
+    OSCollectionIterator *me = new OSCollectionIterator;
+    me->_collection = inColl;
+    inColl->retain();
+    return me;
+}
+
+OSObject *OSCollectionIterator::getNextObject()
+{
+    // arrays give their objects, dictionaries their keys
+    unsigned index = _index;
+    if (index >= _collection->getCount())
+        return NULL;
+    _index++;
+    if (const OSArray *array = OSDynamicCast(OSArray, _collection))
+        return array->getObject(index);
+    if (const OSDictionary *dict = OSDynamicCast(OSDictionary, _collection))
+        return const_cast<OSString *>(dict->keyAt(index));
+    return NULL;
+}
+
+void OSCollectionIterator::free()
+{
+    _collection->release();
+    OSIterator::free();
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// OSUnserializeXML
+
+namespace {
+
+class PlistParser {
+public:
+    explicit PlistParser(const char *text) : _p(text), _error(NULL) {}
+
+    OSObject *parse()
+    {
+        OSObject *object = value();
+        if (!object && !_error)
+            _error = "no value";
+        return object;
+    }
+    const char *error() const { return _error; }
+
+private:
+    void skip()
+    {
+        for (;;) {
+            while (*_p == ' ' || *_p == '\t' || *_p == '\r' || *_p == '\n')
+                _p++;
+            if (!strncmp(_p, "<?", 2) || !strncmp(_p, "<!", 2)) {
+                const char *end = strstr(_p, !strncmp(_p, "<!--", 4) ? "-->" : ">");
+                _p = end ? end + (end[0] == '-' ? 3 : 1) : _p + strlen(_p);
+                continue;
+            }
+            return;
+        }
+    }
+
+    // reads "<name ...>" or "<name/>"; false at a closing tag or the end
+    bool open(std::string *name, bool *empty)
+    {
+        skip();
+        if (*_p != '<' || _p[1] == '/')
+            return false;
+        const char *end = strchr(_p, '>');
+        if (!end) {
+            _error = "unterminated tag";
+            return false;
+        }
+        const char *q = _p + 1;
+        while (q < end && *q != ' ' && *q != '/' && *q != '>')
+            q++;
+        name->assign(_p + 1, q - _p - 1);
+        *empty = end[-1] == '/';
+        _p = end + 1;
+        return true;
+    }
+
+    bool close(const char *name)
+    {
+        skip();
+        size_t length = strlen(name);
+        if (strncmp(_p, "</", 2) || strncmp(_p + 2, name, length) || _p[2 + length] != '>') {
+            _error = "mismatched closing tag";
+            return false;
+        }
+        _p += 3 + length;
+        return true;
+    }
+
+    std::string text(const char *name)
+    {
+        std::string out;
+        std::string closing = std::string("</") + name + ">";
+        const char *end = strstr(_p, closing.c_str());
+        if (!end) {
+            _error = "unterminated element";
+            return out;
+        }
+        for (const char *q = _p; q < end; q++) {
+            static const struct { const char *entity; char c; } entities[] = {
+                { "&lt;", '<' }, { "&gt;", '>' }, { "&amp;", '&' }, { "&quot;", '"' }, { "&apos;", '\'' },
+            };
+            bool replaced = false;
+            for (unsigned i = 0; *q == '&' && i < sizeof(entities) / sizeof(entities[0]); i++) {
+                size_t length = strlen(entities[i].entity);
+                if (!strncmp(q, entities[i].entity, length)) {
+                    out += entities[i].c;
+                    q += length - 1;
+                    replaced = true;
+                    break;
+                }
+            }
+            if (!replaced)
+                out += *q;
+        }
+        _p = end + closing.size();
+        return out;
+    }
+
+    static int base64(char c)
+    {
+        if (c >= 'A' && c <= 'Z') return c - 'A';
+        if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+        if (c >= '0' && c <= '9') return c - '0' + 52;
+        if (c == '+') return 62;
+        if (c == '/') return 63;
+        return -1;
+    }
+
+    OSObject *value()
+    {
+        std::string name;
+        bool empty;
+        if (!open(&name, &empty))
+            return NULL;
+
+        if (name == "plist") {
+            OSObject *inner = value();
+            if (inner && !close("plist")) {
+                inner->release();
+                return NULL;
+            }
+            return inner;
+        }
+        if (name == "true" || name == "false")
+            return OSBoolean::withBoolean(name == "true");
+        if (name == "dict") {
+            OSDictionary *dict = OSDictionary::withCapacity(8);
+            std::string keyName;
+            bool keyEmpty;
+            while (!empty && open(&keyName, &keyEmpty)) {
+                if (keyName != "key") {
+                    _error = "dict entry without a key";
+                    break;
+                }
+                std::string key = keyEmpty ? std::string() : text("key");
+                OSObject *object = value();
+                if (!object)
+                    break;
+                dict->setObject(key.c_str(), object);
+                object->release();
+            }
+            if (_error || (!empty && !close("dict"))) {
+                dict->release();
+                return NULL;
+            }
+            return dict;
+        }
+        if (name == "array") {
+            OSArray *array = OSArray::withCapacity(8);
+            while (!empty) {
+                OSObject *object = value();
+                if (!object)
+                    break;
+                array->setObject(object);
+                object->release();
+            }
+            if (_error || (!empty && !close("array"))) {
+                array->release();
+                return NULL;
+            }
+            return array;
+        }
+        std::string body = empty ? std::string() : text(name.c_str());
+        if (_error)
+            return NULL;
+        if (name == "string" || name == "key")
+            return OSString::withCString(body.c_str());
+        if (name == "integer")
+            return OSNumber::withNumber(strtoull(body.c_str(), NULL, 0), 64);
+        if (name == "data") {
+            OSData *data = OSData::withCapacity((unsigned)body.size());
+            unsigned bits = 0, acc = 0;
+            for (size_t i = 0; i < body.size(); i++) {
+                int v = base64(body[i]);
+                if (v < 0)
+                    continue;
+                acc = acc << 6 | v;
+                if ((bits += 6) >= 8) {
+                    bits -= 8;
+                    UInt8 byte = (UInt8)(acc >> bits);
+                    data->appendBytes(&byte, 1);
+                }
+            }
+            return data;
+        }
+        _error = "unsupported plist element";
+        return NULL;
+    }
+
+    const char *_p;
+    const char *_error;
+};
+
+} // namespace
+
+OSObject *OSUnserializeXML(const char *buffer, OSString **errorString)
+{
+    if (errorString)
+        *errorString = NULL;
+    if (!buffer)
+        return NULL;
+    PlistParser parser(buffer);
+    OSObject *object = parser.parse();
+    if (parser.error()) {
+        OSSafeReleaseNULL(object);
+        if (errorString)
+            *errorString = OSString::withCString(parser.error());
+    }
+    return object;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// IORegistryEntry
+
+OSDefineMetaClassAndStructors(IORegistryEntry, OSObject);
+
+bool IORegistryEntry::init(OSDictionary *dictionary)
+{
+    if (!OSObject::init())
+        return false;
+    // as in the kernel, the dictionary passed in becomes the property table
+    if (dictionary) {
+        dictionary->retain();
+        _properties = dictionary;
+    } else {
+        _properties = OSDictionary::withCapacity(16);
+    }
+    return true;
+}
+
+IORegistryEntry *IORegistryEntry::fromPath(const char *path, const void *plane)
+{
+    // there is no platform expert (and no ACPI) on the host
+    (void)path;
+    (void)plane;
+    return NULL;
+}
+
+static OSDictionary *propertyTable(OSDictionary **properties)
+{
+    if (!*properties)
+        *properties = OSDictionary::withCapacity(16);
+    return *properties;
+}
+
+bool IORegistryEntry::setProperty(const char *aKey, OSObject *anObject)
+{
+    return propertyTable(&_properties)->setObject(aKey, anObject);
+}
+
+bool IORegistryEntry::setProperty(const OSString *aKey, OSObject *anObject)
+{
+    return propertyTable(&_properties)->setObject(aKey, anObject);
+}
+
+bool IORegistryEntry::setProperty(const char *aKey, const char *aString)
+{
+    OSString *string = OSString::withCString(aString);
+    bool ok = string && setProperty(aKey, string);
+    OSSafeReleaseNULL(string);
+    return ok;
+}
+
+bool IORegistryEntry::setProperty(const char *aKey, bool aBoolean)
+{
+    return setProperty(aKey, aBoolean ? kOSBooleanTrue : kOSBooleanFalse);
+}
+
+bool IORegistryEntry::setProperty(const char *aKey, unsigned long long aValue, unsigned int aNumberOfBits)
+{
+    OSNumber *number = OSNumber::withNumber(aValue, aNumberOfBits);
+    bool ok = setProperty(aKey, number);
+    number->release();
+    return ok;
+}
+
+bool IORegistryEntry::setProperty(const char *aKey, void *bytes, unsigned int length)
+{
+    OSData *data = OSData::withBytes(bytes, length);
+    bool ok = setProperty(aKey, data);
+    data->release();
+    return ok;
+}
+
+void IORegistryEntry::removeProperty(const char *aKey)
+{
+    if (_properties)
+        _properties->removeObject(aKey);
+}
+
+OSObject *IORegistryEntry::getProperty(const char *aKey) const
+{
+    return _properties ? _properties->getObject(aKey) : NULL;
+}
+
+OSObject *IORegistryEntry::getProperty(const OSString *aKey) const
+{
+    return _properties ? _properties->getObject(aKey) : NULL;
+}
+
+OSObject *IORegistryEntry::copyProperty(const char *aKey) const
+{
+    OSObject *object = getProperty(aKey);
+    if (object)
+        object->retain();
+    return object;
+}
+
+const char *IORegistryEntry::getName(const void *plane) const
+{
+    (void)plane;
+    return _name[0] ? _name : getClassName();
+}
+
+void IORegistryEntry::setName(const char *name, const void *plane)
+{
+    (void)plane;
+    strlcpy(_name, name, sizeof(_name));
+}
+
+void IORegistryEntry::free()
+{
+    OSSafeReleaseNULL(_properties);
+    OSObject::free();
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// IOService
+
+OSDefineMetaClassAndStructors(IOService, IORegistryEntry);
+
+bool IOService::init(OSDictionary *dictionary)
+{
+    return IORegistryEntry::init(dictionary);
+}
+
+IOService *IOService::probe(IOService *provider, SInt32 *score)
+{
+    (void)provider;
+    (void)score;
+    return this;
+}
+
+bool IOService::start(IOService *provider)
+{
+    (void)provider;
+    return true;
+}
+
+void IOService::stop(IOService *provider)
+{
+    (void)provider;
+}
+
+bool IOService::attach(IOService *provider)
+{
+    if (!provider || _provider)
+        return false;
+    provider->retain();
+    _provider = provider;
+    return true;
+}
+
+void IOService::detach(IOService *provider)
+{
+    if (provider != _provider)
+        return;
+    _provider = NULL;
+    provider->release();
+}
+
+bool IOService::terminate(IOOptionBits options)
+{
+    (void)options;
+    if (_registered)
+        HostKernel::removeService(this);
+    _registered = false;
+    return true;
+}
+
+void IOService::registerService(IOOptionBits options)
+{
+    (void)options;
+    if (!_registered)
+        HostKernel::addService(this);
+    _registered = true;
+}
+
+IOWorkLoop *IOService::getWorkLoop() const
+{
+    return _provider ? _provider->getWorkLoop() : HostKernel::defaultWorkLoop();
+}
+
+IOReturn IOService::setProperties(OSObject *properties)
+{
+    (void)properties;
+    return kIOReturnUnsupported;
+}
+
+bool IOService::open(IOService *forClient, IOOptionBits options, void *arg)
+{
+    return handleOpen(forClient, options, arg);
+}
+
+void IOService::close(IOService *forClient, IOOptionBits options)
+{
+    if (handleIsOpen(forClient))
+        handleClose(forClient, options);
+}
+
+bool IOService::handleOpen(IOService *forClient, IOOptionBits options, void *arg)
+{
+    (void)options;
+    (void)arg;
+    if (_openClient && _openClient != forClient)
+        return false;
+    _openClient = forClient;
+    return true;
+}
+
+void IOService::handleClose(IOService *forClient, IOOptionBits options)
+{
+    (void)options;
+    if (_openClient == forClient)
+        _openClient = NULL;
+}
+
+bool IOService::handleIsOpen(const IOService *forClient) const
+{
+    return forClient ? _openClient == forClient : _openClient != NULL;
+}
+
+IOReturn IOService::message(UInt32 type, IOService *provider, void *argument)
+{
+    (void)type;
+    (void)provider;
+    (void)argument;
+    return kIOReturnUnsupported;
+}
+
+IOReturn IOService::messageClient(UInt32 messageType, OSObject *client, void *messageArgument, size_t argSize)
+{
+    (void)argSize;
+    // as in the kernel, anything but a service (a NULL client too) is refused
+    if (IOService *service = OSDynamicCast(IOService, client))
+        return service->message(messageType, this, messageArgument);
+    return kIOReturnBadArgument;
+}
+
+IOReturn IOService::registerInterrupt(int source, OSObject *target, IOInterruptAction handler, void *refCon)
+{
+    if (source < 0 || source >= kHostInterrupts || !handler)
+        return kIOReturnBadArgument;
+    Interrupt &irq = _interrupts[source];
+    if (irq.handler)
+        return kIOReturnBusy;
+    irq.target = target;
+    irq.handler = handler;
+    irq.refCon = refCon;
+    irq.enabled = false;
+    irq.pending = false;
+    HostKernel::addInterruptNub(this);
+    return kIOReturnSuccess;
+}
+
+IOReturn IOService::unregisterInterrupt(int source)
+{
+    if (source < 0 || source >= kHostInterrupts || !_interrupts[source].handler)
+        return kIOReturnNoResources;
+    memset(&_interrupts[source], 0, sizeof(_interrupts[source]));
+    for (int i = 0; i < kHostInterrupts; i++) {
+        if (_interrupts[i].handler)
+            return kIOReturnSuccess;
+    }
+    HostKernel::removeInterruptNub(this);
+    return kIOReturnSuccess;
+}
+
+IOReturn IOService::enableInterrupt(int source)
+{
+    if (source < 0 || source >= kHostInterrupts || !_interrupts[source].handler)
+        return kIOReturnNoInterrupt;
+    _interrupts[source].enabled = true;
+    return kIOReturnSuccess;
+}
+
+IOReturn IOService::disableInterrupt(int source)
+{
+    if (source < 0 || source >= kHostInterrupts || !_interrupts[source].handler)
+        return kIOReturnNoInterrupt;
+    _interrupts[source].enabled = false;
+    return kIOReturnSuccess;
+}
+
+void IOService::hostInterrupt(int source)
+{
+    if (source < 0 || source >= kHostInterrupts)
+        return;
+    Interrupt &irq = _interrupts[source];
+    // a masked edge is lost, one that arrives with the CPU's interrupts off
+    // waits for ml_set_interrupts_enabled(true)
+    if (!irq.handler || !irq.enabled)
+        return;
+    irq.pending = true;
+    HostKernel::deliverInterrupts();
+}
+
+void IOService::free()
+{
+    // a service released without terminate() must not stay matchable, nor
+    // keep its provider
+    if (_registered)
+        HostKernel::removeService(this);
+    if (_provider)
+        detach(_provider);
+    IORegistryEntry::free();
+}
+
+IOReturn IOService::registerPowerDriver(IOService *controllingDriver, IOPMPowerState *powerStates,
+                                        unsigned long numberOfStates)
+{
+    (void)controllingDriver;
+    (void)powerStates;
+    (void)numberOfStates;
+    return kIOReturnSuccess;
+}
+
+IOReturn IOService::setPowerState(unsigned long powerStateOrdinal, IOService *whatDevice)
+{
+    (void)powerStateOrdinal;
+    (void)whatDevice;
+    return kIOPMAckImplied;
+}
+
+OSDefineMetaClassAndStructors(IOHIDevice, IOService);
+OSDefineMetaClassAndStructors(IOHIPointing, IOHIDevice);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Work loop and event sources
+
+OSDefineMetaClassAndAbstractStructors(IOEventSource, OSObject);
+
+bool IOEventSource::init(OSObject *owner, void *action)
+{
+    _owner = owner;
+    _action = action;
+    _enabled = true;
+    return OSObject::init();
+}
+
+OSDefineMetaClassAndStructors(IOWorkLoop, OSObject);
+
+IOWorkLoop *IOWorkLoop::workLoop()
+{
+    IOWorkLoop *me = new IOWorkLoop;
+    HostKernel::addWorkLoop(me);
+    return me;
+}
+
+IOReturn IOWorkLoop::addEventSource(IOEventSource *newEvent)
+{
+    if (!newEvent || newEvent->_workLoop)
+        return kIOReturnBadArgument;
+    if (_count == _capacity) {
+        unsigned capacity = _capacity ? _capacity * 2 : 8;
+        IOEventSource **sources = (IOEventSource **)realloc(_sources, capacity * sizeof(*sources));
+        if (!sources)
+            return kIOReturnNoMemory;
+        _sources = sources;
+        _capacity = capacity;
+    }
+    newEvent->retain();
+    newEvent->_workLoop = this;
+    _sources[_count++] = newEvent;
+    return kIOReturnSuccess;
+}
+
+IOReturn IOWorkLoop::removeEventSource(IOEventSource *toRemove)
+{
+    for (unsigned i = 0; i < _count; i++) {
+        if (_sources[i] == toRemove) {
+            memmove(&_sources[i], &_sources[i + 1], (_count - i - 1) * sizeof(*_sources));
+            _count--;
+            toRemove->_workLoop = NULL;
+            toRemove->release();
+            return kIOReturnSuccess;
+        }
+    }
+    return kIOReturnNoResources;
+}
+
+IOReturn IOWorkLoop::runAction(Action action, OSObject *target, void *arg0, void *arg1, void *arg2, void *arg3)
+{
+    closeGate();
+    IOReturn result = action(target, arg0, arg1, arg2, arg3);
+    openGate();
+    return result;
+}
+
+bool IOWorkLoop::runEventSources()
+{
+    if (_gateDepth)
+        return false;
+    bool any = false, more;
+    closeGate();
+    do {
+        more = false;
+        // sources may be removed by the actions they run
+        for (unsigned i = 0; i < _count; i++) {
+            IOEventSource *source = _sources[i];
+            if (!source->_enabled)
+                continue;
+            source->retain();
+            more |= source->checkForWork();
+            source->release();
+        }
+        any |= more;
+    } while (more);
+    openGate();
+    return any;
+}
+
+void IOWorkLoop::free()
+{
+    while (_count)
+        removeEventSource(_sources[_count - 1]);
+    ::free(_sources);
+    HostKernel::removeWorkLoop(this);
+    OSObject::free();
+}
+
+OSDefineMetaClassAndStructors(IOInterruptEventSource, IOEventSource);
+
+IOInterruptEventSource *IOInterruptEventSource::interruptEventSource(OSObject *owner, Action action,
+                                                                     IOService *provider, int intIndex)
+{
+    // the drivers here take their interrupts themselves and only use the
+    // source to get onto the work loop
+    (void)provider;
+    (void)intIndex;
+    IOInterruptEventSource *me = new IOInterruptEventSource;
+    me->IOEventSource::init(owner, (void *)action);
+    return me;
+}
+
+void IOInterruptEventSource::interruptOccurred(void *refCon, IOService *nub, int source)
+{
+    (void)refCon;
+    (void)nub;
+    (void)source;
+    _producerCount++;
+}
+
+bool IOInterruptEventSource::checkForWork()
+{
+    int count = _producerCount - _consumerCount;
+    if (!count)
+        return false;
+    _consumerCount += count;
+    if (_action)
+        ((Action)_action)(_owner, this, count);
+    return true;
+}
+
+OSDefineMetaClassAndStructors(IOTimerEventSource, IOEventSource);
+
+IOTimerEventSource *IOTimerEventSource::timerEventSource(OSObject *owner, Action action)
+{
+    IOTimerEventSource *me = new IOTimerEventSource;
+    me->IOEventSource::init(owner, (void *)action);
+    return me;
+}
+
+IOReturn IOTimerEventSource::setTimeoutMS(UInt32 ms)
+{
+    return setTimeout(ms, kMillisecondScale);
+}
+
+IOReturn IOTimerEventSource::setTimeoutUS(UInt32 us)
+{
+    return setTimeout(us, kMicrosecondScale);
+}
+
+IOReturn IOTimerEventSource::setTimeout(UInt32 interval, UInt32 scale_factor)
+{
+    return setTimeout((AbsoluteTime)interval * scale_factor);
+}
+
+IOReturn IOTimerEventSource::setTimeout(AbsoluteTime interval)
+{
+    return wakeAtTime(HostKernel::now() + interval);
+}
+
+IOReturn IOTimerEventSource::wakeAtTime(AbsoluteTime abstime)
+{
+    if (!_action)
+        return kIOReturnNoResources;
+    _deadline = abstime;
+    _armed = true;
+    return kIOReturnSuccess;
+}
+
+void IOTimerEventSource::cancelTimeout()
+{
+    _armed = false;
+}
+
+bool IOTimerEventSource::checkForWork()
+{
+    if (!_armed || HostKernel::now() < _deadline)
+        return false;
+    _armed = false;
+    ((Action)_action)(_owner, this);
+    return true;
+}
+
+OSDefineMetaClassAndStructors(IOCommandGate, IOEventSource);
+
+IOCommandGate *IOCommandGate::commandGate(OSObject *owner, Action action)
+{
+    IOCommandGate *me = new IOCommandGate;
+    me->IOEventSource::init(owner, (void *)action);
+    return me;
+}
+
+IOReturn IOCommandGate::runCommand(void *arg0, void *arg1, void *arg2, void *arg3)
+{
+    return runAction((Action)_action, arg0, arg1, arg2, arg3);
+}
+
+IOReturn IOCommandGate::runAction(Action action, void *arg0, void *arg1, void *arg2, void *arg3)
+{
+    if (!action)
+        return kIOReturnBadArgument;
+    if (!_workLoop)
+        return kIOReturnNotReady;
+    IOWorkLoop *workLoop = _workLoop;
+    workLoop->closeGate();
+    IOReturn result = action(_owner, arg0, arg1, arg2, arg3);
+    workLoop->openGate();
+    return result;
+}
+
+IOReturn IOCommandGate::attemptAction(Action action, void *arg0, void *arg1, void *arg2, void *arg3)
+{
+    if (_workLoop && _workLoop->inGate())
+        return kIOReturnCannotLock;
+    return runAction(action, arg0, arg1, arg2, arg3);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Locks and thread calls
+
+IOLock *IOLockAlloc() { return (IOLock *)calloc(1, sizeof(IOLock)); }
+void IOLockFree(IOLock *lock) { free(lock); }
+
+void IOLockLock(IOLock *lock)
+{
+    if (lock->held)
+        fatal("IOLockLock: lock already held, this deadlocks in the kernel");
+    lock->held = 1;
+}
+
+void IOLockUnlock(IOLock *lock)
+{
+    if (!lock->held)
+        fatal("IOLockUnlock: lock not held");
+    lock->held = 0;
+}
+
+IOSimpleLock *IOSimpleLockAlloc() { return (IOSimpleLock *)calloc(1, sizeof(IOSimpleLock)); }
+void IOSimpleLockFree(IOSimpleLock *lock) { free(lock); }
+
+void IOSimpleLockLock(IOSimpleLock *lock)
+{
+    if (lock->held)
+        fatal("IOSimpleLockLock: lock already held, this deadlocks in the kernel");
+    lock->held = 1;
+}
+
+void IOSimpleLockUnlock(IOSimpleLock *lock)
+{
+    if (!lock->held)
+        fatal("IOSimpleLockUnlock: lock not held");
+    lock->held = 0;
+}
+
+IOInterruptState IOSimpleLockLockDisableInterrupt(IOSimpleLock *lock)
+{
+    IOInterruptState state = ml_set_interrupts_enabled(false);
+    IOSimpleLockLock(lock);
+    return state;
+}
+
+void IOSimpleLockUnlockEnableInterrupt(IOSimpleLock *lock, IOInterruptState state)
+{
+    IOSimpleLockUnlock(lock);
+    ml_set_interrupts_enabled(state);
+}
+
+thread_call_t thread_call_allocate(thread_call_func_t func, thread_call_param_t param0)
+{
+    if (s_threadCallCount == sizeof(s_threadCalls) / sizeof(s_threadCalls[0]))
+        return NULL;
+    thread_call_t call = (thread_call_t)calloc(1, sizeof(*call));
+    call->func = func;
+    call->param0 = param0;
+    s_threadCalls[s_threadCallCount++] = call;
+    return call;
+}
+
+bool thread_call_enter1(thread_call_t call, thread_call_param_t param1)
+{
+    // the call runs on its own thread, that is the next time this one waits
+    bool wasPending = call->pending;
+    call->param1 = param1;
+    HostKernel::queueThreadCall(call);
+    return wasPending;
+}
+
+bool thread_call_cancel(thread_call_t call)
+{
+    bool wasPending = call->pending;
+    call->pending = false;
+    return wasPending;
+}
+
+bool thread_call_free(thread_call_t call)
+{
+    for (unsigned i = 0; i < s_threadCallCount; i++) {
+        if (s_threadCalls[i] == call) {
+            s_threadCalls[i] = s_threadCalls[--s_threadCallCount];
+            free(call);
+            return true;
+        }
+    }
+    return false;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// HostKernel
+
+uint64_t HostKernel::now()
+{
+    return s_timed ? s_virtual + (realNanoseconds() - s_realBase) : s_virtual;
+}
+
+void HostKernel::reset(uint64_t start)
+{
+    s_virtual = start;
+    s_realBase = realNanoseconds();
+    s_logCount = s_wtfCount = 0;
+    s_interruptsEnabled = true;
+}
+
+void HostKernel::setTimed(bool timed)
+{
+    // fold the real time so far into the virtual clock either way
+    s_virtual = now();
+    s_realBase = realNanoseconds();
+    s_timed = timed;
+}
+
+static uint64_t nextDeviceEvent()
+{
+    uint64_t next = UINT64_MAX;
+    for (unsigned i = 0; i < s_deviceCount; i++) {
+        uint64_t t = s_devices[i]->nextEvent();
+        if (t < next)
+            next = t;
+    }
+    return next;
+}
+
+static void tickDevices()
+{
+    uint64_t t = HostKernel::now();
+    for (unsigned i = 0; i < s_deviceCount; i++)
+        s_devices[i]->tick(t);
+}
+
+void HostKernel::advance(uint64_t ns)
+{
+    uint64_t target = s_virtual + ns;
+    // step through what the devices do on the way, so that each interrupt
+    // comes in at its own time
+    for (;;) {
+        uint64_t next = nextDeviceEvent();
+        if (next > target)
+            break;
+        if (next > s_virtual)
+            s_virtual = next;
+        tickDevices();
+        // a device that does not move its next event on would spin here
+        if (nextDeviceEvent() <= s_virtual)
+            break;
+    }
+    // an interrupt taken on the way may have busy-waited past @target
+    if (target > s_virtual)
+        s_virtual = target;
+    tickDevices();
+}
+
+uint64_t HostKernel::nextTimer()
+{
+    uint64_t next = UINT64_MAX;
+    for (unsigned w = 0; w < s_workLoopCount; w++) {
+        IOWorkLoop *workLoop = s_workLoops[w];
+        for (unsigned i = 0; i < workLoop->_count; i++) {
+            IOTimerEventSource *timer = OSDynamicCast(IOTimerEventSource, workLoop->_sources[i]);
+            if (timer && timer->isEnabled() && timer->isArmed() && timer->deadline() < next)
+                next = timer->deadline();
+        }
+    }
+    return next;
+}
+
+void HostKernel::runPending()
+{
+    bool any;
+    do {
+        any = false;
+        deliverInterrupts();
+        for (unsigned i = 0; i < s_threadCallCount; i++) {
+            thread_call_t call = s_threadCalls[i];
+            if (call->pending) {
+                call->pending = false;
+                call->func(call->param0, call->param1);
+                any = true;
+            }
+        }
+        for (unsigned w = 0; w < s_workLoopCount; w++)
+            any |= s_workLoops[w]->runEventSources();
+    } while (any);
+}
+
+void HostKernel::run(uint64_t deadline)
+{
+    for (;;) {
+        runPending();
+        uint64_t t = now();
+        if (t >= deadline)
+            break;
+        uint64_t next = nextTimer();
+        uint64_t device = nextDeviceEvent();
+        if (device < next)
+            next = device;
+        if (next > deadline)
+            next = deadline;
+        advance(next > t ? next - t : 0);
+        if (next == deadline) {
+            runPending();
+            break;
+        }
+    }
+}
+
+void HostKernel::addDevice(HostDevice *device)
+{
+    if (s_deviceCount < sizeof(s_devices) / sizeof(s_devices[0]))
+        s_devices[s_deviceCount++] = device;
+}
+
+void HostKernel::removeDevice(HostDevice *device)
+{
+    for (unsigned i = 0; i < s_deviceCount; i++) {
+        if (s_devices[i] == device) {
+            s_devices[i] = s_devices[--s_deviceCount];
+            break;
+        }
+    }
+    if (s_port == device)
+        s_port = NULL;
+}
+
+void HostKernel::setPort(HostPortDevice *device)
+{
+    if (s_port)
+        removeDevice(s_port);
+    s_port = device;
+    if (device)
+        addDevice(device);
+}
+
+UInt8 HostKernel::inb(UInt16 port)
+{
+    // nothing decodes the port: the bus floats high
+    return s_port ? s_port->inb(port) : 0xff;
+}
+
+void HostKernel::outb(UInt16 port, UInt8 value)
+{
+    if (s_port)
+        s_port->outb(port, value);
+}
+
+bool HostKernel::interruptsEnabled()
+{
+    return s_interruptsEnabled;
+}
+
+bool HostKernel::setInterruptsEnabled(bool enable)
+{
+    bool old = s_interruptsEnabled;
+    s_interruptsEnabled = enable;
+    if (enable && !old)
+        deliverInterrupts();
+    return old;
+}
+
+void HostKernel::addInterruptNub(IOService *nub)
+{
+    for (unsigned i = 0; i < s_nubCount; i++) {
+        if (s_nubs[i] == nub)
+            return;
+    }
+    if (s_nubCount < sizeof(s_nubs) / sizeof(s_nubs[0]))
+        s_nubs[s_nubCount++] = nub;
+}
+
+void HostKernel::removeInterruptNub(IOService *nub)
+{
+    for (unsigned i = 0; i < s_nubCount; i++) {
+        if (s_nubs[i] == nub) {
+            s_nubs[i] = s_nubs[--s_nubCount];
+            return;
+        }
+    }
+}
+
+void HostKernel::addService(IOService *service)
+{
+    if (s_serviceCount == sizeof(s_services) / sizeof(s_services[0]))
+        fatal("too many registered services");
+    s_services[s_serviceCount++] = service;
+}
+
+void HostKernel::removeService(IOService *service)
+{
+    for (unsigned i = 0; i < s_serviceCount; i++) {
+        if (s_services[i] == service) {
+            s_services[i] = s_services[--s_serviceCount];
+            return;
+        }
+    }
+}
+
+IOService *HostKernel::findService(const char *className, IOService *provider)
+{
+    for (unsigned i = 0; i < s_serviceCount; i++) {
+        IOService *service = s_services[i];
+        if (!strcmp(service->getClassName(), className) &&
+            (!provider || service->getProvider() == provider))
+            return service;
+    }
+    return NULL;
+}
+
+void HostKernel::deliverInterrupts()
+{
+    // primary interrupt handlers run with interrupts off and do not nest
+    if (!s_interruptsEnabled || s_inInterrupt)
+        return;
+    bool any;
+    do {
+        any = false;
+        for (unsigned n = 0; n < s_nubCount; n++) {
+            IOService *nub = s_nubs[n];
+            for (int source = 0; source < IOService::kHostInterrupts; source++) {
+                IOService::Interrupt &irq = nub->_interrupts[source];
+                if (!irq.pending)
+                    continue;
+                irq.pending = false;
+                if (!irq.handler || !irq.enabled)
+                    continue;
+                s_inInterrupt = true;
+                s_interruptsEnabled = false;
+                irq.handler(irq.target, irq.refCon, nub, source);
+                s_interruptsEnabled = true;
+                s_inInterrupt = false;
+                any = true;
+            }
+        }
+    } while (any);
+}
+
+void HostKernel::addWorkLoop(IOWorkLoop *workLoop)
+{
+    if (s_workLoopCount == sizeof(s_workLoops) / sizeof(s_workLoops[0]))
+        fatal("too many work loops");
+    s_workLoops[s_workLoopCount++] = workLoop;
+}
+
+void HostKernel::removeWorkLoop(IOWorkLoop *workLoop)
+{
+    for (unsigned i = 0; i < s_workLoopCount; i++) {
+        if (s_workLoops[i] == workLoop) {
+            s_workLoops[i] = s_workLoops[--s_workLoopCount];
+            break;
+        }
+    }
+    if (s_defaultWorkLoop == workLoop)
+        s_defaultWorkLoop = NULL;
+}
+
+IOWorkLoop *HostKernel::defaultWorkLoop()
+{
+    if (!s_defaultWorkLoop)
+        s_defaultWorkLoop = IOWorkLoop::workLoop();
+    return s_defaultWorkLoop;
+}
+
+void HostKernel::queueThreadCall(thread_call_t call)
+{
+    call->pending = true;
+}
+
+void HostKernel::setVerbose(bool verbose) { s_verbose = verbose; }
+unsigned HostKernel::logCount() { return s_logCount; }
+unsigned HostKernel::wtfCount() { return s_wtfCount; }
+
+void HostKernel::log(const char *format, va_list args)
+{
+    char line[1024];
+    vsnprintf(line, sizeof(line), format, args);
+    s_logCount++;
+    if (strstr(line, "WTF") || strstr(line, "ERROR"))
+        s_wtfCount++;
+    if (s_verbose)
+        fputs(line, stderr);
+}
+
+void HostKernel::setPointerEvents(PointerEvents *events) { s_pointer = events; }
+HostKernel::PointerEvents *HostKernel::pointerEvents() { return s_pointer; }
@@ -0,0 +1,728 @@
+//
+// host_iokit - the slice of IOKit and libkern the kext sources use, on the host
+//
+// The driver units in VoodooPS2Controller and VoodooPS2Trackpad are compiled
+// unchanged against these declarations (the per-path headers beside this one
+// stand in for <IOKit/IOService.h> and friends), so the host tools in Host/
+// run the real interrupt, request and packet paths instead of copies of them.
+//
+// Everything runs on one thread against a virtual clock (see HostKernel):
+// IODelay and IOSleep advance it, the devices behind the port see it pass,
+// and work loop event sources and timers run when the host calls
+// HostKernel::run, or when a thread sleeps outside a command gate.
+//
+
+#ifndef _HOST_IOKIT_H
+#define _HOST_IOKIT_H
+
+#include <limits.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Types and return codes
+
+typedef uint8_t  UInt8;
+typedef int8_t   SInt8;
+typedef uint16_t UInt16;
+typedef int16_t  SInt16;
+typedef uint32_t UInt32;
+typedef int32_t  SInt32;
+typedef uint64_t UInt64;
+typedef int64_t  SInt64;
+
+typedef UInt64   AbsoluteTime;
+typedef int      IOReturn;
+typedef int      kern_return_t;
+typedef UInt32   IOOptionBits;
+typedef UInt32   IOItemCount;
+typedef SInt32   IOFixed;
+typedef UInt32   IOByteCount;
+typedef bool     IOInterruptState;
+typedef int      boolean_t;
+
+#define KERN_SUCCESS                0
+
+#ifndef TRUE
+#define TRUE                        1
+#define FALSE                       0
+#endif
+
+#define iokit_common_err(e)         ((IOReturn)(0xe0000000 | (e)))
+#define iokit_common_msg(m)         ((UInt32)(0xe0000000 | (m)))
+
+#define kIOReturnSuccess            KERN_SUCCESS
+#define kIOReturnError              iokit_common_err(0x2bc)
+#define kIOReturnNoMemory           iokit_common_err(0x2bd)
+#define kIOReturnNoResources        iokit_common_err(0x2be)
+#define kIOReturnNoDevice           iokit_common_err(0x2c0)
+#define kIOReturnBadArgument        iokit_common_err(0x2c2)
+#define kIOReturnUnsupported        iokit_common_err(0x2c7)
+#define kIOReturnIOError            iokit_common_err(0x2ca)
+#define kIOReturnCannotLock         iokit_common_err(0x2cc)
+#define kIOReturnBusy               iokit_common_err(0x2d5)
+#define kIOReturnTimeout            iokit_common_err(0x2d6)
+#define kIOReturnNotReady           iokit_common_err(0x2d8)
+#define kIOReturnNoInterrupt        iokit_common_err(0x2e6)
+#define kIOReturnOverrun            iokit_common_err(0x2e8)
+#define kIOReturnNotFound           iokit_common_err(0x2f0)
+#define kIOReturnInvalid            iokit_common_err(0x1)
+
+#define kIOMessageServiceIsTerminated   iokit_common_msg(0x010)
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// libkern and IOLib functions
+
+void IOLog(const char *format, ...) __attribute__((format(printf, 1, 2)));
+void IODelay(unsigned microseconds);
+void IOSleep(unsigned milliseconds);
+
+void *IOMalloc(size_t size);
+void *IOMallocZero(size_t size);
+void  IOFree(void *address, size_t size);
+
+void     clock_get_uptime(uint64_t *result);
+uint64_t mach_absolute_time(void);
+void     absolutetime_to_nanoseconds(uint64_t abstime, uint64_t *result);
+void     nanoseconds_to_absolutetime(uint64_t nanoseconds, uint64_t *result);
+void     clock_interval_to_deadline(uint32_t interval, uint32_t scale_factor, uint64_t *result);
+
+enum {
+    kNanosecondScale  = 1,
+    kMicrosecondScale = 1000,
+    kMillisecondScale = 1000 * 1000,
+    kSecondScale      = 1000 * 1000 * 1000,
+};
+
+size_t strlcpy(char *dst, const char *src, size_t size);
+
+// the kernel's min and max are unsigned (libkern/libkern.h)
+static inline unsigned int min(unsigned int a, unsigned int b) { return a < b ? a : b; }
+static inline unsigned int max(unsigned int a, unsigned int b) { return a > b ? a : b; }
+static inline int imin(int a, int b) { return a < b ? a : b; }
+static inline int imax(int a, int b) { return a > b ? a : b; }
+
+bool ml_set_interrupts_enabled(bool enable);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// OSObject and the metaclass macros
+//
+// OSMetaClass is reduced to C++ RTTI: OSDynamicCast is dynamic_cast and the
+// class name comes from typeid.
+//
+
+class OSObject;
+class OSString;
+class OSDictionary;
+typedef OSObject OSMetaClassBase;
+
+class OSObject {
+public:
+    OSObject() : _retainCount(1) {}
+
+    static void *operator new(size_t size);
+    static void operator delete(void *mem, size_t size);
+
+    virtual bool init() { return true; }
+    virtual void free();
+
+    void retain() const { _retainCount++; }
+    void release() const;
+    int getRetainCount() const { return _retainCount; }
+
+    const char *getClassName() const;
+
+protected:
+    virtual ~OSObject() {}
+
+    mutable int _retainCount;
+};
+
+#define OSDeclareDefaultStructors(className)                            \
+    public:                                                             \
+    className();                                                        \
+    protected:                                                          \
+    virtual ~className()
+
+#define OSDeclareAbstractStructors(className) OSDeclareDefaultStructors(className)
+
+#define OSDefineMetaClassAndStructors(className, superclassName)        \
+    className::className() : superclassName() {}                        \
+    className::~className() {}
+
+#define OSDefineMetaClassAndAbstractStructors(className, superclassName) \
+    OSDefineMetaClassAndStructors(className, superclassName)
+
+#define OSTypeAlloc(type)           (new type)
+#define OSDynamicCast(type, inst)   (dynamic_cast<type *>(__host_object(inst)))
+#define OSRequiredCast(type, inst)  (static_cast<type *>(__host_object(inst)))
+#define OSSafeReleaseNULL(inst)     do { if (inst) (inst)->release(); (inst) = NULL; } while (0)
+#define OSSafeRelease(inst)         do { if (inst) (inst)->release(); } while (0)
+
+static inline OSObject *__host_object(const OSObject *object) { return const_cast<OSObject *>(object); }
+
+// OSMemberFunctionCast resolves a pointer to member function to the function
+// the kernel would call through it, virtual or not (Itanium C++ ABI)
+#define OSMemberFunctionCast(cptrtype, self, func) \
+    ((cptrtype)__host_ptmf2ptf((const void *)(self), func))
+
+template <class C, class F>
+static inline void *__host_ptmf2ptf(const void *self, F C::*func)
+{
+    struct { uintptr_t ptr; ptrdiff_t adj; } pmf;
+    static_assert(sizeof(func) == sizeof(pmf), "pointer to member function is not Itanium ABI");
+    memcpy(&pmf, &func, sizeof(pmf));
+#if defined(__aarch64__) || defined(__arm__)
+    if (pmf.adj & 1) {
+        const char *object = (const char *)self + (pmf.adj >> 1);
+        return *(void **)(*(const char **)object + pmf.ptr);
+    }
+#else
+    if (pmf.ptr & 1) {
+        const char *object = (const char *)self + pmf.adj;
+        return *(void **)(*(const char **)object + pmf.ptr - 1);
+    }
+#endif
+    return (void *)pmf.ptr;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// libkern containers
+
+class OSString : public OSObject {
+    OSDeclareDefaultStructors(OSString);
+public:
+    static OSString *withCString(const char *cString);
+    static OSString *withCStringNoCopy(const char *cString);
+    static OSString *withString(const OSString *aString);
+
+    const char *getCStringNoCopy() const { return _string; }
+    unsigned getLength() const { return (unsigned)strlen(_string); }
+    bool setChar(char aChar, unsigned index);
+    bool isEqualTo(const char *cString) const;
+    bool isEqualTo(const OSString *aString) const;
+
+    void free() override;
+
+protected:
+    char *_string;
+};
+
+class OSSymbol : public OSString {
+    OSDeclareDefaultStructors(OSSymbol);
+public:
+    static const OSSymbol *withCString(const char *cString);
+};
+
+class OSNumber : public OSObject {
+    OSDeclareDefaultStructors(OSNumber);
+public:
+    static OSNumber *withNumber(unsigned long long value, unsigned numberOfBits);
+
+    unsigned numberOfBits() const { return _bits; }
+    UInt8  unsigned8BitValue() const  { return (UInt8)_value; }
+    UInt16 unsigned16BitValue() const { return (UInt16)_value; }
+    UInt32 unsigned32BitValue() const { return (UInt32)_value; }
+    UInt64 unsigned64BitValue() const { return _value; }
+    void setValue(unsigned long long value);
+    bool isEqualTo(const OSNumber *number) const { return number && number->_value == _value; }
+
+private:
+    UInt64 _value;
+    unsigned _bits;
+};
+
+class OSBoolean : public OSObject {
+    OSDeclareDefaultStructors(OSBoolean);
+public:
+    // one shared instance per value, as in the kernel
+    static OSBoolean *withBoolean(bool value);
+
+    bool isTrue() const { return _value; }
+    bool isFalse() const { return !_value; }
+    bool getValue() const { return _value; }
+
+    void free() override {}
+
+private:
+    bool _value;
+};
+
+extern OSBoolean *const kOSBooleanTrue;
+extern OSBoolean *const kOSBooleanFalse;
+
+class OSData : public OSObject {
+    OSDeclareDefaultStructors(OSData);
+public:
+    static OSData *withCapacity(unsigned capacity);
+    static OSData *withBytes(const void *bytes, unsigned numBytes);
+
+    bool appendBytes(const void *bytes, unsigned numBytes);
+    const void *getBytesNoCopy() const { return _length ? _data : NULL; }
+    const void *getBytesNoCopy(unsigned start, unsigned numBytes) const;
+    unsigned getLength() const { return _length; }
+
+    void free() override;
+
+private:
+    UInt8 *_data;
+    unsigned _length;
+    unsigned _capacity;
+};
+
+class OSCollection : public OSObject {
+    OSDeclareAbstractStructors(OSCollection);
+public:
+    virtual unsigned getCount() const = 0;
+};
+
+class OSArray : public OSCollection {
+    OSDeclareDefaultStructors(OSArray);
+public:
+    static OSArray *withCapacity(unsigned capacity);
+
+    unsigned getCount() const override { return _count; }
+    OSObject *getObject(unsigned index) const { return index < _count ? _objects[index] : NULL; }
+    bool setObject(const OSMetaClassBase *anObject);
+    bool setObject(unsigned index, const OSMetaClassBase *anObject);
+    void removeObject(unsigned index);
+    void flushCollection();
+
+    void free() override;
+
+private:
+    OSObject **_objects;
+    unsigned _count;
+    unsigned _capacity;
+};
+
+class OSDictionary : public OSCollection {
+    OSDeclareDefaultStructors(OSDictionary);
+public:
+    static OSDictionary *withCapacity(unsigned capacity);
+    static OSDictionary *withDictionary(const OSDictionary *dict, unsigned capacity = 0);
+
+    unsigned getCount() const override { return _count; }
+    OSObject *getObject(const char *aKey) const;
+    OSObject *getObject(const OSString *aKey) const;
+    bool setObject(const char *aKey, const OSMetaClassBase *anObject);
+    bool setObject(const OSString *aKey, const OSMetaClassBase *anObject);
+    void removeObject(const char *aKey);
+    void removeObject(const OSString *aKey);
+    bool merge(const OSDictionary *otherDictionary);
+    OSDictionary *copyCollection() const;
+    void flushCollection();
+
+    // keys and values in insertion order, for OSCollectionIterator
+    const OSString *keyAt(unsigned index) const { return index < _count ? _keys[index] : NULL; }
+    OSObject *objectAt(unsigned index) const { return index < _count ? _objects[index] : NULL; }
+
+    void free() override;
+
+private:
+    int find(const char *aKey) const;
+
+    OSString **_keys;
+    OSObject **_objects;
+    unsigned _count;
+    unsigned _capacity;
+};
+
+class OSIterator : public OSObject {
+    OSDeclareAbstractStructors(OSIterator);
+public:
+    virtual OSObject *getNextObject() = 0;
+    virtual void reset() = 0;
+};
+
+class OSCollectionIterator : public OSIterator {
+    OSDeclareDefaultStructors(OSCollectionIterator);
+public:
+    static OSCollectionIterator *withCollection(const OSCollection *inColl);
+
+    OSObject *getNextObject() override;
+    void reset() override { _index = 0; }
+
+    void free() override;
+
+private:
+    const OSCollection *_collection;
+    unsigned _index;
+};
+
+// OSUnserializeXML: the plist subset of the kext Info.plist files (dict,
+// array, key, string, integer, data, true and false)
+OSObject *OSUnserializeXML(const char *buffer, OSString **errorString = NULL);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Power states (IOKit/IOPMpowerState.h)
+
+struct IOPMPowerState {
+    unsigned long version;
+    unsigned long capabilityFlags;
+    unsigned long outputPowerCharacter;
+    unsigned long inputPowerRequirement;
+    unsigned long staticPower;
+    unsigned long unbudgetedPower;
+    unsigned long powerToAttain;
+    unsigned long timeToAttain;
+    unsigned long settleUpTime;
+    unsigned long timeToLower;
+    unsigned long settleDownTime;
+    unsigned long powerDomainBudget;
+};
+
+#define kIOPMPowerOff           0
+#define IOPMPowerOn             0x00000002
+#define kIOPMDoze               0x00000400
+#define kIOPMDeviceUsable       0x00008000
+#define kIOPMAckImplied         0
+#define IOPMAckImplied          kIOPMAckImplied
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// IORegistryEntry and IOService
+
+class IOService;
+class IOWorkLoop;
+
+class IORegistryEntry : public OSObject {
+    OSDeclareDefaultStructors(IORegistryEntry);
+public:
+    using OSObject::init;
+    virtual bool init(OSDictionary *dictionary);
+
+    static IORegistryEntry *fromPath(const char *path, const void *plane = NULL);
+
+    OSDictionary *getPropertyTable() const { return _properties; }
+
+    virtual bool setProperty(const char *aKey, OSObject *anObject);
+    virtual bool setProperty(const OSString *aKey, OSObject *anObject);
+    virtual bool setProperty(const char *aKey, const char *aString);
+    virtual bool setProperty(const char *aKey, bool aBoolean);
+    virtual bool setProperty(const char *aKey, unsigned long long aValue, unsigned int aNumberOfBits);
+    virtual bool setProperty(const char *aKey, void *bytes, unsigned int length);
+    virtual void removeProperty(const char *aKey);
+    virtual OSObject *getProperty(const char *aKey) const;
+    virtual OSObject *getProperty(const OSString *aKey) const;
+    virtual OSObject *copyProperty(const char *aKey) const;
+
+    virtual const char *getName(const void *plane = NULL) const;
+    virtual void setName(const char *name, const void *plane = NULL);
+
+    void free() override;
+
+private:
+    OSDictionary *_properties;
+    char _name[64];
+};
+
+typedef void (*IOInterruptAction)(OSObject *target, void *refCon, IOService *nub, int source);
+typedef IOInterruptAction IOServiceInterruptAction;
+
+class IOService : public IORegistryEntry {
+    OSDeclareDefaultStructors(IOService);
+public:
+    bool init(OSDictionary *dictionary = NULL) override;
+    virtual IOService *probe(IOService *provider, SInt32 *score);
+    virtual bool start(IOService *provider);
+    virtual void stop(IOService *provider);
+    virtual bool attach(IOService *provider);
+    virtual void detach(IOService *provider);
+    virtual bool terminate(IOOptionBits options = 0);
+    virtual void registerService(IOOptionBits options = 0);
+    IOService *getProvider() const { return _provider; }
+    bool isRegistered() const { return _registered; }
+
+    virtual IOWorkLoop *getWorkLoop() const;
+    virtual IOReturn setProperties(OSObject *properties);
+
+    virtual bool open(IOService *forClient, IOOptionBits options = 0, void *arg = NULL);
+    virtual void close(IOService *forClient, IOOptionBits options = 0);
+    virtual bool handleOpen(IOService *forClient, IOOptionBits options, void *arg);
+    virtual void handleClose(IOService *forClient, IOOptionBits options);
+    virtual bool handleIsOpen(const IOService *forClient) const;
+
+    virtual IOReturn message(UInt32 type, IOService *provider, void *argument = NULL);
+    virtual IOReturn messageClient(UInt32 messageType, OSObject *client,
+                                   void *messageArgument = NULL, size_t argSize = 0);
+
+    virtual IOReturn registerInterrupt(int source, OSObject *target,
+                                       IOInterruptAction handler, void *refCon = NULL);
+    virtual IOReturn unregisterInterrupt(int source);
+    virtual IOReturn enableInterrupt(int source);
+    virtual IOReturn disableInterrupt(int source);
+
+    // power management, reduced to the calls the drivers make
+    void PMinit() {}
+    void PMstop() {}
+    void joinPMtree(IOService *driver) { (void)driver; }
+    IOReturn registerPowerDriver(IOService *controllingDriver, IOPMPowerState *powerStates,
+                                 unsigned long numberOfStates);
+    IOReturn acknowledgeSetPowerState() { return kIOReturnSuccess; }
+    IOReturn changePowerStateTo(unsigned long ordinal) { (void)ordinal; return kIOReturnSuccess; }
+    virtual IOReturn setPowerState(unsigned long powerStateOrdinal, IOService *whatDevice);
+
+    // the host side of registerInterrupt: raise @source on this nub
+    void hostInterrupt(int source);
+
+    void free() override;
+
+private:
+    enum { kHostInterrupts = 16 };
+    struct Interrupt {
+        OSObject *target;
+        IOInterruptAction handler;
+        void *refCon;
+        bool enabled;
+        bool pending;
+    };
+
+    IOService *_provider;
+    IOService *_openClient;
+    bool _registered;
+    Interrupt _interrupts[kHostInterrupts];
+
+    friend class HostKernel;
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Work loop, event sources and command gate
+
+class IOEventSource : public OSObject {
+    OSDeclareAbstractStructors(IOEventSource);
+public:
+    typedef void (*Action)(OSObject *owner, ...);
+
+    virtual void enable() { _enabled = true; }
+    virtual void disable() { _enabled = false; }
+    bool isEnabled() const { return _enabled; }
+    IOWorkLoop *getWorkLoop() const { return _workLoop; }
+
+protected:
+    bool init(OSObject *owner, void *action);
+
+    // runs pending work, false when there was none
+    virtual bool checkForWork() = 0;
+
+    OSObject *_owner;
+    void *_action;
+    IOWorkLoop *_workLoop;
+    bool _enabled;
+
+    friend class IOWorkLoop;
+    friend class HostKernel;
+};
+
+class IOWorkLoop : public OSObject {
+    OSDeclareDefaultStructors(IOWorkLoop);
+public:
+    typedef IOReturn (*Action)(OSObject *target, void *arg0, void *arg1, void *arg2, void *arg3);
+
+    static IOWorkLoop *workLoop();
+
+    IOReturn addEventSource(IOEventSource *newEvent);
+    IOReturn removeEventSource(IOEventSource *toRemove);
+    IOReturn runAction(Action action, OSObject *target,
+                       void *arg0 = NULL, void *arg1 = NULL, void *arg2 = NULL, void *arg3 = NULL);
+    bool inGate() const { return _gateDepth > 0; }
+    bool onThread() const { return true; }
+
+    void closeGate() { _gateDepth++; }
+    void openGate() { _gateDepth--; }
+
+    // runs the event sources that have work, false when none had any
+    bool runEventSources();
+
+    void free() override;
+
+private:
+    IOEventSource **_sources;
+    unsigned _count;
+    unsigned _capacity;
+    int _gateDepth;
+
+    friend class HostKernel;
+};
+
+class IOInterruptEventSource : public IOEventSource {
+    OSDeclareDefaultStructors(IOInterruptEventSource);
+public:
+    typedef void (*Action)(OSObject *owner, IOInterruptEventSource *sender, int count);
+
+    static IOInterruptEventSource *interruptEventSource(OSObject *owner, Action action,
+                                                        IOService *provider = NULL, int intIndex = 0);
+    void interruptOccurred(void *refCon, IOService *nub, int source);
+
+protected:
+    bool checkForWork() override;
+
+private:
+    volatile int _producerCount;
+    int _consumerCount;
+};
+
+typedef IOInterruptEventSource::Action IOInterruptEventAction;
+
+class IOTimerEventSource : public IOEventSource {
+    OSDeclareDefaultStructors(IOTimerEventSource);
+public:
+    typedef void (*Action)(OSObject *owner, IOTimerEventSource *sender);
+
+    static IOTimerEventSource *timerEventSource(OSObject *owner, Action action = NULL);
+
+    IOReturn setTimeoutMS(UInt32 ms);
+    IOReturn setTimeoutUS(UInt32 us);
+    IOReturn setTimeout(UInt32 interval, UInt32 scale_factor = kNanosecondScale);
+    IOReturn setTimeout(AbsoluteTime interval);
+    IOReturn wakeAtTime(AbsoluteTime abstime);
+    void cancelTimeout();
+    bool isArmed() const { return _armed; }
+    AbsoluteTime deadline() const { return _deadline; }
+
+protected:
+    bool checkForWork() override;
+
+private:
+    AbsoluteTime _deadline;
+    bool _armed;
+};
+
+class IOCommandGate : public IOEventSource {
+    OSDeclareDefaultStructors(IOCommandGate);
+public:
+    typedef IOReturn (*Action)(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3);
+
+    static IOCommandGate *commandGate(OSObject *owner, Action action = NULL);
+
+    IOReturn runCommand(void *arg0 = NULL, void *arg1 = NULL, void *arg2 = NULL, void *arg3 = NULL);
+    IOReturn runAction(Action action,
+                       void *arg0 = NULL, void *arg1 = NULL, void *arg2 = NULL, void *arg3 = NULL);
+    IOReturn attemptAction(Action action,
+                           void *arg0 = NULL, void *arg1 = NULL, void *arg2 = NULL, void *arg3 = NULL);
+
+protected:
+    bool checkForWork() override { return false; }
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Locks and thread calls
+//
+// There is one thread, so a lock only has to catch being taken twice, which
+// would deadlock in the kernel.
+//
+
+struct IOLock { int held; };
+struct IOSimpleLock { int held; };
+
+IOLock *IOLockAlloc();
+void IOLockFree(IOLock *lock);
+void IOLockLock(IOLock *lock);
+void IOLockUnlock(IOLock *lock);
+
+IOSimpleLock *IOSimpleLockAlloc();
+void IOSimpleLockFree(IOSimpleLock *lock);
+void IOSimpleLockLock(IOSimpleLock *lock);
+void IOSimpleLockUnlock(IOSimpleLock *lock);
+IOInterruptState IOSimpleLockLockDisableInterrupt(IOSimpleLock *lock);
+void IOSimpleLockUnlockEnableInterrupt(IOSimpleLock *lock, IOInterruptState state);
+
+typedef void *thread_call_param_t;
+typedef void (*thread_call_func_t)(thread_call_param_t param0, thread_call_param_t param1);
+typedef struct thread_call *thread_call_t;
+
+thread_call_t thread_call_allocate(thread_call_func_t func, thread_call_param_t param0);
+bool thread_call_enter1(thread_call_t call, thread_call_param_t param1);
+bool thread_call_cancel(thread_call_t call);
+bool thread_call_free(thread_call_t call);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// HostKernel: the virtual clock, the port and the scheduler
+
+// something that does things on its own as the virtual clock passes: a
+// touchpad streaming packets, or a controller finishing a transfer
+class HostDevice {
+public:
+    virtual ~HostDevice() {}
+    // the time of the next thing this device does by itself, or UINT64_MAX
+    virtual uint64_t nextEvent() { return UINT64_MAX; }
+    // does whatever is due at @now
+    virtual void tick(uint64_t now) { (void)now; }
+};
+
+// a device on the far side of the I/O ports (architecture/i386/pio.h)
+class HostPortDevice : public HostDevice {
+public:
+    virtual UInt8 inb(UInt16 port) = 0;
+    virtual void outb(UInt16 port, UInt8 value) = 0;
+};
+
+class HostKernel {
+public:
+    // virtual time in ns (absolute time is ns, as on Intel Macs); starts at
+    // 10 s so that nothing looks like it happened right after a key press
+    static uint64_t now();
+    static void advance(uint64_t ns);
+    static void reset(uint64_t start = 10000000000ULL);
+
+    // timed mode adds the real time spent on the host to the clock, so that
+    // latency measurements include the CPU cost of the code being measured
+    static void setTimed(bool timed);
+
+    // runs due timers, interrupt sources and thread calls until @deadline,
+    // advancing the clock to each timer as it falls due
+    static void run(uint64_t deadline);
+    // runs whatever is pending now, without advancing the clock
+    static void runPending();
+
+    static void addDevice(HostDevice *device);
+    static void removeDevice(HostDevice *device);
+    static void setPort(HostPortDevice *device);
+    static UInt8 inb(UInt16 port);
+    static void outb(UInt16 port, UInt8 value);
+
+    static bool interruptsEnabled();
+    static bool setInterruptsEnabled(bool enable);
+
+    // IOLog: counted, and printed when verbose; lines with "WTF" or "ERROR"
+    // are the driver's own sanity errors and are counted separately
+    static void setVerbose(bool verbose);
+    static unsigned logCount();
+    static unsigned wtfCount();
+    static void log(const char *format, va_list args);
+
+    // hooks for what IOHIPointing would pass on to the HID system
+    struct PointerEvents {
+        virtual ~PointerEvents() {}
+        virtual void relative(IOService *sender, int dx, int dy, UInt32 buttons, AbsoluteTime ts) = 0;
+        virtual void scroll(IOService *sender, short d1, short d2, short d3, AbsoluteTime ts) = 0;
+    };
+    static void setPointerEvents(PointerEvents *events);
+    static PointerEvents *pointerEvents();
+
+    static IOWorkLoop *defaultWorkLoop();
+
+    // the registered service of class @className (attached to @provider, when
+    // it is not NULL), as IOKit matching would find it; NULL if there is none
+    static IOService *findService(const char *className, IOService *provider = NULL);
+
+private:
+    friend class IOWorkLoop;
+    friend class IOService;
+    friend bool thread_call_enter1(thread_call_t, thread_call_param_t);
+
+    static void addWorkLoop(IOWorkLoop *workLoop);
+    static void removeWorkLoop(IOWorkLoop *workLoop);
+    static void addService(IOService *service);
+    static void removeService(IOService *service);
+    static void addInterruptNub(IOService *nub);
+    static void removeInterruptNub(IOService *nub);
+    static void deliverInterrupts();
+    static uint64_t nextTimer();
+    static void queueThreadCall(thread_call_t call);
+};
+
+#endif /* _HOST_IOKIT_H */
@@ -0,0 +1,2 @@
+// host stand-in for <kern/clock.h>, see Host/shim/host_iokit.h
+#include "../host_iokit.h"
@@ -0,0 +1,54 @@
+// host stand-in for <kern/queue.h>: the element-linked queues ("method 2")
+// of osfmk/kern/queue.h, the ones the controller's request queue uses
+#ifndef _HOST_KERN_QUEUE_H
+#define _HOST_KERN_QUEUE_H
+
+struct queue_entry {
+    struct queue_entry *next;
+    struct queue_entry *prev;
+};
+
+typedef struct queue_entry *queue_t;
+typedef struct queue_entry  queue_head_t;
+typedef struct queue_entry  queue_chain_t;
+typedef struct queue_entry *queue_entry_t;
+
+#define queue_init(q)           do { (q)->next = (q); (q)->prev = (q); } while (0)
+#define queue_first(q)          ((q)->next)
+#define queue_end(q, qe)        ((q) == (qe))
+#define queue_empty(q)          queue_end((q), queue_first(q))
+
+#define queue_enter(head, elt, type, field)                             \
+do {                                                                    \
+    queue_entry_t __prev = (head)->prev;                                \
+    if ((head) == __prev)                                               \
+        (head)->next = (queue_entry_t)(elt);                            \
+    else                                                                \
+        ((type)(void *)__prev)->field.next = (queue_entry_t)(elt);      \
+    (elt)->field.prev = __prev;                                         \
+    (elt)->field.next = (head);                                         \
+    (head)->prev = (queue_entry_t)(elt);                                \
+} while (0)
+
+#define queue_remove_first(head, entry, type, field)                    \
+do {                                                                    \
+    queue_entry_t __next;                                               \
+    (entry) = (type)(void *)((head)->next);                             \
+    __next = (entry)->field.next;                                       \
+    if ((head) == __next)                                               \
+        (head)->prev = (head);                                          \
+    else                                                                \
+        ((type)(void *)(__next))->field.prev = (head);                  \
+    (head)->next = __next;                                              \
+    (entry)->field.next = (queue_t)0;                                   \
+    (entry)->field.prev = (queue_t)0;                                   \
+} while (0)
+
+#define queue_assign(to, from, type, field)                             \
+do {                                                                    \
+    ((type)(void *)((from)->prev))->field.next = (to);                  \
+    ((type)(void *)((from)->next))->field.prev = (to);                  \
+    *(to) = *(from);                                                    \
+} while (0)
+
+#endif /* _HOST_KERN_QUEUE_H */
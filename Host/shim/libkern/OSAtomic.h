@@ -0,0 +1,30 @@
+// host stand-in for <libkern/OSAtomic.h>; there is one thread, but the
+// builtins keep the ordering the callers ask for
+#ifndef _HOST_OSATOMIC_H
+#define _HOST_OSATOMIC_H
+
+#include "../host_iokit.h"
+
+static inline SInt32 OSAddAtomic(SInt32 amount, volatile SInt32 *address)
+{
+    return __atomic_fetch_add(address, amount, __ATOMIC_SEQ_CST);
+}
+
+static inline SInt32 OSIncrementAtomic(volatile SInt32 *address) { return OSAddAtomic(1, address); }
+static inline SInt32 OSDecrementAtomic(volatile SInt32 *address) { return OSAddAtomic(-1, address); }
+
+static inline bool OSCompareAndSwap(UInt32 oldValue, UInt32 newValue, volatile UInt32 *address)
+{
+    return __atomic_compare_exchange_n(address, &oldValue, newValue, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline bool OSCompareAndSwapPtr(void *oldValue, void *newValue, void *volatile *address)
+{
+    return __atomic_compare_exchange_n(address, &oldValue, newValue, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline void OSMemoryBarrier(void) { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+
+#endif /* _HOST_OSATOMIC_H */
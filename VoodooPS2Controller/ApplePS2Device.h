@@ -252,6 +252,32 @@ public:
     }
 };
 
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// PS/2 Byte-Stream Trace Record
+//
+// The controller can record every byte read from the data port in a ring of
+// these records (see "TraceRecords"/"DumpTrace" in ApplePS2Controller).  The
+// ring is written at interrupt time without locks; seq gives the global order
+// of the records and lets a reader detect entries that were overwritten while
+// a snapshot was being taken.  Device drivers may accept the same format to
+// replay a captured stream.
+//
+
+#define kPS2TF_Mouse            0x01    // byte arrived on the AUX (mouse) stream
+#define kPS2TF_Request          0x02    // byte read by readDataPort (in a request)
+#define kPS2TF_Timeout          0x04    // readDataPort timed out (data is fake)
+
+struct PS2TraceRecord
+{
+    UInt64 time;                        // mach_absolute_time of the read
+    UInt32 seq;                         // running sequence number
+    UInt8  data;                        // byte read from the data port
+    UInt8  status;                      // command port status for that byte
+    UInt8  flags;                       // kPS2TF_* flags
+    UInt8  reserved;
+};
+typedef struct PS2TraceRecord PS2TraceRecord;
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 // PS/2 Command Primitives
 //
@@ -110,6 +110,7 @@ void ApplePS2Controller::interruptHandlerKeyboard(OSObject*, void* refCon, IOSer
             
             IODelay(kDataDelay);
             key = inb(kDataPort);
+            me->traceByte(key, status, 0);
             
             // Call the debugger-key-sequence checking code (if a debugger sequence
             // completes, the debugger function will be invoked immediately within
@@ -198,6 +199,7 @@ void ApplePS2Controller::handleInterrupt(PS2DeviceType deviceType)
         // now ok for interrupts, we have read status, and found data...
         // (it does not matter [too much] if keyboard data is delivered out of order)
         ml_set_interrupts_enabled(enable);
+        traceByte(data, status, 0);
         
 #if WATCHDOG_TIMER
         //REVIEW: remove this debug eventually...
@@ -245,6 +247,7 @@ void ApplePS2Controller::handleInterrupt(PS2DeviceType deviceType)
         
         IODelay(kDataDelay);
         UInt8 data = inb(kDataPort);
+        traceByte(data, status, 0);
 #if WATCHDOG_TIMER
         //REVIEW: remove this debug eventually...
         if (deviceType == kDT_Watchdog)
@@ -337,6 +340,11 @@ bool ApplePS2Controller::init(OSDictionary* dict)
     _requestQueueLock = 0;
     _cmdbyteLock = 0;
     
+    _traceBuffer = 0;
+    _traceSize = 0;
+    _traceIndex = 0;
+    bzero(&_stats, sizeof(_stats));
+    
 #if WATCHDOG_TIMER
     _watchdogTimer = 0;
 #endif
@@ -396,6 +404,21 @@ IOReturn ApplePS2Controller::setPropertiesGated(OSObject* props)
         _mouseWakeFirst = flag->isTrue();
         setProperty("MouseWakeFirst", _mouseWakeFirst);
     }
+    // get trace buffer size (in records, 0 to disable)
+    if (OSNumber* num = OSDynamicCast(OSNumber, dict->getObject(kTraceRecords)))
+        allocateTrace(num->unsigned32BitValue());
+    // snapshot trace buffer into the registry on request
+    if (OSBoolean* flag = OSDynamicCast(OSBoolean, dict->getObject(kDumpTrace)))
+    {
+        if (flag->isTrue())
+            dumpTrace();
+    }
+    // publish request/port statistics on request
+    if (OSBoolean* flag = OSDynamicCast(OSBoolean, dict->getObject(kDumpStatistics)))
+    {
+        if (flag->isTrue())
+            dumpStatistics();
+    }
     return kIOReturnSuccess;
 }
 
@@ -413,6 +436,113 @@ IOReturn ApplePS2Controller::setProperties(OSObject* props)
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
+void ApplePS2Controller::allocateTrace(UInt32 records)
+{
+    //
+    // The trace ring is written from interrupt context without a lock, so once
+    // published it stays put until stop.  Changing the size at runtime is only
+    // possible from the disabled state.
+    //
+    
+    if (_traceBuffer)
+    {
+        if (records != _traceSize)
+            IOLog("%s: trace buffer already allocated (%u records)\n", getName(), (unsigned)_traceSize);
+        return;
+    }
+    if (!records)
+    {
+        setProperty(kTraceRecords, 0ULL, 32);
+        return;
+    }
+    
+    // round up to a power of 2 so the ring index is a simple mask
+    if (records > kTraceRecordsMax)
+        records = kTraceRecordsMax;
+    UInt32 size = 1;
+    while (size < records)
+        size <<= 1;
+    
+    PS2TraceRecord* buffer = (PS2TraceRecord*)IOMalloc(size * sizeof(PS2TraceRecord));
+    if (!buffer)
+    {
+        IOLog("%s: unable to allocate trace buffer (%u records)\n", getName(), (unsigned)size);
+        return;
+    }
+    bzero(buffer, size * sizeof(PS2TraceRecord));
+    _traceSize = size;
+    _traceIndex = 0;
+    OSMemoryBarrier();
+    _traceBuffer = buffer;
+    setProperty(kTraceRecords, size, 32);
+}
+
+void ApplePS2Controller::freeTrace()
+{
+    if (!_traceBuffer)
+        return;
+    PS2TraceRecord* buffer = _traceBuffer;
+    _traceBuffer = 0;
+    OSMemoryBarrier();
+    IOFree(buffer, _traceSize * sizeof(PS2TraceRecord));
+    _traceSize = 0;
+    removeProperty(kPS2Trace);
+}
+
+void ApplePS2Controller::dumpTrace()
+{
+    //
+    // Copy the ring, oldest record first, into the "PS2Trace" property.  The
+    // writer is not stopped while copying, so the newest few records may be
+    // torn or already overwritten; consumers should order by seq and drop any
+    // record whose seq is out of the expected range.
+    //
+    
+    if (!_traceBuffer)
+        return;
+    
+    UInt32 next = (UInt32)_traceIndex;
+    UInt32 count = next < _traceSize ? next : _traceSize;
+    OSData* data = OSData::withCapacity(count * sizeof(PS2TraceRecord));
+    if (!data)
+        return;
+    for (UInt32 seq = next - count; seq != next; seq++)
+        data->appendBytes(&_traceBuffer[seq & (_traceSize-1)], sizeof(PS2TraceRecord));
+    setProperty(kPS2Trace, data);
+    data->release();
+}
+
+void ApplePS2Controller::dumpStatistics()
+{
+    OSDictionary* dict = OSDictionary::withCapacity(8);
+    if (!dict)
+        return;
+    
+    uint64_t totalNs, maxNs;
+    absolutetime_to_nanoseconds(_stats.requestTime, &totalNs);
+    absolutetime_to_nanoseconds(_stats.maxRequestTime, &maxNs);
+    const struct {const char* name; UInt64 value;} values[] = {
+        {"Requests",                    _stats.requests},
+        {"FailedRequests",              _stats.failedRequests},
+        {"RequestTimeTotalUS",          totalNs / 1000},
+        {"RequestTimeMaxUS",            maxNs / 1000},
+        {"ReadTimeouts",                _stats.readTimeouts},
+        {"WriteTimeouts",               _stats.writeTimeouts},
+        {"OutOfOrderCorrections",       _stats.outOfOrder},
+        {"CrossStreamBytes",            _stats.crossStream},
+    };
+    for (int i = 0; i < countof(values); i++) {
+        if (OSNumber* num = OSNumber::withNumber(values[i].value, 64)) {
+            dict->setObject(values[i].name, num);
+            num->release();
+        }
+    }
+    setProperty(kPS2Statistics, dict);
+    dict->release();
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
 void ApplePS2Controller::resetController(void)
 {
     _suppressTimeout = true;
@@ -705,6 +835,9 @@ void ApplePS2Controller::stop(IOService * provider)
     // Detach from power management plane.
     PMstop();
     
+    // Free the byte-stream trace ring (no more interrupts at this point).
+    freeTrace();
+    
 #if DEBUGGER_SUPPORT
     // Free the keyboard queue allocation space (after disabling interrupt).
     if (_keyboardQueueAlloc)
@@ -986,12 +1119,14 @@ void ApplePS2Controller::interruptOccurred(IOInterruptEventSource* source, int)
         
         // See if data is available on the mouse input stream (off real port).
         
-        else if ( (inb(kCommandPort) & (kOutputReady | kMouseData)) ==
+        else if ( ((status = inb(kCommandPort)) & (kOutputReady | kMouseData)) ==
                  (kOutputReady | kMouseData))
         {
             unlockController(state);
             IODelay(kDataDelay);
-            dispatchDriverInterrupt(kDT_Mouse, inb(kDataPort));
+            UInt8 data = inb(kDataPort);
+            traceByte(data, status, 0);
+            dispatchDriverInterrupt(kDT_Mouse, data);
             lockController(&state);
         }
         else break; // out of loop
@@ -1075,6 +1210,7 @@ void ApplePS2Controller::processRequest(PS2Request * request)
     bool          failed          = false;
     bool          transmitToMouse = false;
     unsigned      index;
+    uint64_t      startTime       = mach_absolute_time();
     
     if (_hardwareOffline)
     {
@@ -1109,7 +1245,7 @@ void ApplePS2Controller::processRequest(PS2Request * request)
                 break;
                 
             case kPS2C_WriteDataPort:
-                writeDataPort(request->commands[index].inOrOut);
+                failed = !writeDataPort(request->commands[index].inOrOut);
                 if (transmitToMouse)     // next reads from mouse input stream
                 {
                     deviceMode      = kDT_Mouse;
@@ -1122,7 +1258,7 @@ void ApplePS2Controller::processRequest(PS2Request * request)
                 break;
                 
             case kPS2C_WriteCommandPort:
-                writeCommandPort(request->commands[index].inOrOut);
+                failed = !writeCommandPort(request->commands[index].inOrOut);
                 if (request->commands[index].inOrOut == kCP_TransmitToMouse)
                     transmitToMouse = true; // preparing to transmit data to mouse
                 break;
@@ -1137,8 +1273,12 @@ void ApplePS2Controller::processRequest(PS2Request * request)
                 //
                 
             case kPS2C_SendMouseCommandAndCompareAck:
-                writeCommandPort(kCP_TransmitToMouse);
-                writeDataPort(request->commands[index].inOrOut);
+                if (!writeCommandPort(kCP_TransmitToMouse) ||
+                    !writeDataPort(request->commands[index].inOrOut))
+                {
+                    failed = true;  // no ACK can come for a byte never sent
+                    break;
+                }
                 deviceMode = kDT_Mouse;
 #if OUT_OF_ORDER_DATA_CORRECTION_FEATURE
                 byte = readDataPort(kDT_Mouse, kSC_Acknowledge);
@@ -1179,10 +1319,14 @@ void ApplePS2Controller::processRequest(PS2Request * request)
                 break;
                 
             case kPS2C_ModifyCommandByte:
-                writeCommandPort(kCP_GetCommandByte);
+                if (!writeCommandPort(kCP_GetCommandByte))
+                {
+                    failed = true;
+                    break;
+                }
                 UInt8 commandByte = readDataPort(kDT_Keyboard);
-                writeCommandPort(kCP_SetCommandByte);
-                writeDataPort((commandByte | request->commands[index].setBits) & ~request->commands[index].clearBits);
+                failed = !writeCommandPort(kCP_SetCommandByte) ||
+                         !writeDataPort((commandByte | request->commands[index].setBits) & ~request->commands[index].clearBits);
                 request->commands[index].oldBits = commandByte;
                 break;
         }
@@ -1201,6 +1345,14 @@ hardware_offline:
     
     if (failed) request->commandsCount = index;
     
+    // Account for the request in the statistics.
+    
+    uint64_t elapsed = mach_absolute_time() - startTime;
+    _stats.requests++;
+    if (failed) _stats.failedRequests++;
+    _stats.requestTime += elapsed;
+    if (elapsed > _stats.maxRequestTime) _stats.maxRequestTime = elapsed;
+    
     // Invoke the completion routine, if one was supplied.
     
     if (request->completionTarget != kStackCompletionTarget && request->completionTarget && request->completionAction)  {
@@ -1262,7 +1414,7 @@ UInt8 ApplePS2Controller::readDataPort(PS2DeviceType deviceType)
     
     UInt8  readByte;
     UInt8  status;
-    UInt32 timeoutCounter = 10000;    // (timeoutCounter * kDataDelay = 70 ms)
+    UInt32 timeoutCounter = kPortTimeout;
     
     while (1)
     {
@@ -1296,6 +1448,8 @@ UInt8 ApplePS2Controller::readDataPort(PS2DeviceType deviceType)
             unlockController(state);  // (release interrupt lockout + access to queue)
 #endif //DEBUGGER_SUPPORT
             
+            traceByte(0, deviceType == kDT_Mouse ? kMouseData : 0, kPS2TF_Request | kPS2TF_Timeout);
+            _stats.readTimeouts++;
             if (!_suppressTimeout)
                 IOLog("%s: Timed out on %s input stream.\n", getName(),
                       (deviceType == kDT_Keyboard) ? "keyboard" : "mouse");
@@ -1316,6 +1470,7 @@ UInt8 ApplePS2Controller::readDataPort(PS2DeviceType deviceType)
         //
         
         readByte = inb(kDataPort);
+        traceByte(readByte, status, kPS2TF_Request);
         
 #if DEBUGGER_SUPPORT
         unlockController(state);    // (release interrupt lockout + access to queue)
@@ -1338,6 +1493,7 @@ UInt8 ApplePS2Controller::readDataPort(PS2DeviceType deviceType)
         // that was requested, so dispatch other device's interrupt handler.
         //
         
+        _stats.crossStream++;
         dispatchDriverInterrupt((deviceType==kDT_Keyboard)?kDT_Mouse:kDT_Keyboard,
                                 readByte);
     } // while (forever)
@@ -1384,7 +1540,7 @@ UInt8 ApplePS2Controller::readDataPort(PS2DeviceType deviceType,
     UInt8  readByte;
     bool   requestedStream;
     UInt8  status;
-    UInt32 timeoutCounter = 10000;    // (timeoutCounter * kDataDelay = 70 ms)
+    UInt32 timeoutCounter = kPortTimeout;
     
     while (1)
     {
@@ -1420,6 +1576,8 @@ UInt8 ApplePS2Controller::readDataPort(PS2DeviceType deviceType,
             unlockController(state);  // (release interrupt lockout + access to queue)
 #endif //DEBUGGER_SUPPORT
             
+            traceByte(0, deviceType == kDT_Mouse ? kMouseData : 0, kPS2TF_Request | kPS2TF_Timeout);
+            _stats.readTimeouts++;
             if (firstByteHeld)  return firstByte;
             
             IOLog("%s: Timed out on %s input stream.\n", getName(),
@@ -1442,6 +1600,7 @@ UInt8 ApplePS2Controller::readDataPort(PS2DeviceType deviceType,
         
         readByte        = inb(kDataPort);
         requestedStream = false;
+        traceByte(readByte, status, kPS2TF_Request);
         
         if ( (status & kMouseData) )
         {
@@ -1476,6 +1635,7 @@ UInt8 ApplePS2Controller::readDataPort(PS2DeviceType deviceType,
                     // the first byte to the interrupt handler, and return the second.
                     //
                     
+                    _stats.outOfOrder++;
                     if (!_ignoreOutOfOrder)
                         dispatchDriverInterrupt(deviceType, firstByte);
                     return readByte;
@@ -1513,6 +1673,7 @@ UInt8 ApplePS2Controller::readDataPort(PS2DeviceType deviceType,
             // so dispatch appropriate interrupt handler.
             //
             
+            _stats.crossStream++;
             if (!_ignoreOutOfOrder)
                 dispatchDriverInterrupt(deviceType == kDT_Keyboard ? kDT_Mouse : kDT_Keyboard, readByte);
         }
@@ -1523,36 +1684,58 @@ UInt8 ApplePS2Controller::readDataPort(PS2DeviceType deviceType,
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-void ApplePS2Controller::writeDataPort(UInt8 byte)
+bool ApplePS2Controller::writeDataPort(UInt8 byte)
 {
     //
     // Block until room in the controller's input buffer is available, then
-    // write the given byte to the Data Port.
+    // write the given byte to the Data Port.  Gives up and returns false if
+    // the controller does not drain its input buffer within kPortTimeout polls.
     //
     // This method should only be dispatched from our single-threaded work loop.
     //
     
+    UInt32 timeoutCounter = kPortTimeout;
     while (inb(kCommandPort) & kInputBusy)
+    {
+        if (!--timeoutCounter)
+        {
+            _stats.writeTimeouts++;
+            IOLog("%s: Timed out writing %02x to data port.\n", getName(), byte);
+            return false;
+        }
         IODelay(kDataDelay);
+    }
     IODelay(kDataDelay);
     outb(kDataPort, byte);
+    return true;
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-void ApplePS2Controller::writeCommandPort(UInt8 byte)
+bool ApplePS2Controller::writeCommandPort(UInt8 byte)
 {
     //
     // Block until room in the controller's input buffer is available, then
-    // write the given byte to the Command Port.
+    // write the given byte to the Command Port.  Gives up and returns false if
+    // the controller does not drain its input buffer within kPortTimeout polls.
     //
     // This method should only be dispatched from our single-threaded work loop.
     //
     
+    UInt32 timeoutCounter = kPortTimeout;
     while (inb(kCommandPort) & kInputBusy)
+    {
+        if (!--timeoutCounter)
+        {
+            _stats.writeTimeouts++;
+            IOLog("%s: Timed out writing %02x to command port.\n", getName(), byte);
+            return false;
+        }
         IODelay(kDataDelay);
+    }
     IODelay(kDataDelay);
     outb(kCommandPort, byte);
+    return true;
 }
 
 // =============================================================================
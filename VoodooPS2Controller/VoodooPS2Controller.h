@@ -26,6 +26,8 @@
 #include <IOKit/IOInterruptEventSource.h>
 #include <IOKit/IOService.h>
 #include <IOKit/IOWorkLoop.h>
+#include <libkern/OSAtomic.h>
+#include <kern/clock.h>
 #include "ApplePS2Device.h"
 
 class ApplePS2KeyboardDevice;
@@ -126,6 +128,7 @@ class ApplePS2MouseDevice;
 // Port timings.
 
 #define kDataDelay              7       // usec to delay before data is valid
+#define kPortTimeout            10000   // kDataDelay polls before giving up (70 ms)
 
 // Ports used to control the PS/2 keyboard/mouse and read data from it.
 
@@ -159,10 +162,37 @@ struct KeyboardQueueElement
 };
 #endif //DEBUGGER_SUPPORT
 
+// Byte-stream trace definitions (see PS2TraceRecord in ApplePS2Device.h).
+// When "TraceRecords" is non-zero, every byte read from the data port is
+// stamped and stored in a fixed-size ring, which can be snapshotted into the
+// "PS2Trace" registry property by setting "DumpTrace" through setProperties.
+
+#define kTraceRecordsMax        65536   // upper bound for "TraceRecords"
+
+// Request/port statistics, kept on the workloop and published as the
+// "PS2Statistics" dictionary when "DumpStatistics" is set.
+
+struct PS2ControllerStats
+{
+    UInt32 requests;                    // requests processed
+    UInt32 failedRequests;              // requests stopped by a failed command
+    UInt64 requestTime;                 // total time in processRequest (abs)
+    UInt64 maxRequestTime;              // longest single request (abs)
+    UInt32 readTimeouts;                // readDataPort gave up waiting for data
+    UInt32 writeTimeouts;               // write gave up waiting for kInputBusy
+    UInt32 outOfOrder;                  // responses recovered by second chance
+    UInt32 crossStream;                 // other-stream bytes read in a request
+};
+
 // Info.plist definitions
 
 #define kDisableDevice          "DisableDevice"
 #define kPlatformProfile        "Platform Profile"
+#define kTraceRecords           "TraceRecords"
+#define kDumpTrace              "DumpTrace"
+#define kPS2Trace               "PS2Trace"
+#define kDumpStatistics         "DumpStatistics"
+#define kPS2Statistics          "PS2Statistics"
 
 #ifdef DEBUG
 #define kMergedConfiguration    "Merged Configuration"
@@ -253,6 +283,32 @@ private:
     IOTimerEventSource*      _watchdogTimer;
 #endif
     
+    PS2TraceRecord*          _traceBuffer;          // byte-stream trace ring
+    UInt32                   _traceSize;            // records (power of 2)
+    volatile SInt32          _traceIndex;           // next sequence number
+    
+    inline void traceByte(UInt8 data, UInt8 status, UInt8 flags)
+    {
+        PS2TraceRecord* buffer = _traceBuffer;
+        if (!buffer)
+            return;
+        UInt32 seq = (UInt32)OSIncrementAtomic(&_traceIndex);
+        PS2TraceRecord* record = &buffer[seq & (_traceSize-1)];
+        record->time = mach_absolute_time();
+        record->data = data;
+        record->status = status;
+        record->flags = flags | (status & kMouseData ? kPS2TF_Mouse : 0);
+        record->reserved = 0;
+        OSMemoryBarrier();
+        record->seq = seq;
+    }
+    void allocateTrace(UInt32 records);
+    void freeTrace();
+    void dumpTrace();
+    
+    PS2ControllerStats       _stats;
+    void dumpStatistics();
+    
     virtual PS2InterruptResult _dispatchDriverInterrupt(PS2DeviceType deviceType, UInt8 data);
     virtual void dispatchDriverInterrupt(PS2DeviceType deviceType, UInt8 data);
 #if HANDLE_INTERRUPT_DATA_LATER
@@ -269,8 +325,8 @@ private:
     virtual void  processRequestQueue(IOInterruptEventSource *, int);
     
     virtual UInt8 readDataPort(PS2DeviceType deviceType);
-    virtual void  writeCommandPort(UInt8 byte);
-    virtual void  writeDataPort(UInt8 byte);
+    virtual bool  writeCommandPort(UInt8 byte);
+    virtual bool  writeDataPort(UInt8 byte);
     void resetController(void);
     
     static void interruptHandlerMouse(OSObject*, void* refCon, IOService*, int);
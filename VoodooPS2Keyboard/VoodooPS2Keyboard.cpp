@@ -63,17 +63,6 @@
 #define kMacroTranslation                   "Macro Translation"
 #define kMaxMacroTime                       "MaximumMacroTime"
 
-// Definitions for Macro Inversion data format
-//REVIEW: This should really be defined as some sort of structure
-#define kIgnoreBytes            2 // first two bytes of macro data are ignored (always 0xffff)
-#define kOutputBytes            2 // two bytes of Macro Inversion are used to specify output
-#define kModifierBytes          4 // 4 bytes specify modifier key match criteria
-#define kOutputBytesOffset      (kIgnoreBytes+0)
-#define kModifierBytesOffset    (kIgnoreBytes+kOutputBytes+0)
-#define kPrefixBytes            (kIgnoreBytes+kOutputBytes+kModifierBytes)
-#define kSequenceBytesOffset    (kPrefixBytes+0)
-#define kMinMacroInversion      (kPrefixBytes+2)
-
 // Constants for other services to communicate with
 
 #define kIOHIDSystem                        "IOHIDSystem"
@@ -107,51 +96,13 @@ UInt32 ApplePS2Keyboard::maxKeyCodes() { return NX_NUMKEYCODES; }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-static const char* parseHex(const char *psz, char term1, char term2, unsigned& out)
-{
-    int n = 0;
-    for (; 0 != *psz && term1 != *psz && term2 != *psz; ++psz)
-    {
-        n <<= 4;
-        if (*psz >= '0' && *psz <= '9')
-            n += *psz - '0';
-        else if (*psz >= 'a' && *psz <= 'f')
-            n += *psz - 'a' + 10;
-        else if (*psz >= 'A' && *psz <= 'F')
-            n += *psz - 'A' + 10;
-        else
-            return NULL;
-    }
-    out = n;
-    return psz;
-}
-
-static bool parseRemap(const char *psz, UInt16 &scanFrom, UInt16& scanTo)
-{
-    // psz is of the form: "scanfrom=scanto", examples:
-    //      non-extended:  "1d=3a"
-    //      extended:      "e077=e017"
-    // of course, extended can be mapped to non-extended or non-extended to extended
-    
-    unsigned n;
-    psz = parseHex(psz, '=', 0, n);
-    if (NULL == psz || *psz != '=' || n > 0xFFFF)
-        return false;
-    scanFrom = n;
-    psz = parseHex(psz+1, '\n', ';', n);
-    if (NULL == psz || n > 0xFFFF)
-        return false;
-    scanTo = n;
-    return true;
-}
-
 static bool parseAction(const char* psz, UInt16 dest[], int size)
 {
     int i = 0;
     while (*psz && i < size)
     {
         unsigned n;
-        psz = parseHex(psz, ' ', 0, n);
+        psz = ps2_parse_hex(psz, ' ', 0, n);
         if (!psz || *psz != ' ')
             goto error;
         ++psz;
@@ -208,10 +159,8 @@ bool ApplePS2Keyboard::init(OSDictionary * dict)
     
     // initialize state
     _device                    = 0;
-    _extendCount               = 0;
     _interruptHandlerInstalled = false;
     _ledState                  = 0;
-    _lastdata = 0;
     
     _swapcommandoption = false;
     _sleepEjectTimer = 0;
@@ -223,6 +172,11 @@ bool ApplePS2Keyboard::init(OSDictionary * dict)
     _keysSpecial = 0;
     _f12ejectdelay = 250;   // default is 250 ms
     
+#ifdef DEBUG
+    bzero(_keyTime, sizeof(_keyTime));
+    _replayEvents = 0;
+#endif
+    
     // initialize ACPI support for keyboard backlight/screen brightness
     _provider = 0;
     _brightnessLevels = 0;
@@ -241,7 +195,7 @@ bool ApplePS2Keyboard::init(OSDictionary * dict)
     _macroTimer = 0;
     
     // start out with all keys up
-    bzero(_keyBitVector, sizeof(_keyBitVector));
+    bzero(&_scan, sizeof(_scan));
     
     // make separate copy of ADB translation table.
     bcopy(PS2ToADBMapStock, _PS2ToADBMapMapped, sizeof(_PS2ToADBMapMapped));
@@ -631,25 +585,19 @@ void ApplePS2Keyboard::loadCustomPS2Map(OSArray* pArray)
             // check for comment
             if (';' == *psz)
                 continue;
-            // otherwise, try to parse it
-            UInt16 scanIn, scanOut;
-            if (!parseRemap(psz, scanIn, scanOut))
-            {
-                IOLog("VoodooPS2Keyboard: invalid custom PS2 map entry: \"%s\"\n", psz);
-                continue;
-            }
-            // must be normal scan code or extended, nothing else
-            UInt8 exIn = scanIn >> 8;
-            UInt8 exOut = scanOut >> 8;
-            if ((exIn != 0 && exIn != 0xe0) || (exOut != 0 && exOut != 0xe0))
+            // otherwise, try to parse it and modify PS2 to PS2 map per remap entry
+            switch (ps2_load_ps2_entry(psz, _PS2ToPS2Map))
             {
-                IOLog("VoodooPS2Keyboard: scan code invalid for PS2 map entry: \"%s\"\n", psz);
-                continue;
+                case PS2_ENTRY_INVALID:
+                    IOLog("VoodooPS2Keyboard: invalid custom PS2 map entry: \"%s\"\n", psz);
+                    break;
+                case PS2_ENTRY_BAD_SCANCODE:
+                    // must be normal scan code or extended, nothing else
+                    IOLog("VoodooPS2Keyboard: scan code invalid for PS2 map entry: \"%s\"\n", psz);
+                    break;
+                case PS2_ENTRY_OK:
+                    break;
             }
-            // modify PS2 to PS2 map per remap entry
-            int index = (scanIn & 0xff) + (exIn == 0xe0 ? KBV_NUM_SCANCODES : 0);
-            assert(index < countof(_PS2ToPS2Map));
-            _PS2ToPS2Map[index] = (scanOut & 0xff) + (exOut == 0xe0 ? KBV_NUM_SCANCODES : 0);
         }
     }
 }
@@ -669,24 +617,19 @@ void ApplePS2Keyboard::loadBreaklessPS2(OSDictionary* dict, const char* name)
             // check for comment
             if (';' == *psz)
                 continue;
-            // otherwise, try to parse it
-            unsigned scanIn;
-            if (!parseHex(psz, '\n', ';', scanIn))
+            // otherwise, try to parse it and mark the key breakless
+            switch (ps2_load_breakless_entry(psz, _PS2flags))
             {
-                IOLog("VoodooPS2Keyboard: invalid breakless PS2 entry: \"%s\"\n", psz);
-                continue;
-            }
-            // must be normal scan code or extended, nothing else
-            UInt8 exIn = scanIn >> 8;
-            if ((exIn != 0 && exIn != 0xe0))
-            {
-                IOLog("VoodooPS2Keyboard: scan code invalid for breakless PS2 entry: \"%s\"\n", psz);
-                continue;
+                case PS2_ENTRY_INVALID:
+                    IOLog("VoodooPS2Keyboard: invalid breakless PS2 entry: \"%s\"\n", psz);
+                    break;
+                case PS2_ENTRY_BAD_SCANCODE:
+                    // must be normal scan code or extended, nothing else
+                    IOLog("VoodooPS2Keyboard: scan code invalid for breakless PS2 entry: \"%s\"\n", psz);
+                    break;
+                case PS2_ENTRY_OK:
+                    break;
             }
-            // modify PS2 to PS2 map per remap entry
-            int index = (scanIn & 0xff) + (exIn == 0xe0 ? KBV_NUM_SCANCODES : 0);
-            assert(index < countof(_PS2flags));
-            _PS2flags[index] |= kBreaklessKey;
         }
     }
 }
@@ -706,24 +649,19 @@ void ApplePS2Keyboard::loadCustomADBMap(OSDictionary* dict, const char* name)
             // check for comment
             if (';' == *psz)
                 continue;
-            // otherwise, try to parse it
-            UInt16 scanIn, adbOut;
-            if (!parseRemap(psz, scanIn, adbOut))
+            // otherwise, try to parse it and modify PS2 to ADB map per remap entry
+            switch (ps2_load_adb_entry(psz, _PS2ToADBMapMapped))
             {
-                IOLog("VoodooPS2Keyboard: invalid custom ADB map entry: \"%s\"\n", psz);
-                continue;
+                case PS2_ENTRY_INVALID:
+                    IOLog("VoodooPS2Keyboard: invalid custom ADB map entry: \"%s\"\n", psz);
+                    break;
+                case PS2_ENTRY_BAD_SCANCODE:
+                    // must be normal scan code or extended, nothing else, adbOut is only a byte
+                    IOLog("VoodooPS2Keyboard: scan code invalid for ADB map entry: \"%s\"\n", psz);
+                    break;
+                case PS2_ENTRY_OK:
+                    break;
             }
-            // must be normal scan code or extended, nothing else, adbOut is only a byte
-            UInt8 exIn = scanIn >> 8;
-            if ((exIn != 0 && exIn != 0xe0) || adbOut > 0xFF)
-            {
-                IOLog("VoodooPS2Keyboard: scan code invalid for ADB map entry: \"%s\"\n", psz);
-                continue;
-            }
-            // modify PS2 to ADB map per remap entry
-            int index = (scanIn & 0xff) + (exIn == 0xe0 ? ADB_CONVERTER_EX_START : 0);
-            assert(index < countof(_PS2ToADBMapMapped));
-            _PS2ToADBMapMapped[index] = adbOut;
         }
     }
 }
@@ -741,13 +679,8 @@ OSData** ApplePS2Keyboard::loadMacroData(OSDictionary* dict, const char* name)
         {
             if (OSData* pData = OSDynamicCast(OSData, pArray->getObject(i)))
             {
-                int length = pData->getLength();
-                if (length >= kMinMacroInversion && !(length & 0x01))
-                {
-                    const UInt8* p = static_cast<const UInt8*>(pData->getBytesNoCopy());
-                    if (p[0] == 0xFF && p[1] == 0xFF)
-                        total++;
-                }
+                if (ps2_valid_macro(static_cast<const UInt8*>(pData->getBytesNoCopy()), pData->getLength()))
+                    total++;
             }
         }
         if (total)
@@ -762,13 +695,8 @@ OSData** ApplePS2Keyboard::loadMacroData(OSDictionary* dict, const char* name)
                 {
                     if (OSData* pData = OSDynamicCast(OSData, pArray->getObject(i)))
                     {
-                        int length = pData->getLength();
-                        if (length >= kMinMacroInversion && !(length & 0x01))
-                        {
-                            const UInt8* p = static_cast<const UInt8*>(pData->getBytesNoCopy());
-                            if (p[0] == 0xFF && p[1] == 0xFF)
-                                result[index++] = pData;
-                        }
+                        if (ps2_valid_macro(static_cast<const UInt8*>(pData->getBytesNoCopy()), pData->getLength()))
+                            result[index++] = pData;
                     }
                 }
             }
@@ -958,6 +886,18 @@ void ApplePS2Keyboard::setParamPropertiesGated(OSDictionary * dict)
         parseAction(str->getCStringNoCopy(), _actionSwipeRight, countof(_actionSwipeRight));
         setProperty(kActionSwipeRight, str);
     }
+    
+#ifdef DEBUG
+    // replay a byte trace captured by the controller ("PS2Trace")
+    if (OSData* trace = OSDynamicCast(OSData, dict->getObject("ReplayTrace")))
+        replayTrace(trace);
+    // publish per-key processing time on request
+    if (OSBoolean* flag = OSDynamicCast(OSBoolean, dict->getObject("DumpKeyTime")))
+    {
+        if (flag->isTrue())
+            dumpKeyTime();
+    }
+#endif
 }
 
 IOReturn ApplePS2Keyboard::setParamProperties(OSDictionary *dict)
@@ -1149,104 +1089,36 @@ PS2InterruptResult ApplePS2Keyboard::interruptOccurred(UInt8 data)   // PS2Inter
     //
     
     UInt8* packet = _ringBuffer.head();
+    UInt8 lastdata = _scan.lastdata;
     
-    // special case for $AA $00, spontaneous reset (usually due to static electricity)
-    if (kSC_Reset == _lastdata && 0x00 == data)
-    {
-        IOLog("%s: Unexpected reset (%02x %02x) request from PS/2 controller.\n", getName(), _lastdata, data);
-        
-        // buffer a packet that will cause a reset in work loop
-        packet[0] = 0x00;
-        packet[1] = kSC_Reset;
-        // mark packet with timestamp
-        clock_get_uptime((uint64_t*)(&packet[kPacketTimeOffset]));
-        _ringBuffer.advanceHead(kPacketLength);
-        _extendCount = 0;
-        return kPS2IR_packetReady;
-    }
-    _lastdata = data;
-    
-    // other data error conditions
-    if (kSC_Acknowledge == data)
-    {
-        IOLog("%s: Unexpected acknowledge (%02x) from PS/2 controller.\n", getName(), data);
-        return kPS2IR_packetBuffering;
-    }
-    if (kSC_Resend == data)
-    {
-        IOLog("%s: Unexpected resend (%02x) request from PS/2 controller.\n", getName(), data);
-        return kPS2IR_packetBuffering;
-    }
-    
-    //
-    // See if this scan code introduces an extended key sequence.  If so, note
-    // it and then return.  Next time we get a key we'll finish the sequence.
-    //
-    
-    if (data == kSC_Extend)
+    switch (ps2_scan_byte(&_scan, _PS2flags, data, packet))
     {
-        _extendCount = 1;
-        return kPS2IR_packetBuffering;
-    }
-    
-    //
-    // See if this scan code introduces an extended key sequence for the Pause
-    // Key.  If so, note it and then return.  The next time we get a key, drop
-    // it.  The next key we get after that finishes the Pause Key sequence.
-    //
-    // The sequence actually sent to us by the keyboard for the Pause Key is:
-    //
-    // 1. E1  Extended Sequence for Pause Key
-    // 2. 1D  Useless Data, with Up Bit Cleared
-    // 3. 45  Pause Key, with Up Bit Cleared
-    // 4. E1  Extended Sequence for Pause Key
-    // 5. 9D  Useless Data, with Up Bit Set
-    // 6. C5  Pause Key, with Up Bit Set
-    //
-    // The reason items 4 through 6 are sent with the Pause Key is because the
-    // keyboard hardware never generates a release code for the Pause Key and
-    // the designers are being smart about it.  The sequence above translates
-    // to this parser as two separate events, as it should be -- one down key
-    // event and one up key event (for the Pause Key).
-    //
-    
-    if (data == kSC_Pause)
-    {
-        _extendCount = 2;
-        return kPS2IR_packetBuffering;
+        case PS2_SCAN_RESET:
+            // spontaneous reset (usually due to static electricity)
+            IOLog("%s: Unexpected reset (%02x %02x) request from PS/2 controller.\n", getName(), lastdata, data);
+            // the packet will cause a reset in work loop
+            break;
+            
+        case PS2_SCAN_ACK:
+            IOLog("%s: Unexpected acknowledge (%02x) from PS/2 controller.\n", getName(), data);
+            return kPS2IR_packetBuffering;
+            
+        case PS2_SCAN_RESEND:
+            IOLog("%s: Unexpected resend (%02x) request from PS/2 controller.\n", getName(), data);
+            return kPS2IR_packetBuffering;
+            
+        case PS2_SCAN_BUFFERING:
+            // E0/E1 prefix, the dropped byte of a Pause sequence, or a repeat
+            return kPS2IR_packetBuffering;
+            
+        case PS2_SCAN_KEY:
+            // non-repeat make, or just break found, buffer it and dispatch
+            break;
     }
-    
-    //
-    // Otherwise it is a normal scan code, packetize it...
-    //
-    
-    UInt8 extended = _extendCount;
-    if (!_extendCount || 0 == --_extendCount)
-    {
-        // Update our key bit vector, which maintains the up/down status of all keys.
-        unsigned keyCodeRaw =  (extended << 8) | (data & ~kSC_UpBit);
-        if (!(_PS2flags[keyCodeRaw] & kBreaklessKey))
-        {
-            if (!(data & kSC_UpBit))
-            {
-                if (KBV_IS_KEYDOWN(keyCodeRaw))
-                    return kPS2IR_packetBuffering;
-                KBV_KEYDOWN(keyCodeRaw);
-            }
-            else
-            {
-                KBV_KEYUP(keyCodeRaw);
-            }
-        }
-        // non-repeat make, or just break found, buffer it and dispatch
-        packet[0] = extended + 1;  // packet[0] = 0 is special packet, so add one
-        packet[1] = data;
-        // mark packet with timestamp
-        clock_get_uptime((uint64_t*)(&packet[kPacketTimeOffset]));
-        _ringBuffer.advanceHead(kPacketLength);
-        return kPS2IR_packetReady;
-    }
-    return kPS2IR_packetBuffering;
+    // mark packet with timestamp
+    clock_get_uptime((uint64_t*)(&packet[kPacketTimeOffset]));
+    _ringBuffer.advanceHead(kPacketLength);
+    return kPS2IR_packetReady;
 }
 
 void ApplePS2Keyboard::packetReady()
@@ -1258,11 +1130,18 @@ void ApplePS2Keyboard::packetReady()
         UInt8* packet = _ringBuffer.tail();
         if (0x00 != packet[0])
         {
+#ifdef DEBUG
+            uint64_t start;
+            clock_get_uptime(&start);
+#endif
             if (!_macroInversion || !invertMacros(packet))
             {
                 // normal packet
                 dispatchKeyboardEventWithPacket(packet);
             }
+#ifdef DEBUG
+            recordKeyTime(packet, start);
+#endif
         }
         else
         {
@@ -1273,18 +1152,127 @@ void ApplePS2Keyboard::packetReady()
     }
 }
 
-bool ApplePS2Keyboard::compareMacro(const UInt8* buffer, const UInt8* data, int count)
+#ifdef DEBUG
+void ApplePS2Keyboard::recordKeyTime(const UInt8* packet, uint64_t start)
+{
+    //
+    // Time from packetReady picking up the packet until macro inversion,
+    // remapping and dispatch are done, keyed by scan code.  Packets held
+    // back for macro inversion are only charged their buffering cost.
+    //
+    
+    uint64_t now, ns;
+    clock_get_uptime(&now);
+    absolutetime_to_nanoseconds(now - start, &ns);
+    
+    unsigned index = (packet[0] > 1 ? 0x100 : 0) | (packet[1] & ~kSC_UpBit);
+    KeyTimeStats& stats = _keyTime[index];
+    stats.count++;
+    stats.totalNS += ns;
+    if (ns > stats.maxNS)
+        stats.maxNS = (UInt32)ns;
+}
+
+void ApplePS2Keyboard::dumpKeyTime()
 {
-    while (count--)
+    //
+    // Publish "KeyTime" with an entry per scan code seen so far, named by its
+    // hex index (extended codes at 0x100), holding Count, AverageNS and MaxNS.
+    //
+    
+    OSDictionary* dict = OSDictionary::withCapacity(32);
+    if (!dict)
+        return;
+    for (unsigned i = 0; i < countof(_keyTime); i++)
     {
-        if (buffer[0] != data[0] || buffer[1] != data[1])
-            return false;
-        buffer += kPacketLength;
-        data += kPacketKeyDataLength;
+        const KeyTimeStats& stats = _keyTime[i];
+        if (!stats.count)
+            continue;
+        OSDictionary* entry = OSDictionary::withCapacity(3);
+        if (!entry)
+            break;
+        const struct {const char* name; UInt64 value;} values[] = {
+            {"Count",       stats.count},
+            {"AverageNS",   stats.totalNS / stats.count},
+            {"MaxNS",       stats.maxNS},
+        };
+        for (int j = 0; j < countof(values); j++)
+        {
+            if (OSNumber* num = OSNumber::withNumber(values[j].value, 64))
+            {
+                entry->setObject(values[j].name, num);
+                num->release();
+            }
+        }
+        char name[8];
+        snprintf(name, sizeof(name), "%03x", i);
+        dict->setObject(name, entry);
+        entry->release();
     }
-    return true;
+    setProperty("KeyTime", dict);
+    dict->release();
 }
 
+void ApplePS2Keyboard::replayTrace(OSData* trace)
+{
+    //
+    // Feed a PS2TraceRecord stream, as exported by the controller, through
+    // interruptOccurred/packetReady.  Only keyboard stream bytes that arrived
+    // asynchronously are replayed; command responses and timeouts are skipped.
+    // Each packet is stamped with its capture time so macro inversion sees
+    // the original timing.  The resulting ADB events are collected in the
+    // "ReplayEvents" property (as ReplayKeyEvent) rather than dispatched, and
+    // per-key processing time restarts and is published as "KeyTime".
+    //
+    // Key up/down state is saved and restored around the replay so keys
+    // held during the trace don't leak into live typing.
+    //
+    
+    unsigned count = trace->getLength() / sizeof(PS2TraceRecord);
+    const PS2TraceRecord* records = (const PS2TraceRecord*)trace->getBytesNoCopy();
+    if (!records || !count)
+        return;
+    
+    _replayEvents = OSData::withCapacity(count * sizeof(ReplayKeyEvent));
+    if (!_replayEvents)
+        return;
+    
+    UInt32 keyBitVector[KBV_NUNITS];
+    memcpy(keyBitVector, _scan.keyBitVector, sizeof(keyBitVector));
+    bzero(&_scan, sizeof(_scan));
+    bzero(_keyTime, sizeof(_keyTime));
+    _ringBuffer.reset();
+    _macroCurrent = 0;
+    
+    unsigned replayed = 0;
+    for (unsigned i = 0; i < count; i++)
+    {
+        const PS2TraceRecord& record = records[i];
+        if (record.flags & (kPS2TF_Mouse | kPS2TF_Request | kPS2TF_Timeout))
+            continue;
+        if (kPS2IR_packetReady == interruptOccurred(record.data))
+        {
+            // the ring is drained after every packet, so it sits at the tail
+            *(uint64_t*)(&_ringBuffer.tail()[kPacketTimeOffset]) = record.time;
+            packetReady();
+        }
+        replayed++;
+    }
+    // flush a partial macro the timer would otherwise flush
+    if (_macroCurrent > 0)
+        dispatchInvertBuffer();
+    
+    DEBUG_LOG("%s: replayed %u of %u trace bytes, %u events\n", getName(), replayed, count,
+              (unsigned)(_replayEvents->getLength() / sizeof(ReplayKeyEvent)));
+    setProperty("ReplayEvents", _replayEvents);
+    OSSafeReleaseNULL(_replayEvents);
+    dumpKeyTime();
+    
+    bzero(&_scan, sizeof(_scan));
+    memcpy(_scan.keyBitVector, keyBitVector, sizeof(_scan.keyBitVector));
+}
+#endif
+
 bool ApplePS2Keyboard::invertMacros(const UInt8* packet)
 {
     assert(_macroInversion);
@@ -1313,43 +1301,32 @@ bool ApplePS2Keyboard::invertMacros(const UInt8* packet)
     // add current packet to macro buffer for comparison
     memcpy(_macroBuffer+_macroCurrent*kPacketLength, packet, kPacketLength);
     int buffered = _macroCurrent+1;
-    int total = buffered*kPacketKeyDataLength;
     // compare against macro inversions
     for (OSData** p = _macroInversion; *p; p++)
     {
-        int length = (*p)->getLength()-kPrefixBytes;
-        if (total <= length)
+        const UInt8* data = static_cast<const UInt8*>((*p)->getBytesNoCopy());
+        switch (ps2_match_macro(data, (*p)->getLength(), _macroBuffer, buffered, kPacketLength, _PS2modifierState))
         {
-            const UInt8* data = static_cast<const UInt8*>((*p)->getBytesNoCopy());
-            if (compareMacro(_macroBuffer, data+kSequenceBytesOffset, buffered))
-            {
-                if (total == length)
-                {
-                    // get modifier mask/compare from macro definition
-                    UInt16 mask = (static_cast<UInt16>(data[kModifierBytesOffset+0]) << 8) + data[kModifierBytesOffset+1];
-                    UInt16 compare = (static_cast<UInt16>(data[kModifierBytesOffset+2]) << 8) + data[kModifierBytesOffset+3];
-                    if ((0xFFFF == compare && (_PS2modifierState & mask)) || ((_PS2modifierState & mask) == compare))
-                    {
-                        // exact match causes macro inversion
-                        // grab bytes from macro definition
-                        _macroBuffer[0] = data[kOutputBytesOffset+0];
-                        _macroBuffer[1] = data[kOutputBytesOffset+1];
-                        // dispatch constructed packet (timestamp is stamp on first macro packet)
-                        dispatchKeyboardEventWithPacket(_macroBuffer);
-                        cancelTimer(_macroTimer);
-                        _macroCurrent = 0;
-                        return true;
-                    }
-                }
-                else
-                {
-                    // partial match, keep waiting for full match
-                    cancelTimer(_macroTimer);
-                    setTimerTimeout(_macroTimer, _macroMaxTime);
-                    _macroCurrent++;
-                    return true;
-                }
-            }
+            case PS2_MACRO_MATCH:
+                // exact match causes macro inversion
+                // grab bytes from macro definition
+                _macroBuffer[0] = data[kOutputBytesOffset+0];
+                _macroBuffer[1] = data[kOutputBytesOffset+1];
+                // dispatch constructed packet (timestamp is stamp on first macro packet)
+                dispatchKeyboardEventWithPacket(_macroBuffer);
+                cancelTimer(_macroTimer);
+                _macroCurrent = 0;
+                return true;
+                
+            case PS2_MACRO_PARTIAL:
+                // partial match, keep waiting for full match
+                cancelTimer(_macroTimer);
+                setTimerTimeout(_macroTimer, _macroMaxTime);
+                _macroCurrent++;
+                return true;
+                
+            case PS2_MACRO_NONE:
+                break;
         }
     }
     // no match, so... empty macro buffer that may have been existing...
@@ -1543,16 +1520,12 @@ bool ApplePS2Keyboard::dispatchKeyboardEventWithPacket(const UInt8* packet)
     //
     // Returns true if a key event was indeed dispatched.
     
-    UInt8 extended = packet[0] - 1;
     UInt8 scanCode = packet[1];
     
 #ifdef DEBUG_VERBOSE
-    DEBUG_LOG("%s: PS/2 scancode %s 0x%x\n", getName(),  extended ? "extended" : "", scanCode);
+    DEBUG_LOG("%s: PS/2 scancode %s 0x%x\n", getName(),  packet[0] > 1 ? "extended" : "", scanCode);
 #endif
     
-    unsigned keyCodeRaw = scanCode & ~kSC_UpBit;
-    bool goingDown = !(scanCode & kSC_UpBit);
-    unsigned keyCode;
     uint64_t now_abs = *(uint64_t*)(&packet[kPacketTimeOffset]);
     uint64_t now_ns;
     absolutetime_to_nanoseconds(now_abs, &now_ns);
@@ -1566,51 +1539,36 @@ bool ApplePS2Keyboard::dispatchKeyboardEventWithPacket(const UInt8* packet)
     // Refer to the conversion table in defaultKeymapOfLength
     // and the conversion table in ApplePS2ToADBMap.h.
     //
-    if (!extended)
+    // ps2_translate_key applies the PS2 -> PS2 map (extended codes in the
+    // upper half of the table) and tracks the modifier key state.
+    //
+    ps2_key_event key;
+    switch (ps2_translate_key(packet, _PS2ToPS2Map, _PS2flags, &_PS2modifierState, &key))
     {
-        // LANG1(Hangul) and LANG2(Hanja) make one event only when the key was pressed.
-        // Make key-down and key-up event ADB event
-        if (scanCode == 0xf2 || scanCode == 0xf1)
-        {
+        case PS2_KEY_NONE:
+            // header or trailer for PrintScreen
+            return false;
+            
+        case PS2_KEY_PULSE:
+            // LANG1(Hangul) and LANG2(Hanja) make one event only when the key was pressed.
+            // Make key-down and key-up event ADB event
             clock_get_uptime(&now_abs);
             dispatchKeyboardEventX(_PS2ToADBMap[scanCode], true, now_abs);
             clock_get_uptime(&now_abs);
             dispatchKeyboardEventX(_PS2ToADBMap[scanCode], false, now_abs);
             return true;
-        }
-        
-        // Allow PS2 -> PS2 map to work, look in normal part of the table
-        keyCode = _PS2ToPS2Map[keyCodeRaw];
-        
-#ifdef DEBUG_VERBOSE
-        if (keyCode != keyCodeRaw)
-            DEBUG_LOG("%s: keycode translated from=0x%02x to=0x%04x\n", getName(), keyCodeRaw, keyCode);
-#endif
+            
+        case PS2_KEY_EVENT:
+            break;
     }
-    else
-    {
-        // allow PS2 -> PS2 map to work, look in extended part of the table
-        keyCodeRaw += KBV_NUM_SCANCODES;
-        keyCode = _PS2ToPS2Map[keyCodeRaw];
-        
+    unsigned keyCodeRaw = key.keyCodeRaw;
+    unsigned keyCode = key.keyCode;
+    bool goingDown = key.goingDown;
+    
 #ifdef DEBUG_VERBOSE
-        if (keyCode != keyCodeRaw)
-            DEBUG_LOG("%s: keycode translated from=0xe0%02x to=0x%04x\n", getName(), keyCodeRaw, keyCode);
+    if (keyCode != keyCodeRaw)
+        DEBUG_LOG("%s: keycode translated from=%s0x%02x to=0x%04x\n", getName(), keyCodeRaw >= KBV_NUM_SCANCODES ? "0xe0" : "", keyCodeRaw & 0xFF, keyCode);
 #endif
-        // handle special cases
-        switch (keyCodeRaw)
-        {
-            case 0x012a: // header or trailer for PrintScreen
-                return false;
-        }
-    }
-    
-    // tracking modifier key state
-    if (UInt8 bit = (_PS2flags[keyCodeRaw] >> 8))
-    {
-        UInt16 mask = 1 << (bit-1);
-        goingDown ? _PS2modifierState |= mask : _PS2modifierState &= ~mask;
-    }
     
     // codes e0f0 through e0ff can be used to call back into ACPI methods on this device
     if (keyCode >= 0x01f0 && keyCode <= 0x01ff && _provider != NULL)
@@ -1646,11 +1604,11 @@ bool ApplePS2Keyboard::dispatchKeyboardEventWithPacket(const UInt8* packet)
                 // if Option key is down don't pull up on the Shift keys
                 int start = checkModifierState(kMaskLeftWindows) ? 1 : 0;
                 for (int i = start; i < countof(keys); i++)
-                    if (KBV_IS_KEYDOWN(keys[i]))
+                    if (KBV_IS_KEYDOWN(_scan.keyBitVector, keys[i]))
                         dispatchKeyboardEventX(_PS2ToADBMap[keys[i]], false, now_abs);
                 dispatchKeyboardEventX(keyCode == 0x4e ? 0x90 : 0x91, goingDown, now_abs);
                 for (int i = start; i < countof(keys); i++)
-                    if (KBV_IS_KEYDOWN(keys[i]))
+                    if (KBV_IS_KEYDOWN(_scan.keyBitVector, keys[i]))
                         dispatchKeyboardEventX(_PS2ToADBMap[keys[i]], true, now_abs);
                 keyCode = 0;
             }
@@ -2313,7 +2271,7 @@ void ApplePS2Keyboard::initKeyboard()
     UInt8 packet[kPacketLength];
     for (int scanCode = 0; scanCode < KBV_NUM_KEYCODES; scanCode++)
     {
-        if (KBV_IS_KEYDOWN(scanCode))
+        if (KBV_IS_KEYDOWN(_scan.keyBitVector, scanCode))
         {
             packet[0] = scanCode < KBV_NUM_SCANCODES ? 1 : 2;
             packet[1] = scanCode | kSC_UpBit;
@@ -2322,7 +2280,7 @@ void ApplePS2Keyboard::initKeyboard()
     }
     
     // start out with all keys up
-    bzero(_keyBitVector, sizeof(_keyBitVector));
+    bzero(_scan.keyBitVector, sizeof(_scan.keyBitVector));
     _PS2modifierState = 0;
     
     //
@@ -2335,7 +2293,7 @@ void ApplePS2Keyboard::initKeyboard()
     // Reset state of packet/keystroke buffer
     //
     
-    _extendCount = 0;
+    _scan.extendCount = 0;
     _ringBuffer.reset();
     
     //
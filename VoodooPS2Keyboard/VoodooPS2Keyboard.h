@@ -28,34 +28,7 @@
 #include <IOKit/hidsystem/IOHIKeyboard.h>
 #include <IOKit/acpi/IOACPIPlatformDevice.h>
 #include <IOKit/IOCommandGate.h>
-
-// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-// Definitions used to keep track of key state.   Key up/down state is tracked
-// in a bit list.  Bits are set for key-down, and cleared for key-up.  The bit
-// vector and macros for it's manipulation are defined here.
-//
-
-#define KBV_NUM_KEYCODES        512     // related with ADB_CONVERTER_LEN
-#define KBV_BITS_PER_UNIT       32      // for UInt32
-#define KBV_BITS_MASK           31
-#define KBV_BITS_SHIFT          5       // 1<<5 == 32, for cheap divide
-#define KBV_NUNITS ((KBV_NUM_KEYCODES + \
-            (KBV_BITS_PER_UNIT-1))/KBV_BITS_PER_UNIT)
-
-#define KBV_KEYDOWN(n) \
-    (_keyBitVector)[((n)>>KBV_BITS_SHIFT)] |= (1 << ((n) & KBV_BITS_MASK))
-
-#define KBV_KEYUP(n) \
-    (_keyBitVector)[((n)>>KBV_BITS_SHIFT)] &= ~(1 << ((n) & KBV_BITS_MASK))
-
-#define KBV_IS_KEYDOWN(n) \
-    (((_keyBitVector)[((n)>>KBV_BITS_SHIFT)] & (1 << ((n) & KBV_BITS_MASK))) != 0)
-
-#define KBV_NUM_SCANCODES       256
-
-// Special bits for _PS2ToPS2Map
-
-#define kBreaklessKey           0x01    // keys with this flag don't generate break codes
+#include "ps2_scancode.h"
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 // ApplePS2Keyboard Class Declaration
@@ -66,6 +39,22 @@
 #define kPacketTimeOffset 8
 #define kPacketKeyDataLength 2
 
+#ifdef DEBUG
+// per scan code processing time, extended codes at 0x100 (see recordKeyTime)
+struct KeyTimeStats {
+    UInt32 count;
+    UInt32 maxNS;
+    UInt64 totalNS;
+};
+
+// ADB event captured during a trace replay (see replayTrace)
+struct ReplayKeyEvent {
+    UInt64 time;
+    UInt32 keyCode;
+    UInt32 goingDown;
+};
+#endif
+
 class EXPORT ApplePS2Keyboard : public IOHIKeyboard
 {
     typedef IOHIKeyboard super;
@@ -73,10 +62,8 @@ class EXPORT ApplePS2Keyboard : public IOHIKeyboard
 
 private:
     ApplePS2KeyboardDevice *    _device;
-    UInt32                      _keyBitVector[KBV_NUNITS];
-    UInt8                       _extendCount;
+    ps2_scan_state              _scan;
     RingBuffer<UInt8, kPacketLength*32> _ringBuffer;
-    UInt8                       _lastdata;
     bool                        _interruptHandlerInstalled;
     bool                        _powerControlHandlerInstalled;
     bool                        _messageHandlerInstalled;
@@ -136,6 +123,15 @@ private:
     uint64_t                    _macroMaxTime;
     IOTimerEventSource*         _macroTimer;
     
+#ifdef DEBUG
+    // diagnostics: per-key cost and scan code trace replay
+    KeyTimeStats                _keyTime[KBV_NUM_SCANCODES*2];
+    OSData*                     _replayEvents;
+    void recordKeyTime(const UInt8* packet, uint64_t start);
+    void dumpKeyTime();
+    void replayTrace(OSData* trace);
+#endif
+    
     virtual bool dispatchKeyboardEventWithPacket(const UInt8* packet);
     virtual void setLEDs(UInt8 ledState);
     virtual void setKeyboardEnable(bool enable);
@@ -158,7 +154,6 @@ private:
     void onMacroTimer(void);
     bool invertMacros(const UInt8* packet);
     void dispatchInvertBuffer();
-    static bool compareMacro(const UInt8* packet, const UInt8* data, int count);
 
 protected:
     const unsigned char * defaultKeymapOfLength(UInt32 * length) override;
@@ -166,7 +161,18 @@ protected:
     void setNumLockFeedback(bool locked) override;
     UInt32 maxKeyCodes() override;
     inline void dispatchKeyboardEventX(unsigned int keyCode, bool goingDown, uint64_t time)
-        { dispatchKeyboardEvent(keyCode, goingDown, *(AbsoluteTime*)&time); }
+    {
+#ifdef DEBUG
+        // capture instead of sending while replaying a trace
+        if (_replayEvents)
+        {
+            ReplayKeyEvent event = { time, keyCode, goingDown };
+            _replayEvents->appendBytes(&event, sizeof(event));
+            return;
+        }
+#endif
+        dispatchKeyboardEvent(keyCode, goingDown, *(AbsoluteTime*)&time);
+    }
     inline void setTimerTimeout(IOTimerEventSource* timer, uint64_t time)
         { timer->setTimeout(*(AbsoluteTime*)&time); }
     inline void cancelTimer(IOTimerEventSource* timer)
@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) 1998-2000 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * The contents of this file constitute Original Code as defined in and
+ * are subject to the Apple Public Source License Version 1.1 (the
+ * "License").  You may not use this file except in compliance with the
+ * License.  Please obtain a copy of the License at
+ * http://www.apple.com/publicsource and read it before using this file.
+ *
+ * This Original Code and all software distributed under the License are
+ * distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE OR NON-INFRINGEMENT.  Please see the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include <stddef.h>
+
+#include "ps2_scancode.h"
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+enum ps2_scan_result ps2_scan_byte(struct ps2_scan_state *state, const uint16_t flags[],
+                                   uint8_t data, uint8_t key[2])
+{
+    // special case for $AA $00, spontaneous reset (usually due to static electricity)
+    if (kSC_Reset == state->lastdata && 0x00 == data)
+    {
+        // a packet that will cause a reset in work loop
+        key[0] = 0x00;
+        key[1] = kSC_Reset;
+        state->extendCount = 0;
+        return PS2_SCAN_RESET;
+    }
+    state->lastdata = data;
+
+    // other data error conditions
+    if (kSC_Acknowledge == data)
+        return PS2_SCAN_ACK;
+    if (kSC_Resend == data)
+        return PS2_SCAN_RESEND;
+
+    //
+    // See if this scan code introduces an extended key sequence.  If so, note
+    // it and then return.  Next time we get a key we'll finish the sequence.
+    //
+
+    if (data == kSC_Extend)
+    {
+        state->extendCount = 1;
+        return PS2_SCAN_BUFFERING;
+    }
+
+    //
+    // See if this scan code introduces an extended key sequence for the Pause
+    // Key.  If so, note it and then return.  The next time we get a key, drop
+    // it.  The next key we get after that finishes the Pause Key sequence.
+    //
+    // The sequence actually sent to us by the keyboard for the Pause Key is:
+    //
+    // 1. E1  Extended Sequence for Pause Key
+    // 2. 1D  Useless Data, with Up Bit Cleared
+    // 3. 45  Pause Key, with Up Bit Cleared
+    // 4. E1  Extended Sequence for Pause Key
+    // 5. 9D  Useless Data, with Up Bit Set
+    // 6. C5  Pause Key, with Up Bit Set
+    //
+    // The reason items 4 through 6 are sent with the Pause Key is because the
+    // keyboard hardware never generates a release code for the Pause Key and
+    // the designers are being smart about it.  The sequence above translates
+    // to this parser as two separate events, as it should be -- one down key
+    // event and one up key event (for the Pause Key).
+    //
+
+    if (data == kSC_Pause)
+    {
+        state->extendCount = 2;
+        return PS2_SCAN_BUFFERING;
+    }
+
+    //
+    // Otherwise it is a normal scan code, packetize it...
+    //
+
+    uint8_t extended = state->extendCount;
+    if (!state->extendCount || 0 == --state->extendCount)
+    {
+        // Update our key bit vector, which maintains the up/down status of all keys.
+        unsigned keyCodeRaw =  (extended << 8) | (data & ~kSC_UpBit);
+        if (!(flags[keyCodeRaw] & kBreaklessKey))
+        {
+            if (!(data & kSC_UpBit))
+            {
+                if (KBV_IS_KEYDOWN(state->keyBitVector, keyCodeRaw))
+                    return PS2_SCAN_BUFFERING;
+                KBV_KEYDOWN(state->keyBitVector, keyCodeRaw);
+            }
+            else
+            {
+                KBV_KEYUP(state->keyBitVector, keyCodeRaw);
+            }
+        }
+        // non-repeat make, or just break found
+        key[0] = extended + 1;  // key[0] = 0 is special packet, so add one
+        key[1] = data;
+        return PS2_SCAN_KEY;
+    }
+    return PS2_SCAN_BUFFERING;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+enum ps2_key_type ps2_translate_key(const uint8_t key[2], const uint16_t ps2ToPS2[],
+                                    const uint16_t flags[], uint16_t *modifierState,
+                                    struct ps2_key_event *event)
+{
+    uint8_t extended = key[0] - 1;
+    uint8_t scanCode = key[1];
+
+    event->keyCodeRaw = scanCode & ~kSC_UpBit;
+    event->goingDown = !(scanCode & kSC_UpBit);
+
+    if (!extended)
+    {
+        // LANG1(Hangul) and LANG2(Hanja) make one event only when the key was pressed.
+        if (scanCode == 0xf2 || scanCode == 0xf1)
+        {
+            event->keyCodeRaw = event->keyCode = scanCode;
+            event->goingDown = true;
+            return PS2_KEY_PULSE;
+        }
+
+        // Allow PS2 -> PS2 map to work, look in normal part of the table
+        event->keyCode = ps2ToPS2[event->keyCodeRaw];
+    }
+    else
+    {
+        // allow PS2 -> PS2 map to work, look in extended part of the table
+        event->keyCodeRaw += KBV_NUM_SCANCODES;
+        event->keyCode = ps2ToPS2[event->keyCodeRaw];
+
+        // handle special cases
+        switch (event->keyCodeRaw)
+        {
+            case 0x012a: // header or trailer for PrintScreen
+                return PS2_KEY_NONE;
+        }
+    }
+
+    // tracking modifier key state
+    if (uint8_t bit = (flags[event->keyCodeRaw] >> 8))
+    {
+        uint16_t mask = 1 << (bit-1);
+        event->goingDown ? *modifierState |= mask : *modifierState &= ~mask;
+    }
+    return PS2_KEY_EVENT;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+enum ps2_macro_match ps2_match_macro(const uint8_t *macro, int length,
+                                     const uint8_t *buffer, int buffered, int stride,
+                                     uint16_t modifierState)
+{
+    int total = buffered*2;
+    length -= kPrefixBytes;
+    if (total > length)
+        return PS2_MACRO_NONE;
+
+    const uint8_t* data = macro+kSequenceBytesOffset;
+    for (int i = 0; i < buffered; i++)
+    {
+        if (buffer[0] != data[0] || buffer[1] != data[1])
+            return PS2_MACRO_NONE;
+        buffer += stride;
+        data += 2;
+    }
+    if (total < length)
+        return PS2_MACRO_PARTIAL;
+
+    // get modifier mask/compare from macro definition
+    uint16_t mask = (static_cast<uint16_t>(macro[kModifierBytesOffset+0]) << 8) + macro[kModifierBytesOffset+1];
+    uint16_t compare = (static_cast<uint16_t>(macro[kModifierBytesOffset+2]) << 8) + macro[kModifierBytesOffset+3];
+    if ((0xFFFF == compare && (modifierState & mask)) || ((modifierState & mask) == compare))
+        return PS2_MACRO_MATCH;
+    return PS2_MACRO_NONE;
+}
+
+bool ps2_valid_macro(const uint8_t *macro, int length)
+{
+    return length >= kMinMacroInversion && !(length & 0x01) && macro[0] == 0xFF && macro[1] == 0xFF;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+const char* ps2_parse_hex(const char *psz, char term1, char term2, unsigned& out)
+{
+    int n = 0;
+    for (; 0 != *psz && term1 != *psz && term2 != *psz; ++psz)
+    {
+        n <<= 4;
+        if (*psz >= '0' && *psz <= '9')
+            n += *psz - '0';
+        else if (*psz >= 'a' && *psz <= 'f')
+            n += *psz - 'a' + 10;
+        else if (*psz >= 'A' && *psz <= 'F')
+            n += *psz - 'A' + 10;
+        else
+            return NULL;
+    }
+    out = n;
+    return psz;
+}
+
+bool ps2_parse_remap(const char *psz, uint16_t &scanFrom, uint16_t& scanTo)
+{
+    // psz is of the form: "scanfrom=scanto", examples:
+    //      non-extended:  "1d=3a"
+    //      extended:      "e077=e017"
+    // of course, extended can be mapped to non-extended or non-extended to extended
+
+    unsigned n;
+    psz = ps2_parse_hex(psz, '=', 0, n);
+    if (NULL == psz || *psz != '=' || n > 0xFFFF)
+        return false;
+    scanFrom = n;
+    psz = ps2_parse_hex(psz+1, '\n', ';', n);
+    if (NULL == psz || n > 0xFFFF)
+        return false;
+    scanTo = n;
+    return true;
+}
+
+enum ps2_entry_result ps2_load_ps2_entry(const char *psz, uint16_t ps2ToPS2[])
+{
+    uint16_t scanIn, scanOut;
+    if (!ps2_parse_remap(psz, scanIn, scanOut))
+        return PS2_ENTRY_INVALID;
+    // must be normal scan code or extended, nothing else
+    uint8_t exIn = scanIn >> 8;
+    uint8_t exOut = scanOut >> 8;
+    if ((exIn != 0 && exIn != 0xe0) || (exOut != 0 && exOut != 0xe0))
+        return PS2_ENTRY_BAD_SCANCODE;
+    // modify PS2 to PS2 map per remap entry
+    int index = (scanIn & 0xff) + (exIn == 0xe0 ? KBV_NUM_SCANCODES : 0);
+    ps2ToPS2[index] = (scanOut & 0xff) + (exOut == 0xe0 ? KBV_NUM_SCANCODES : 0);
+    return PS2_ENTRY_OK;
+}
+
+enum ps2_entry_result ps2_load_breakless_entry(const char *psz, uint16_t flags[])
+{
+    unsigned scanIn;
+    if (!ps2_parse_hex(psz, '\n', ';', scanIn))
+        return PS2_ENTRY_INVALID;
+    // must be normal scan code or extended, nothing else
+    uint8_t exIn = scanIn >> 8;
+    if ((exIn != 0 && exIn != 0xe0))
+        return PS2_ENTRY_BAD_SCANCODE;
+    int index = (scanIn & 0xff) + (exIn == 0xe0 ? KBV_NUM_SCANCODES : 0);
+    flags[index] |= kBreaklessKey;
+    return PS2_ENTRY_OK;
+}
+
+enum ps2_entry_result ps2_load_adb_entry(const char *psz, uint8_t ps2ToADB[])
+{
+    uint16_t scanIn, adbOut;
+    if (!ps2_parse_remap(psz, scanIn, adbOut))
+        return PS2_ENTRY_INVALID;
+    // must be normal scan code or extended, nothing else, adbOut is only a byte
+    uint8_t exIn = scanIn >> 8;
+    if ((exIn != 0 && exIn != 0xe0) || adbOut > 0xFF)
+        return PS2_ENTRY_BAD_SCANCODE;
+    // modify PS2 to ADB map per remap entry
+    int index = (scanIn & 0xff) + (exIn == 0xe0 ? KBV_NUM_SCANCODES : 0);
+    ps2ToADB[index] = adbOut;
+    return PS2_ENTRY_OK;
+}
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 1998-2000 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * The contents of this file constitute Original Code as defined in and
+ * are subject to the Apple Public Source License Version 1.1 (the
+ * "License").  You may not use this file except in compliance with the
+ * License.  Please obtain a copy of the License at
+ * http://www.apple.com/publicsource and read it before using this file.
+ *
+ * This Original Code and all software distributed under the License are
+ * distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE OR NON-INFRINGEMENT.  Please see the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// PS/2 keyboard scan code handling
+//
+// The stages of the keyboard driver that only work on scan codes and the
+// loaded maps: packetizing the byte stream, PS2 to PS2 translation with
+// modifier tracking, macro inversion matching and parsing of the map entries
+// in Info.plist. Nothing in here may depend on IOKit, so the same code can be
+// built with a plain host compiler and timed outside the kernel; Host/Makefile
+// does that (ps2kbd_replay).
+//
+
+#ifndef _PS2_SCANCODE_H
+#define _PS2_SCANCODE_H
+
+#include <stdint.h>
+
+#ifndef kSC_Reset
+#define kSC_Acknowledge         0xFA    // ack for transmitted commands
+#define kSC_Extend              0xE0    // marker for "extended" sequence
+#define kSC_Pause               0xE1    // marker for pause key sequence
+#define kSC_Resend              0xFE    // request to resend keybd cmd
+#define kSC_Reset               0xAA    // the keyboard/mouse has reset
+#define kSC_UpBit               0x80    // OR'd in if key below is released
+#endif
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Definitions used to keep track of key state.   Key up/down state is tracked
+// in a bit list.  Bits are set for key-down, and cleared for key-up.  The bit
+// vector and macros for it's manipulation are defined here.
+//
+
+#define KBV_NUM_KEYCODES        512     // related with ADB_CONVERTER_LEN
+#define KBV_BITS_PER_UNIT       32      // for UInt32
+#define KBV_BITS_MASK           31
+#define KBV_BITS_SHIFT          5       // 1<<5 == 32, for cheap divide
+#define KBV_NUNITS ((KBV_NUM_KEYCODES + \
+            (KBV_BITS_PER_UNIT-1))/KBV_BITS_PER_UNIT)
+
+#define KBV_KEYDOWN(kbv, n) \
+    (kbv)[((n)>>KBV_BITS_SHIFT)] |= (1 << ((n) & KBV_BITS_MASK))
+
+#define KBV_KEYUP(kbv, n) \
+    (kbv)[((n)>>KBV_BITS_SHIFT)] &= ~(1 << ((n) & KBV_BITS_MASK))
+
+#define KBV_IS_KEYDOWN(kbv, n) \
+    (((kbv)[((n)>>KBV_BITS_SHIFT)] & (1 << ((n) & KBV_BITS_MASK))) != 0)
+
+// extended scan codes (e0xx) are indexed from here, in the PS2 to PS2 map,
+// the flags and (as ADB_CONVERTER_EX_START) the PS2 to ADB map
+#define KBV_NUM_SCANCODES       256
+
+// Special bits for _PS2ToPS2Map
+
+#define kBreaklessKey           0x01    // keys with this flag don't generate break codes
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Macro Inversion data: two ignored bytes (always 0xffff), the two output
+// bytes, the modifier mask and compare words, then the key data to match
+//REVIEW: This should really be defined as some sort of structure
+
+#define kIgnoreBytes            2 // first two bytes of macro data are ignored (always 0xffff)
+#define kOutputBytes            2 // two bytes of Macro Inversion are used to specify output
+#define kModifierBytes          4 // 4 bytes specify modifier key match criteria
+#define kOutputBytesOffset      (kIgnoreBytes+0)
+#define kModifierBytesOffset    (kIgnoreBytes+kOutputBytes+0)
+#define kPrefixBytes            (kIgnoreBytes+kOutputBytes+kModifierBytes)
+#define kSequenceBytesOffset    (kPrefixBytes+0)
+#define kMinMacroInversion      (kPrefixBytes+2)
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Byte stream to key packets (interruptOccurred)
+
+struct ps2_scan_state {
+    uint32_t keyBitVector[KBV_NUNITS];
+    uint8_t extendCount;
+    uint8_t lastdata;
+};
+
+enum ps2_scan_result {
+    PS2_SCAN_BUFFERING,     // byte consumed, nothing to queue
+    PS2_SCAN_KEY,           // key[0] is extended+1, key[1] the scan code
+    PS2_SCAN_RESET,         // $AA $00, spontaneous reset; key[] is 00 AA
+    PS2_SCAN_ACK,           // unexpected acknowledge
+    PS2_SCAN_RESEND,        // unexpected resend request
+};
+
+// flags is the _PS2flags table, for breakless keys
+enum ps2_scan_result ps2_scan_byte(struct ps2_scan_state *state, const uint16_t flags[],
+                                   uint8_t data, uint8_t key[2]);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Key packets to key codes (dispatchKeyboardEventWithPacket)
+
+enum ps2_key_type {
+    PS2_KEY_NONE,           // not a key (PrintScreen header/trailer)
+    PS2_KEY_PULSE,          // LANG1/LANG2: down and up from a single make code
+    PS2_KEY_EVENT,          // regular key, modifier state already updated
+};
+
+struct ps2_key_event {
+    unsigned keyCodeRaw;    // scan code, extended codes from KBV_NUM_SCANCODES
+    unsigned keyCode;       // after the PS2 to PS2 map
+    bool goingDown;
+};
+
+enum ps2_key_type ps2_translate_key(const uint8_t key[2], const uint16_t ps2ToPS2[],
+                                    const uint16_t flags[], uint16_t *modifierState,
+                                    struct ps2_key_event *event);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Macro inversion (invertMacros)
+
+enum ps2_macro_match {
+    PS2_MACRO_NONE,
+    PS2_MACRO_PARTIAL,      // buffered keys are a prefix of the macro
+    PS2_MACRO_MATCH,        // full match, output at macro[kOutputBytesOffset]
+};
+
+// macro/length is one Macro Inversion entry; buffer holds the buffered key
+// packets, stride bytes apart
+enum ps2_macro_match ps2_match_macro(const uint8_t *macro, int length,
+                                     const uint8_t *buffer, int buffered, int stride,
+                                     uint16_t modifierState);
+
+// true if data is a usable Macro Inversion/Translation entry
+bool ps2_valid_macro(const uint8_t *macro, int length);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Info.plist map entries
+
+enum ps2_entry_result {
+    PS2_ENTRY_OK,
+    PS2_ENTRY_INVALID,      // does not parse
+    PS2_ENTRY_BAD_SCANCODE, // not a normal or e0 extended scan code
+};
+
+const char* ps2_parse_hex(const char *psz, char term1, char term2, unsigned& out);
+bool ps2_parse_remap(const char *psz, uint16_t &scanFrom, uint16_t& scanTo);
+
+// "Custom PS2 Map" entry, "1d=3a" or "e077=e017"
+enum ps2_entry_result ps2_load_ps2_entry(const char *psz, uint16_t ps2ToPS2[]);
+// "Breakless PS2" entry, "e05b"
+enum ps2_entry_result ps2_load_breakless_entry(const char *psz, uint16_t flags[]);
+// "Custom ADB Map" entry, "e05b=3a"
+enum ps2_entry_result ps2_load_adb_entry(const char *psz, uint8_t ps2ToADB[]);
+
+#endif /* _PS2_SCANCODE_H */
@@ -110,53 +110,6 @@ static const struct alps_nibble_commands alps_v6_nibble_commands[] = {
     { kDP_SetMouseScaling1To1,	    0x00 }, /* f */
 };
 
-
-#define ALPS_DUALPOINT          0x02    /* touchpad has trackstick */
-#define ALPS_PASS               0x04    /* device has a pass-through port */
-
-#define ALPS_WHEEL              0x08    /* hardware wheel present */
-#define ALPS_FW_BK_1            0x10    /* front & back buttons present */
-#define ALPS_FW_BK_2            0x20    /* front & back buttons present */
-#define ALPS_FOUR_BUTTONS       0x40    /* 4 direction button present */
-#define ALPS_PS2_INTERLEAVED    0x80    /* 3-byte PS/2 packet interleaved with 6-byte ALPS packet */
-#define ALPS_STICK_BITS		    0x100	/* separate stick button bits */
-#define ALPS_BUTTONPAD		    0x200	/* device is a clickpad */
-#define ALPS_DUALPOINT_WITH_PRESSURE	0x400	/* device can report trackpoint pressure */
-
-
-static const struct alps_model_info alps_model_data[] = {
-    /*
-     * XXX This entry is suspicious. First byte has zero lower nibble,
-     * which is what a normal mouse would report. Also, the value 0x0e
-     * isn't valid per PS/2 spec.
-     */
-    { { 0x20, 0x02, 0x0e }, { ALPS_PROTO_V2, 0xf8, 0xf8, ALPS_PASS | ALPS_DUALPOINT } },
-    
-    { { 0x22, 0x02, 0x0a }, { ALPS_PROTO_V2, 0xf8, 0xf8, ALPS_PASS | ALPS_DUALPOINT } },
-    { { 0x22, 0x02, 0x14 }, { ALPS_PROTO_V2, 0xff, 0xff, ALPS_PASS | ALPS_DUALPOINT } },    /* Dell Latitude D600 */
-    { { 0x32, 0x02, 0x14 }, { ALPS_PROTO_V2, 0xf8, 0xf8, ALPS_PASS | ALPS_DUALPOINT } },    /* Toshiba Salellite Pro M10 */
-    { { 0x33, 0x02, 0x0a }, { ALPS_PROTO_V1, 0x88, 0xf8, 0 } },                /* UMAX-530T */
-    { { 0x52, 0x01, 0x14 }, { ALPS_PROTO_V2, 0xff, 0xff,
-        ALPS_PASS | ALPS_DUALPOINT | ALPS_PS2_INTERLEAVED } },                /* Toshiba Tecra A11-11L */
-    { { 0x53, 0x02, 0x0a }, { ALPS_PROTO_V2, 0xf8, 0xf8, 0 } },
-    { { 0x53, 0x02, 0x14 }, { ALPS_PROTO_V2, 0xf8, 0xf8, 0 } },
-    { { 0x60, 0x03, 0xc8 }, { ALPS_PROTO_V2, 0xf8, 0xf8, 0 } },                /* HP ze1115 */
-    { { 0x62, 0x02, 0x14 }, { ALPS_PROTO_V2, 0xcf, 0xcf,
-        ALPS_PASS | ALPS_DUALPOINT | ALPS_PS2_INTERLEAVED } },                /* Dell Latitude E5500, E6400, E6500, Precision M4400 */
-    { { 0x63, 0x02, 0x0a }, { ALPS_PROTO_V2, 0xf8, 0xf8, 0 } },
-    { { 0x63, 0x02, 0x14 }, { ALPS_PROTO_V2, 0xf8, 0xf8, 0 } },
-    { { 0x63, 0x02, 0x28 }, { ALPS_PROTO_V2, 0xf8, 0xf8, ALPS_FW_BK_2 } },            /* Fujitsu Siemens S6010 */
-    { { 0x63, 0x02, 0x3c }, { ALPS_PROTO_V2, 0x8f, 0x8f, ALPS_WHEEL } },            /* Toshiba Satellite S2400-103 */
-    { { 0x63, 0x02, 0x50 }, { ALPS_PROTO_V2, 0xef, 0xef, ALPS_FW_BK_1 } },            /* NEC Versa L320 */
-    { { 0x63, 0x02, 0x64 }, { ALPS_PROTO_V2, 0xf8, 0xf8, 0 } },
-    { { 0x63, 0x03, 0xc8 }, { ALPS_PROTO_V2, 0xf8, 0xf8, ALPS_PASS | ALPS_DUALPOINT } },    /* Dell Latitude D800 */
-    { { 0x73, 0x00, 0x0a }, { ALPS_PROTO_V2, 0xf8, 0xf8, ALPS_DUALPOINT } },        /* ThinkPad R61 8918-5QG */
-    { { 0x73, 0x00, 0x14 }, { ALPS_PROTO_V6, 0xff, 0xff, ALPS_DUALPOINT } },        /* Dell XT2 */
-    { { 0x73, 0x02, 0x0a }, { ALPS_PROTO_V2, 0xf8, 0xf8, 0 } },
-    { { 0x73, 0x02, 0x14 }, { ALPS_PROTO_V2, 0xf8, 0xf8, ALPS_FW_BK_2 } },            /* Ahtec Laptop */
-    { { 0x73, 0x02, 0x50 }, { ALPS_PROTO_V2, 0xcf, 0xcf, ALPS_FOUR_BUTTONS } },        /* Dell Vostro 1400 */
-};
-
 /*
  static const struct alps_protocol_info alps_v3_protocol_data = {
  ALPS_PROTO_V3, 0x8f, 0x8f, ALPS_DUALPOINT | ALPS_DUALPOINT_WITH_PRESSURE
@@ -256,21 +209,23 @@ bool ALPS::deviceSpecificInit() {
     // Setup expected packet size
     priv.pktsize = priv.proto_version == ALPS_PROTO_V4 ? 8 : 6;
     
-    if (!(this->*hw_init)()) {
+    uint64_t start_abs, end_abs, elapsed_ns;
+    clock_get_uptime(&start_abs);
+    bool ok = (this->*hw_init)();
+    clock_get_uptime(&end_abs);
+    absolutetime_to_nanoseconds(end_abs - start_abs, &elapsed_ns);
+    setProperty("HWInitTimeUS", elapsed_ns / 1000, 32);
+    // what identify settled on, for ioreg and the bring-up tools
+    setProperty("ProtocolVersion", priv.proto_version, 32);
+    setProperty("DeviceFlags", priv.flags, 32);
+    if (!ok) {
         goto init_fail;
     }
     
     // init my stuff
-    memset(&fingerStates, 0, MAX_TOUCHES * sizeof(struct alps_hw_state));
-    // agmFingerCount = 0;
-    lastFingerCount = 0;
-    hadLiftFinger = false;
-    wasSkipped = false;
-    for (int i = 0; i < MAX_TOUCHES; i++)
-        fingerStates[i].virtualFingerIndex = -1;
-    
-    memset(freeFingerTypes, true, kMT2FingerTypeCount);
-    freeFingerTypes[kMT2FingerTypeUndefined] = false;
+    memset(&priv.f, 0, sizeof(priv.f));
+    priv.multi_packet = 0;
+    _tracker.reset();
     
     return true;
     
@@ -319,8 +274,25 @@ bool ALPS::init(OSDictionary *dict) {
     _powerControlHandlerInstalled = false;
     _messageHandlerInstalled = false;
     _packetByteCount = 0;
+    _desyncBytes = 0;
+    _desyncTime = 0;
+    _droppedBytesTotal = 0;
     _lastdata = 0;
     _cmdGate = 0;
+    bzero(_latency, sizeof(_latency));
+    bzero(&_resync, sizeof(_resync));
+    _recoveryBadBytes = 60;
+    _recoveryWindowMS = 1000;
+    _recoveryWindow = 0;
+    bzero(&_recovery, sizeof(_recovery));
+    _recoveryTimerArmed = false;
+    _recoveryTimer = 0;
+    _packetTime = 0;
+    _dispatchTime = 0;
+#ifdef DEBUG
+    _replayEvents = 0;
+    _replayTime = 0;
+#endif
     
     // set defaults for configuration items
     
@@ -355,6 +327,7 @@ bool ALPS::init(OSDictionary *dict) {
     xrest=0;
     yrest=0;
     lastbuttons=0;
+    _bareButtons=0;
     
     // intialize state for secondary packets/extendedwmode
     xrest2=0;
@@ -387,6 +360,25 @@ bool ALPS::init(OSDictionary *dict) {
     usb_mouse_stops_trackpad = true;
     _modifierdown = 0;
     
+    _coalesceFrames = true;
+    _holdFrame = false;
+    _lastFrameHeld = false;
+    _lastSentShape = 0;
+    _maxFrameRate = 0;
+    _frameInterval = 0;
+    _lastSentTime = 0;
+    _frameTimerArmed = false;
+    _frameTimer = 0;
+    _smoothingFilter = kSmoothingBox;
+    _oneEuroMinCutoff = 1000;
+    _oneEuroBeta = 7;
+    _oneEuroDCutoff = 1000;
+    _alphaBetaAlpha = 500;
+    _alphaBetaBeta = 100;
+    _predictionTime = 0;
+    _fingerGateDistance = 1000;
+    _tracker.fingerGate = 1000000;
+    
     _forceTouchMode = FORCE_TOUCH_DISABLED;
     _forceTouchPressureThreshold = 100;
     
@@ -421,6 +413,7 @@ bool ALPS::init(OSDictionary *dict) {
     xrest=0;
     yrest=0;
     lastbuttons=0;
+    _bareButtons=0;
     
     return true;
 }
@@ -440,6 +433,14 @@ void ALPS::handleClose(IOService *forClient, IOOptionBits options) {
     super::handleClose(forClient, options);
 }
 
+bool ALPS::handleIsOpen(const IOService *forClient) const {
+    // close only calls handleClose for a client this says is open, and
+    // handleOpen keeps VoodooInput to itself
+    if (voodooInputInstance && (!forClient || forClient == voodooInputInstance))
+        return true;
+    return super::handleIsOpen(forClient);
+}
+
 bool ALPS::start( IOService * provider )
 {
     //
@@ -485,6 +486,16 @@ bool ALPS::start( IOService * provider )
     
     pWorkLoop->addEventSource(_cmdGate);
     
+    // _frameTimer sends the newest frame held back by MaxFrameRate
+    _frameTimer = IOTimerEventSource::timerEventSource(this, OSMemberFunctionCast(IOTimerEventSource::Action, this, &ALPS::onFrameTimer));
+    if (_frameTimer)
+        pWorkLoop->addEventSource(_frameTimer);
+    
+    // _recoveryTimer runs the recovery steps chosen by checkRecovery
+    _recoveryTimer = IOTimerEventSource::timerEventSource(this, OSMemberFunctionCast(IOTimerEventSource::Action, this, &ALPS::onRecoveryTimer));
+    if (_recoveryTimer)
+        pWorkLoop->addEventSource(_recoveryTimer);
+    
     //
     // Lock the controller during initialization
     //
@@ -560,6 +571,18 @@ void ALPS::stop(IOService *provider) {
             _buttonTimer->release();
             _buttonTimer = 0;
         }
+        if (_frameTimer)
+        {
+            pWorkLoop->removeEventSource(_frameTimer);
+            _frameTimer->release();
+            _frameTimer = 0;
+        }
+        if (_recoveryTimer)
+        {
+            pWorkLoop->removeEventSource(_recoveryTimer);
+            _recoveryTimer->release();
+            _recoveryTimer = 0;
+        }
         if (_cmdGate)
         {
             pWorkLoop->removeEventSource(_cmdGate);
@@ -642,9 +665,7 @@ bool ALPS::resetMouse() {
 void ALPS::alps_process_packet_v1_v2(UInt8 *packet) {
     int x, y, z, ges, fin, left, right, middle, fingers = 0;
     int back = 0, forward = 0;
-    uint64_t now_abs;
-    
-    clock_get_uptime(&now_abs);
+    uint64_t now_abs = _packetTime;
     
     if (priv.proto_version == ALPS_PROTO_V1) {
         left = packet[2] & 0x10;
@@ -720,7 +741,7 @@ void ALPS::alps_process_packet_v1_v2(UInt8 *packet) {
     f.middle = middle;
     
     // MARK: Still needs to be tested
-    alps_parse_hw_state(_ringBuffer.tail(), f);
+    alps_parse_hw_state(f);
     
     if (priv.flags & ALPS_WHEEL) {
         int scrollAmount = ((packet[2] << 1) & 0x08) - ((packet[0] >> 4) & 0x07);
@@ -730,166 +751,6 @@ void ALPS::alps_process_packet_v1_v2(UInt8 *packet) {
     }
 }
 
-static void alps_get_bitmap_points(unsigned int map,
-                                   struct alps_bitmap_point *low,
-                                   struct alps_bitmap_point *high,
-                                   int *fingers)
-{
-    struct alps_bitmap_point *point;
-    int i, bit, prev_bit = 0;
-    
-    point = low;
-    for (i = 0; map != 0; i++, map >>= 1) {
-        bit = map & 1;
-        if (bit) {
-            if (!prev_bit) {
-                point->start_bit = i;
-                point->num_bits = 0;
-                (*fingers)++;
-            }
-            point->num_bits++;
-        } else {
-            if (prev_bit)
-                point = high;
-        }
-        prev_bit = bit;
-    }
-}
-
-/*
- * Process bitmap data from semi-mt protocols. Returns the number of
- * fingers detected. A return value of 0 means at least one of the
- * bitmaps was empty.
- *
- * The bitmaps don't have enough data to track fingers, so this function
- * only generates points representing a bounding box of all contacts.
- * These points are returned in fields->mt when the return value
- * is greater than 0.
- */
-int ALPS::alps_process_bitmap(struct alps_data *priv,
-                              struct alps_fields *fields)
-{
-    
-    int i, fingers_x = 0, fingers_y = 0, fingers, closest;
-    struct alps_bitmap_point x_low = {0,}, x_high = {0,};
-    struct alps_bitmap_point y_low = {0,}, y_high = {0,};
-    struct input_mt_pos corner[4];
-    
-    
-    if (!fields->x_map || !fields->y_map) {
-        return 0;
-    }
-    
-    alps_get_bitmap_points(fields->x_map, &x_low, &x_high, &fingers_x);
-    alps_get_bitmap_points(fields->y_map, &y_low, &y_high, &fingers_y);
-    
-    /*
-     * Fingers can overlap, so we use the maximum count of fingers
-     * on either axis as the finger count.
-     */
-    fingers = max(fingers_x, fingers_y);
-    
-    /*
-     * If an axis reports only a single contact, we have overlapping or
-     * adjacent fingers. Divide the single contact between the two points.
-     */
-    if (fingers_x == 1) {
-        i = x_low.num_bits / 2;
-        x_low.num_bits = x_low.num_bits - i;
-        x_high.start_bit = x_low.start_bit + i;
-        x_high.num_bits = max(i, 1);
-    }
-    
-    if (fingers_y == 1) {
-        i = y_low.num_bits / 2;
-        y_low.num_bits = y_low.num_bits - i;
-        y_high.start_bit = y_low.start_bit + i;
-        y_high.num_bits = max(i, 1);
-    }
-    
-    /* top-left corner */
-    corner[0].x = (priv->x_max * (2 * x_low.start_bit + x_low.num_bits - 1)) /
-    (2 * (priv->x_bits - 1));
-    corner[0].y = (priv->y_max * (2 * y_low.start_bit + y_low.num_bits - 1)) /
-    (2 * (priv->y_bits - 1));
-    
-    /* top-right corner */
-    corner[1].x = (priv->x_max * (2 * x_high.start_bit + x_high.num_bits - 1)) /
-    (2 * (priv->x_bits - 1));
-    corner[1].y = (priv->y_max * (2 * y_low.start_bit + y_low.num_bits - 1)) /
-    (2 * (priv->y_bits - 1));
-    
-    /* bottom-right corner */
-    corner[2].x = (priv->x_max * (2 * x_high.start_bit + x_high.num_bits - 1)) /
-    (2 * (priv->x_bits - 1));
-    corner[2].y = (priv->y_max * (2 * y_high.start_bit + y_high.num_bits - 1)) /
-    (2 * (priv->y_bits - 1));
-    
-    /* bottom-left corner */
-    corner[3].x = (priv->x_max * (2 * x_low.start_bit + x_low.num_bits - 1)) /
-    (2 * (priv->x_bits - 1));
-    corner[3].y = (priv->y_max * (2 * y_high.start_bit + y_high.num_bits - 1)) /
-    (2 * (priv->y_bits - 1));
-    
-    /* x-bitmap order is reversed on v5 touchpads  */
-    if (priv->proto_version == ALPS_PROTO_V5) {
-        for (i = 0; i < 4; i++)
-            corner[i].x = priv->x_max - corner[i].x;
-    }
-    
-    /* y-bitmap order is reversed on v3 and v4 touchpads  */
-    if (priv->proto_version == ALPS_PROTO_V3 || priv->proto_version == ALPS_PROTO_V4) {
-        for (i = 0; i < 4; i++)
-            corner[i].y = priv->y_max - corner[i].y;
-    }
-    
-    /*
-     * We only select a corner for the second touch once per 2 finger
-     * touch sequence to avoid the chosen corner (and thus the coordinates)
-     * jumping around when the first touch is in the middle.
-     */
-    if (priv->second_touch == -1) {
-        /* Find corner closest to our st coordinates */
-        closest = 0x7fffffff;
-        for (i = 0; i < 4; i++) {
-            int dx = fields->st.x - corner[i].x;
-            int dy = fields->st.y - corner[i].y;
-            int distance = dx * dx + dy * dy;
-            
-            if (distance < closest) {
-                priv->second_touch = i;
-                closest = distance;
-            }
-        }
-        /* And select the opposite corner to use for the 2nd touch */
-        priv->second_touch = (priv->second_touch + 2) % 4;
-    }
-    
-    fields->mt[0] = fields->st;
-    fields->mt[1] = corner[priv->second_touch];
-    
-#if DEBUG
-    IOLog("ALPS: BITMAP\n");
-    
-    unsigned int ymap = fields->y_map;
-    
-    for (int i = 0; ymap != 0; i++, ymap >>= 1) {
-        unsigned int xmap = fields->x_map;
-        char bitLog[160];
-        strlcpy(bitLog, "ALPS: ", sizeof("ALPS: ") + 1);
-        
-        for (int j = 0; xmap != 0; j++, xmap >>= 1) {
-            strcat(bitLog, (ymap & 1 && xmap & 1) ? "1 " : "0 ");
-        }
-        
-        IOLog("%s\n", bitLog);
-    }
-    
-    IOLog("ALPS: Process Bitmap, Corner=%d, Fingers=%d, x1=%d, x2=%d, y1=%d, y2=%d xmap=%d ymap=%d\n", priv->second_touch, fingers, fields->mt[0].x, fields->mt[1].x, fields->mt[0].y, fields->mt[1].y, fields->x_map, fields->y_map);
-#endif // DEBUG
-    return fingers;
-}
-
 void ALPS::alps_process_trackstick_packet_v3(UInt8 *packet) {
     int x, y, z, left, right, middle;
     uint64_t now_abs;
@@ -929,7 +790,7 @@ void ALPS::alps_process_trackstick_packet_v3(UInt8 *packet) {
     /* To get proper movement direction */
     y = -y;
     
-    clock_get_uptime(&now_abs);
+    now_abs = _packetTime;
     
     /*
      * Most ALPS models report the trackstick buttons in the touchpad
@@ -969,98 +830,7 @@ void ALPS::alps_process_trackstick_packet_v3(UInt8 *packet) {
     }
 }
 
-bool ALPS::alps_decode_buttons_v3(struct alps_fields *f, unsigned char *p) {
-    f->left = !!(p[3] & 0x01);
-    f->right = !!(p[3] & 0x02);
-    f->middle = !!(p[3] & 0x04);
-    
-    f->ts_left = !!(p[3] & 0x10);
-    f->ts_right = !!(p[3] & 0x20);
-    f->ts_middle = !!(p[3] & 0x40);
-    return true;
-}
-
-bool ALPS::alps_decode_pinnacle(struct alps_fields *f, UInt8 *p) {
-    f->first_mp = !!(p[4] & 0x40);
-    f->is_mp = !!(p[0] & 0x40);
-    
-    if (f->is_mp) {
-        f->fingers = (p[5] & 0x3) + 1;
-        f->x_map = ((p[4] & 0x7e) << 8) |
-        ((p[1] & 0x7f) << 2) |
-        ((p[0] & 0x30) >> 4);
-        f->y_map = ((p[3] & 0x70) << 4) |
-        ((p[2] & 0x7f) << 1) |
-        (p[4] & 0x01);
-    } else {
-        f->st.x = ((p[1] & 0x7f) << 4) | ((p[4] & 0x30) >> 2) |
-        ((p[0] & 0x30) >> 4);
-        f->st.y = ((p[2] & 0x7f) << 4) | (p[4] & 0x0f);
-        f->pressure = p[5] & 0x7f;
-        
-        alps_decode_buttons_v3(f, p);
-    }
-    return true;
-}
-
-bool ALPS::alps_decode_rushmore(struct alps_fields *f, UInt8 *p) {
-    f->first_mp = !!(p[4] & 0x40);
-    f->is_mp = !!(p[5] & 0x40);
-    
-    if (f->is_mp) {
-        f->fingers = max((p[5] & 0x3), ((p[5] >> 2) & 0x3)) + 1;
-        f->x_map = ((p[5] & 0x10) << 11) |
-        ((p[4] & 0x7e) << 8) |
-        ((p[1] & 0x7f) << 2) |
-        ((p[0] & 0x30) >> 4);
-        f->y_map = ((p[5] & 0x20) << 6) |
-        ((p[3] & 0x70) << 4) |
-        ((p[2] & 0x7f) << 1) |
-        (p[4] & 0x01);
-    } else {
-        f->st.x = ((p[1] & 0x7f) << 4) | ((p[4] & 0x30) >> 2) |
-        ((p[0] & 0x30) >> 4);
-        f->st.y = ((p[2] & 0x7f) << 4) | (p[4] & 0x0f);
-        f->pressure = p[5] & 0x7f;
-        
-        alps_decode_buttons_v3(f, p);
-    }
-    return true;
-}
-
-bool ALPS::alps_decode_dolphin(struct alps_fields *f, UInt8 *p) {
-    uint64_t palm_data = 0;
-    
-    f->first_mp = !!(p[0] & 0x02);
-    f->is_mp = !!(p[0] & 0x20);
-    
-    if (!f->is_mp) {
-        f->st.x = ((p[1] & 0x7f) | ((p[4] & 0x0f) << 7));
-        f->st.y = ((p[2] & 0x7f) | ((p[4] & 0xf0) << 3));
-        f->pressure = (p[0] & 4) ? 0 : p[5] & 0x7f;
-        alps_decode_buttons_v3(f, p);
-    } else {
-        f->fingers = ((p[0] & 0x6) >> 1 |
-                      (p[0] & 0x10) >> 2);
-        
-        palm_data = (p[1] & 0x7f) |
-        ((p[2] & 0x7f) << 7) |
-        ((p[4] & 0x7f) << 14) |
-        ((p[5] & 0x7f) << 21) |
-        ((p[3] & 0x07) << 28) |
-        (((uint64_t)p[3] & 0x70) << 27) |
-        (((uint64_t)p[0] & 0x01) << 34);
-        
-        /* Y-profile is stored in P(0) to p(n-1), n = y_bits; */
-        f->y_map = palm_data & (BIT(priv.y_bits) - 1);
-        
-        /* X-profile is stored in p(n) to p(n+m-1), m = x_bits; */
-        f->x_map = (palm_data >> priv.y_bits) &
-        (BIT(priv.x_bits) - 1);
-    }
-    return true;
-}
-
+template <alps_decoder decode>
 void ALPS::alps_process_touchpad_packet_v3_v5(UInt8 *packet) {
     int fingers = 0;
     //int buttons = 0;
@@ -1068,7 +838,7 @@ void ALPS::alps_process_touchpad_packet_v3_v5(UInt8 *packet) {
     
     memset(&f, 0, sizeof(f));
     
-    (this->*decode_fields)(&f, packet);
+    decode(&priv, &f, packet);
     /*
      * There's no single feature of touchpad position and bitmap packets
      * that can be used to distinguish between them. We rely on the fact
@@ -1088,7 +858,7 @@ void ALPS::alps_process_touchpad_packet_v3_v5(UInt8 *packet) {
              * Bitmap processing uses position packet's coordinate
              * data, so we need to do decode it first.
              */
-            (this->*decode_fields)(&f, priv.multi_data);
+            decode(&priv, &f, priv.multi_data);
             if (alps_process_bitmap(&priv, &f) == 0) {
                 fingers = 0; /* Use st data */
             }
@@ -1135,18 +905,15 @@ void ALPS::alps_process_touchpad_packet_v3_v5(UInt8 *packet) {
         priv.second_touch = -1;
     }
     
-    /* Reverse y co-ordinates to have 0 at bottom for gestures to work */
-    f.mt[0].y = priv.y_max - f.mt[0].y;
-    f.mt[1].y = priv.y_max - f.mt[1].y;
-    
     /* Ignore 1 finger events after 2 finger scroll to prevent jitter */
     if (last_fingers == 2 && fingers == 1 && scrolldebounce) {
         //fingers = 2;
     }
     
-    alps_parse_hw_state(_ringBuffer.tail(), f);
+    alps_parse_hw_state(f);
 }
 
+template <alps_decoder decode>
 void ALPS::alps_process_packet_v3(UInt8 *packet) {
     /*
      * v3 protocol packets come in three types, two representing
@@ -1161,7 +928,7 @@ void ALPS::alps_process_packet_v3(UInt8 *packet) {
         return;
     }
     
-    alps_process_touchpad_packet_v3_v5(packet);
+    alps_process_touchpad_packet_v3_v5<decode>(packet);
 }
 
 void ALPS::alps_process_packet_v6(UInt8 *packet)
@@ -1170,8 +937,7 @@ void ALPS::alps_process_packet_v6(UInt8 *packet)
     // int left, right, middle;
     int buttons = 0;
     
-    uint64_t now_abs;
-    clock_get_uptime(&now_abs);
+    uint64_t now_abs = _packetTime;
     
     /*
      * We can use Byte5 to distinguish if the packet is from Touchpad
@@ -1231,210 +997,21 @@ void ALPS::alps_process_packet_v6(UInt8 *packet)
     // buttons |= left ? 0x01 : 0;
     // buttons |= right ? 0x02 : 0;
     
-    alps_parse_hw_state(_ringBuffer.tail(), f);
+    alps_parse_hw_state(f);
 }
 
 void ALPS::alps_process_packet_v4(UInt8 *packet) {
-    SInt32 offset;
-    // SInt32 fingers = 0;
-    // UInt32 buttons = 0;
-    struct alps_fields f;
-    
     /*
-     * v4 has a 6-byte encoding for bitmap data, but this data is
-     * broken up between 3 normal packets. Use priv.multi_packet to
-     * track our position in the bitmap packet.
+     * The bitmap is assembled across 3 packets in priv.f, so fingers
+     * keeps its last complete value in between.
      */
-    if (packet[6] & 0x40) {
-        /* sync, reset position */
-        priv.multi_packet = 0;
-    }
-    
-    if (priv.multi_packet > 2) {
-        return;
-    }
-    
-    offset = 2 * priv.multi_packet;
-    priv.multi_data[offset] = packet[6];
-    priv.multi_data[offset + 1] = packet[7];
-    
-    f.left = packet[4] & 0x01;
-    f.right = packet[4] & 0x02;
-    
-    f.st.x = ((packet[1] & 0x7f) << 4) | ((packet[3] & 0x30) >> 2) |
-    ((packet[0] & 0x30) >> 4);
-    f.st.y = ((packet[2] & 0x7f) << 4) | (packet[3] & 0x0f);
-    f.pressure = packet[5] & 0x7f;
-    
-    if (++priv.multi_packet > 2) {
-        priv.multi_packet = 0;
-        
-        f.x_map = ((priv.multi_data[2] & 0x1f) << 10) |
-        ((priv.multi_data[3] & 0x60) << 3) |
-        ((priv.multi_data[0] & 0x3f) << 2) |
-        ((priv.multi_data[1] & 0x60) >> 5);
-        f.y_map = ((priv.multi_data[5] & 0x01) << 10) |
-        ((priv.multi_data[3] & 0x1f) << 5) |
-        (priv.multi_data[1] & 0x1f);
-        
-        f.fingers = alps_process_bitmap(&priv, &f);
-        
-    }
-    
-    // MARK: Remove later
-    // buttons |= f.left ? 0x01 : 0;
-    // buttons |= f.right ? 0x02 : 0;
+    alps_decode_v4(&priv, packet);
     
+    struct alps_fields f = priv.f;
     f.mt[0].x = f.st.x;
     f.mt[0].y = f.st.y;
     
-    //f.fingers = fingers;
-    
-    alps_parse_hw_state(_ringBuffer.tail(), f);
-}
-
-unsigned char ALPS::alps_get_packet_id_v7(UInt8 *byte)
-{
-    unsigned char packet_id;
-    
-    if (byte[4] & 0x40)
-        packet_id = V7_PACKET_ID_TWO;
-    else if (byte[4] & 0x01)
-        packet_id = V7_PACKET_ID_MULTI;
-    else if ((byte[0] & 0x10) && !(byte[4] & 0x43))
-        packet_id = V7_PACKET_ID_NEW;
-    else if (byte[1] == 0x00 && byte[4] == 0x00)
-        packet_id = V7_PACKET_ID_IDLE;
-    else
-        packet_id = V7_PACKET_ID_UNKNOWN;
-    
-    return packet_id;
-}
-
-void ALPS::alps_get_finger_coordinate_v7(struct input_mt_pos *mt,
-                                         UInt8 *pkt,
-                                         UInt8 pkt_id)
-{
-    mt[0].x = ((pkt[2] & 0x80) << 4);
-    mt[0].x |= ((pkt[2] & 0x3F) << 5);
-    mt[0].x |= ((pkt[3] & 0x30) >> 1);
-    mt[0].x |= (pkt[3] & 0x07);
-    mt[0].y = (pkt[1] << 3) | (pkt[0] & 0x07);
-    
-    mt[1].x = ((pkt[3] & 0x80) << 4);
-    mt[1].x |= ((pkt[4] & 0x80) << 3);
-    mt[1].x |= ((pkt[4] & 0x3F) << 4);
-    mt[1].y = ((pkt[5] & 0x80) << 3);
-    mt[1].y |= ((pkt[5] & 0x3F) << 4);
-    
-    switch (pkt_id) {
-        case V7_PACKET_ID_TWO:
-            mt[1].x &= ~0x000F;
-            mt[1].y |= 0x000F;
-            /* Detect false-positive touches where x & y report max value */
-            if (mt[1].y == 0x7ff && mt[1].x == 0xff0)
-                mt[1].x = 0;
-            /* y gets set to 0 at the end of this function */
-            break;
-            
-        case V7_PACKET_ID_MULTI:
-            mt[1].x &= ~0x003F;
-            mt[1].y &= ~0x0020;
-            mt[1].y |= ((pkt[4] & 0x02) << 4);
-            mt[1].y |= 0x001F;
-            break;
-            
-        case V7_PACKET_ID_NEW:
-            mt[1].x &= ~0x003F;
-            mt[1].x |= (pkt[0] & 0x20);
-            mt[1].y |= 0x000F;
-            break;
-    }
-    
-    mt[0].y = 0x7FF - mt[0].y;
-    mt[1].y = 0x7FF - mt[1].y;
-}
-
-int ALPS::alps_get_mt_count(struct input_mt_pos *mt)
-{
-    int i, fingers = 0;
-    
-    for (i = 0; i < MAX_TOUCHES; i++) {
-        if (mt[i].x != 0 || mt[i].y != 0)
-            fingers++;
-    }
-    
-    return fingers;
-}
-
-bool ALPS::alps_decode_packet_v7(struct alps_fields *f, UInt8 *p){
-    //IOLog("Decode V7 touchpad Packet... 0x%x 0x%x 0x%x 0x%x 0x%x 0x%x\n", p[0], p[1], p[2], p[3], p[4], p[5]);
-    
-    unsigned char pkt_id;
-    
-    pkt_id = alps_get_packet_id_v7(p);
-    if (pkt_id == V7_PACKET_ID_IDLE) {
-        DEBUG_LOG("ALPS: V7_PACKET_ID_IDLE\n");
-        return true;
-    }
-    if (pkt_id == V7_PACKET_ID_UNKNOWN) {
-        DEBUG_LOG("ALPS: V7_PACKET_ID_UNKNOWN\n");
-        return false;
-    }
-    
-    /*
-     * NEW packets are send to indicate a discontinuity in the finger
-     * coordinate reporting. Specifically a finger may have moved from
-     * slot 0 to 1 or vice versa. INPUT_MT_TRACK takes care of this for
-     * us.
-     *
-     * NEW packets have 3 problems:
-     * 1) They do not contain middle / right button info (on non clickpads)
-     *    this can be worked around by preserving the old button state
-     * 2) They do not contain an accurate fingercount, and they are
-     *    typically send when the number of fingers changes. We cannot use
-     *    the old finger count as that may mismatch with the amount of
-     *    touch coordinates we've available in the NEW packet
-     * 3) Their x data for the second touch is inaccurate leading to
-     *    a possible jump of the x coordinate by 16 units when the first
-     *    non NEW packet comes in
-     * Since problems 2 & 3 cannot be worked around, just ignore them.
-     */
-    if (pkt_id == V7_PACKET_ID_NEW) {
-        DEBUG_LOG("ALPS: V7_PACKET_ID_NEW\n");
-        return true;
-    }
-    
-    alps_get_finger_coordinate_v7(f->mt, p, pkt_id);
-    
-    if (pkt_id == V7_PACKET_ID_TWO) {
-        DEBUG_LOG("ALPS: V7_PACKET_ID_TWO\n");
-        f->fingers = alps_get_mt_count(f->mt);
-    }
-    else { /* pkt_id == V7_PACKET_ID_MULTI */
-        DEBUG_LOG("ALPS: V7_PACKET_ID_MULTI\n");
-        f->fingers = 3 + (p[5] & 0x03);
-    }
-    
-    f->left = (p[0] & 0x80) >> 7;
-    if (priv.flags & ALPS_BUTTONPAD) {
-        if (p[0] & 0x20)
-            f->fingers++;
-        if (p[0] & 0x10)
-            f->fingers++;
-    } else {
-        f->right = (p[0] & 0x20) >> 5;
-        f->middle = (p[0] & 0x10) >> 4;
-    }
-    
-    /* Sometimes a single touch is reported in mt[1] rather then mt[0] */
-    if (f->fingers == 1 && f->mt[0].x == 0 && f->mt[0].y == 0) {
-        f->mt[0].x = f->mt[1].x;
-        f->mt[0].y = f->mt[1].y;
-        f->mt[1].x = 0;
-        f->mt[1].y = 0;
-    }
-    return true;
+    alps_parse_hw_state(f);
 }
 
 void ALPS::alps_process_trackstick_packet_v7(UInt8 *packet)
@@ -1442,8 +1019,7 @@ void ALPS::alps_process_trackstick_packet_v7(UInt8 *packet)
     int x, y, z, left, right, middle;
     int buttons = 0;
     
-    uint64_t now_abs;
-    clock_get_uptime(&now_abs);
+    uint64_t now_abs = _packetTime;
     
     /* It should be a DualPoint when received trackstick packet */
     if (!(priv.flags & ALPS_DUALPOINT)) {
@@ -1481,7 +1057,10 @@ void ALPS::alps_process_trackstick_packet_v7(UInt8 *packet)
 void ALPS::alps_process_touchpad_packet_v7(UInt8 *packet){
     struct alps_fields f;
     
-    alps_parse_hw_state(_ringBuffer.tail(), f);
+    memset(&f, 0, sizeof(f));
+    alps_decode_packet_v7(&priv, &f, packet);
+    
+    alps_parse_hw_state(f);
 }
 
 void ALPS::alps_process_packet_v7(UInt8 *packet){
@@ -1491,191 +1070,16 @@ void ALPS::alps_process_packet_v7(UInt8 *packet){
         alps_process_touchpad_packet_v7(packet);
 }
 
-unsigned char ALPS::alps_get_pkt_id_ss4_v2(UInt8 *byte)
-{
-    unsigned char pkt_id = SS4_PACKET_ID_IDLE;
-    
-    switch (byte[3] & 0x30) {
-        case 0x00:
-            if (SS4_IS_IDLE_V2(byte)) {
-                pkt_id = SS4_PACKET_ID_IDLE;
-            } else {
-                pkt_id = SS4_PACKET_ID_ONE;
-            }
-            break;
-        case 0x10:
-            /* two-finger finger positions */
-            pkt_id = SS4_PACKET_ID_TWO;
-            break;
-        case 0x20:
-            /* stick pointer */
-            pkt_id = SS4_PACKET_ID_STICK;
-            break;
-        case 0x30:
-            /* third and fourth finger positions */
-            pkt_id = SS4_PACKET_ID_MULTI;
-            break;
-    }
-    
-    return pkt_id;
-}
-
-bool ALPS::alps_decode_ss4_v2(struct alps_fields *f, UInt8 *p){
-    
-    //struct alps_data *priv;
-    unsigned char pkt_id;
-    unsigned int no_data_x, no_data_y;
-    uint64_t now_abs;
-    clock_get_uptime(&now_abs);
-    
-    pkt_id = alps_get_pkt_id_ss4_v2(p);
-    
-    /* Current packet is 1Finger coordinate packet */
-    switch (pkt_id) {
-        case SS4_PACKET_ID_ONE:
-            DEBUG_LOG("ALPS: SS4_PACKET_ID_ONE\n");
-            f->mt[0].x = SS4_1F_X_V2(p);
-            f->mt[0].y = SS4_1F_Y_V2(p);
-            DEBUG_LOG("ALPS: Coordinates for SS4_PACKET_ID_ONE: %dx%d\n", f->mt[0].x, f->mt[0].y);
-            f->pressure = ((SS4_1F_Z_V2(p)) * 2) & 0x7f;
-            /*
-             * When a button is held the device will give us events
-             * with x, y, and pressure of 0. This causes annoying jumps
-             * if a touch is released while the button is held.
-             * Handle this by claiming zero contacts.
-             */
-            f->fingers = f->pressure > 0 ? 1 : 0;
-            f->first_mp = 0;
-            f->is_mp = 0;
-            break;
-            
-        case SS4_PACKET_ID_TWO:
-            DEBUG_LOG("ALPS: SS4_PACKET_ID_TWO\n");
-            if (priv.flags & ALPS_BUTTONPAD) {
-                if (IS_SS4PLUS_DEV(priv.dev_id)) {
-                    f->mt[0].x = SS4_PLUS_BTL_MF_X_V2(p, 0);
-                    f->mt[1].x = SS4_PLUS_BTL_MF_X_V2(p, 1);
-                } else {
-                    f->mt[0].x = SS4_BTL_MF_X_V2(p, 0);
-                    f->mt[1].x = SS4_BTL_MF_X_V2(p, 1);
-                }
-                f->mt[0].y = SS4_BTL_MF_Y_V2(p, 0);
-                f->mt[1].y = SS4_BTL_MF_Y_V2(p, 1);
-            } else {
-                if (IS_SS4PLUS_DEV(priv.dev_id)) {
-                    f->mt[0].x = SS4_PLUS_STD_MF_X_V2(p, 0);
-                    f->mt[1].x = SS4_PLUS_STD_MF_X_V2(p, 1);
-                } else {
-                    f->mt[0].x = SS4_STD_MF_X_V2(p, 0);
-                    f->mt[1].x = SS4_STD_MF_X_V2(p, 1);
-                }
-                f->mt[0].y = SS4_STD_MF_Y_V2(p, 0);
-                f->mt[1].y = SS4_STD_MF_Y_V2(p, 1);
-            }
-            DEBUG_LOG("ALPS: Coordinates for SS4_PACKET_ID_TWO: %dx%d\n", f->mt[0].x, f->mt[0].y);
-            f->pressure = SS4_MF_Z_V2(p, 0) ? 0x30 : 0;
-            
-            if (SS4_IS_MF_CONTINUE(p)) {
-                f->first_mp = 1;
-            } else {
-                f->fingers = 2;
-                f->first_mp = 0;
-            }
-            f->is_mp = 0;
-            
-            break;
-            
-        case SS4_PACKET_ID_MULTI:
-            DEBUG_LOG("ALPS: SS4_PACKET_ID_MULTI\n");
-            if (priv.flags & ALPS_BUTTONPAD) {
-                if (IS_SS4PLUS_DEV(priv.dev_id)) {
-                    f->mt[2].x = SS4_PLUS_BTL_MF_X_V2(p, 0);
-                    f->mt[3].x = SS4_PLUS_BTL_MF_X_V2(p, 1);
-                    no_data_x = SS4_PLUS_MFPACKET_NO_AX_BL;
-                } else {
-                    f->mt[2].x = SS4_BTL_MF_X_V2(p, 0);
-                    f->mt[3].x = SS4_BTL_MF_X_V2(p, 1);
-                    no_data_x = SS4_MFPACKET_NO_AX_BL;
-                }
-                no_data_y = SS4_MFPACKET_NO_AY_BL;
-                
-                f->mt[2].y = SS4_BTL_MF_Y_V2(p, 0);
-                f->mt[3].y = SS4_BTL_MF_Y_V2(p, 1);
-            } else {
-                if (IS_SS4PLUS_DEV(priv.dev_id)) {
-                    f->mt[2].x = SS4_PLUS_STD_MF_X_V2(p, 0);
-                    f->mt[3].x = SS4_PLUS_STD_MF_X_V2(p, 1);
-                    no_data_x = SS4_PLUS_MFPACKET_NO_AX;
-                } else {
-                    f->mt[2].x = SS4_STD_MF_X_V2(p, 0);
-                    f->mt[3].x = SS4_STD_MF_X_V2(p, 1);
-                    no_data_x = SS4_MFPACKET_NO_AX;
-                }
-                no_data_y = SS4_MFPACKET_NO_AY;
-                
-                f->mt[2].y = SS4_STD_MF_Y_V2(p, 0);
-                f->mt[3].y = SS4_STD_MF_Y_V2(p, 1);
-            }
-            
-            f->first_mp = 0;
-            f->is_mp = 1;
-            
-            if (SS4_IS_5F_DETECTED(p)) {
-                f->fingers = 5;
-            } else if (f->mt[3].x == no_data_x &&
-                       f->mt[3].y == no_data_y) {
-                f->mt[3].x = 0;
-                f->mt[3].y = 0;
-                f->fingers = 3;
-            } else {
-                f->fingers = 4;
-            }
-            break;
-            
-        case SS4_PACKET_ID_STICK:
-            DEBUG_LOG("ALPS: SS4_PACKET_ID_STICK\n");
-            /*
-             * x, y, and pressure are decoded in
-             * alps_process_packet_ss4_v2()
-             */
-            f->first_mp = 0;
-            f->is_mp = 0;
-            break;
-            
-        case SS4_PACKET_ID_IDLE:
-        default:
-            memset(f, 0, sizeof(struct alps_fields));
-            break;
-    }
-    
-    /* handle buttons */
-    if (pkt_id == SS4_PACKET_ID_STICK) {
-        f->ts_left = !!(SS4_BTN_V2(p) & 0x01);
-        // TODO: Check if this statement is needed
-        //if (!(priv.flags & ALPS_BUTTONPAD)) {
-        f->ts_right = !!(SS4_BTN_V2(p) & 0x02);
-        f->ts_middle = !!(SS4_BTN_V2(p) & 0x04);
-        //}
-    } else {
-        f->left = !!(SS4_BTN_V2(p) & 0x01);
-        if (!(priv.flags & ALPS_BUTTONPAD)) {
-            f->right = !!(SS4_BTN_V2(p) & 0x02);
-            f->middle = !!(SS4_BTN_V2(p) & 0x04);
-        }
-    }
-    return true;
-}
-
+template <alps_decoder decode>
 void ALPS::alps_process_packet_ss4_v2(UInt8 *packet) {
     int buttons = 0;
     struct alps_fields f;
     int x, y, pressure;
     
-    uint64_t now_abs;
-    clock_get_uptime(&now_abs);
+    uint64_t now_abs = _packetTime;
     
     memset(&f, 0, sizeof(struct alps_fields));
-    (this->*decode_fields)(&f, packet);
+    decode(&priv, &f, packet);
     if (priv.multi_packet) {
         /*
          * Sometimes the first packet will indicate a multi-packet
@@ -1685,7 +1089,7 @@ void ALPS::alps_process_packet_ss4_v2(UInt8 *packet) {
          */
         if (f.is_mp) {
             /* Now process the 1st packet */
-            (this->*decode_fields)(&f, priv.multi_data);
+            decode(&priv, &f, priv.multi_data);
         } else {
             priv.multi_packet = 0;
         }
@@ -1745,25 +1149,18 @@ void ALPS::alps_process_packet_ss4_v2(UInt8 *packet) {
     //buttons |= f.right ? 0x02 : 0;
     //buttons |= f.middle ? 0x04 : 0;
     
-    /* Reverse y co-ordinates to have 0 at bottom for gestures to work */
-    f.mt[0].y = priv.y_max - f.mt[0].y;
-    f.mt[1].y = priv.y_max - f.mt[1].y;
-    
     DEBUG_LOG("ALPS: There are currently %d fingers in alps_process_packet_ss4_v2\n", f.fingers);
     
-    // TODO: maybe move this to alps_parse_hw_state
-    // scale x & y to the axis which has the most resolution
-    if (xupmm < yupmm) {
-        f.mt[0].x = f.mt[0].x * yupmm / xupmm;
-    } else if (xupmm > yupmm) {
-        f.mt[0].y = f.mt[0].y * xupmm / yupmm;
-    }
-    
-    /* Dr Hurt: Scale all touchpads' axes to 6000 to be able to the same divisors for all models */
-    f.mt[0].x *= (6000 / ((priv.x_max + priv.y_max)/2));
-    f.mt[1].y *= (6000 / ((priv.x_max + priv.y_max)/2));
-    
-    alps_parse_hw_state(_ringBuffer.tail(), f);
+    alps_parse_hw_state(f);
+}
+
+inline void ALPS::stampPacket(UInt8* packet) {
+    clock_get_uptime((uint64_t*)(&packet[kPacketTimeOffset]));
+#ifdef DEBUG
+    // replayed packets carry the time they were originally captured
+    if (_replayEvents)
+        *(uint64_t*)(&packet[kPacketTimeOffset]) = _replayTime;
+#endif
 }
 
 PS2InterruptResult ALPS::interruptOccurred(UInt8 data) {
@@ -1775,84 +1172,111 @@ PS2InterruptResult ALPS::interruptOccurred(UInt8 data) {
     
     UInt8 *packet = _ringBuffer.head();
     
-    /* Save first packet */
-    if (0 == _packetByteCount) {
-        packet[0] = data;
-    }
-    
-    /* Reset PSMOUSE_BAD_DATA flag */
-    priv.PSMOUSE_BAD_DATA = false;
+    if (!_packetByteCount)
+        stampPacket(packet);
+    packet[_packetByteCount] = data;
     
-    /*
-     * Check if we are dealing with a bare PS/2 packet, presumably from
-     * a device connected to the external PS/2 port. Because bare PS/2
-     * protocol does not have enough constant bits to self-synchronize
-     * properly we only do this if the device is fully synchronized.
-     * Can not distinguish V8's first byte from PS/2 packet's
-     */
-    if (priv.proto_version != ALPS_PROTO_V8 &&
-        (packet[0] & 0xc8) == 0x08) {
-        if (_packetByteCount == 3) {
-            DEBUG_LOG("ALPS: V8: Dealing with bare PS/2 packet");
-            //dispatchRelativePointerEventWithPacket(packet, kPacketLengthSmall); //Dr Hurt: allow this?
-            priv.PSMOUSE_BAD_DATA = true;
-            _ringBuffer.advanceHead(priv.pktsize);
+    UInt8 status;
+    switch (alps_check_packet_sync(&priv, packet, _packetByteCount + 1)) {
+        case ALPS_SYNC_PS2:
+        case ALPS_SYNC_INTERLEAVED:
+            _packetByteCount++;
+            return kPS2IR_packetBuffering;
+            
+        case ALPS_SYNC_PS2_DONE:
+            status = kPacketStatusBare;
+            break;
+            
+        case ALPS_SYNC_INTERLEAVED_PS2: {
+            // queue bytes 3-5 on their own, the 7th byte is the ALPS 4th
+            UInt8 head[4] = {packet[0], packet[1], packet[2], packet[6]};
+            uint64_t time = *(uint64_t*)(&packet[kPacketTimeOffset]);
+            memmove(packet, packet + 3, 3);
+            stampPacket(packet);
+            queuePacket(packet, kPacketStatusInterleaved);
+            packet = _ringBuffer.head();
+            memcpy(packet, head, sizeof(head));
+            // the 4th bit is normally 1, clear it so this is not taken
+            // for an interleaved packet again when all buttons are down
+            packet[3] &= 0xf7;
+            *(uint64_t*)(&packet[kPacketTimeOffset]) = time;
+            _packetByteCount = 4;
             return kPS2IR_packetReady;
         }
-        packet[_packetByteCount++] = data;
-        return kPS2IR_packetBuffering;
-    }
-    
-    /* Check for PS/2 packet stuffed in the middle of ALPS packet. */
-    if ((priv.flags & ALPS_PS2_INTERLEAVED) &&
-        _packetByteCount >= 4 && (packet[3] & 0x0f) == 0x0f) {
-        priv.PSMOUSE_BAD_DATA = true;
-        _ringBuffer.advanceHead(priv.pktsize);
-        return kPS2IR_packetReady;
-    }
-    
-    /* alps_is_valid_first_byte */
-    if ((packet[0] & priv.mask0) != priv.byte0) {
-        priv.PSMOUSE_BAD_DATA = true;
-        _ringBuffer.advanceHead(priv.pktsize);
-        return kPS2IR_packetReady;
-    }
-    
-    /* Bytes 2 - pktsize should have 0 in the highest bit */
-    if (priv.proto_version < ALPS_PROTO_V5 &&
-        _packetByteCount >= 2 && _packetByteCount <= priv.pktsize &&
-        (packet[_packetByteCount - 1] & 0x80)) {
-        priv.PSMOUSE_BAD_DATA = true;
-        _ringBuffer.advanceHead(priv.pktsize);
-        return kPS2IR_packetReady;
-    }
-    
-    /* alps_is_valid_package_v7 */
-    if (priv.proto_version == ALPS_PROTO_V7 &&
-        (((_packetByteCount == 3) && ((packet[2] & 0x40) != 0x40)) ||
-         ((_packetByteCount == 4) && ((packet[3] & 0x48) != 0x48)) ||
-         ((_packetByteCount == 6) && ((packet[5] & 0x40) != 0x0)))) {
-        priv.PSMOUSE_BAD_DATA = true;
-        _ringBuffer.advanceHead(priv.pktsize);
-        return kPS2IR_packetReady;
-    }
-    
-    /* alps_is_valid_package_ss4_v2 */
-    if (priv.proto_version == ALPS_PROTO_V8 &&
-        ((_packetByteCount == 4 && ((packet[3] & 0x08) != 0x08)) ||
-         (_packetByteCount == 6 && ((packet[5] & 0x10) != 0x0)))) {
-        priv.PSMOUSE_BAD_DATA = true;
-        _ringBuffer.advanceHead(priv.pktsize);
-        return kPS2IR_packetReady;
+            
+        case ALPS_SYNC_INTERLEAVED_NEXT: {
+            // bytes 0-5 were a whole ALPS packet, the 7th starts the next
+            UInt8 next = packet[6];
+            queuePacket(packet, kPacketStatusOK);
+            packet = _ringBuffer.head();
+            stampPacket(packet);
+            packet[0] = next;
+            _packetByteCount = 1;
+            return kPS2IR_packetReady;
+        }
+            
+        case ALPS_SYNC_BAD: {
+            //
+            // Drop only the bytes before the next one that can start a
+            // packet, so that a lost or interleaved byte costs about one
+            // packet instead of everything up to the next header that
+            // happens to fall on a packet boundary.
+            //
+            unsigned count = _packetByteCount + 1;
+            unsigned skip = alps_resync_offset(&priv, packet, count);
+            if (!_desyncBytes)
+                _desyncTime = *(uint64_t*)(&packet[kPacketTimeOffset]);
+            _desyncBytes += skip;
+            _droppedBytesTotal += skip;
+            _packetByteCount = count - skip;
+            if (_packetByteCount) {
+                memmove(packet, packet + skip, _packetByteCount);
+                stampPacket(packet);    // close enough, it is within a packet time
+            }
+            // let packetReady see the drop (see checkRecovery)
+            return kPS2IR_packetReady;
+        }
+            
+        case ALPS_SYNC_OK:
+        default:
+            if (++_packetByteCount < priv.pktsize)
+                return kPS2IR_packetBuffering;
+            status = kPacketStatusOK;
+            break;
     }
     
-    packet[_packetByteCount++] = data;
-    if (_packetByteCount == priv.pktsize)
-    {
-        _ringBuffer.advanceHead(priv.pktsize);
-        return kPS2IR_packetReady;
-    }
-    return kPS2IR_packetBuffering;
+    queuePacket(packet, status);
+    return kPS2IR_packetReady;
+}
+
+inline void ALPS::queuePacket(UInt8* packet, UInt8 status) {
+    // the first packet after lost sync reports what it cost
+    *(UInt32*)(&packet[kPacketDroppedOffset]) = _desyncBytes;
+    *(uint64_t*)(&packet[kPacketDesyncOffset]) = _desyncTime;
+    if (status == kPacketStatusOK)
+        _desyncBytes = 0;
+    
+    /*
+     * Queue the packet, marked with how it ended, and start the next one
+     * right here. packetReady may run much later and must not touch the
+     * byte count, or bytes arriving in between would be lost.
+     */
+    packet[kPacketStatusOffset] = status;
+    _packetByteCount = 0;
+    _ringBuffer.advanceHead(kPacketStride);
+}
+
+void ALPS::dispatchBarePacket(const UInt8* packet, bool reportButtons) {
+    // alps_report_bare_ps2_packet in Linux: 9 bit deltas, sign in byte 0
+    int dx = packet[1] ? packet[1] - ((packet[0] << 4) & 0x100) : 0;
+    int dy = packet[2] ? ((packet[0] << 3) & 0x100) - packet[2] : 0;
+    
+    // the device has its own buttons, an interleaved packet does not tell them
+    if (reportButtons)
+        _bareButtons = packet[0] & 0x07;
+    
+    DEBUG_LOG("ALPS: bare PS/2 packet: dx=%d, dy=%d, buttons=%d\n", dx, dy, (int)_bareButtons);
+    dispatchRelativePointerEventX(dx, dy, _bareButtons, _packetTime);
 }
 
 bool ALPS::alps_command_mode_send_nibble(int nibble) {
@@ -2501,7 +1925,7 @@ bool ALPS::alps_get_v3_v7_resolution(int reg_pitch)
     
     reg = alps_command_mode_read_reg(reg_pitch);
     if (reg < 0)
-        return reg;
+        return false;
     
     x_pitch = (char)(reg << 4) >> 4; /* sign extend lower 4 bits */
     x_pitch = 50 + 2 * x_pitch; /* In 0.1 mm units */
@@ -2511,7 +1935,7 @@ bool ALPS::alps_get_v3_v7_resolution(int reg_pitch)
     
     reg = alps_command_mode_read_reg(reg_pitch + 1);
     if (reg < 0)
-        return reg;
+        return false;
     
     x_electrode = (char)(reg << 4) >> 4; /* sign extend lower 4 bits */
     x_electrode = 17 + x_electrode;
@@ -2548,7 +1972,7 @@ bool ALPS::alps_hw_init_rushmore_v3() {
         goto error;
     }
     
-    if (alps_get_v3_v7_resolution(0xc2da))
+    if (!alps_get_v3_v7_resolution(0xc2da))
         goto error;
     
     regVal = alps_command_mode_read_reg(0xc2c6);
@@ -2777,28 +2201,7 @@ void ALPS::alps_update_device_area_ss4_v2(unsigned char otp[][4], struct alps_da
     //logical_max_x = x_phys;
     //logical_max_y = y_phys;
     
-    physical_max_x = priv->x_max * manual_x_phy;
-    physical_max_y = priv->y_max * manual_y_phy;
-    
-    logical_max_x = priv->x_max * manual_x_log;
-    logical_max_y = priv->y_max * manual_y_log;
-    
-    setProperty(VOODOO_INPUT_LOGICAL_MAX_X_KEY, logical_max_x - logical_min_x, 32);
-    setProperty(VOODOO_INPUT_LOGICAL_MAX_Y_KEY, logical_max_y - logical_min_y, 32);
-    
-    setProperty(VOODOO_INPUT_PHYSICAL_MAX_X_KEY, physical_max_x, 32);
-    setProperty(VOODOO_INPUT_PHYSICAL_MAX_Y_KEY, physical_max_y, 32);
-    
-    setProperty(VOODOO_INPUT_TRANSFORM_KEY, 0ull, 32);
-    setProperty("VoodooInputSupported", kOSBooleanTrue);
-    
-    registerService();
-    
-    DEBUG_LOG("VoodooPS2Trackpad: logical %dx%d-%dx%d physical_max %dx%d upmm %dx%d",
-              logical_min_x, logical_min_y,
-              logical_max_x, logical_max_y,
-              physical_max_x, physical_max_y,
-              xupmm, yupmm);
+    set_resolution(priv->x_max, priv->y_max);
 }
 
 void ALPS::alps_update_btn_info_ss4_v2(unsigned char otp[][4], struct alps_data *priv)
@@ -2988,6 +2391,9 @@ void ALPS::set_protocol() {
     priv.x_bits = 15;
     priv.y_bits = 11;
     
+    // V7 and SS4 set it in set_resolution, V1-V5 below
+    _resolutionX = _resolutionY = 0;
+    
     switch (priv.proto_version) {
         case ALPS_PROTO_V1:
         case ALPS_PROTO_V2:
@@ -3000,9 +2406,8 @@ void ALPS::set_protocol() {
             
         case ALPS_PROTO_V3:
             hw_init = &ALPS::alps_hw_init_v3;
-            process_packet = &ALPS::alps_process_packet_v3;
+            process_packet = &ALPS::alps_process_packet_v3<alps_decode_pinnacle>;
             //set_abs_params = alps_set_abs_params_semi_mt;
-            decode_fields = &ALPS::alps_decode_pinnacle;
             priv.nibble_commands = alps_v3_nibble_commands;
             priv.addr_command = kDP_MouseResetWrap;
             
@@ -3016,9 +2421,8 @@ void ALPS::set_protocol() {
             
         case ALPS_PROTO_V3_RUSHMORE:
             hw_init = &ALPS::alps_hw_init_rushmore_v3;
-            process_packet = &ALPS::alps_process_packet_v3;
+            process_packet = &ALPS::alps_process_packet_v3<alps_decode_rushmore>;
             //set_abs_params = alps_set_abs_params_semi_mt;
-            decode_fields = &ALPS::alps_decode_rushmore;
             priv.nibble_commands = alps_v3_nibble_commands;
             priv.addr_command = kDP_MouseResetWrap;
             priv.x_bits = 16;
@@ -3042,8 +2446,7 @@ void ALPS::set_protocol() {
             
         case ALPS_PROTO_V5:
             hw_init = &ALPS::alps_hw_init_dolphin_v1;
-            process_packet = &ALPS::alps_process_touchpad_packet_v3_v5;
-            decode_fields = &ALPS::alps_decode_dolphin;
+            process_packet = &ALPS::alps_process_touchpad_packet_v3_v5<alps_decode_dolphin>;
             //set_abs_params = alps_set_abs_params_semi_mt;
             priv.nibble_commands = alps_v3_nibble_commands;
             priv.addr_command = kDP_MouseResetWrap;
@@ -3078,7 +2481,6 @@ void ALPS::set_protocol() {
         case ALPS_PROTO_V7:
             hw_init = &ALPS::alps_hw_init_v7;
             process_packet = &ALPS::alps_process_packet_v7;
-            decode_fields = &ALPS::alps_decode_packet_v7;
             //set_abs_params = alps_set_abs_params_v7;
             priv.nibble_commands = alps_v3_nibble_commands;
             priv.addr_command = kDP_MouseResetWrap;
@@ -3088,7 +2490,7 @@ void ALPS::set_protocol() {
             priv.x_max = 0xfff;
             priv.y_max = 0x7ff;
             
-            set_resolution();
+            set_resolution(priv.x_max * 4, priv.y_max * 4.5);
             
             if (priv.fw_ver[1] != 0xba){
                 priv.flags |= ALPS_BUTTONPAD;
@@ -3105,8 +2507,6 @@ void ALPS::set_protocol() {
             
         case ALPS_PROTO_V8:
             hw_init = &ALPS::alps_hw_init_ss4_v2;
-            process_packet = &ALPS::alps_process_packet_ss4_v2;
-            decode_fields = &ALPS::alps_decode_ss4_v2;
             //set_abs_params = alps_set_abs_params_ss4_v2;
             priv.nibble_commands = alps_v3_nibble_commands;
             priv.addr_command = kDP_MouseResetWrap;
@@ -3132,51 +2532,38 @@ void ALPS::set_protocol() {
             }
             
             alps_set_defaults_ss4_v2(&priv);
+            // dev_id and ALPS_BUTTONPAD are final now, pick the decoder variant
+            if (IS_SS4PLUS_DEV(priv.dev_id)) {
+                if (priv.flags & ALPS_BUTTONPAD)
+                    process_packet = &ALPS::alps_process_packet_ss4_v2<alps_decode_ss4_v2<true, true> >;
+                else
+                    process_packet = &ALPS::alps_process_packet_ss4_v2<alps_decode_ss4_v2<true, false> >;
+            } else {
+                if (priv.flags & ALPS_BUTTONPAD)
+                    process_packet = &ALPS::alps_process_packet_ss4_v2<alps_decode_ss4_v2<false, true> >;
+                else
+                    process_packet = &ALPS::alps_process_packet_ss4_v2<alps_decode_ss4_v2<false, false> >;
+            }
             break;
     }
-}
-
-bool ALPS::matchTable(ALPSStatus_t *e7, ALPSStatus_t *ec) {
-    const struct alps_model_info *model;
-    int i;
     
-    IOLog("ALPS: Touchpad with Signature { %d, %d, %d }", e7->bytes[0], e7->bytes[1], e7->bytes[2]);
+    // x/y_max and x/y_bits are final for the semi-MT bitmap decoding
+    alps_set_bitmap_scale(&priv);
     
-    for (i = 0; i < ARRAY_SIZE(alps_model_data); i++) {
-        model = &alps_model_data[i];
-        
-        if (!memcmp(e7->bytes, model->signature, sizeof(model->signature))) {
-            
-            priv.proto_version = model->protocol_info.version;
-            
-            // log model version:
-            if (priv.proto_version == ALPS_PROTO_V1) {
-                IOLog("ALPS: Found an ALPS V1 TouchPad\n");
-            } else if (priv.proto_version == ALPS_PROTO_V2) {
-                IOLog("ALPS: Found an ALPS V2 TouchPad\n");
-            } else if (priv.proto_version == ALPS_PROTO_V3_RUSHMORE) {
-                IOLog("ALPS: Found an ALPS V3 Rushmore TouchPad\n!");
-            } else if (priv.proto_version == ALPS_PROTO_V4) {
-                IOLog("ALPS: Found an ALPS V4 TouchPad\n");
-            }else if (priv.proto_version == ALPS_PROTO_V6) {
-                IOLog("ALPS: Found an ALPS V6 TouchPad\n");
-            }
-            
-            set_protocol();
-            
-            priv.flags = model->protocol_info.flags;
-            priv.byte0 = model->protocol_info.byte0;
-            priv.mask0 = model->protocol_info.mask0;
-            
-            return true;
-        }
+    // V1-V5 get the same transform (y flip and 6000-unit scale) once their
+    // limits are known; without a physical size they take the device units
+    // for it, as SS4 does
+    if (!_resolutionX) {
+        _resolutionX = priv.x_max;
+        _resolutionY = priv.y_max;
+        update_resolution();
     }
-    
-    return false;
 }
 
 IOReturn ALPS::identify() {
     ALPSStatus_t e6, e7, ec;
+    uint64_t start_abs, end_abs, elapsed_ns;
+    clock_get_uptime(&start_abs);
     
     /*
      * First try "E6 report".
@@ -3206,45 +2593,32 @@ IOReturn ALPS::identify() {
         return kIOReturnIOError;
     }
     
-    if (matchTable(&e7, &ec)) {
-        return 0;
-        
-    } else if (e7.bytes[0] == 0x73 && e7.bytes[1] == 0x02 && e7.bytes[2] == 0x64 &&
-               ec.bytes[2] == 0x8a) {
-        priv.proto_version = ALPS_PROTO_V4;
-        IOLog("ALPS: Found a V4 TouchPad with ID: E7=0x%02x 0x%02x 0x%02x, EC=0x%02x 0x%02x 0x%02x\n", e7.bytes[0], e7.bytes[1], e7.bytes[2], ec.bytes[0], ec.bytes[1], ec.bytes[2]);
-    } else if (e7.bytes[0] == 0x73 && e7.bytes[1] == 0x03 && e7.bytes[2] == 0x50 &&
-               ec.bytes[0] == 0x73 && (ec.bytes[1] == 0x01 || ec.bytes[1] == 0x02)) {
-        priv.proto_version = ALPS_PROTO_V5;
-        IOLog("ALPS: Found a V5 Dolphin TouchPad with ID: E7=0x%02x 0x%02x 0x%02x, EC=0x%02x 0x%02x 0x%02x\n", e7.bytes[0], e7.bytes[1], e7.bytes[2], ec.bytes[0], ec.bytes[1], ec.bytes[2]);
-        
-    } else if (ec.bytes[0] == 0x88 &&
-               ((ec.bytes[1] & 0xf0) == 0xb0 || (ec.bytes[1] & 0xf0) == 0xc0)) {
-        priv.proto_version = ALPS_PROTO_V7;
-        IOLog("ALPS: Found a V7 TouchPad with ID: E7=0x%02x 0x%02x 0x%02x, EC=0x%02x 0x%02x 0x%02x\n", e7.bytes[0], e7.bytes[1], e7.bytes[2], ec.bytes[0], ec.bytes[1], ec.bytes[2]);
-        
-    } else if (ec.bytes[0] == 0x88 && ec.bytes[1] == 0x08) {
-        priv.proto_version = ALPS_PROTO_V3_RUSHMORE;
-        IOLog("ALPS: Found a V3 Rushmore TouchPad with ID: E7=0x%02x 0x%02x 0x%02x, EC=0x%02x 0x%02x 0x%02x\n", e7.bytes[0], e7.bytes[1], e7.bytes[2], ec.bytes[0], ec.bytes[1], ec.bytes[2]);
-        
-    } else if (ec.bytes[0] == 0x88 && ec.bytes[1] == 0x07 &&
-               ec.bytes[2] >= 0x90 && ec.bytes[2] <= 0x9d) {
-        priv.proto_version = ALPS_PROTO_V3;
-        IOLog("ALPS: Found a V3 Pinnacle TouchPad with ID: E7=0x%02x 0x%02x 0x%02x, EC=0x%02x 0x%02x 0x%02x\n", e7.bytes[0], e7.bytes[1], e7.bytes[2], ec.bytes[0], ec.bytes[1], ec.bytes[2]);
-        
-    } else if (e7.bytes[0] == 0x73 && e7.bytes[1] == 0x03 &&
-               (e7.bytes[2] == 0x14 || e7.bytes[2] == 0x28)) {
-        priv.proto_version = ALPS_PROTO_V8;
-        IOLog("ALPS: Found a V8 TouchPad with ID: E7=0x%02x 0x%02x 0x%02x, EC=0x%02x 0x%02x 0x%02x\n", e7.bytes[0], e7.bytes[1], e7.bytes[2], ec.bytes[0], ec.bytes[1], ec.bytes[2]);
-        
-    } else if (e7.bytes[0] == 0x73 && e7.bytes[1] == 0x03 && e7.bytes[2] == 0xc8) {
-        priv.proto_version = ALPS_PROTO_V8;
-        IOLog("ALPS: Found a unsupported V9 TouchPad with ID: E7=0x%02x 0x%02x 0x%02x, EC=0x%02x 0x%02x 0x%02x\n", e7.bytes[0], e7.bytes[1], e7.bytes[2], ec.bytes[0], ec.bytes[1], ec.bytes[2]);
-        
-    } else {
-        IOLog("ALPS DRIVER: TouchPad didn't match any known IDs: E7=0x%02x 0x%02x 0x%02x, EC=0x%02x 0x%02x 0x%02x ... driver will now exit\n",
-              e7.bytes[0], e7.bytes[1], e7.bytes[2], ec.bytes[0], ec.bytes[1], ec.bytes[2]);
-        return kIOReturnInvalid;
+    // time taken by the E6/E7/EC report sequence
+    clock_get_uptime(&end_abs);
+    absolutetime_to_nanoseconds(end_abs - start_abs, &elapsed_ns);
+    setProperty("IdentifyTimeUS", elapsed_ns / 1000, 32);
+    
+    struct alps_protocol_info info;
+    const char *name;
+    switch (alps_identify(e7.bytes, ec.bytes, &info, &name)) {
+        case ALPS_ID_MODEL:
+            IOLog("ALPS: Found an ALPS %s TouchPad with Signature { %d, %d, %d }\n", name, e7.bytes[0], e7.bytes[1], e7.bytes[2]);
+            priv.proto_version = info.version;
+            set_protocol();
+            priv.flags = info.flags;
+            priv.byte0 = info.byte0;
+            priv.mask0 = info.mask0;
+            return 0;
+            
+        case ALPS_ID_PROTOCOL:
+            priv.proto_version = info.version;
+            IOLog("ALPS: Found a %s TouchPad with ID: E7=0x%02x 0x%02x 0x%02x, EC=0x%02x 0x%02x 0x%02x\n", name, e7.bytes[0], e7.bytes[1], e7.bytes[2], ec.bytes[0], ec.bytes[1], ec.bytes[2]);
+            break;
+            
+        default:
+            IOLog("ALPS DRIVER: TouchPad didn't match any known IDs: E7=0x%02x 0x%02x 0x%02x, EC=0x%02x 0x%02x 0x%02x ... driver will now exit\n",
+                  e7.bytes[0], e7.bytes[1], e7.bytes[2], ec.bytes[0], ec.bytes[1], ec.bytes[2]);
+            return kIOReturnInvalid;
     }
     
     /* Save Device ID and Firmware version */
@@ -3273,17 +2647,40 @@ void ALPS::setTouchPadEnable(bool enable) {
 
 void ALPS::packetReady() {
     // empty the ring buffer, dispatching each packet...
-    while (_ringBuffer.count() >= priv.pktsize) {
-        if (priv.PSMOUSE_BAD_DATA == false) {
-            if (!ignoreall)
-                (this->*process_packet)(_ringBuffer.tail());
-        } else {
-            IOLog("ALPS: an invalid or bare packet has been dropped...\n");
-            /* Might need to perform a full HW reset here if we keep receiving bad packets (consecutively) */
+    while (_ringBuffer.count() >= kPacketStride) {
+        UInt8 *packet = _ringBuffer.tail();
+        switch (packet[kPacketStatusOffset]) {
+            case kPacketStatusOK:
+                // with more packets queued behind this one, sendTouchData
+                // may fold it into the next frame (see CoalesceFrames)
+                _holdFrame = _coalesceFrames && _ringBuffer.count() >= 2 * kPacketStride;
+                _packetTime = *(uint64_t*)(&packet[kPacketTimeOffset]);
+                clock_get_uptime(&_dispatchTime);
+                recordLatency(kLatencyQueue, _packetTime, _dispatchTime);
+                if (*(UInt32*)(&packet[kPacketDroppedOffset]))
+                    recordResync(packet);
+                if (!ignoreall)
+                    (this->*process_packet)(packet);
+                break;
+                
+            case kPacketStatusBare:
+            case kPacketStatusInterleaved:
+                // external PS/2 device or trackstick, alongside the ALPS stream
+                _packetTime = *(uint64_t*)(&packet[kPacketTimeOffset]);
+                if (!ignoreall)
+                    dispatchBarePacket(packet, packet[kPacketStatusOffset] == kPacketStatusBare);
+                break;
         }
-        _packetByteCount = 0;
-        _ringBuffer.advanceTail(priv.pktsize);
+        _ringBuffer.advanceTail(kPacketStride);
     }
+    _holdFrame = false;
+    
+    // the packets after a held frame may not have produced one of their own
+    // (a bitmap half, trackstick or bare packet), so the held frame goes out now
+    flushHeldFrame();
+    
+    if (_droppedBytesTotal != _recovery.seenDropped || _recovery.level != kRecoveryNone)
+        checkRecovery();
 }
 
 void ALPS::ps2_command(unsigned char value, UInt8 command)
@@ -3321,12 +2718,44 @@ void ALPS::ps2_command_short(UInt8 command)
 /* ============================================================================================== */
 
 
-void ALPS::set_resolution() {
-    physical_max_x = priv.x_max * 4;
-    physical_max_y = priv.y_max * 4.5;
+void ALPS::set_resolution(int phys_x, int phys_y) {
+    _resolutionX = phys_x;
+    _resolutionY = phys_y;
+    update_resolution();
     
-    logical_max_x = priv.x_max;
-    logical_max_y = priv.y_max;
+    setProperty(VOODOO_INPUT_TRANSFORM_KEY, 0ull, 32);
+    setProperty("VoodooInputSupported", kOSBooleanTrue);
+    
+    registerService();
+}
+
+void ALPS::update_resolution() {
+    /* Dr Hurt: Scale all touchpads' axes to 6000 to be able to the same divisors for all models */
+    int64_t common = 6000 / ((priv.x_max + priv.y_max) / 2);
+    if (common < 1)
+        common = 1;
+    
+    int64_t scale_x = (common * manual_x_log) << 16;
+    int64_t scale_y = (common * manual_y_log) << 16;
+    
+    // scale x & y to the axis which has the most resolution
+    if (xupmm < yupmm)
+        scale_x = scale_x * yupmm / xupmm;
+    else if (xupmm > yupmm)
+        scale_y = scale_y * xupmm / yupmm;
+    
+    _transformX.scale = scale_x;
+    _transformX.offset = 0;
+    
+    /* Reverse y co-ordinates to have 0 at bottom for gestures to work */
+    _transformY.scale = -scale_y;
+    _transformY.offset = priv.y_max * scale_y;
+    
+    logical_max_x = _transformX.apply(priv.x_max);
+    logical_max_y = _transformY.apply(0);
+    
+    physical_max_x = _resolutionX * manual_x_phy;
+    physical_max_y = _resolutionY * manual_y_phy;
     
     setProperty(VOODOO_INPUT_LOGICAL_MAX_X_KEY, logical_max_x - logical_min_x, 32);
     setProperty(VOODOO_INPUT_LOGICAL_MAX_Y_KEY, logical_max_y - logical_min_y, 32);
@@ -3334,10 +2763,15 @@ void ALPS::set_resolution() {
     setProperty(VOODOO_INPUT_PHYSICAL_MAX_X_KEY, physical_max_x, 32);
     setProperty(VOODOO_INPUT_PHYSICAL_MAX_Y_KEY, physical_max_y, 32);
     
-    setProperty(VOODOO_INPUT_TRANSFORM_KEY, 0ull, 32);
-    setProperty("VoodooInputSupported", kOSBooleanTrue);
-    
-    registerService();
+    // VoodooInput already read the properties if it is attached
+    if (voodooInputInstance) {
+        VoodooInputDimensions d;
+        d.min_x = logical_min_x;
+        d.max_x = logical_max_x;
+        d.min_y = logical_min_y;
+        d.max_y = logical_max_y;
+        super::messageClient(kIOMessageVoodooInputUpdateDimensionsMessage, voodooInputInstance, &d, sizeof(VoodooInputDimensions));
+    }
     
     DEBUG_LOG("VoodooPS2Trackpad: logical %dx%d-%dx%d physical_max %dx%d upmm %dx%d",
               logical_min_x, logical_min_y,
@@ -3348,43 +2782,11 @@ void ALPS::set_resolution() {
 
 // port from VoodooPS2SynapticsTouchpad.cpp; huge credits to @usr-sse2
 
-#define sqr(x) ((x) * (x))
-int ALPS::dist(int physicalFinger, int virtualFinger) {
-    const auto &phy = fingerStates[physicalFinger];
-    const auto &virt = virtualFingerStates[virtualFinger];
-    return sqr(phy.x - virt.x_avg.newest()) + sqr(phy.y - virt.y_avg.newest());
+static inline int16_t saturate16(int value) {
+    return value > INT16_MAX ? INT16_MAX : value < INT16_MIN ? INT16_MIN : value;
 }
 
-void ALPS::assignVirtualFinger(int physicalFinger) {
-    if (physicalFinger < 0 || physicalFinger >= MAX_TOUCHES) {
-        IOLog("VoodooPS2ALPS::assignVirtualFinger ERROR: invalid physical finger %d", physicalFinger);
-        return;
-    }
-    for (int j = 0; j < MAX_TOUCHES; j++) {
-        virtual_finger_state &vfj = virtualFingerStates[j];
-        if (!vfj.touch) {
-            fingerStates[physicalFinger].virtualFingerIndex = j;
-            vfj.touch = true;
-            vfj.x_avg.reset();
-            vfj.y_avg.reset();
-            assignFingerType(vfj);
-            break;
-        }
-    }
-}
-
-void ALPS::assignFingerType(virtual_finger_state &vf) {
-    vf.fingerType = kMT2FingerTypeUndefined;
-    for (MT2FingerType i = kMT2FingerTypeIndexFinger; i < kMT2FingerTypeCount; i = (MT2FingerType)(i + 1))
-        if (freeFingerTypes[i]) {
-            freeFingerTypes[i] = false;
-            vf.fingerType = i;
-            break;
-        }
-    
-}
-
-void ALPS::alps_parse_hw_state(const UInt8 buf[], struct alps_fields &f)
+void ALPS::alps_parse_hw_state(struct alps_fields &f)
 {
     // Check if input is disabled via ApplePS2Keyboard request
     if (ignoreall)
@@ -3393,31 +2795,6 @@ void ALPS::alps_parse_hw_state(const UInt8 buf[], struct alps_fields &f)
     // get fingercounts from packets
     int fingers = 0;
     
-    if(priv.proto_version == ALPS_PROTO_V7) {
-        UInt8 *packet = _ringBuffer.tail();
-        
-        //struct alps_fields f;
-        
-        memset(&f, 0, sizeof(alps_fields));
-        
-        (this->alps_decode_packet_v7)(&f, packet);
-        
-        /* Reverse y co-ordinates to have 0 at bottom for gestures to work */
-        f.mt[0].y = priv.y_max - f.mt[0].y;
-        f.mt[1].y = priv.y_max - f.mt[1].y;
-        
-        // scale x & y to the axis which has the most resolution
-        if (xupmm < yupmm) {
-            f.mt[0].x = f.mt[0].x * yupmm / xupmm;
-        } else if (xupmm > yupmm) {
-            f.mt[0].y = f.mt[0].y * xupmm / yupmm;
-        }
-        
-        /* Dr Hurt: Scale all touchpads' axes to 6000 to be able to the same divisors for all models */
-        f.mt[0].x *= (6000 / ((priv.x_max + priv.y_max)/2));
-        f.mt[1].y *= (6000 / ((priv.x_max + priv.y_max)/2));
-    }
-    
     fingers = f.fingers;
     
     DEBUG_LOG("There are currently %d finger(s) accessing alps_parse_hw_state\n", f.fingers);
@@ -3432,43 +2809,43 @@ void ALPS::alps_parse_hw_state(const UInt8 buf[], struct alps_fields &f)
     middle = f.middle | f.ts_middle;
     left_ts = f.ts_left;
     
-    if (fingers >= 2) {
-        fingerStates[1].x = f.mt[1].x;
-        fingerStates[1].y = f.mt[1].y;
-        fingerStates[1].z = f.pressure;
+    // raw positions past X/Y_MAX_POSITIVE are negative, then device to logical units
+    int x[MAX_TOUCHES], y[MAX_TOUCHES];
+    for (int i = 0; i < MAX_TOUCHES; i++) {
+        int raw_x = f.mt[i].x;
+        int raw_y = f.mt[i].y;
         
-        if (fingerStates[1].x > X_MAX_POSITIVE)
-            fingerStates[1].x -= 1 << ABS_POS_BITS;
-        else if (fingerStates[1].x == X_MAX_POSITIVE)
-            fingerStates[1].x = XMAX;
+        if (raw_x > X_MAX_POSITIVE)
+            raw_x -= 1 << ABS_POS_BITS;
+        else if (raw_x == X_MAX_POSITIVE)
+            raw_x = XMAX;
         
-        if (fingerStates[1].y > Y_MAX_POSITIVE)
-            fingerStates[1].y -= 1 << ABS_POS_BITS;
-        else if (fingerStates[1].y == Y_MAX_POSITIVE)
-            fingerStates[1].y = YMAX;
+        if (raw_y > Y_MAX_POSITIVE)
+            raw_y -= 1 << ABS_POS_BITS;
+        else if (raw_y == Y_MAX_POSITIVE)
+            raw_y = YMAX;
+        
+        x[i] = _transformX.apply(raw_x);
+        y[i] = _transformY.apply(raw_y);
+    }
+    
+    if (fingers >= 2) {
+        _tracker.fingerStates.x[1] = saturate16(x[1]);
+        _tracker.fingerStates.y[1] = saturate16(y[1]);
+        _tracker.fingerStates.z[1] = saturate16(f.pressure);
     }
     // normal "packet"
     // my port of synaptics_parse_hw_state from synaptics.c from Linux Kernel
-    fingerStates[0].x = f.mt[0].x;
-    fingerStates[0].y = f.mt[0].y;
-    fingerStates[0].z = f.pressure;
+    _tracker.fingerStates.x[0] = saturate16(x[0]);
+    _tracker.fingerStates.y[0] = saturate16(y[0]);
+    _tracker.fingerStates.z[0] = saturate16(f.pressure);
     
-    DEBUG_LOG("ALPS: fingerStates[0] report: x: %d, y: %d, z: %d\n", fingerStates[0].x, fingerStates[0].y, fingerStates[0].z);
-    
-    if (fingerStates[0].x > X_MAX_POSITIVE)
-        fingerStates[0].x -= 1 << ABS_POS_BITS;
-    else if (fingerStates[0].x == X_MAX_POSITIVE)
-        fingerStates[0].x = XMAX;
-    
-    if (fingerStates[0].y > Y_MAX_POSITIVE)
-        fingerStates[0].y -= 1 << ABS_POS_BITS;
-    else if (fingerStates[0].y == Y_MAX_POSITIVE)
-        fingerStates[0].y = YMAX;
+    DEBUG_LOG("ALPS: _tracker.fingerStates[0] report: x: %d, y: %d, z: %d\n", _tracker.fingerStates.x[0], _tracker.fingerStates.y[0], _tracker.fingerStates.z[0]);
     
     // count the number of fingers
     // my port of synaptics_process_packet from synaptics.c from Linux Kernel
     int fingerCount = 0;
-    if (fingerStates[0].z == 0) {
+    if (_tracker.fingerStates.z[0] == 0) {
         fingerCount = 0;
         switch (fingers) {
             case 0:
@@ -3489,48 +2866,62 @@ void ALPS::alps_parse_hw_state(const UInt8 buf[], struct alps_fields &f)
         }
     }
     
-    clampedFingerCount = fingerCount;
-    
-    if (clampedFingerCount > MAX_TOUCHES)
-        clampedFingerCount = MAX_TOUCHES;
-    
-    if (renumberFingers())
+    _tracker.clampedFingerCount = fingerCount;
+    
+    if (_tracker.clampedFingerCount > MAX_TOUCHES)
+        _tracker.clampedFingerCount = MAX_TOUCHES;
+    
+    uint64_t decoded, tracked;
+    clock_get_uptime(&decoded);
+    recordLatency(kLatencyDecode, _dispatchTime, decoded);
+    // the imaginary 3rd to 5th fingers stay inside the current logical area
+    _tracker.min_x = logical_min_x;
+    _tracker.max_x = logical_max_x;
+    _tracker.min_y = logical_min_y;
+    _tracker.max_y = logical_max_y;
+    _tracker.margin_x = margin_size_x;
+    _tracker.margin_y = margin_size_y;
+    uint64_t packet_ns;
+    absolutetime_to_nanoseconds(_packetTime, &packet_ns);
+    bool ready = _tracker.renumberFingers(packet_ns / 1000, (priv.flags & ALPS_BUTTONPAD) && left);
+#ifdef DEBUG
+    if (ready && _replayEvents) {
+        for (int i = 0; i < _tracker.clampedFingerCount; i++) {
+            int j = _tracker.fingerStates.virtualFingerIndex[i];
+            if (isValidVirtualFinger(j))
+                recordFilterSample(j);
+        }
+    }
+#endif
+    clock_get_uptime(&tracked);
+    recordLatency(kLatencyTrack, decoded, tracked);
+    if (ready)
         sendTouchData();
     
-    AbsoluteTime timestamp;
-    clock_get_uptime(&timestamp);
+    uint64_t timestamp = _packetTime;
     // Physical left button (for non-Clickpads)
     // Only use this if trackpad is not a clickpad
     if (!(priv.flags & ALPS_BUTTONPAD)) {
         if (left && !prev_left)
-            dispatchRelativePointerEvent(0, 0, 0x01, timestamp);
+            dispatchRelativePointerEventX(0, 0, 0x01, timestamp);
         else if (prev_left && !left)
-            dispatchRelativePointerEvent(0, 0, 0x00, timestamp);
+            dispatchRelativePointerEventX(0, 0, 0x00, timestamp);
     }
     // Physical right button (non-passthrough)
     if (right && !prev_right)
-        dispatchRelativePointerEvent(0, 0, 0x02, timestamp);
+        dispatchRelativePointerEventX(0, 0, 0x02, timestamp);
     else if (prev_right && !right)
-        dispatchRelativePointerEvent(0, 0, 0x00, timestamp);
+        dispatchRelativePointerEventX(0, 0, 0x00, timestamp);
     // Physical middle button (non-passthrough)
     if (middle && !prev_middle)
-        dispatchRelativePointerEvent(0, 0, 0x04, timestamp);
+        dispatchRelativePointerEventX(0, 0, 0x04, timestamp);
     else if (prev_middle && !middle)
-        dispatchRelativePointerEvent(0, 0, 0x00, timestamp);
+        dispatchRelativePointerEventX(0, 0, 0x00, timestamp);
     // Physical left button (Trackstick)
     if (left_ts && !prev_left_ts)
-        dispatchRelativePointerEvent(0, 0, 0x01, timestamp);
+        dispatchRelativePointerEventX(0, 0, 0x01, timestamp);
     else if (prev_left_ts && !left_ts)
-        dispatchRelativePointerEvent(0, 0, 0x00, timestamp);
-}
-
-template <typename TValue, typename TLimit, typename TMargin>
-static void clip_no_update_limits(TValue& value, TLimit minimum, TLimit maximum, TMargin margin)
-{
-    if (value < minimum)
-        value = minimum;
-    if (value > maximum)
-        value = maximum;
+        dispatchRelativePointerEventX(0, 0, 0x00, timestamp);
 }
 
 template <typename TValue, typename TLimit, typename TMargin>
@@ -3547,413 +2938,23 @@ static void clip(TValue& value, TLimit& minimum, TLimit& maximum, TMargin margin
     clip_no_update_limits(value, minimum, maximum, margin);
 }
 
-void ALPS::freeAndMarkVirtualFingers() {
-    memset(freeFingerTypes, true, kMT2FingerTypeCount);
-    freeFingerTypes[kMT2FingerTypeUndefined] = false;
-    
-    for (int i = 0; i < MAX_TOUCHES; i++) { // free up all virtual fingers
-        auto &vfi = virtualFingerStates[i];
-        vfi.touch = false;
-        vfi.x_avg.reset(); // maybe it should be done only for unpressed fingers?
-        vfi.y_avg.reset();
-        vfi.pressure = 0;
-    }
-    for (int i = 0; i < clampedFingerCount; i++) { // mark virtual fingers as used
-        int j = fingerStates[i].virtualFingerIndex;
-        if (j == -1) {
-            IOLog("alps_parse_hw_state: WTF!? Finger %d has no virtual finger", i);
-            continue;
-        }
-        auto &vfj = virtualFingerStates[j];
-        vfj.touch = true;
-        freeFingerTypes[vfj.fingerType] = false;
-    }
-    for (int i = 0; i < MAX_TOUCHES; i++) {
-        auto &vfi = virtualFingerStates[i];
-        if (!vfi.touch)
-            vfi.fingerType = kMT2FingerTypeUndefined;
-    }
-}
-
-static void clone(alps_hw_state &dst, const alps_hw_state &src) {
-    dst.x = src.x;
-    dst.y = src.y;
-    dst.z = src.z;
-}
-
-int ALPS::upperFingerIndex() const {
-    return fingerStates[0].y < fingerStates[1].y ? 1 : 0;
-}
-
-const alps_hw_state& ALPS::upperFinger() const {
-    return fingerStates[upperFingerIndex()];
-}
-
-void ALPS::swapFingers(int dst, int src) {
-    int j = fingerStates[src].virtualFingerIndex;
-    const auto &vfj = virtualFingerStates[j];
-    fingerStates[dst].x = vfj.x_avg.average();
-    fingerStates[dst].y = vfj.y_avg.average();
-    fingerStates[dst].virtualFingerIndex = j;
-    assignVirtualFinger(src);
-}
-
-#define FINGER_DIST 1000000
-
-bool ALPS::renumberFingers() {
-    const auto &f0 = fingerStates[0];
-    const auto &f1 = fingerStates[1];
-    auto &f2 = fingerStates[2];
-    auto &f3 = fingerStates[3];
-    auto &f4 = fingerStates[4];
-    
-    if (clampedFingerCount == lastFingerCount && clampedFingerCount >= 3) {
-        // update imaginary finger states
-        if (f0.virtualFingerIndex != -1 && f1.virtualFingerIndex != -1) {
-            if (clampedFingerCount >= 4) {
-                const auto &fi = upperFinger();
-                const auto &fiv = virtualFingerStates[fi.virtualFingerIndex];
-                for (int j = 2; j < clampedFingerCount; j++) {
-                    auto &fj = fingerStates[j];
-                    fj.x += fi.x - fiv.x_avg.newest();
-                    fj.y += fi.y - fiv.y_avg.newest();
-                    fj.z = fi.z;
-                    
-                    clip_no_update_limits(fj.x, logical_min_x, logical_max_x, margin_size_x);
-                    clip_no_update_limits(fj.y, logical_min_y, logical_max_y, margin_size_y);
-                }
-            }
-            else if (clampedFingerCount == 3) {
-                const auto &f0v = virtualFingerStates[f0.virtualFingerIndex];
-                const auto &f1v = virtualFingerStates[f1.virtualFingerIndex];
-                auto &f2 = fingerStates[2];
-                f2.x += ((f0.x - f0v.x_avg.newest()) + (f1.x - f1v.x_avg.newest())) / 2;
-                f2.y += ((f0.y - f0v.y_avg.newest()) + (f1.y - f1v.y_avg.newest())) / 2;
-                f2.z = (f0.z + f1.z) / 2;
-                
-                clip_no_update_limits(f2.x, logical_min_x, logical_max_x, margin_size_x);
-                clip_no_update_limits(f2.y, logical_min_y, logical_max_y, margin_size_y);
-            }
-        }
-        else
-            IOLog("alps_parse_hw_state: WTF - have %d fingers, but first 2 don't have virtual finger", clampedFingerCount);
-    }
-    
-    // We really need to send the "no touch" event
-    // multiple times, because if we don't do it and return,
-    // gestures like desktop switching or inertial scrolling
-    // got stuck midway until the next touch.
-    //if(!lastFingerCount && !clampedFingerCount) {
-    //    return 0;
-    //}
-    
-    // Finger type detection:
-    // We think that fingers are added beginning with the index finger,
-    // then middle, ring and little.
-    // However, when the finger count reaches 4, the lowest finger becomes thumb,
-    // but other fingers don't change their types.
-    // All fingers preserve their types during the gesture.
-    // Though it would be nice to see what MT2 does.
-    
-    if (clampedFingerCount == lastFingerCount && clampedFingerCount == 1) {
-        int i = 0;
-        int j = fingerStates[i].virtualFingerIndex;
-        int d = dist(i, j);
-        if (d > FINGER_DIST) { // this number was determined experimentally
-            // Prevent jumps by unpressing finger. Other way could be leaving the old finger pressed.
-            DEBUG_LOG("alps_parse_hw_state: unpressing finger: dist is %d", d);
-            auto &vfj = virtualFingerStates[j];
-            vfj.x_avg.reset();
-            vfj.y_avg.reset();
-            vfj.pressure = 0;
-            vfj.fingerType = kMT2FingerTypeUndefined;
-            clampedFingerCount = 0;
-        }
-    }
-    if (clampedFingerCount != lastFingerCount) {
-        if (clampedFingerCount > lastFingerCount && clampedFingerCount >= 3) {
-            // Skip sending touch data once because we need to wait for the next extended packet
-            if (wasSkipped)
-                wasSkipped = false;
-            else {
-                DEBUG_LOG("alps_parse_hw_state: Skip sending touch data");
-                wasSkipped = true;
-                return false;
-            }
-        }
-        
-        if (lastFingerCount == 0) {
-            // Assign to identity mapping
-            for (int i = 0; i < clampedFingerCount; i++) {
-                auto &fi = fingerStates[i];
-                fi.virtualFingerIndex = i;
-                auto &vfi = virtualFingerStates[i];
-                vfi.touch = true;
-                assignFingerType(vfi);
-                vfi.x_avg.reset();
-                vfi.y_avg.reset();
-                if (i >= 2) // more than 3 fingers added simultaneously
-                    clone(fi, upperFinger()); // Copy from the upper finger
-            }
-        }
-        else if (clampedFingerCount > lastFingerCount && !hadLiftFinger) {
-            // First finger already exists
-            // Can add 1, 2 or 3 fingers at once
-            // Newly added finger is always in secondary finger packet
-            switch (clampedFingerCount - lastFingerCount) {
-                case 1:
-                    if (lastFingerCount >= 2)
-                        swapFingers(lastFingerCount, 1);
-                    else // lastFingerCount = 1
-                        assignVirtualFinger(1);
-                    break;
-                case 2:
-                    if (lastFingerCount == 1) { // added second and third
-                        assignVirtualFinger(1);
-                        clone(f2, upperFinger()); // We don't know better
-                        assignVirtualFinger(2);
-                    }
-                    else { // added third and fourth
-                        swapFingers(lastFingerCount, 1);
-                        
-                        // add fourth
-                        clone(f3, upperFinger());
-                        assignVirtualFinger(3);
-                    }
-                    break;
-                case 3:
-                    assignVirtualFinger(1);
-                    clone(f2, upperFinger());
-                    assignVirtualFinger(2);
-                    clone(f3, upperFinger());
-                    assignVirtualFinger(3);
-                    break;
-                case 4:
-                    assignVirtualFinger(1);
-                    clone(f2, upperFinger());
-                    assignVirtualFinger(2);
-                    clone(f3, upperFinger());
-                    assignVirtualFinger(3);
-                    clone(f4, upperFinger());
-                    assignVirtualFinger(4);
-                    break;
-                default:
-                    IOLog("alps_parse_hw_state: WTF!? fc=%d lfc=%d", clampedFingerCount, lastFingerCount);
-            }
-        }
-        else if (clampedFingerCount > lastFingerCount && hadLiftFinger) {
-            for (int i = 0; i < MAX_TOUCHES; i++) // clean virtual finger numbers
-                fingerStates[i].virtualFingerIndex = -1;
-            
-            int maxMinDist = 0, maxMinDistIndex = -1;
-            int secondMaxMinDist = 0, secondMaxMinDistIndex = -1;
-            
-            // find new physical finger for each existing virtual finger
-            for (int j = 0; j < MAX_TOUCHES; j++) {
-                if (!virtualFingerStates[j].touch)
-                    continue; // free
-                int minDist = INT_MAX, minIndex = -1;
-                for (int i = 0; i < lastFingerCount; i++) {
-                    if (fingerStates[i].virtualFingerIndex != -1)
-                        continue; // already taken
-                    int d = dist(i, j);
-                    if (d < minDist) {
-                        minDist = d;
-                        minIndex = i;
-                    }
-                }
-                if (minIndex == -1) {
-                    IOLog("alps_parse_hw_state: WTF!? minIndex is -1");
-                    continue;
-                }
-                if (minDist > maxMinDist) {
-                    secondMaxMinDist = maxMinDist;
-                    secondMaxMinDistIndex = maxMinDistIndex;
-                    maxMinDist = minDist;
-                    maxMinDistIndex = minIndex;
-                }
-                fingerStates[minIndex].virtualFingerIndex = j;
-            }
-            
-            // assign new virtual fingers for all new fingers
-            for (int i = 0; i < min(2, clampedFingerCount); i++) // third and fourth 'fingers' are handled separately
-                if (fingerStates[i].virtualFingerIndex == -1)
-                    assignVirtualFinger(i); // here OK
-            
-            if (clampedFingerCount == 3) {
-                DEBUG_LOG("alps_parse_hw_state: adding third finger, maxMinDist=%d", maxMinDist);
-                f2.z = (f0.z + f1.z) / 2;
-                if (maxMinDist > FINGER_DIST && maxMinDistIndex >= 0) {
-                    // i-th physical finger was replaced, save its old coordinates to the 3rd physical finger and map it to a new virtual finger.
-                    // The third physical finger should now be mapped to the old fingerStates[i].virtualFingerIndex.
-                    swapFingers(2, maxMinDistIndex);
-                    DEBUG_LOG("alps_parse_hw_state: swapped, saving location");
-                }
-                else {
-                    // existing fingers didn't change or were swapped, so we don't know the location of the third finger
-                    const auto &fj = upperFinger();
-                    
-                    f2.x = fj.x;
-                    f2.y = fj.y;
-                    assignVirtualFinger(2);
-                    DEBUG_LOG("alps_parse_hw_state: not swapped, taking upper finger position");
-                }
-            }
-            else if (clampedFingerCount >= 4) {
-                // Is it possible that both 0 and 1 fingers were swapped with 2 and 3?
-                DEBUG_LOG("alps_parse_hw_state: adding third and fourth fingers, maxMinDist=%d, secondMaxMinDist=%d", maxMinDist, secondMaxMinDist);
-                f2.z = f3.z = (f0.z + f1.z) / 2;
-                
-                // Possible situations:
-                // 1. maxMinDist ≤ 1000000, lastFingerCount = 3 - no fingers swapped, just adding 4th finger
-                // 2. maxMinDist ≤ 1000000, lastFingerCount = 2 - no fingers swapped, just adding 3rd and 4th fingers
-                // 3. maxMinDist > 1000000, secondMaxMinDist ≤ 1000000, lastFingerCount = 3 - i'th finger was swapped with 4th, 3rd left in place (i∈{0,1}):
-                //      4th.xy = i'th.xy
-                //      p2v[2] = j
-                //      p2v[i] = next free
-                // 4. maxMinDist > 1000000, secondMaxMinDist > 1000000, lastFingerCount = 3 - i'th finger was swapped with 3rd and k'th finger was swapped with 4th (i,k∈{0,1}):
-                //      is it possible that only imaginary finger was left in place?!
-                // 5. maxMinDist > 1000000, secondMaxMinDist ≤ 1000000, lastFingerCount = 2 - one finger swapped, one finger left in place.
-                
-                
-                if (maxMinDist > FINGER_DIST && maxMinDistIndex >= 0) {
-                    if (lastFingerCount < 3) {
-                        // i-th physical finger was replaced, save its old coordinates to the 3rd physical finger and map it to a new virtual finger.
-                        // The third physical finger should now be mapped to the old fingerStates[i].virtualFingerIndex.
-                        swapFingers(2, maxMinDistIndex);
-                        if (secondMaxMinDist > FINGER_DIST && secondMaxMinDistIndex >= 0) {
-                            // both fingers were swapped with new ones
-                            // i-th physical finger was replaced, save its old coordinates to the 4th physical finger and map it to a new virtual finger.
-                            // The fourth physical finger should now be mapped to the old fingerStates[i].virtualFingerIndex.
-                            swapFingers(3, secondMaxMinDistIndex);
-                        }
-                        else {
-                            // fourth finger is new
-                            clone(f3, upperFinger());
-                            assignVirtualFinger(3);
-                        }
-                    }
-                    else {
-                        // i-th physical finger was replaced, save its old coordinates to the 4th physical finger and map it to a new virtual finger.
-                        // The fourth physical finger should now be mapped to the old fingerStates[i].virtualFingerIndex.
-                        swapFingers(3, maxMinDistIndex);
-                        if (secondMaxMinDist > FINGER_DIST && secondMaxMinDistIndex >= 0) {
-                            IOLog("alps_parse_hw_state: WTF, I thought it is impossible: fc=%d, lfc=%d, mdi=%d(%d), smdi=%d(%d)", clampedFingerCount, lastFingerCount, maxMinDist, maxMinDistIndex, secondMaxMinDist, secondMaxMinDistIndex);
-                        }
-                    }
-                    DEBUG_LOG("alps_parse_hw_state: swapped, saving location");
-                }
-                else {
-                    // existing fingers didn't change or were swapped, so we don't know the location of the third and fourth fingers
-                    const auto &fj = upperFinger();
-                    clone(f2, fj);
-                    if (lastFingerCount < 3)
-                        assignVirtualFinger(2);
-                    clone(f3, fj);
-                    assignVirtualFinger(3);
-                    DEBUG_LOG("alps_parse_hw_state: not swapped, cloning existing fingers");
-                }
-                if (clampedFingerCount >= 5) {
-                    // Don't bother with 5th finger, always clone
-                    clone(f4, upperFinger());
-                    assignVirtualFinger(4);
-                    DEBUG_LOG("cloning 5th finger");
-                }
-            }
-            freeAndMarkVirtualFingers();
-        }
-        else if (clampedFingerCount < lastFingerCount) {
-            // Set hadLiftFinger if lifted some fingers
-            // Reset hadLiftFinger if lifted all fingers
-            hadLiftFinger = clampedFingerCount > 0;
-            
-            // some fingers removed, need renumbering
-            bool used[MAX_TOUCHES];
-            for (int i = 0; i < MAX_TOUCHES; i++) { // clean virtual finger numbers
-                fingerStates[i].virtualFingerIndex = -1;
-                used[i] = false;
-            }
-            for (int i = 0; i < clampedFingerCount; i++) {
-                // find new virtual finger number with nearest coordinates for this finger
-                int minDist = INT_MAX, minIndex = -1;
-                for (int j = 0; j < MAX_TOUCHES; j++) {
-                    if (!virtualFingerStates[j].touch || used[j])
-                        continue;
-                    int d = dist(i, j);
-                    if (d < minDist) {
-                        minDist = d;
-                        minIndex = j;
-                    }
-                }
-                fingerStates[i].virtualFingerIndex = minIndex;
-                if (minIndex == -1) {
-                    IOLog("alps_parse_hw_state: WTF: renumbering failed, minIndex for %d is -1", i);
-                    continue;
-                }
-                used[minIndex] = true;
-            }
-            freeAndMarkVirtualFingers();
-        }
-    }
+void ALPS::sendTouchData() {
+    uint64_t sendStart;
+    clock_get_uptime(&sendStart);
     
-    for (int i = 0; i < clampedFingerCount; i++) {
-        const auto &fi = fingerStates[i];
-        DEBUG_LOG("alps_parse_hw_state: finger %d -> virtual finger %d", i, fi.virtualFingerIndex);
-        if (fi.virtualFingerIndex < 0 || fi.virtualFingerIndex >= MAX_TOUCHES) {
-            IOLog("alps_parse_hw_state: ERROR: invalid physical finger %d", fi.virtualFingerIndex);
-            continue;
-        }
-        virtual_finger_state &fiv = virtualFingerStates[fi.virtualFingerIndex];
-        fiv.x_avg.filter(fi.x);
-        fiv.y_avg.filter(fi.y);
-        fiv.pressure = fi.z;
-        // Only use this if trackpad is a clickpad
-        if (priv.flags & ALPS_BUTTONPAD)
-            fiv.button = left;
-        else
-            fiv.button = 0;
-    }
-    
-    // Thumb detection. Must happen after setting coordinates (filter)
-    if (clampedFingerCount > lastFingerCount && clampedFingerCount >= 4) {
-        // find the lowest finger
-        int lowestFingerIndex = -1;
-        int min_y = INT_MAX;
-        for (int i = 0; i < MAX_TOUCHES; i++) {
-            const auto &vfi = virtualFingerStates[i];
-            DEBUG_LOG("finger %d: touch %d, y %d", i, vfi.touch, vfi.y_avg.average());
-            if (vfi.touch && vfi.y_avg.average() < min_y) {
-                lowestFingerIndex = i;
-                min_y = vfi.y_avg.average();
-            }
-        }
-        DEBUG_LOG("lowest finger: %d", lowestFingerIndex);
-        if (lowestFingerIndex == -1)
-            IOLog("alps_parse_hw_state: WTF?! lowest finger not found!");
-        else {
-            auto &vf = virtualFingerStates[lowestFingerIndex];
-            freeFingerTypes[vf.fingerType] = true;
-            vf.fingerType = kMT2FingerTypeThumb;
-            freeFingerTypes[kMT2FingerTypeThumb] = false;
-        }
-    }
+    // the whole frame carries the arrival time of its packet
+    AbsoluteTime timestamp = _packetTime;
     
-    DEBUG_LOG("alps_parse_hw_state: lastFingerCount=%d clampedFingerCount=%d left=%d", lastFingerCount,  clampedFingerCount, left);
-    return true;
-}
-
-void ALPS::sendTouchData() {
     // Ignore input for specified time after keyboard usage
-    AbsoluteTime timestamp;
-    clock_get_uptime(&timestamp);
     uint64_t timestamp_ns;
     absolutetime_to_nanoseconds(timestamp, &timestamp_ns);
     
-    if (timestamp_ns - keytime < maxaftertyping)
+    // (a packet that arrived before the key event is not suppressed)
+    if (timestamp_ns >= keytime && timestamp_ns - keytime < maxaftertyping)
         return;
     
-    if (lastFingerCount != clampedFingerCount) {
-        lastFingerCount = clampedFingerCount;
+    if (_tracker.lastFingerCount != _tracker.clampedFingerCount) {
+        _tracker.lastFingerCount = _tracker.clampedFingerCount;
         return; // Skip while fingers are placed on the touchpad or removed
     }
     
@@ -3961,11 +2962,17 @@ void ALPS::sendTouchData() {
     
     bool dimensions_changed = false;
     
+    // which virtual fingers are down, clicking or force touching
+    UInt32 shape = 0;
+    
     int transducers_count = 0;
     for(int i = 0; i < MAX_TOUCHES; i++) {
-        const auto& state = virtualFingerStates[i];
-        if (!state.touch)
+        if (!(_tracker.virtualFingers.touch & (1 << i)))
             continue;
+        const auto& state = _tracker.virtualFingerStates[i];
+        int pressure = _tracker.virtualFingers.pressure[i];
+        bool button = _tracker.virtualFingers.button & (1 << i);
+        int fingerType = _tracker.virtualFingers.fingerType[i];
         
         auto& transducer = inputEvent.transducers[transducers_count++];
         
@@ -3979,12 +2986,20 @@ void ALPS::sendTouchData() {
         clip(posX, logical_min_x, logical_max_x, margin_size_x, dimensions_changed);
         clip(posY, logical_min_y, logical_max_y, margin_size_y, dimensions_changed);
         
+        // predicted positions must not grow the logical area
+        if (_predictionTime > 0 && predictMotion(state.history, 0, _predictionTime * 1000, posX, posY)) {
+            clip_no_update_limits(posX, logical_min_x, logical_max_x, margin_size_x);
+            clip_no_update_limits(posY, logical_min_y, logical_max_y, margin_size_y);
+        }
+        
         posX -= logical_min_x;
         posY = logical_max_y + 1 - posY;
         
         DEBUG_LOG("alps_parse_hw_state finger[%d] x=%d y=%d raw_x=%d raw_y=%d", i, posX, posY, state.x_avg.average(), state.y_avg.average());
         
-        transducer.previousCoordinates = transducer.currentCoordinates;
+        // previousCoordinates are those of the last frame actually sent
+        if (!_lastFrameHeld)
+            transducer.previousCoordinates = transducer.currentCoordinates;
         
         transducer.currentCoordinates.x = posX;
         transducer.currentCoordinates.y = posY;
@@ -3994,34 +3009,34 @@ void ALPS::sendTouchData() {
         {
             case FORCE_TOUCH_BUTTON: // Physical button is translated into force touch instead of click
                 transducer.isPhysicalButtonDown = false;
-                transducer.currentCoordinates.pressure = state.button ? 255 : 0;
+                transducer.currentCoordinates.pressure = button ? 255 : 0;
                 break;
                 
             case FORCE_TOUCH_THRESHOLD: // Force touch is touch with pressure over threshold
-                transducer.isPhysicalButtonDown = state.button;
-                transducer.currentCoordinates.pressure = state.pressure > _forceTouchPressureThreshold ? 255 : 0;
+                transducer.isPhysicalButtonDown = button;
+                transducer.currentCoordinates.pressure = pressure > _forceTouchPressureThreshold ? 255 : 0;
                 break;
                 
             case FORCE_TOUCH_VALUE: // Pressure is passed to system as is
-                transducer.isPhysicalButtonDown = state.button;
-                transducer.currentCoordinates.pressure = state.pressure;
+                transducer.isPhysicalButtonDown = button;
+                transducer.currentCoordinates.pressure = pressure;
                 break;
                 
             case FORCE_TOUCH_CUSTOM: // Pressure is passed, but with locking
-                transducer.isPhysicalButtonDown = state.button;
+                transducer.isPhysicalButtonDown = button;
                 
-                if (clampedFingerCount != 1) {
-                    transducer.currentCoordinates.pressure = state.pressure > _forceTouchPressureThreshold ? 255 : 0;
+                if (_tracker.clampedFingerCount != 1) {
+                    transducer.currentCoordinates.pressure = pressure > _forceTouchPressureThreshold ? 255 : 0;
                     break;
                 }
                 
                 double value;
-                if (state.pressure >= _forceTouchCustomDownThreshold) {
+                if (pressure >= _forceTouchCustomDownThreshold) {
                     value = 1.0;
-                } else if (state.pressure <= _forceTouchCustomUpThreshold) {
+                } else if (pressure <= _forceTouchCustomUpThreshold) {
                     value = 0.0;
                 } else {
-                    double base = ((double) (state.pressure - _forceTouchCustomUpThreshold)) / ((double) (_forceTouchCustomDownThreshold - _forceTouchCustomUpThreshold));
+                    double base = ((double) (pressure - _forceTouchCustomUpThreshold)) / ((double) (_forceTouchCustomDownThreshold - _forceTouchCustomUpThreshold));
                     value = 1;
                     for (int i = 0; i < _forceTouchCustomPower; ++i) {
                         value *= base;
@@ -4032,22 +3047,28 @@ void ALPS::sendTouchData() {
                 
             case FORCE_TOUCH_DISABLED:
             default:
-                transducer.isPhysicalButtonDown = state.button;
+                transducer.isPhysicalButtonDown = button;
                 transducer.currentCoordinates.pressure = 0;
                 break;
                 
         }
         
         transducer.isTransducerActive = 1;
-        transducer.currentCoordinates.width = state.pressure / 2;
-        if (state.fingerType == kMT2FingerTypeUndefined)
+        transducer.currentCoordinates.width = pressure / 2;
+        if (fingerType == kMT2FingerTypeUndefined)
             IOLog("alps_parse_hw_state: WTF!? finger type is undefined");
-        if (state.fingerType < kMT2FingerTypeUndefined || state.fingerType > kMT2FingerTypeLittleFinger)
+        if (!isValidFingerType(fingerType))
             IOLog("alps_parse_hw_state: WTF!? finger type is out of range");
-        if (freeFingerTypes[state.fingerType])
+        else if (_tracker.virtualFingers.freeFingerTypes & (1 << fingerType))
             IOLog("alps_parse_hw_state: WTF!? finger type is marked free");
-        transducer.fingerType = state.fingerType;
+        transducer.fingerType = (MT2FingerType)fingerType;
         transducer.secondaryId = i;
+        
+        shape |= 1 << i;
+        if (transducer.isPhysicalButtonDown)
+            shape |= 0x100 << i;
+        if (transducer.currentCoordinates.pressure == 255)
+            shape |= 0x10000 << i;
     }
     
     for (int i = 0; i < transducers_count; i++)
@@ -4055,8 +3076,8 @@ void ALPS::sendTouchData() {
             if (inputEvent.transducers[i].fingerType == inputEvent.transducers[j].fingerType)
                 IOLog("alps_parse_hw_state: WTF!? equal finger types");
     
-    if (transducers_count != clampedFingerCount)
-        IOLog("alps_parse_hw_state: WTF?! tducers_count %d clampedFingerCount %d", transducers_count, clampedFingerCount);
+    if (transducers_count != _tracker.clampedFingerCount)
+        IOLog("alps_parse_hw_state: WTF?! tducers_count %d _tracker.clampedFingerCount %d", transducers_count, _tracker.clampedFingerCount);
     
     // create new VoodooI2CMultitouchEvent
     inputEvent.contact_count = transducers_count;
@@ -4072,13 +3093,104 @@ void ALPS::sendTouchData() {
         super::messageClient(kIOMessageVoodooInputUpdateDimensionsMessage, voodooInputInstance, &d, sizeof(VoodooInputDimensions));
     }
     
+    /*
+     * With a backlog in packetReady, a frame is held back when only
+     * coordinates changed since the last one sent. Its positions have already
+     * gone through the filters; the newest frame goes out instead.
+     */
+    if (_holdFrame && shape == _lastSentShape) {
+        _lastFrameHeld = true;
+        _tracker.lastFingerCount = _tracker.clampedFingerCount;
+        return;
+    }
+    
+    /*
+     * The frame-rate governor holds a frame that comes within _frameInterval
+     * of the last one sent, unless contacts, buttons or force touch changed.
+     * _frameTimer sends the newest held frame when the interval is up.
+     */
+    if (_frameInterval && shape == _lastSentShape && inputEvent.contact_count &&
+        timestamp - _lastSentTime < _frameInterval) {
+        _lastFrameHeld = true;
+        _tracker.lastFingerCount = _tracker.clampedFingerCount;
+        armFrameTimer();
+        return;
+    }
+    
     // send the event into the multitouch interface
     // send the 0 finger message only once
     if (inputEvent.contact_count != 0 || lastSentFingerCount != 0) {
-        super::messageClient(kIOMessageVoodooInputMessage, voodooInputInstance, &inputEvent, sizeof(VoodooInputEvent));
+        sendInputEvent();
+        
+        uint64_t sent;
+        clock_get_uptime(&sent);
+        recordLatency(kLatencySend, sendStart, sent);
+        recordLatency(kLatencyTotal, _packetTime, sent);
     }
-    lastFingerCount = clampedFingerCount;
+    _tracker.lastFingerCount = _tracker.clampedFingerCount;
     lastSentFingerCount = inputEvent.contact_count;
+    _lastSentShape = shape;
+    _lastFrameHeld = false;
+}
+
+void ALPS::sendInputEvent() {
+#ifdef DEBUG
+    // capture instead of sending while replaying a trace
+    if (_replayEvents) {
+        _replayEvents->appendBytes(&inputEvent, sizeof(VoodooInputEvent));
+        _lastSentTime = inputEvent.timestamp;
+        return;
+    }
+#endif
+    super::messageClient(kIOMessageVoodooInputMessage, voodooInputInstance, &inputEvent, sizeof(VoodooInputEvent));
+    _lastSentTime = inputEvent.timestamp;
+}
+
+void ALPS::armFrameTimer() {
+    if (!_frameTimer || _frameTimerArmed)
+        return;
+    
+    uint64_t now;
+    clock_get_uptime(&now);
+    uint64_t due = _lastSentTime + _frameInterval;
+    uint64_t delay = due > now ? due - now : 0;
+    _frameTimer->setTimeout(*(AbsoluteTime*)&delay);
+    _frameTimerArmed = true;
+}
+
+void ALPS::flushHeldFrame() {
+    // nothing held, or the governor's timer sends it
+    if (!_lastFrameHeld || _frameTimerArmed)
+        return;
+    
+    // held for coalescing, but the governor would have held it as well
+    if (_frameInterval && _frameTimer && inputEvent.timestamp - _lastSentTime < _frameInterval) {
+        armFrameTimer();
+        return;
+    }
+    
+    sendInputEvent();
+    _lastFrameHeld = false;
+    
+    uint64_t sent;
+    clock_get_uptime(&sent);
+    recordLatency(kLatencyTotal, _packetTime, sent);
+}
+
+void ALPS::onFrameTimer() {
+    _frameTimerArmed = false;
+    
+    // nothing held, or a later frame went out directly
+    if (!_lastFrameHeld)
+        return;
+    
+    // inputEvent still holds the newest frame built by sendTouchData
+    sendInputEvent();
+    _lastFrameHeld = false;
+    
+    uint64_t sent;
+    clock_get_uptime(&sent);
+    recordLatency(kLatencyTotal, _packetTime, sent);
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -4091,6 +3203,7 @@ void ALPS::initTouchPad()
     //
     
     _packetByteCount = 0;
+    _desyncBytes = 0;
     _ringBuffer.reset();
     
     // clear passbuttons, just in case buttons were down when system
@@ -4136,10 +3249,22 @@ void ALPS::setParamPropertiesGated(OSDictionary * config)
         {"LogicalYMultiplier",              &manual_y_log},
         {"PhysicalXMultiplier",             &manual_x_phy},
         {"PhysicalYMultiplier",             &manual_y_phy},
+        {"MaxFrameRate",                    &_maxFrameRate}, // Hz, 0 - unlimited
+        {"SmoothingFilter",                 &_smoothingFilter}, // 0 - box, 1 - One-Euro, 2 - alpha-beta
+        {"OneEuroMinCutoff",                &_oneEuroMinCutoff}, // mHz
+        {"OneEuroBeta",                     &_oneEuroBeta}, // mHz per unit/s
+        {"OneEuroDCutoff",                  &_oneEuroDCutoff}, // mHz
+        {"AlphaBetaAlpha",                  &_alphaBetaAlpha}, // 1/1000
+        {"AlphaBetaBeta",                   &_alphaBetaBeta}, // 1/1000
+        {"PredictionTime",                  &_predictionTime}, // ms, 0 - off
+        {"FingerGateDistance",              &_fingerGateDistance}, // logical units
+        {"RecoveryBadBytes",                &_recoveryBadBytes}, // 0 - no recovery
+        {"RecoveryWindow",                  &_recoveryWindowMS}, // ms
     };
     const struct {const char *name; int *var;} boolvars[]={
         {"DisableLEDUpdate",                &noled},
         {"SkipPassThrough",                 &skippassthru},
+        {"CoalesceFrames",                  &_coalesceFrames},
     };
     const struct {const char* name; bool* var;} lowbitvars[]={
         {"USBMouseStopsTrackpad",           &usb_mouse_stops_trackpad},
@@ -4188,6 +3313,62 @@ void ALPS::setParamPropertiesGated(OSDictionary * config)
         }
     }
     
+    // the transform is set up at probe, before the profile is loaded, so redo
+    // it with its UnitsPerMM and Logical/PhysicalMultipliers
+    if (_resolutionX)
+        update_resolution();
+    
+    // frame interval for the output governor in sendTouchData
+    _frameInterval = 0;
+    if (_maxFrameRate > 0)
+        nanoseconds_to_absolutetime(1000000000ULL / _maxFrameRate, &_frameInterval);
+    
+    // smoothing coefficients in the units CoordinateFilter works in
+    _tracker.smoothing.filter = _smoothingFilter;
+    if (_tracker.smoothing.filter < kSmoothingBox || _tracker.smoothing.filter > kSmoothingAlphaBeta)
+        _tracker.smoothing.filter = kSmoothingBox;
+    _tracker.smoothing.min_cutoff = max(_oneEuroMinCutoff, 1);
+    _tracker.smoothing.beta = max(_oneEuroBeta, 0);
+    _tracker.smoothing.d_tau = 159154943 / max(_oneEuroDCutoff, 1);
+    // gains outside 0..1 make the alpha-beta filter diverge
+    _alphaBetaAlpha = min(max(_alphaBetaAlpha, 0), 1000);
+    _alphaBetaBeta = min(max(_alphaBetaBeta, 0), 1000);
+    _tracker.smoothing.alpha = ((int64_t)_alphaBetaAlpha << 16) / 1000;
+    _tracker.smoothing.ab_beta = ((int64_t)_alphaBetaBeta << 16) / 1000;
+    
+    // window over which dropped bytes count towards the next recovery step
+    nanoseconds_to_absolutetime((uint64_t)max(_recoveryWindowMS, 1) * 1000000, &_recoveryWindow);
+    
+    // dist() compares squared distances
+    _tracker.fingerGate = (int64_t)_fingerGateDistance * _fingerGateDistance;
+    
+    // publish latency histograms on request, "ResetLatency" starts over
+    if (OSBoolean* flag = OSDynamicCast(OSBoolean, config->getObject("DumpLatency")))
+    {
+        if (flag->isTrue())
+            dumpLatency();
+    }
+    if (OSBoolean* flag = OSDynamicCast(OSBoolean, config->getObject("ResetLatency")))
+    {
+        if (flag->isTrue())
+            bzero(_latency, sizeof(_latency));
+    }
+    // the same for the counts of bytes dropped to resync
+    if (OSBoolean* flag = OSDynamicCast(OSBoolean, config->getObject("DumpResyncStats")))
+    {
+        if (flag->isTrue())
+            dumpResyncStats();
+    }
+    
+#ifdef DEBUG
+    // replay a byte trace captured by the controller ("PS2Trace")
+    if (OSData* trace = OSDynamicCast(OSData, config->getObject("ReplayTrace")))
+        replayTrace(trace);
+    // compare the last replay against a golden VoodooInputEvent sequence
+    if (OSData* expected = OSDynamicCast(OSData, config->getObject("ReplayExpected")))
+        compareReplay(expected);
+#endif
+    
     // bogusdeltathreshx/y = 0 is MAX_INT
     if (!bogusdxthresh)
         bogusdxthresh = 0x7FFFFFFF;
@@ -4214,6 +3395,543 @@ void ALPS::setParamPropertiesGated(OSDictionary * config)
      */
 }
 
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+void ALPS::recordLatency(int stage, uint64_t start, uint64_t end)
+{
+    if (end < start)
+        return;
+    uint64_t ns;
+    absolutetime_to_nanoseconds(end - start, &ns);
+    
+    uint64_t us = ns / 1000;
+    int bucket = us ? 64 - __builtin_clzll(us) : 0;
+    if (bucket >= kLatencyBuckets)
+        bucket = kLatencyBuckets - 1;
+    
+    alps_latency& hist = _latency[stage];
+    hist.buckets[bucket]++;
+    hist.samples++;
+    if (ns > hist.maxNS)
+        hist.maxNS = ns;
+}
+
+static UInt64 latencyPercentile(const alps_latency& hist, unsigned percent)
+{
+    // upper bound of the bucket holding the percentile, in microseconds
+    UInt64 seen = 0;
+    for (int i = 0; i < kLatencyBuckets; i++) {
+        seen += hist.buckets[i];
+        if (seen * 100 >= hist.samples * percent)
+            return 1ULL << i;
+    }
+    return 1ULL << (kLatencyBuckets - 1);
+}
+
+void ALPS::dumpLatency()
+{
+    //
+    // Publish "LatencyStats" with one dictionary per stage:
+    //   Queue  - first byte of the packet until packetReady picks it up
+    //   Decode - process_packet/alps_parse_hw_state up to renumberFingers
+    //   Track  - renumberFingers, including the coordinate averaging
+    //   Send   - sendTouchData until messageClient returns
+    //   Total  - first byte of the packet until messageClient returns
+    // Percentiles are bucket upper bounds, so only good to a factor of 2.
+    //
+    
+    static const char* const names[kLatencyStages] = {"Queue", "Decode", "Track", "Send", "Total"};
+    
+    OSDictionary* stats = OSDictionary::withCapacity(kLatencyStages);
+    if (!stats)
+        return;
+    for (int stage = 0; stage < kLatencyStages; stage++) {
+        const alps_latency& hist = _latency[stage];
+        OSDictionary* dict = OSDictionary::withCapacity(5);
+        OSArray* buckets = OSArray::withCapacity(kLatencyBuckets);
+        if (!dict || !buckets) {
+            OSSafeReleaseNULL(dict);
+            OSSafeReleaseNULL(buckets);
+            break;
+        }
+        const struct {const char* name; UInt64 value;} values[] = {
+            {"Samples",                 hist.samples},
+            {"P50US",                   hist.samples ? latencyPercentile(hist, 50) : 0},
+            {"P99US",                   hist.samples ? latencyPercentile(hist, 99) : 0},
+            {"MaxUS",                   hist.maxNS / 1000},
+        };
+        for (int i = 0; i < countof(values); i++) {
+            if (OSNumber* num = OSNumber::withNumber(values[i].value, 64)) {
+                dict->setObject(values[i].name, num);
+                num->release();
+            }
+        }
+        for (int i = 0; i < kLatencyBuckets; i++) {
+            if (OSNumber* num = OSNumber::withNumber(hist.buckets[i], 32)) {
+                buckets->setObject(num);
+                num->release();
+            }
+        }
+        dict->setObject("Histogram", buckets);
+        buckets->release();
+        stats->setObject(names[stage], dict);
+        dict->release();
+    }
+    setProperty("LatencyStats", stats);
+    stats->release();
+}
+
+void ALPS::recordResync(const UInt8* packet)
+{
+    UInt32 dropped = *(const UInt32*)(&packet[kPacketDroppedOffset]);
+    uint64_t start = *(const uint64_t*)(&packet[kPacketDesyncOffset]);
+    uint64_t ns = 0;
+    if (_packetTime > start)
+        absolutetime_to_nanoseconds(_packetTime - start, &ns);
+    
+    _resync.droppedBytes += dropped;
+    _resync.events++;
+    if (dropped > _resync.longestBytes)
+        _resync.longestBytes = dropped;
+    if (ns > _resync.longestNS)
+        _resync.longestNS = ns;
+    
+    // counted only, "DumpResyncStats" publishes the totals
+    DEBUG_LOG("ALPS: lost sync, dropped %u bytes in %llu us\n", dropped, ns / 1000);
+}
+
+void ALPS::dumpResyncStats()
+{
+    //
+    // Publish "ResyncStats": bytes dropped to get back in sync, how often
+    // sync was lost, and the longest loss in bytes and time until the
+    // next good packet started.
+    //
+    
+    OSDictionary* stats = OSDictionary::withCapacity(4);
+    if (!stats)
+        return;
+    const struct {const char* name; UInt64 value;} values[] = {
+        {"DroppedBytes",            _resync.droppedBytes},
+        {"ResyncEvents",            _resync.events},
+        {"LongestDesyncBytes",      _resync.longestBytes},
+        {"LongestDesyncUS",         _resync.longestNS / 1000},
+    };
+    for (int i = 0; i < countof(values); i++) {
+        if (OSNumber* num = OSNumber::withNumber(values[i].value, 64)) {
+            stats->setObject(values[i].name, num);
+            num->release();
+        }
+    }
+    setProperty("ResyncStats", stats);
+    stats->release();
+}
+
+void ALPS::checkRecovery()
+{
+    //
+    // Called from packetReady when bytes were dropped or a step was taken.
+    // RecoveryBadBytes dropped within one RecoveryWindow take the next step:
+    // resync, then reinit, then a full reset, which repeats with doubling
+    // intervals for as long as the stream stays bad. A window without drops
+    // starts over from the first step. The steps themselves issue PS/2
+    // commands, so they run from _recoveryTimer rather than right here.
+    //
+    
+    if (_recoveryBadBytes <= 0)
+        return;
+    
+    uint64_t now;
+    clock_get_uptime(&now);
+#ifdef DEBUG
+    if (_replayEvents)
+        now = _replayTime;
+#endif
+    
+    alps_recovery_state& r = _recovery;
+    if (now - r.windowStart >= _recoveryWindow) {
+        if (!r.windowDropped && r.level != kRecoveryNone) {
+            IOLog("ALPS: recovered, stream in sync again\n");
+            r.level = kRecoveryNone;
+            r.backoff = 0;
+        }
+        r.windowStart = now;
+        r.windowDropped = 0;
+    }
+    UInt32 total = _droppedBytesTotal;
+    r.windowDropped += total - r.seenDropped;
+    r.seenDropped = total;
+    
+    if (r.windowDropped < (UInt32)_recoveryBadBytes || now < r.nextStep || _recoveryTimerArmed)
+        return;
+    
+    if (r.level < kRecoveryReset)
+        r.level++;
+    else if (r.backoff < 6)
+        r.backoff++;
+    r.steps[r.level]++;
+    r.nextStep = now + (_recoveryWindow << r.backoff);
+    
+    static const char* const names[kRecoverySteps] = {"none", "resync", "reinit", "reset"};
+    IOLog("ALPS: %u bytes dropped within %d ms, recovery step %s (%u)\n",
+          (unsigned)r.windowDropped, _recoveryWindowMS, names[r.level], (unsigned)r.steps[r.level]);
+    r.windowStart = now;
+    r.windowDropped = 0;
+    dumpRecoveryStats();
+    
+#ifdef DEBUG
+    // a replay counts the steps but leaves the hardware alone
+    if (_replayEvents)
+        return;
+#endif
+    if (_recoveryTimer) {
+        _recoveryTimerArmed = true;
+        _recoveryTimer->setTimeoutMS(0);
+    }
+}
+
+void ALPS::onRecoveryTimer()
+{
+    _recoveryTimerArmed = false;
+    
+    switch (_recovery.level) {
+        case kRecoveryResync:
+            // with reporting stopped no byte can arrive, so the partial
+            // packet is safe to drop from here
+            ps2_command_short(kDP_SetDefaultsAndDisable);
+            _packetByteCount = 0;
+            _desyncBytes = 0;
+            ps2_command_short(kDP_Enable);
+            break;
+            
+        case kRecoveryReinit:
+            initTouchPad();
+            break;
+            
+        case kRecoveryReset:
+            // the device is already identified; restart() would identify it
+            // again and re-register the service
+            resetMouse();
+            initTouchPad();
+            break;
+    }
+    
+    // whatever came in meanwhile belongs to the old stream
+    _recovery.seenDropped = _droppedBytesTotal;
+}
+
+void ALPS::dumpRecoveryStats()
+{
+    //
+    // Publish "RecoveryStats": how often each recovery step was taken, and
+    // the step taken last (0 when the stream has been in sync since).
+    //
+    
+    OSDictionary* stats = OSDictionary::withCapacity(4);
+    if (!stats)
+        return;
+    const struct {const char* name; UInt64 value;} values[] = {
+        {"Resync",                  _recovery.steps[kRecoveryResync]},
+        {"Reinit",                  _recovery.steps[kRecoveryReinit]},
+        {"Reset",                   _recovery.steps[kRecoveryReset]},
+        {"Level",                   (UInt64)_recovery.level},
+    };
+    for (int i = 0; i < countof(values); i++) {
+        if (OSNumber* num = OSNumber::withNumber(values[i].value, 64)) {
+            stats->setObject(values[i].name, num);
+            num->release();
+        }
+    }
+    setProperty("RecoveryStats", stats);
+    stats->release();
+}
+
+#ifdef DEBUG
+void ALPS::replayTrace(OSData* trace)
+{
+    //
+    // Feed a PS2TraceRecord stream, as exported by the controller, through the
+    // same interruptOccurred/packetReady path the hardware uses.  Only mouse
+    // stream bytes that arrived asynchronously are replayed; command responses
+    // and timeouts are skipped.  Each record's capture time becomes the event
+    // time, and the resulting VoodooInputEvents are collected in the
+    // "ReplayEvents" property rather than being sent to VoodooInput.
+    // Latency histograms restart with the replay and are published with it;
+    // Queue and Total are meaningless here as packets carry their capture time.
+    // So are the smoothing filter's lag and jitter and the predictor's error
+    // by horizon ("FilterStats").
+    //
+    // The real device is disabled for the duration so its bytes can't mix
+    // with replayed ones in the ring buffer, then re-initialized as on wake.
+    //
+    
+    unsigned count = trace->getLength() / sizeof(PS2TraceRecord);
+    const PS2TraceRecord* records = (const PS2TraceRecord*)trace->getBytesNoCopy();
+    if (!records || !count)
+        return;
+    
+    _replayEvents = OSData::withCapacity(count / priv.pktsize * sizeof(VoodooInputEvent));
+    if (!_replayEvents)
+        return;
+    
+    setTouchPadEnable(false);
+    _packetByteCount = 0;
+    _desyncBytes = 0;
+    _ringBuffer.reset();
+    bzero(_latency, sizeof(_latency));
+    bzero(&_resync, sizeof(_resync));
+    bzero(&_recovery, sizeof(_recovery));
+    _recovery.seenDropped = _droppedBytesTotal;
+    bzero(&_filterStats, sizeof(_filterStats));
+    
+    unsigned replayed = 0;
+    for (unsigned i = 0; i < count; i++) {
+        const PS2TraceRecord& record = records[i];
+        if ((record.flags & (kPS2TF_Mouse | kPS2TF_Request | kPS2TF_Timeout)) != kPS2TF_Mouse)
+            continue;
+        _replayTime = record.time;
+        if (kPS2IR_packetReady == interruptOccurred(record.data))
+            packetReady();
+        replayed++;
+    }
+    
+    // a frame the governor still holds is captured as its timer would have
+    // sent it; the timer must not fire into VoodooInput after the replay
+    if (_lastFrameHeld)
+        sendInputEvent();
+    if (_frameTimer)
+        _frameTimer->cancelTimeout();
+    _frameTimerArmed = false;
+    _lastFrameHeld = false;
+    
+    DEBUG_LOG("ALPS: replayed %u of %u trace bytes, %u events\n", replayed, count,
+              (unsigned)(_replayEvents->getLength() / sizeof(VoodooInputEvent)));
+    setProperty("ReplayEvents", _replayEvents);
+    OSSafeReleaseNULL(_replayEvents);
+    dumpLatency();
+    dumpResyncStats();
+    dumpRecoveryStats();
+    dumpFilterStats();
+    
+    setTouchPadEnable(true);
+}
+
+static uint32_t isqrt(uint64_t value)
+{
+    uint64_t root = 0, bit = 1ULL << 62;
+    while (bit > value)
+        bit >>= 2;
+    while (bit) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)root;
+}
+
+void ALPS::compareReplay(OSData* expected)
+{
+    //
+    // Compare "ReplayEvents" from the last replay with a golden sequence of
+    // VoodooInputEvents frame by frame.  A frame diverges if contact_count,
+    // or any transducer's secondaryId, fingerType or coordinates differ.
+    // Coordinate deltas of transducers present in both frames (matched by
+    // secondaryId, i.e. virtual finger) are accumulated into a per-finger
+    // RMS so small filtering changes can be judged by magnitude.
+    // The result is published as the "ReplayDiff" dictionary.
+    //
+    
+    OSData* actual = OSDynamicCast(OSData, getProperty("ReplayEvents"));
+    if (!actual)
+        return;
+    
+    unsigned actualCount = actual->getLength() / sizeof(VoodooInputEvent);
+    unsigned expectedCount = expected->getLength() / sizeof(VoodooInputEvent);
+    const VoodooInputEvent* a = (const VoodooInputEvent*)actual->getBytesNoCopy();
+    const VoodooInputEvent* e = (const VoodooInputEvent*)expected->getBytesNoCopy();
+    unsigned frames = min(actualCount, expectedCount);
+    
+    int firstDivergent = actualCount != expectedCount ? frames : -1;
+    unsigned divergentFrames = 0;
+    uint64_t sumSq[MAX_TOUCHES] = {};
+    uint32_t samples[MAX_TOUCHES] = {};
+    
+    for (unsigned n = 0; n < frames; n++) {
+        bool diverged = a[n].contact_count != e[n].contact_count;
+        for (int i = 0; i < a[n].contact_count && i < VOODOO_INPUT_MAX_TRANSDUCERS; i++) {
+            const VoodooInputTransducer& ta = a[n].transducers[i];
+            for (int k = 0; k < e[n].contact_count && k < VOODOO_INPUT_MAX_TRANSDUCERS; k++) {
+                const VoodooInputTransducer& te = e[n].transducers[k];
+                if (ta.secondaryId != te.secondaryId)
+                    continue;
+                int dx = (int)ta.currentCoordinates.x - (int)te.currentCoordinates.x;
+                int dy = (int)ta.currentCoordinates.y - (int)te.currentCoordinates.y;
+                if (dx || dy || ta.fingerType != te.fingerType || i != k)
+                    diverged = true;
+                if (ta.secondaryId < MAX_TOUCHES) {
+                    sumSq[ta.secondaryId] += (uint64_t)(dx * dx) + (uint64_t)(dy * dy);
+                    samples[ta.secondaryId]++;
+                }
+                break;
+            }
+        }
+        if (diverged) {
+            divergentFrames++;
+            if (firstDivergent < 0 || (unsigned)firstDivergent > n)
+                firstDivergent = n;
+        }
+    }
+    
+    OSDictionary* diff = OSDictionary::withCapacity(5);
+    OSArray* rms = OSArray::withCapacity(MAX_TOUCHES);
+    if (!diff || !rms) {
+        OSSafeReleaseNULL(diff);
+        OSSafeReleaseNULL(rms);
+        return;
+    }
+    const struct {const char* name; UInt64 value;} values[] = {
+        {"Frames",                      actualCount},
+        {"ExpectedFrames",              expectedCount},
+        {"DivergentFrames",             divergentFrames},
+        {"FirstDivergentFrame",         (UInt64)firstDivergent},
+    };
+    // FirstDivergentFrame (last entry) only if the sequences differ
+    int count = firstDivergent < 0 ? countof(values) - 1 : countof(values);
+    for (int i = 0; i < count; i++) {
+        if (OSNumber* num = OSNumber::withNumber(values[i].value, 64)) {
+            diff->setObject(values[i].name, num);
+            num->release();
+        }
+    }
+    for (int i = 0; i < MAX_TOUCHES; i++) {
+        if (OSNumber* num = OSNumber::withNumber(samples[i] ? isqrt(sumSq[i] / samples[i]) : 0, 32)) {
+            rms->setObject(num);
+            num->release();
+        }
+    }
+    diff->setObject("FingerRMS", rms);
+    rms->release();
+    
+    IOLog("ALPS: replay diff: %u/%u frames, %u divergent, first at %d\n",
+          actualCount, expectedCount, divergentFrames, firstDivergent);
+    setProperty("ReplayDiff", diff);
+    diff->release();
+}
+
+void ALPS::recordFilterSample(int finger)
+{
+    //
+    // Lag is how far the filtered position is from the raw one, jitter the
+    // second difference (acceleration) of consecutive positions.  A filter
+    // trades one for the other; the raw jitter is the baseline to judge it.
+    //
+    
+    const virtual_finger_state& vf = _tracker.virtualFingerStates[finger];
+    const CoordinateFilter* axes[2] = {&vf.x_avg, &vf.y_avg};
+    bool history = vf.x_avg.count() >= 3;
+    
+    for (int axis = 0; axis < 2; axis++) {
+        int (&prev)[2][2] = _filterStats.prev[finger][axis];
+        int raw = axes[axis]->newest();
+        int out = axes[axis]->average();
+        
+        _filterStats.lagSq += (int64_t)(out - raw) * (out - raw);
+        _filterStats.samples++;
+        if (history) {
+            int64_t rawJitter = raw - 2 * prev[0][0] + prev[0][1];
+            int64_t jitter = out - 2 * prev[1][0] + prev[1][1];
+            _filterStats.rawJitterSq += rawJitter * rawJitter;
+            _filterStats.jitterSq += jitter * jitter;
+            _filterStats.jitterSamples++;
+        }
+        prev[0][1] = prev[0][0];
+        prev[0][0] = raw;
+        prev[1][1] = prev[1][0];
+        prev[1][0] = out;
+    }
+    
+    //
+    // Prediction error by horizon: an older entry is extrapolated to the
+    // newest one's time and compared with it. The hold error (no prediction)
+    // is the sample age the predictor tries to hide.
+    //
+    
+    const motion_history& h = vf.history;
+    int newest = h.at(0);
+    for (int k = 1; k < h.count; k++) {
+        uint64_t horizon = h.time[newest] - h.time[h.at(k)];
+        int bucket = (int)((horizon + kPredictionBucketMS * 500) / (kPredictionBucketMS * 1000)) - 1;
+        if (bucket < 0)
+            continue;
+        if (bucket >= kPredictionBuckets)
+            break;
+        int px, py;
+        if (!predictMotion(h, k, horizon, px, py))
+            continue;
+        int64_t dx = px - h.x[newest], dy = py - h.y[newest];
+        int64_t hx = h.x[h.at(k)] - h.x[newest], hy = h.y[h.at(k)] - h.y[newest];
+        _filterStats.predictSq[bucket] += dx * dx + dy * dy;
+        _filterStats.holdSq[bucket] += hx * hx + hy * hy;
+        _filterStats.predictSamples[bucket]++;
+    }
+}
+
+void ALPS::dumpFilterStats()
+{
+    const filter_stats& stats = _filterStats;
+    OSDictionary* dict = OSDictionary::withCapacity(5);
+    if (!dict)
+        return;
+    const struct {const char* name; UInt64 value;} values[] = {
+        {"Filter",                      (UInt64)_tracker.smoothing.filter},
+        {"Samples",                     stats.samples},
+        {"LagRMS",                      stats.samples ? isqrt(stats.lagSq / stats.samples) : 0},
+        {"JitterRMS",                   stats.jitterSamples ? isqrt(stats.jitterSq / stats.jitterSamples) : 0},
+        {"RawJitterRMS",                stats.jitterSamples ? isqrt(stats.rawJitterSq / stats.jitterSamples) : 0},
+    };
+    for (int i = 0; i < countof(values); i++) {
+        if (OSNumber* num = OSNumber::withNumber(values[i].value, 64)) {
+            dict->setObject(values[i].name, num);
+            num->release();
+        }
+    }
+    IOLog("ALPS: replay filter %d: lag %llu jitter %llu (raw %llu)\n", _tracker.smoothing.filter,
+          values[2].value, values[3].value, values[4].value);
+    
+    OSArray* prediction = OSArray::withCapacity(kPredictionBuckets);
+    for (int i = 0; prediction && i < kPredictionBuckets; i++) {
+        OSDictionary* bucket = OSDictionary::withCapacity(4);
+        if (!bucket)
+            break;
+        uint32_t samples = stats.predictSamples[i];
+        const struct {const char* name; UInt64 value;} errors[] = {
+            {"HorizonMS",               (UInt64)(i + 1) * kPredictionBucketMS},
+            {"Samples",                 samples},
+            {"ErrorRMS",                samples ? isqrt(stats.predictSq[i] / samples) : 0},
+            {"HoldErrorRMS",            samples ? isqrt(stats.holdSq[i] / samples) : 0},
+        };
+        for (int j = 0; j < countof(errors); j++) {
+            if (OSNumber* num = OSNumber::withNumber(errors[j].value, 64)) {
+                bucket->setObject(errors[j].name, num);
+                num->release();
+            }
+        }
+        prediction->setObject(bucket);
+        bucket->release();
+    }
+    if (prediction) {
+        dict->setObject("Prediction", prediction);
+        prediction->release();
+    }
+    setProperty("FilterStats", dict);
+    dict->release();
+}
+#endif
+
 IOReturn ALPS::setParamProperties(OSDictionary* dict)
 {
     ////IOReturn result = super::IOHIDevice::setParamProperties(dict);
@@ -4251,6 +3969,9 @@ void ALPS::setDevicePowerState( UInt32 whatToDo )
             // Disable touchpad (synchronous).
             //
             
+            if (_recoveryTimer)
+                _recoveryTimer->cancelTimeout();
+            _recoveryTimerArmed = false;
             setTouchPadEnable( false );
             break;
             
@@ -25,6 +25,8 @@
 #include <IOKit/hidsystem/IOHIPointing.h>
 #include <IOKit/IOCommandGate.h>
 #include "VoodooPS2Common.h"
+#include "alps_decode.h"
+#include "alps_tracker.h"
 
 #include "VoodooInputMultitouch/VoodooInputEvent.h"
 
@@ -32,96 +34,7 @@
 // #include "../VoodooInput/VoodooInput/VoodooInputMultitouch/VoodooInputMessages.h"
 // #include "../VoodooInput/VoodooInput/VoodooInputMultitouch/VoodooInputEvent.h"
 
-#define ALPS_PROTO_V1             0x100
-#define ALPS_PROTO_V2             0x200
-#define ALPS_PROTO_V3             0x300
-#define ALPS_PROTO_V3_RUSHMORE    0x310
-#define ALPS_PROTO_V4             0x400
-#define ALPS_PROTO_V5             0x500
-#define ALPS_PROTO_V6             0x600
-#define ALPS_PROTO_V7             0x700    /* t3btl t4s */
-#define ALPS_PROTO_V8             0x800    /* SS4btl SS4s */
-#define ALPS_PROTO_V9             0x900    /* ss3btl */
-
-#define MAX_TOUCHES     5
-
-#define DOLPHIN_COUNT_PER_ELECTRODE	64
-#define DOLPHIN_PROFILE_XOFFSET		8	/* x-electrode offset */
-#define DOLPHIN_PROFILE_YOFFSET		1	/* y-electrode offset */
-
 // TODO: Remove or move?
-// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-// SimpleAverage Class Declaration
-//
-
-template <class T, int N>
-class SimpleAverage
-{
-private:
-    T m_buffer[N];
-    int m_count;
-    int m_sum;
-    int m_index;
-    
-public:
-    inline SimpleAverage() { reset(); }
-    T filter(T data)
-    {
-        // add new entry to sum
-        m_sum += data;
-        // if full buffer, then we are overwriting, so subtract old from sum
-        if (m_count == N)
-            m_sum -= m_buffer[m_index];
-        // new entry into buffer
-        m_buffer[m_index] = data;
-        // move index to next position with wrap around
-        if (++m_index >= N)
-            m_index = 0;
-        // keep count moving until buffer is full
-        if (m_count < N)
-            ++m_count;
-        // return average of current items
-        return m_sum / m_count;
-    }
-    inline void reset()
-    {
-        m_count = 0;
-        m_sum = 0;
-        m_index = 0;
-    }
-    inline int count() const { return m_count; }
-    inline int sum() const { return m_sum; }
-    T oldest() const
-    {
-        // undefined if nothing in here, return zero
-        if (m_count == 0)
-            return 0;
-        // if it is not full, oldest is at index 0
-        // if full, it is right where the next one goes
-        if (m_count < N)
-            return m_buffer[0];
-        else
-            return m_buffer[m_index];
-    }
-    T newest() const
-    {
-        // undefined if nothing in here, return zero
-        if (m_count == 0)
-            return 0;
-        // newest is index - 1, with wrap
-        int index = m_index;
-        if (--index < 0)
-            index = m_count-1;
-        return m_buffer[index];
-    }
-    T average() const
-    {
-        if (m_count == 0)
-            return 0;
-        return m_sum / m_count;
-    }
-};
-
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 // DecayingAverage Class Declaration
 //
@@ -176,186 +89,6 @@ public:
     }
 };
 
-/*
- * enum SS4_PACKET_ID - defines the packet type for V8
- * SS4_PACKET_ID_IDLE: There's no finger and no button activity.
- * SS4_PACKET_ID_ONE: There's one finger on touchpad
- *  or there's button activities.
- * SS4_PACKET_ID_TWO: There's two or more fingers on touchpad
- * SS4_PACKET_ID_MULTI: There's three or more fingers on touchpad
- * SS4_PACKET_ID_STICK: A stick pointer packet
- */
-enum SS4_PACKET_ID {
-    SS4_PACKET_ID_IDLE = 0,
-    SS4_PACKET_ID_ONE,
-    SS4_PACKET_ID_TWO,
-    SS4_PACKET_ID_MULTI,
-    SS4_PACKET_ID_STICK,
-};
-
-#define SS4_COUNT_PER_ELECTRODE        256
-#define SS4_NUMSENSOR_XOFFSET        7
-#define SS4_NUMSENSOR_YOFFSET        7
-#define SS4_MIN_PITCH_MM        50
-
-#define SS4_MASK_NORMAL_BUTTONS        0x07
-
-#define SS4PLUS_COUNT_PER_ELECTRODE    128
-#define SS4PLUS_NUMSENSOR_XOFFSET    16
-#define SS4PLUS_NUMSENSOR_YOFFSET    5
-#define SS4PLUS_MIN_PITCH_MM        37
-
-#define IS_SS4PLUS_DEV(_b)    (((_b[0]) == 0x73) &&    \
-                 ((_b[1]) == 0x03) &&    \
-                 ((_b[2]) == 0x28)        \
-                )
-
-#define SS4_IS_IDLE_V2(_b)    (((_b[0]) == 0x18) &&        \
-                 ((_b[1]) == 0x10) &&        \
-                 ((_b[2]) == 0x00) &&        \
-                 ((_b[3] & 0x88) == 0x08) &&    \
-                 ((_b[4]) == 0x10) &&        \
-                 ((_b[5]) == 0x00)        \
-                )
-
-#define SS4_1F_X_V2(_b)        (((_b[0]) & 0x0007) |        \
-                 ((_b[1] << 3) & 0x0078) |    \
-                 ((_b[1] << 2) & 0x0380) |    \
-                 ((_b[2] << 5) & 0x1C00)    \
-                )
-
-#define SS4_1F_Y_V2(_b)        (((_b[2]) & 0x000F) |        \
-                 ((_b[3] >> 2) & 0x0030) |    \
-                 ((_b[4] << 6) & 0x03C0) |    \
-                 ((_b[4] << 5) & 0x0C00)    \
-                )
-
-#define SS4_1F_Z_V2(_b)        (((_b[5]) & 0x0F) |        \
-                 ((_b[5] >> 1) & 0x70) |    \
-                 ((_b[4]) & 0x80)        \
-                )
-
-#define SS4_1F_LFB_V2(_b)    (((_b[2] >> 4) & 0x01) == 0x01)
-
-#define SS4_MF_LF_V2(_b, _i)    ((_b[1 + (_i) * 3] & 0x0004) == 0x0004)
-
-#define SS4_BTN_V2(_b)        ((_b[0] >> 5) & SS4_MASK_NORMAL_BUTTONS)
-
-#define SS4_STD_MF_X_V2(_b, _i)    (((_b[0 + (_i) * 3] << 5) & 0x00E0) |    \
-                 ((_b[1 + _i * 3]  << 5) & 0x1F00)    \
-                )
-
-#define SS4_PLUS_STD_MF_X_V2(_b, _i) (((_b[0 + (_i) * 3] << 4) & 0x0070) | \
-                 ((_b[1 + (_i) * 3]  << 4) & 0x0F80)    \
-                )
-
-#define SS4_STD_MF_Y_V2(_b, _i)    (((_b[1 + (_i) * 3] << 3) & 0x0010) |    \
-                 ((_b[2 + (_i) * 3] << 5) & 0x01E0) |    \
-                 ((_b[2 + (_i) * 3] << 4) & 0x0E00)    \
-                )
-
-#define SS4_BTL_MF_X_V2(_b, _i)    (SS4_STD_MF_X_V2(_b, _i) |        \
-                 ((_b[0 + (_i) * 3] >> 3) & 0x0010)    \
-                )
-
-#define SS4_PLUS_BTL_MF_X_V2(_b, _i) (SS4_PLUS_STD_MF_X_V2(_b, _i) |    \
-                 ((_b[0 + (_i) * 3] >> 4) & 0x0008)    \
-                )
-
-#define SS4_BTL_MF_Y_V2(_b, _i)    (SS4_STD_MF_Y_V2(_b, _i) | \
-                 ((_b[0 + (_i) * 3] >> 3) & 0x0008)    \
-                )
-
-#define SS4_MF_Z_V2(_b, _i)    (((_b[1 + (_i) * 3]) & 0x0001) |    \
-                 ((_b[1 + (_i) * 3] >> 1) & 0x0002)    \
-                )
-
-#define SS4_IS_MF_CONTINUE(_b)    ((_b[2] & 0x10) == 0x10)
-#define SS4_IS_5F_DETECTED(_b)    ((_b[2] & 0x10) == 0x10)
-
-#define SS4_TS_X_V2(_b)        (int)(                \
-                 ((_b[0] & 0x01) << 7) |    \
-                 (_b[1] & 0x7F)        \
-                )
-
-#define SS4_TS_Y_V2(_b)        -(int)(                \
-                 ((_b[3] & 0x01) << 7) |    \
-                 (_b[2] & 0x7F)        \
-                )
-
-#define SS4_TS_Z_V2(_b)        (int)(_b[4] & 0x7F)
-
-
-#define SS4_MFPACKET_NO_AX        8160    /* X-Coordinate value */
-#define SS4_MFPACKET_NO_AY        4080    /* Y-Coordinate value */
-#define SS4_MFPACKET_NO_AX_BL        8176    /* Buttonless X-Coord value */
-#define SS4_MFPACKET_NO_AY_BL        4088    /* Buttonless Y-Coord value */
-#define SS4_PLUS_MFPACKET_NO_AX        4080    /* SS4 PLUS, X */
-#define SS4_PLUS_MFPACKET_NO_AX_BL    4088    /* Buttonless SS4 PLUS, X */
-
-// TODO: Move to different place
-struct alps_hw_state {
-     int x;
-     int y;
-     int z;
-     int virtualFingerIndex;
- };
-
-struct virtual_finger_state {
-     SimpleAverage<int, 5> x_avg;
-     SimpleAverage<int, 5> y_avg;
-     uint8_t pressure;
-     bool touch;
-     bool button;
-     MT2FingerType fingerType;
- };
-
-/*
- * enum V7_PACKET_ID - defines the packet type for V7
- * V7_PACKET_ID_IDLE: There's no finger and no button activity.
- * V7_PACKET_ID_TWO: There's one or two non-resting fingers on touchpad
- *  or there's button activities.
- * V7_PACKET_ID_MULTI: There are at least three non-resting fingers.
- * V7_PACKET_ID_NEW: The finger position in slot is not continues from
- *  previous packet.
- */
-enum V7_PACKET_ID {
-    V7_PACKET_ID_IDLE,
-    V7_PACKET_ID_TWO,
-    V7_PACKET_ID_MULTI,
-    V7_PACKET_ID_NEW,
-    V7_PACKET_ID_UNKNOWN,
-};
-
-/**
- * struct alps_protocol_info - information about protocol used by a device
- * @version: Indicates V1/V2/V3/...
- * @byte0: Helps figure out whether a position report packet matches the
- *   known format for this model.  The first byte of the report, ANDed with
- *   mask0, should match byte0.
- * @mask0: The mask used to check the first byte of the report.
- * @flags: Additional device capabilities (passthrough port, trackstick, etc.).
- */
-struct alps_protocol_info {
-    UInt16 version;
-    UInt8 byte0, mask0;
-    unsigned int flags;
-};
-
-/**
- * struct alps_model_info - touchpad ID table
- * @signature: E7 response string to match.
- * @protocol_info: information about protocol used by the device.
- *
- * Many (but not all) ALPS touchpads can be identified by looking at the
- * values returned in the "E7 report" and/or the "EC report."  This table
- * lists a number of such touchpads.
- */
-struct alps_model_info {
-    UInt8 signature[3];
-    struct alps_protocol_info protocol_info;
-};
-
 /**
  * struct alps_nibble_commands - encodings for register accesses
  * @command: PS/2 command used for the nibble
@@ -372,114 +105,14 @@ struct alps_nibble_commands {
     UInt8 data;
 };
 
-struct alps_bitmap_point {
-    int start_bit;
-    int num_bits;
-};
-
-struct input_mt_pos {
-    UInt32 x;
-    UInt32 y;
-};
-
-/**
- * struct alps_fields - decoded version of the report packet
- * @x_map: Bitmap of active X positions for MT.
- * @y_map: Bitmap of active Y positions for MT.
- * @fingers: Number of fingers for MT.
- * @pressure: Pressure.
- * @st: position for ST.
- * @mt: position for MT.
- * @first_mp: Packet is the first of a multi-packet report.
- * @is_mp: Packet is part of a multi-packet report.
- * @left: Left touchpad button is active.
- * @right: Right touchpad button is active.
- * @middle: Middle touchpad button is active.
- * @ts_left: Left trackstick button is active.
- * @ts_right: Right trackstick button is active.
- * @ts_middle: Middle trackstick button is active.
- */
-struct alps_fields {
-    unsigned int x_map;
-    unsigned int y_map;
-    unsigned int fingers;
-
-    int pressure;
-    struct input_mt_pos st;
-    struct input_mt_pos mt[MAX_TOUCHES];
-
-    unsigned int first_mp:1;
-    unsigned int is_mp:1;
-
-    unsigned int left:1;
-    unsigned int right:1;
-    unsigned int middle:1;
-
-    unsigned int ts_left:1;
-    unsigned int ts_right:1;
-    unsigned int ts_middle:1;
-};
-
 class ALPS;
 
-/**
- * struct alps_data - private data structure for the ALPS driver
- * @nibble_commands: Command mapping used for touchpad register accesses.
- * @addr_command: Command used to tell the touchpad that a register address
- *   follows.
- * @proto_version: Indicates V1/V2/V3/...
- * @byte0: Helps figure out whether a position report packet matches the
- *   known format for this model.  The first byte of the report, ANDed with
- *   mask0, should match byte0.
- * @mask0: The mask used to check the first byte of the report.
- * @fw_ver: cached copy of firmware version (EC report)
- * @flags: Additional device capabilities (passthrough port, trackstick, etc.).
- * @x_max: Largest possible X position value.
- * @y_max: Largest possible Y position value.
- * @x_bits: Number of X bits in the MT bitmap.
- * @y_bits: Number of Y bits in the MT bitmap.
- * @prev_fin: Finger bit from previous packet.
- * @multi_packet: Multi-packet data in progress.
- * @multi_data: Saved multi-packet data.
- * @f: Decoded packet data fields.
- * @quirks: Bitmap of ALPS_QUIRK_*.
- */
-struct alps_data {
-    /* these are autodetected when the device is identified */
-    const struct alps_nibble_commands *nibble_commands;
-    SInt32 addr_command;
-    UInt16 proto_version;
-    UInt8 byte0, mask0;
-    UInt8 dev_id[3];
-    UInt8 fw_ver[3];
-    int flags;
-    SInt32 x_max;
-    SInt32 y_max;
-    SInt32 x_bits;
-    SInt32 y_bits;
-    unsigned int x_res;
-    unsigned int y_res;
-    
-    SInt32 prev_fin;
-    SInt32 multi_packet;
-    int second_touch;
-    UInt8 multi_data[6];
-    struct alps_fields f;
-    UInt8 quirks;
-    bool PSMOUSE_BAD_DATA;
-    
-    int pktsize = 6;
-};
-
 // Pulled out of alps_data, now saved as vars on class
 // makes invoking a little easier
 typedef bool (ALPS::*hw_init)();
-typedef bool (ALPS::*decode_fields)(struct alps_fields *f, UInt8 *p);
 typedef void (ALPS::*process_packet)(UInt8 *packet);
 //typedef void (ALPS::*set_abs_params)();
 
-#define ALPS_QUIRK_TRACKSTICK_BUTTONS	1 /* trakcstick buttons in trackstick packet */
-
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 // ALPS Class Declaration
 //
@@ -501,7 +134,30 @@ typedef struct ALPSStatus {
 #define X_MAX_POSITIVE 8176
 #define Y_MAX_POSITIVE 8176
 
+/// Fixed-point affine map of one axis from device to logical units:
+/// out = (in * scale + offset) >> 16; a negative scale flips the axis
+struct alps_axis_transform {
+    int64_t scale;
+    int64_t offset;
+    
+    inline int apply(int v) const { return (int)((v * scale + offset) >> 16); }
+};
+
 #define kPacketLength 6
+// ring buffer slot: packet bytes (up to 8 for V4), the time the first byte
+// arrived (as in the keyboard's ring buffer), what kind of packet it is, and
+// for the first good packet after lost sync, how much was dropped since when
+#define kPacketStride (8+8+8+8)
+#define kPacketTimeOffset 8
+#define kPacketStatusOffset 16
+#define kPacketDroppedOffset 20     // UInt32 bytes dropped before this packet
+#define kPacketDesyncOffset 24      // uint64_t time the first of them arrived
+
+enum {
+    kPacketStatusOK,            // ALPS packet
+    kPacketStatusBare,          // bare PS/2 packet, external device or trackstick
+    kPacketStatusInterleaved,   // PS/2 packet from inside an ALPS packet, no buttons
+};
 #define kPacketLengthSmall  3
 #define kPacketLengthLarge  6
 #define kPacketLengthMax    6
@@ -511,6 +167,45 @@ typedef struct ALPSStatus {
 // predeclure stuff
 struct alps_data;
 
+// log2 histogram of one latency stage, bucket n counts samples
+// below 2^n microseconds (and at least 2^(n-1))
+#define kLatencyBuckets 24
+struct alps_latency {
+    UInt32 buckets[kLatencyBuckets];
+    UInt64 samples;
+    UInt64 maxNS;
+};
+
+// bytes dropped to find the next packet start (see dumpResyncStats)
+struct alps_resync_stats {
+    UInt64 droppedBytes;
+    UInt64 events;
+    UInt32 longestBytes;
+    UInt64 longestNS;
+};
+
+// escalating recovery from a stream that keeps losing sync (see checkRecovery)
+enum {
+    kRecoveryNone,
+    kRecoveryResync,        // stop reporting, drop the partial packet, restart
+    kRecoveryReinit,        // hw_init again, without identify
+    kRecoveryReset,         // resetMouse, identify and hw_init
+    kRecoverySteps
+};
+struct alps_recovery_state {
+    UInt32 seenDropped;             // _droppedBytesTotal at the last check
+    UInt32 windowDropped;           // dropped in the current window
+    uint64_t windowStart;
+    uint64_t nextStep;              // no step before this time
+    int level;                      // last step taken
+    int backoff;                    // repeated resets wait window << backoff
+    UInt32 steps[kRecoverySteps];
+};
+
+// replay report of the predictor error, horizons up to 5 x 10 ms
+#define kPredictionBuckets 5
+#define kPredictionBucketMS 10
+
 class EXPORT ALPS : public IOHIPointing {
     typedef IOHIPointing super;
         OSDeclareDefaultStructors( ALPS );
@@ -521,7 +216,6 @@ private:
     
     alps_data priv;
     hw_init hw_init;
-    decode_fields decode_fields;
     process_packet process_packet;
     //    set_abs_params set_abs_params;
     
@@ -542,6 +236,7 @@ public:
     // Acidanthera VoodooPS2
     bool handleOpen(IOService *forClient, IOOptionBits options, void *arg) override;
     void handleClose(IOService *forClient, IOOptionBits options) override;
+    bool handleIsOpen(const IOService *forClient) const override;
     
 protected:
     int _multiPacket;
@@ -556,49 +251,35 @@ protected:
     
     void alps_process_packet_v1_v2(UInt8 *packet);
     
-    int alps_process_bitmap(struct alps_data *priv, struct alps_fields *f);
-    
     void alps_process_trackstick_packet_v3(UInt8 * packet);
     
-    bool alps_decode_buttons_v3(struct alps_fields *f, UInt8 *p);
-    
-    bool alps_decode_pinnacle(struct alps_fields *f, UInt8 *p);
-    
-    bool alps_decode_rushmore(struct alps_fields *f, UInt8 *p);
-    
-    bool alps_decode_dolphin(struct alps_fields *f, UInt8 *p);
-    
+    // each protocol's decoder is a template argument, so set_protocol binds
+    // the whole packet path with the one process_packet pointer
+    template <alps_decoder decode>
     void alps_process_touchpad_packet_v3_v5(UInt8 * packet);
     
+    template <alps_decoder decode>
     void alps_process_packet_v3(UInt8 *packet);
     
     void alps_process_packet_v6(UInt8 *packet);
     
     void alps_process_packet_v4(UInt8 *packet);
     
-    unsigned char alps_get_packet_id_v7(UInt8 *byte);
-    
-    void alps_get_finger_coordinate_v7(struct input_mt_pos *mt, UInt8 *pkt, UInt8 pkt_id);
-    
-    int alps_get_mt_count(struct input_mt_pos *mt);
-    
-    bool alps_decode_packet_v7(struct alps_fields *f, UInt8 *p);
-    
     void alps_process_trackstick_packet_v7(UInt8 *packet);
     
     void alps_process_touchpad_packet_v7(UInt8 *packet);
     
     void alps_process_packet_v7(UInt8 *packet);
     
-    unsigned char alps_get_pkt_id_ss4_v2(UInt8 *byte);
-    
-    bool alps_decode_ss4_v2(struct alps_fields *f, UInt8 *p);
-    
+    template <alps_decoder decode>
     void alps_process_packet_ss4_v2(UInt8 *packet);
     
     void setTouchPadEnable(bool enable);
     
     PS2InterruptResult interruptOccurred(UInt8 data);
+    inline void stampPacket(UInt8* packet);
+    inline void queuePacket(UInt8* packet, UInt8 status);
+    void dispatchBarePacket(const UInt8* packet, bool reportButtons);
     
     void packetReady();
     
@@ -680,8 +361,6 @@ protected:
         
     void set_protocol();
     
-    bool matchTable(ALPSStatus_t *e7, ALPSStatus_t *ec);
-    
     IOReturn identify();
     
     void restart();
@@ -690,8 +369,12 @@ protected:
     bool                _interruptHandlerInstalled;
     bool                _powerControlHandlerInstalled;
     bool                _messageHandlerInstalled;
-    RingBuffer<UInt8, kPacketLength*32> _ringBuffer;
+    // the slots' times are read and written as uint64_t in place
+    RingBuffer<UInt8, kPacketStride*32> _ringBuffer __attribute__((aligned(8)));
     UInt32              _packetByteCount;
+    UInt32              _desyncBytes;       // dropped since the last good packet
+    UInt32              _droppedBytesTotal; // written by interruptOccurred only
+    uint64_t            _desyncTime;        // when the first of them arrived
     UInt8               _lastdata;
     UInt16              _touchPadVersion;
 
@@ -720,31 +403,55 @@ protected:
     uint32_t physical_max_x;
     uint32_t physical_max_y;
     
-    struct alps_hw_state fingerStates[MAX_TOUCHES];
-    struct virtual_finger_state virtualFingerStates[MAX_TOUCHES];
-    bool freeFingerTypes[kMT2FingerTypeCount];
-    
-    static_assert(MAX_TOUCHES <= kMT2FingerTypeLittleFinger, "Too many fingers for one hand");
-    
-    void assignVirtualFinger(int physicalFinger);
-    void assignFingerType(virtual_finger_state &vf);
-    int lastFingerCount;
+    // physical and virtual fingers (see alps_tracker.h)
+    AlpsTracker _tracker;
     int lastSentFingerCount;
-    bool hadLiftFinger;
     
-    int upperFingerIndex() const;
-    const alps_hw_state& upperFinger() const;
-    void swapFingers(int dst, int src);
-    void alps_parse_hw_state(const UInt8 buf[], struct alps_fields &f);
-    
-    /// Translates physical fingers into virtual fingers so that host software doesn't see 'jumps' and has coordinates for all fingers.
-    /// @return True if is ready to send finger state to host interface
-    bool renumberFingers();
+    // frame coalescing when packetReady finds a backlog (see sendTouchData)
+    int _coalesceFrames;
+    bool _holdFrame;
+    bool _lastFrameHeld;
+    UInt32 _lastSentShape;
+    
+    // output frame-rate governor, MaxFrameRate 0 is unlimited
+    int _maxFrameRate;
+    uint64_t _frameInterval;
+    uint64_t _lastSentTime;
+    bool _frameTimerArmed;
+    IOTimerEventSource* _frameTimer;
+    void onFrameTimer();
+    void armFrameTimer();
+    void flushHeldFrame();
+    void sendInputEvent();
+    
+    // smoothing of virtual finger positions (see CoordinateFilter)
+    int _smoothingFilter;
+    int _oneEuroMinCutoff, _oneEuroBeta, _oneEuroDCutoff;
+    int _alphaBetaAlpha, _alphaBetaBeta;
+    
+    // extrapolation of sent positions, PredictionTime 0 is off (see predictMotion)
+    int _predictionTime;
+    
+    // a finger moving further than this between packets is a different finger
+    int _fingerGateDistance;
+    
+    /// Tracks and emits a decoded frame; the last stage of every process_packet
+    void alps_parse_hw_state(struct alps_fields &f);
     void sendTouchData();
-    void freeAndMarkVirtualFingers();
-    int dist(int physicalFinger, int virtualFinger);
     
-    void set_resolution();
+    /// Publishes the VoodooInput dimensions and computes the coordinate
+    /// transform; @phys_x and @phys_y are the physical size before the
+    /// PhysicalX/YMultiplier, in 0.01 mm
+    void set_resolution(int phys_x, int phys_y);
+    
+    /// Recomputes the transform and the logical and physical maxima from the
+    /// current settings; set_protocol calls it for V1-V5, and
+    /// setParamPropertiesGated once the protocol's limits are known
+    void update_resolution();
+    int _resolutionX, _resolutionY;
+    
+    // device to logical units, set by update_resolution for every protocol
+    alps_axis_transform _transformX, _transformY;
     
     ForceTouchMode _forceTouchMode;
     int _forceTouchPressureThreshold;
@@ -753,8 +460,6 @@ protected:
     int _forceTouchCustomUpThreshold;
     int _forceTouchCustomPower;
     
-    int clampedFingerCount;
-    bool wasSkipped;
     int z_finger;
     int threefingervertswipe;
     int threefingerhorizswipe;
@@ -791,6 +496,7 @@ protected:
     // normal state
     int lastx, lasty, last_fingers, b4last;
     UInt32 lastbuttons;
+    UInt32 _bareButtons;    // of the device sending bare PS/2 packets
     UInt32 lastTrackStickButtons, lastTouchpadButtons;
     int ignoredeltas;
     int ignoresingle;
@@ -875,6 +581,53 @@ protected:
 
     virtual void setParamPropertiesGated(OSDictionary* dict);
 
+    // latency from the first byte of a packet to VoodooInput (see dumpLatency)
+    enum { kLatencyQueue, kLatencyDecode, kLatencyTrack, kLatencySend, kLatencyTotal, kLatencyStages };
+    alps_latency _latency[kLatencyStages];
+    uint64_t _packetTime;
+    uint64_t _dispatchTime;
+    void recordLatency(int stage, uint64_t start, uint64_t end);
+    void dumpLatency();
+    
+    alps_resync_stats _resync;
+    void recordResync(const UInt8* packet);
+    void dumpResyncStats();
+    
+    // RecoveryBadBytes dropped within RecoveryWindow ms take the next step
+    int _recoveryBadBytes;
+    int _recoveryWindowMS;
+    uint64_t _recoveryWindow;
+    alps_recovery_state _recovery;
+    bool _recoveryTimerArmed;
+    IOTimerEventSource* _recoveryTimer;
+    void checkRecovery();
+    void onRecoveryTimer();
+    void dumpRecoveryStats();
+
+#ifdef DEBUG
+    // trace replay (see replayTrace)
+    OSData*  _replayEvents;
+    uint64_t _replayTime;
+    void replayTrace(OSData* trace);
+    void compareReplay(OSData* expected);
+    
+    // lag and jitter of the smoothing filter during a replay (see dumpFilterStats)
+    struct filter_stats {
+        uint64_t lagSq;
+        uint64_t jitterSq;
+        uint64_t rawJitterSq;
+        uint32_t samples;
+        uint32_t jitterSamples;
+        int prev[MAX_TOUCHES][2][2][2];     // finger, axis, raw/filtered, t-1/t-2
+        // prediction error by horizon, in kPredictionBucketMS steps
+        uint64_t predictSq[kPredictionBuckets];
+        uint64_t holdSq[kPredictionBuckets];
+        uint32_t predictSamples[kPredictionBuckets];
+    } _filterStats;
+    void recordFilterSample(int finger);
+    void dumpFilterStats();
+#endif
+
     IOItemCount buttonCount() override;
     IOFixed     resolution() override;
     inline void dispatchRelativePointerEventX(int dx, int dy, UInt32 buttonState, uint64_t now)
@@ -0,0 +1,993 @@
+/*
+ * Copyright (c) 2002 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * The contents of this file constitute Original Code as defined in and
+ * are subject to the Apple Public Source License Version 1.2 (the
+ * "License").  You may not use this file except in compliance with the
+ * License.  Please obtain a copy of the License at
+ * http://www.apple.com/publicsource and read it before using this file.
+ *
+ * This Original Code and all software distributed under the License are
+ * distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE OR NON-INFRINGEMENT.  Please see the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include "alps_decode.h"
+
+#define BIT(x) (1 << (x))
+
+static inline int alps_max(int a, int b) { return a > b ? a : b; }
+
+/* ============================================================================================== */
+/* ===============================||\\ V3 / V5 semi-MT decoding //||============================= */
+/* ============================================================================================== */
+
+/*
+ * Finds the contact runs in a bitmap. The first run goes to @low and the
+ * last to @high, runs in between only count as fingers. Each run is found
+ * with one ctz, its length with one popcount of the isolated run.
+ */
+static int alps_get_bitmap_points(unsigned int map,
+                                  struct alps_bitmap_point *low,
+                                  struct alps_bitmap_point *high)
+{
+    int fingers = 0;
+
+    while (map) {
+        int start = __builtin_ctz(map);
+        unsigned int run = map >> start;
+        /* run + 1 clears the low ones and sets the bit above them */
+        unsigned int ones = run & ~(run + 1);
+        struct alps_bitmap_point *point = fingers ? high : low;
+
+        point->start_bit = start;
+        point->num_bits = __builtin_popcount(ones);
+        fingers++;
+        map &= ~(ones << start);
+    }
+    return fingers;
+}
+
+/*
+ * floor(n / d) as (n * recip) >> 32 with recip = ceil(2^32 / d). This is
+ * exact while n * (recip * d - 2^32) < 2^32, which holds for every bitmap
+ * width up to 31 bits with x_max/y_max up to 65535.
+ */
+static inline uint32_t alps_bitmap_recip(int32_t bits)
+{
+    uint32_t d = 2 * (bits - 1);
+    return (uint32_t)(((1ULL << 32) + d - 1) / d);
+}
+
+void alps_set_bitmap_scale(struct alps_data *priv)
+{
+    priv->x_bitmap_recip = priv->x_bits > 1 ? alps_bitmap_recip(priv->x_bits) : 0;
+    priv->y_bitmap_recip = priv->y_bits > 1 ? alps_bitmap_recip(priv->y_bits) : 0;
+}
+
+static inline uint32_t alps_bitmap_coord(int32_t max, uint32_t recip,
+                                         const struct alps_bitmap_point &point)
+{
+    uint64_t n = (uint64_t)max * (2 * point.start_bit + point.num_bits - 1);
+    return (uint32_t)((n * recip) >> 32);
+}
+
+/*
+ * Process bitmap data from semi-mt protocols. Returns the number of
+ * fingers detected. A return value of 0 means at least one of the
+ * bitmaps was empty.
+ *
+ * The bitmaps don't have enough data to track fingers, so this function
+ * only generates points representing a bounding box of all contacts.
+ * These points are returned in fields->mt when the return value
+ * is greater than 0.
+ */
+int alps_process_bitmap(struct alps_data *priv,
+                        struct alps_fields *fields)
+{
+
+    int i, fingers_x, fingers_y, fingers, closest;
+    struct alps_bitmap_point x_low = {}, x_high = {};
+    struct alps_bitmap_point y_low = {}, y_high = {};
+    struct input_mt_pos corner[4];
+    uint32_t x1, x2, y1, y2;
+
+
+    if (!fields->x_map || !fields->y_map) {
+        return 0;
+    }
+
+    fingers_x = alps_get_bitmap_points(fields->x_map, &x_low, &x_high);
+    fingers_y = alps_get_bitmap_points(fields->y_map, &y_low, &y_high);
+
+    /* raw run lengths, before a single contact is split below */
+    fields->x_run[0] = x_low.num_bits;
+    fields->x_run[1] = fingers_x > 1 ? x_high.num_bits : 0;
+    fields->y_run[0] = y_low.num_bits;
+    fields->y_run[1] = fingers_y > 1 ? y_high.num_bits : 0;
+
+    /*
+     * Fingers can overlap, so we use the maximum count of fingers
+     * on either axis as the finger count. A noisy bitmap can have more
+     * runs than there are fingers to report.
+     */
+    fingers = alps_max(fingers_x, fingers_y);
+    if (fingers > MAX_TOUCHES)
+        fingers = MAX_TOUCHES;
+
+    /*
+     * If an axis reports only a single contact, we have overlapping or
+     * adjacent fingers. Divide the single contact between the two points.
+     */
+    if (fingers_x == 1) {
+        i = x_low.num_bits / 2;
+        x_low.num_bits = x_low.num_bits - i;
+        x_high.start_bit = x_low.start_bit + i;
+        x_high.num_bits = alps_max(i, 1);
+    }
+
+    if (fingers_y == 1) {
+        i = y_low.num_bits / 2;
+        y_low.num_bits = y_low.num_bits - i;
+        y_high.start_bit = y_low.start_bit + i;
+        y_high.num_bits = alps_max(i, 1);
+    }
+
+    /* corners of the bounding box, divisions precomputed in set_protocol */
+    x1 = alps_bitmap_coord(priv->x_max, priv->x_bitmap_recip, x_low);
+    x2 = alps_bitmap_coord(priv->x_max, priv->x_bitmap_recip, x_high);
+    y1 = alps_bitmap_coord(priv->y_max, priv->y_bitmap_recip, y_low);
+    y2 = alps_bitmap_coord(priv->y_max, priv->y_bitmap_recip, y_high);
+
+    /* top-left corner */
+    corner[0].x = x1;
+    corner[0].y = y1;
+
+    /* top-right corner */
+    corner[1].x = x2;
+    corner[1].y = y1;
+
+    /* bottom-right corner */
+    corner[2].x = x2;
+    corner[2].y = y2;
+
+    /* bottom-left corner */
+    corner[3].x = x1;
+    corner[3].y = y2;
+
+    /* x-bitmap order is reversed on v5 touchpads  */
+    if (priv->proto_version == ALPS_PROTO_V5) {
+        for (i = 0; i < 4; i++)
+            corner[i].x = priv->x_max - corner[i].x;
+    }
+
+    /* y-bitmap order is reversed on v3 and v4 touchpads  */
+    if (priv->proto_version == ALPS_PROTO_V3 || priv->proto_version == ALPS_PROTO_V4) {
+        for (i = 0; i < 4; i++)
+            corner[i].y = priv->y_max - corner[i].y;
+    }
+
+    /*
+     * We only select a corner for the second touch once per 2 finger
+     * touch sequence to avoid the chosen corner (and thus the coordinates)
+     * jumping around when the first touch is in the middle.
+     */
+    if (priv->second_touch == -1) {
+        /* Find corner closest to our st coordinates */
+        closest = 0x7fffffff;
+        for (i = 0; i < 4; i++) {
+            int dx = fields->st.x - corner[i].x;
+            int dy = fields->st.y - corner[i].y;
+            int distance = dx * dx + dy * dy;
+
+            if (distance < closest) {
+                priv->second_touch = i;
+                closest = distance;
+            }
+        }
+        /* And select the opposite corner to use for the 2nd touch */
+        priv->second_touch = (priv->second_touch + 2) % 4;
+    }
+
+    fields->mt[0] = fields->st;
+    fields->mt[1] = corner[priv->second_touch];
+
+#if defined(KERNEL) && DEBUG
+    IOLog("ALPS: BITMAP\n");
+
+    unsigned int ymap = fields->y_map;
+
+    for (int i = 0; ymap != 0; i++, ymap >>= 1) {
+        unsigned int xmap = fields->x_map;
+        char bitLog[160];
+        strlcpy(bitLog, "ALPS: ", sizeof("ALPS: ") + 1);
+
+        for (int j = 0; xmap != 0; j++, xmap >>= 1) {
+            strcat(bitLog, (ymap & 1 && xmap & 1) ? "1 " : "0 ");
+        }
+
+        IOLog("%s\n", bitLog);
+    }
+
+    IOLog("ALPS: Process Bitmap, Corner=%d, Fingers=%d, x1=%d, x2=%d, y1=%d, y2=%d xmap=%d ymap=%d\n", priv->second_touch, fingers, fields->mt[0].x, fields->mt[1].x, fields->mt[0].y, fields->mt[1].y, fields->x_map, fields->y_map);
+#endif // DEBUG
+    return fingers;
+}
+
+bool alps_decode_buttons_v3(struct alps_fields *f, const uint8_t *p) {
+    f->left = !!(p[3] & 0x01);
+    f->right = !!(p[3] & 0x02);
+    f->middle = !!(p[3] & 0x04);
+
+    f->ts_left = !!(p[3] & 0x10);
+    f->ts_right = !!(p[3] & 0x20);
+    f->ts_middle = !!(p[3] & 0x40);
+    return true;
+}
+
+bool alps_decode_pinnacle(const struct alps_data *, struct alps_fields *f, const uint8_t *p) {
+    f->first_mp = !!(p[4] & 0x40);
+    f->is_mp = !!(p[0] & 0x40);
+
+    if (f->is_mp) {
+        f->fingers = (p[5] & 0x3) + 1;
+        f->x_map = ((p[4] & 0x7e) << 8) |
+        ((p[1] & 0x7f) << 2) |
+        ((p[0] & 0x30) >> 4);
+        f->y_map = ((p[3] & 0x70) << 4) |
+        ((p[2] & 0x7f) << 1) |
+        (p[4] & 0x01);
+    } else {
+        f->st.x = ((p[1] & 0x7f) << 4) | ((p[4] & 0x30) >> 2) |
+        ((p[0] & 0x30) >> 4);
+        f->st.y = ((p[2] & 0x7f) << 4) | (p[4] & 0x0f);
+        f->pressure = p[5] & 0x7f;
+
+        alps_decode_buttons_v3(f, p);
+    }
+    return true;
+}
+
+bool alps_decode_rushmore(const struct alps_data *, struct alps_fields *f, const uint8_t *p) {
+    f->first_mp = !!(p[4] & 0x40);
+    f->is_mp = !!(p[5] & 0x40);
+
+    if (f->is_mp) {
+        f->fingers = alps_max((p[5] & 0x3), ((p[5] >> 2) & 0x3)) + 1;
+        f->x_map = ((p[5] & 0x10) << 11) |
+        ((p[4] & 0x7e) << 8) |
+        ((p[1] & 0x7f) << 2) |
+        ((p[0] & 0x30) >> 4);
+        f->y_map = ((p[5] & 0x20) << 6) |
+        ((p[3] & 0x70) << 4) |
+        ((p[2] & 0x7f) << 1) |
+        (p[4] & 0x01);
+    } else {
+        f->st.x = ((p[1] & 0x7f) << 4) | ((p[4] & 0x30) >> 2) |
+        ((p[0] & 0x30) >> 4);
+        f->st.y = ((p[2] & 0x7f) << 4) | (p[4] & 0x0f);
+        f->pressure = p[5] & 0x7f;
+
+        alps_decode_buttons_v3(f, p);
+    }
+    return true;
+}
+
+bool alps_decode_dolphin(const struct alps_data *priv, struct alps_fields *f, const uint8_t *p) {
+    uint64_t palm_data = 0;
+
+    f->first_mp = !!(p[0] & 0x02);
+    f->is_mp = !!(p[0] & 0x20);
+
+    if (!f->is_mp) {
+        f->st.x = ((p[1] & 0x7f) | ((p[4] & 0x0f) << 7));
+        f->st.y = ((p[2] & 0x7f) | ((p[4] & 0xf0) << 3));
+        f->pressure = (p[0] & 4) ? 0 : p[5] & 0x7f;
+        alps_decode_buttons_v3(f, p);
+    } else {
+        f->fingers = ((p[0] & 0x6) >> 1 |
+                      (p[0] & 0x10) >> 2);
+        /* the 3 bit count can claim more fingers than there are slots */
+        if (f->fingers > MAX_TOUCHES)
+            f->fingers = MAX_TOUCHES;
+
+        palm_data = (p[1] & 0x7f) |
+        ((p[2] & 0x7f) << 7) |
+        ((p[4] & 0x7f) << 14) |
+        ((p[5] & 0x7f) << 21) |
+        ((p[3] & 0x07) << 28) |
+        (((uint64_t)p[3] & 0x70) << 27) |
+        (((uint64_t)p[0] & 0x01) << 34);
+
+        /* Y-profile is stored in P(0) to p(n-1), n = y_bits; */
+        f->y_map = palm_data & (BIT(priv->y_bits) - 1);
+
+        /* X-profile is stored in p(n) to p(n+m-1), m = x_bits; */
+        f->x_map = (palm_data >> priv->y_bits) &
+        (BIT(priv->x_bits) - 1);
+    }
+    return true;
+}
+
+/*
+ * v4 has a 6-byte encoding for bitmap data, but this data is broken up
+ * between 3 normal packets. priv->multi_packet tracks our position in the
+ * bitmap packet and priv->f accumulates the result, so the finger count
+ * from the last complete bitmap stays valid for the packets in between.
+ * Returns true when this packet completed a bitmap.
+ */
+bool alps_decode_v4(struct alps_data *priv, const uint8_t *p) {
+    struct alps_fields *f = &priv->f;
+    int offset;
+    
+    if (p[6] & 0x40) {
+        /* sync, reset position */
+        priv->multi_packet = 0;
+    }
+    
+    if (priv->multi_packet > 2) {
+        return false;
+    }
+    
+    offset = 2 * priv->multi_packet;
+    priv->multi_data[offset] = p[6];
+    priv->multi_data[offset + 1] = p[7];
+    
+    f->left = p[4] & 0x01;
+    f->right = p[4] & 0x02;
+    
+    f->st.x = ((p[1] & 0x7f) << 4) | ((p[3] & 0x30) >> 2) |
+    ((p[0] & 0x30) >> 4);
+    f->st.y = ((p[2] & 0x7f) << 4) | (p[3] & 0x0f);
+    f->pressure = p[5] & 0x7f;
+    
+    if (++priv->multi_packet > 2) {
+        priv->multi_packet = 0;
+        
+        f->x_map = ((priv->multi_data[2] & 0x1f) << 10) |
+        ((priv->multi_data[3] & 0x60) << 3) |
+        ((priv->multi_data[0] & 0x3f) << 2) |
+        ((priv->multi_data[1] & 0x60) >> 5);
+        f->y_map = ((priv->multi_data[5] & 0x01) << 10) |
+        ((priv->multi_data[3] & 0x1f) << 5) |
+        (priv->multi_data[1] & 0x1f);
+        
+        f->fingers = alps_process_bitmap(priv, f);
+        return true;
+    }
+    return false;
+}
+
+/* ============================================================================================== */
+/* ====================================||\\ V7 decoding //||====================================== */
+/* ============================================================================================== */
+
+/*
+ * V7 decoding is table driven: the packet ID comes from one lookup indexed by
+ * the bits alps_get_packet_id_v7 used to branch on, which span bytes 0, 1 and
+ * 4, and the finger coordinates are ORed together from per-byte tables holding
+ * pre-shifted fragments. mt[0] takes bytes 0-3; mt[1] takes bytes 4 and 5 and,
+ * through the packet ID's fixups, bits of bytes 0, 3 and 4. Host/alps_v7check
+ * checks all of it against the formulas the tables replaced.
+ */
+
+/*
+ * Packet ID by (byte[4] & 0x03) | (byte[4] & 0x40) >> 4 | (byte[0] & 0x10) >> 1
+ * | (byte[1] == 0 && byte[4] == 0) << 4. Entries with bit 4 set and any byte[4]
+ * bit set can't occur.
+ */
+static const uint8_t v7_packet_id[32] = {
+    V7_PACKET_ID_UNKNOWN, V7_PACKET_ID_MULTI, V7_PACKET_ID_UNKNOWN, V7_PACKET_ID_MULTI,
+    V7_PACKET_ID_TWO,     V7_PACKET_ID_TWO,   V7_PACKET_ID_TWO,     V7_PACKET_ID_TWO,
+    V7_PACKET_ID_NEW,     V7_PACKET_ID_MULTI, V7_PACKET_ID_UNKNOWN, V7_PACKET_ID_MULTI,
+    V7_PACKET_ID_TWO,     V7_PACKET_ID_TWO,   V7_PACKET_ID_TWO,     V7_PACKET_ID_TWO,
+    V7_PACKET_ID_IDLE,    V7_PACKET_ID_UNKNOWN, V7_PACKET_ID_UNKNOWN, V7_PACKET_ID_UNKNOWN,
+    V7_PACKET_ID_UNKNOWN, V7_PACKET_ID_UNKNOWN, V7_PACKET_ID_UNKNOWN, V7_PACKET_ID_UNKNOWN,
+    V7_PACKET_ID_NEW,     V7_PACKET_ID_UNKNOWN, V7_PACKET_ID_UNKNOWN, V7_PACKET_ID_UNKNOWN,
+    V7_PACKET_ID_UNKNOWN, V7_PACKET_ID_UNKNOWN, V7_PACKET_ID_UNKNOWN, V7_PACKET_ID_UNKNOWN,
+};
+
+/* pkt[2] -> mt[0].x bits 11, 5..10 */
+static const uint16_t v7_x0_byte2[256] = {
+    0x0000, 0x0020, 0x0040, 0x0060, 0x0080, 0x00a0, 0x00c0, 0x00e0,
+    0x0100, 0x0120, 0x0140, 0x0160, 0x0180, 0x01a0, 0x01c0, 0x01e0,
+    0x0200, 0x0220, 0x0240, 0x0260, 0x0280, 0x02a0, 0x02c0, 0x02e0,
+    0x0300, 0x0320, 0x0340, 0x0360, 0x0380, 0x03a0, 0x03c0, 0x03e0,
+    0x0400, 0x0420, 0x0440, 0x0460, 0x0480, 0x04a0, 0x04c0, 0x04e0,
+    0x0500, 0x0520, 0x0540, 0x0560, 0x0580, 0x05a0, 0x05c0, 0x05e0,
+    0x0600, 0x0620, 0x0640, 0x0660, 0x0680, 0x06a0, 0x06c0, 0x06e0,
+    0x0700, 0x0720, 0x0740, 0x0760, 0x0780, 0x07a0, 0x07c0, 0x07e0,
+    0x0000, 0x0020, 0x0040, 0x0060, 0x0080, 0x00a0, 0x00c0, 0x00e0,
+    0x0100, 0x0120, 0x0140, 0x0160, 0x0180, 0x01a0, 0x01c0, 0x01e0,
+    0x0200, 0x0220, 0x0240, 0x0260, 0x0280, 0x02a0, 0x02c0, 0x02e0,
+    0x0300, 0x0320, 0x0340, 0x0360, 0x0380, 0x03a0, 0x03c0, 0x03e0,
+    0x0400, 0x0420, 0x0440, 0x0460, 0x0480, 0x04a0, 0x04c0, 0x04e0,
+    0x0500, 0x0520, 0x0540, 0x0560, 0x0580, 0x05a0, 0x05c0, 0x05e0,
+    0x0600, 0x0620, 0x0640, 0x0660, 0x0680, 0x06a0, 0x06c0, 0x06e0,
+    0x0700, 0x0720, 0x0740, 0x0760, 0x0780, 0x07a0, 0x07c0, 0x07e0,
+    0x0800, 0x0820, 0x0840, 0x0860, 0x0880, 0x08a0, 0x08c0, 0x08e0,
+    0x0900, 0x0920, 0x0940, 0x0960, 0x0980, 0x09a0, 0x09c0, 0x09e0,
+    0x0a00, 0x0a20, 0x0a40, 0x0a60, 0x0a80, 0x0aa0, 0x0ac0, 0x0ae0,
+    0x0b00, 0x0b20, 0x0b40, 0x0b60, 0x0b80, 0x0ba0, 0x0bc0, 0x0be0,
+    0x0c00, 0x0c20, 0x0c40, 0x0c60, 0x0c80, 0x0ca0, 0x0cc0, 0x0ce0,
+    0x0d00, 0x0d20, 0x0d40, 0x0d60, 0x0d80, 0x0da0, 0x0dc0, 0x0de0,
+    0x0e00, 0x0e20, 0x0e40, 0x0e60, 0x0e80, 0x0ea0, 0x0ec0, 0x0ee0,
+    0x0f00, 0x0f20, 0x0f40, 0x0f60, 0x0f80, 0x0fa0, 0x0fc0, 0x0fe0,
+    0x0800, 0x0820, 0x0840, 0x0860, 0x0880, 0x08a0, 0x08c0, 0x08e0,
+    0x0900, 0x0920, 0x0940, 0x0960, 0x0980, 0x09a0, 0x09c0, 0x09e0,
+    0x0a00, 0x0a20, 0x0a40, 0x0a60, 0x0a80, 0x0aa0, 0x0ac0, 0x0ae0,
+    0x0b00, 0x0b20, 0x0b40, 0x0b60, 0x0b80, 0x0ba0, 0x0bc0, 0x0be0,
+    0x0c00, 0x0c20, 0x0c40, 0x0c60, 0x0c80, 0x0ca0, 0x0cc0, 0x0ce0,
+    0x0d00, 0x0d20, 0x0d40, 0x0d60, 0x0d80, 0x0da0, 0x0dc0, 0x0de0,
+    0x0e00, 0x0e20, 0x0e40, 0x0e60, 0x0e80, 0x0ea0, 0x0ec0, 0x0ee0,
+    0x0f00, 0x0f20, 0x0f40, 0x0f60, 0x0f80, 0x0fa0, 0x0fc0, 0x0fe0,
+};
+
+/* pkt[3] -> mt[0].x bits 3..4, 0..2 */
+static const uint8_t v7_x0_byte3[256] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+    0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+    0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+    0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+    0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+    0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+    0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+    0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+    0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+};
+
+/* pkt[4] -> mt[1].x and pkt[5] -> mt[1].y, bits 10, 4..9 */
+static const uint16_t v7_hi6[256] = {
+    0x0000, 0x0010, 0x0020, 0x0030, 0x0040, 0x0050, 0x0060, 0x0070,
+    0x0080, 0x0090, 0x00a0, 0x00b0, 0x00c0, 0x00d0, 0x00e0, 0x00f0,
+    0x0100, 0x0110, 0x0120, 0x0130, 0x0140, 0x0150, 0x0160, 0x0170,
+    0x0180, 0x0190, 0x01a0, 0x01b0, 0x01c0, 0x01d0, 0x01e0, 0x01f0,
+    0x0200, 0x0210, 0x0220, 0x0230, 0x0240, 0x0250, 0x0260, 0x0270,
+    0x0280, 0x0290, 0x02a0, 0x02b0, 0x02c0, 0x02d0, 0x02e0, 0x02f0,
+    0x0300, 0x0310, 0x0320, 0x0330, 0x0340, 0x0350, 0x0360, 0x0370,
+    0x0380, 0x0390, 0x03a0, 0x03b0, 0x03c0, 0x03d0, 0x03e0, 0x03f0,
+    0x0000, 0x0010, 0x0020, 0x0030, 0x0040, 0x0050, 0x0060, 0x0070,
+    0x0080, 0x0090, 0x00a0, 0x00b0, 0x00c0, 0x00d0, 0x00e0, 0x00f0,
+    0x0100, 0x0110, 0x0120, 0x0130, 0x0140, 0x0150, 0x0160, 0x0170,
+    0x0180, 0x0190, 0x01a0, 0x01b0, 0x01c0, 0x01d0, 0x01e0, 0x01f0,
+    0x0200, 0x0210, 0x0220, 0x0230, 0x0240, 0x0250, 0x0260, 0x0270,
+    0x0280, 0x0290, 0x02a0, 0x02b0, 0x02c0, 0x02d0, 0x02e0, 0x02f0,
+    0x0300, 0x0310, 0x0320, 0x0330, 0x0340, 0x0350, 0x0360, 0x0370,
+    0x0380, 0x0390, 0x03a0, 0x03b0, 0x03c0, 0x03d0, 0x03e0, 0x03f0,
+    0x0400, 0x0410, 0x0420, 0x0430, 0x0440, 0x0450, 0x0460, 0x0470,
+    0x0480, 0x0490, 0x04a0, 0x04b0, 0x04c0, 0x04d0, 0x04e0, 0x04f0,
+    0x0500, 0x0510, 0x0520, 0x0530, 0x0540, 0x0550, 0x0560, 0x0570,
+    0x0580, 0x0590, 0x05a0, 0x05b0, 0x05c0, 0x05d0, 0x05e0, 0x05f0,
+    0x0600, 0x0610, 0x0620, 0x0630, 0x0640, 0x0650, 0x0660, 0x0670,
+    0x0680, 0x0690, 0x06a0, 0x06b0, 0x06c0, 0x06d0, 0x06e0, 0x06f0,
+    0x0700, 0x0710, 0x0720, 0x0730, 0x0740, 0x0750, 0x0760, 0x0770,
+    0x0780, 0x0790, 0x07a0, 0x07b0, 0x07c0, 0x07d0, 0x07e0, 0x07f0,
+    0x0400, 0x0410, 0x0420, 0x0430, 0x0440, 0x0450, 0x0460, 0x0470,
+    0x0480, 0x0490, 0x04a0, 0x04b0, 0x04c0, 0x04d0, 0x04e0, 0x04f0,
+    0x0500, 0x0510, 0x0520, 0x0530, 0x0540, 0x0550, 0x0560, 0x0570,
+    0x0580, 0x0590, 0x05a0, 0x05b0, 0x05c0, 0x05d0, 0x05e0, 0x05f0,
+    0x0600, 0x0610, 0x0620, 0x0630, 0x0640, 0x0650, 0x0660, 0x0670,
+    0x0680, 0x0690, 0x06a0, 0x06b0, 0x06c0, 0x06d0, 0x06e0, 0x06f0,
+    0x0700, 0x0710, 0x0720, 0x0730, 0x0740, 0x0750, 0x0760, 0x0770,
+    0x0780, 0x0790, 0x07a0, 0x07b0, 0x07c0, 0x07d0, 0x07e0, 0x07f0,
+};
+
+/*
+ * Second touch fixups by packet ID: mt[1].x is masked, mt[1].y masked and
+ * filled with low bits. MULTI additionally takes y bit 5 from byte[4] and NEW
+ * takes x bit 5 from byte[0].
+ */
+static const struct {
+    uint16_t x_mask;
+    uint16_t y_mask;
+    uint16_t y_fill;
+} v7_fixup[] = {
+    { 0xffff, 0xffff, 0x0000 },     /* V7_PACKET_ID_IDLE */
+    { 0xfff0, 0xffff, 0x000f },     /* V7_PACKET_ID_TWO */
+    { 0xffc0, 0xffdf, 0x001f },     /* V7_PACKET_ID_MULTI */
+    { 0xffc0, 0xffff, 0x000f },     /* V7_PACKET_ID_NEW */
+    { 0xffff, 0xffff, 0x0000 },     /* V7_PACKET_ID_UNKNOWN */
+};
+
+unsigned char alps_get_packet_id_v7(const uint8_t *byte)
+{
+    unsigned index = (byte[4] & 0x03) | ((byte[4] & 0x40) >> 4) | ((byte[0] & 0x10) >> 1) |
+                     (!(byte[1] | byte[4]) << 4);
+
+    return v7_packet_id[index];
+}
+
+void alps_get_finger_coordinate_v7(struct input_mt_pos *mt,
+                                   const uint8_t *pkt,
+                                   uint8_t pkt_id)
+{
+    uint32_t x1 = ((pkt[3] & 0x80) << 4) | v7_hi6[pkt[4]];
+    uint32_t y1 = v7_hi6[pkt[5]];
+
+    mt[0].x = v7_x0_byte2[pkt[2]] | v7_x0_byte3[pkt[3]];
+    mt[0].y = (pkt[1] << 3) | (pkt[0] & 0x07);
+
+    x1 &= v7_fixup[pkt_id].x_mask;
+    y1 = (y1 & v7_fixup[pkt_id].y_mask) | v7_fixup[pkt_id].y_fill;
+    if (pkt_id == V7_PACKET_ID_MULTI)
+        y1 |= (pkt[4] & 0x02) << 4;
+    else if (pkt_id == V7_PACKET_ID_NEW)
+        x1 |= pkt[0] & 0x20;
+    /* Detect false-positive touches where x & y report max value */
+    else if (pkt_id == V7_PACKET_ID_TWO && y1 == 0x7ff && x1 == 0xff0)
+        x1 = 0;
+    mt[1].x = x1;
+    mt[1].y = y1;
+
+    mt[0].y = 0x7FF - mt[0].y;
+    mt[1].y = 0x7FF - mt[1].y;
+}
+
+int alps_get_mt_count(const struct input_mt_pos *mt)
+{
+    int i, fingers = 0;
+
+    for (i = 0; i < MAX_TOUCHES; i++) {
+        if (mt[i].x != 0 || mt[i].y != 0)
+            fingers++;
+    }
+
+    return fingers;
+}
+
+bool alps_decode_packet_v7(const struct alps_data *priv, struct alps_fields *f, const uint8_t *p) {
+    unsigned char pkt_id;
+
+    pkt_id = alps_get_packet_id_v7(p);
+    if (pkt_id == V7_PACKET_ID_IDLE) {
+        ALPS_DECODE_LOG("ALPS: V7_PACKET_ID_IDLE\n");
+        return true;
+    }
+    if (pkt_id == V7_PACKET_ID_UNKNOWN) {
+        ALPS_DECODE_LOG("ALPS: V7_PACKET_ID_UNKNOWN\n");
+        return false;
+    }
+
+    /*
+     * NEW packets are send to indicate a discontinuity in the finger
+     * coordinate reporting. Specifically a finger may have moved from
+     * slot 0 to 1 or vice versa. INPUT_MT_TRACK takes care of this for
+     * us.
+     *
+     * NEW packets have 3 problems:
+     * 1) They do not contain middle / right button info (on non clickpads)
+     *    this can be worked around by preserving the old button state
+     * 2) They do not contain an accurate fingercount, and they are
+     *    typically send when the number of fingers changes. We cannot use
+     *    the old finger count as that may mismatch with the amount of
+     *    touch coordinates we've available in the NEW packet
+     * 3) Their x data for the second touch is inaccurate leading to
+     *    a possible jump of the x coordinate by 16 units when the first
+     *    non NEW packet comes in
+     * Since problems 2 & 3 cannot be worked around, just ignore them.
+     */
+    if (pkt_id == V7_PACKET_ID_NEW) {
+        ALPS_DECODE_LOG("ALPS: V7_PACKET_ID_NEW\n");
+        return true;
+    }
+
+    alps_get_finger_coordinate_v7(f->mt, p, pkt_id);
+
+    if (pkt_id == V7_PACKET_ID_TWO) {
+        ALPS_DECODE_LOG("ALPS: V7_PACKET_ID_TWO\n");
+        f->fingers = alps_get_mt_count(f->mt);
+    }
+    else { /* pkt_id == V7_PACKET_ID_MULTI */
+        ALPS_DECODE_LOG("ALPS: V7_PACKET_ID_MULTI\n");
+        f->fingers = 3 + (p[5] & 0x03);
+    }
+
+    f->left = (p[0] & 0x80) >> 7;
+    if (priv->flags & ALPS_BUTTONPAD) {
+        if (p[0] & 0x20)
+            f->fingers++;
+        if (p[0] & 0x10)
+            f->fingers++;
+    } else {
+        f->right = (p[0] & 0x20) >> 5;
+        f->middle = (p[0] & 0x10) >> 4;
+    }
+    /* the multi count and the button bits together can exceed the slots */
+    if (f->fingers > MAX_TOUCHES)
+        f->fingers = MAX_TOUCHES;
+
+    /* Sometimes a single touch is reported in mt[1] rather then mt[0] */
+    if (f->fingers == 1 && f->mt[0].x == 0 && f->mt[0].y == 0) {
+        f->mt[0].x = f->mt[1].x;
+        f->mt[0].y = f->mt[1].y;
+        f->mt[1].x = 0;
+        f->mt[1].y = 0;
+    }
+    return true;
+}
+
+/* ============================================================================================== */
+/* =================================||\\ SS4 (V8) decoding //||=================================== */
+/* ============================================================================================== */
+
+unsigned char alps_get_pkt_id_ss4_v2(const uint8_t *byte)
+{
+    unsigned char pkt_id = SS4_PACKET_ID_IDLE;
+
+    switch (byte[3] & 0x30) {
+        case 0x00:
+            if (SS4_IS_IDLE_V2(byte)) {
+                pkt_id = SS4_PACKET_ID_IDLE;
+            } else {
+                pkt_id = SS4_PACKET_ID_ONE;
+            }
+            break;
+        case 0x10:
+            /* two-finger finger positions */
+            pkt_id = SS4_PACKET_ID_TWO;
+            break;
+        case 0x20:
+            /* stick pointer */
+            pkt_id = SS4_PACKET_ID_STICK;
+            break;
+        case 0x30:
+            /* third and fourth finger positions */
+            pkt_id = SS4_PACKET_ID_MULTI;
+            break;
+    }
+
+    return pkt_id;
+}
+
+/* multi-finger coordinates and "no finger" markers of each SS4 variant */
+template <bool plus, bool buttonpad>
+static inline unsigned int ss4_mf_x(const uint8_t *p, int i)
+{
+    if (plus)
+        return buttonpad ? SS4_PLUS_BTL_MF_X_V2(p, i) : SS4_PLUS_STD_MF_X_V2(p, i);
+    return buttonpad ? SS4_BTL_MF_X_V2(p, i) : SS4_STD_MF_X_V2(p, i);
+}
+
+template <bool buttonpad>
+static inline unsigned int ss4_mf_y(const uint8_t *p, int i)
+{
+    return buttonpad ? SS4_BTL_MF_Y_V2(p, i) : SS4_STD_MF_Y_V2(p, i);
+}
+
+template <bool plus, bool buttonpad>
+static inline unsigned int ss4_no_data_x()
+{
+    if (plus)
+        return buttonpad ? SS4_PLUS_MFPACKET_NO_AX_BL : SS4_PLUS_MFPACKET_NO_AX;
+    return buttonpad ? SS4_MFPACKET_NO_AX_BL : SS4_MFPACKET_NO_AX;
+}
+
+template <bool buttonpad>
+static inline unsigned int ss4_no_data_y()
+{
+    return buttonpad ? SS4_MFPACKET_NO_AY_BL : SS4_MFPACKET_NO_AY;
+}
+
+template <bool plus, bool buttonpad>
+bool alps_decode_ss4_v2(const struct alps_data *, struct alps_fields *f, const uint8_t *p) {
+    unsigned char pkt_id;
+
+    pkt_id = alps_get_pkt_id_ss4_v2(p);
+
+    /* Current packet is 1Finger coordinate packet */
+    switch (pkt_id) {
+        case SS4_PACKET_ID_ONE:
+            ALPS_DECODE_LOG("ALPS: SS4_PACKET_ID_ONE\n");
+            f->mt[0].x = SS4_1F_X_V2(p);
+            f->mt[0].y = SS4_1F_Y_V2(p);
+            ALPS_DECODE_LOG("ALPS: Coordinates for SS4_PACKET_ID_ONE: %dx%d\n", f->mt[0].x, f->mt[0].y);
+            f->pressure = ((SS4_1F_Z_V2(p)) * 2) & 0x7f;
+            /*
+             * When a button is held the device will give us events
+             * with x, y, and pressure of 0. This causes annoying jumps
+             * if a touch is released while the button is held.
+             * Handle this by claiming zero contacts.
+             */
+            f->fingers = f->pressure > 0 ? 1 : 0;
+            f->first_mp = 0;
+            f->is_mp = 0;
+            break;
+
+        case SS4_PACKET_ID_TWO:
+            ALPS_DECODE_LOG("ALPS: SS4_PACKET_ID_TWO\n");
+            f->mt[0].x = ss4_mf_x<plus, buttonpad>(p, 0);
+            f->mt[1].x = ss4_mf_x<plus, buttonpad>(p, 1);
+            f->mt[0].y = ss4_mf_y<buttonpad>(p, 0);
+            f->mt[1].y = ss4_mf_y<buttonpad>(p, 1);
+            ALPS_DECODE_LOG("ALPS: Coordinates for SS4_PACKET_ID_TWO: %dx%d\n", f->mt[0].x, f->mt[0].y);
+            f->pressure = SS4_MF_Z_V2(p, 0) ? 0x30 : 0;
+
+            if (SS4_IS_MF_CONTINUE(p)) {
+                f->first_mp = 1;
+            } else {
+                f->fingers = 2;
+                f->first_mp = 0;
+            }
+            f->is_mp = 0;
+
+            break;
+
+        case SS4_PACKET_ID_MULTI:
+            ALPS_DECODE_LOG("ALPS: SS4_PACKET_ID_MULTI\n");
+            f->mt[2].x = ss4_mf_x<plus, buttonpad>(p, 0);
+            f->mt[3].x = ss4_mf_x<plus, buttonpad>(p, 1);
+            f->mt[2].y = ss4_mf_y<buttonpad>(p, 0);
+            f->mt[3].y = ss4_mf_y<buttonpad>(p, 1);
+
+            f->first_mp = 0;
+            f->is_mp = 1;
+
+            if (SS4_IS_5F_DETECTED(p)) {
+                f->fingers = 5;
+            } else if (f->mt[3].x == ss4_no_data_x<plus, buttonpad>() &&
+                       f->mt[3].y == ss4_no_data_y<buttonpad>()) {
+                f->mt[3].x = 0;
+                f->mt[3].y = 0;
+                f->fingers = 3;
+            } else {
+                f->fingers = 4;
+            }
+            break;
+
+        case SS4_PACKET_ID_STICK:
+            ALPS_DECODE_LOG("ALPS: SS4_PACKET_ID_STICK\n");
+            /*
+             * x, y, and pressure are decoded in
+             * alps_process_packet_ss4_v2()
+             */
+            f->first_mp = 0;
+            f->is_mp = 0;
+            break;
+
+        case SS4_PACKET_ID_IDLE:
+        default:
+            memset(f, 0, sizeof(struct alps_fields));
+            break;
+    }
+
+    /* handle buttons */
+    if (pkt_id == SS4_PACKET_ID_STICK) {
+        f->ts_left = !!(SS4_BTN_V2(p) & 0x01);
+        // TODO: Check if this statement is needed
+        //if (!(priv->flags & ALPS_BUTTONPAD)) {
+        f->ts_right = !!(SS4_BTN_V2(p) & 0x02);
+        f->ts_middle = !!(SS4_BTN_V2(p) & 0x04);
+        //}
+    } else {
+        f->left = !!(SS4_BTN_V2(p) & 0x01);
+        if (!buttonpad) {
+            f->right = !!(SS4_BTN_V2(p) & 0x02);
+            f->middle = !!(SS4_BTN_V2(p) & 0x04);
+        }
+    }
+    return true;
+}
+
+template bool alps_decode_ss4_v2<false, false>(const struct alps_data *, struct alps_fields *, const uint8_t *);
+template bool alps_decode_ss4_v2<false, true>(const struct alps_data *, struct alps_fields *, const uint8_t *);
+template bool alps_decode_ss4_v2<true, false>(const struct alps_data *, struct alps_fields *, const uint8_t *);
+template bool alps_decode_ss4_v2<true, true>(const struct alps_data *, struct alps_fields *, const uint8_t *);
+
+alps_decoder alps_select_decode_ss4_v2(const struct alps_data *priv)
+{
+    bool buttonpad = priv->flags & ALPS_BUTTONPAD;
+
+    if (IS_SS4PLUS_DEV(priv->dev_id))
+        return buttonpad ? alps_decode_ss4_v2<true, true> : alps_decode_ss4_v2<true, false>;
+    return buttonpad ? alps_decode_ss4_v2<false, true> : alps_decode_ss4_v2<false, false>;
+}
+
+/* ============================================================================================== */
+/* ==============================||\\ Stream synchronization //||================================ */
+/* ============================================================================================== */
+
+enum alps_sync_result alps_check_packet_sync(const struct alps_data *priv, const uint8_t *packet, unsigned count)
+{
+    /*
+     * Check if we are dealing with a bare PS/2 packet, presumably from
+     * a device connected to the external PS/2 port. Because bare PS/2
+     * protocol does not have enough constant bits to self-synchronize
+     * properly we only do this if the device is fully synchronized.
+     * Can not distinguish V8's first byte from PS/2 packet's
+     */
+    if (priv->proto_version != ALPS_PROTO_V8 &&
+        (packet[0] & 0xc8) == 0x08) {
+        return count == 3 ? ALPS_SYNC_PS2_DONE : ALPS_SYNC_PS2;
+    }
+    
+    /* Check for PS/2 packet stuffed in the middle of ALPS packet. */
+    if ((priv->flags & ALPS_PS2_INTERLEAVED) &&
+        count >= 4 && (packet[3] & 0x0f) == 0x0f) {
+        if (count < 7)
+            return ALPS_SYNC_INTERLEAVED;
+        /*
+         * High bit clear: a PS/2 packet indeed got in the middle. A whole
+         * ALPS packet followed by a trackstick packet looks the same, but
+         * would need all buttons down while moving the stick.
+         */
+        if (!(packet[6] & 0x80))
+            return ALPS_SYNC_INTERLEAVED_PS2;
+        /* High bit set: a whole ALPS packet and the start of the next, or garbage */
+        if (((packet[3] | packet[4] | packet[5]) & 0x80) ||
+            (packet[6] & priv->mask0) != priv->byte0)
+            return ALPS_SYNC_BAD;
+        return ALPS_SYNC_INTERLEAVED_NEXT;
+    }
+    
+    /* alps_is_valid_first_byte */
+    if ((packet[0] & priv->mask0) != priv->byte0) {
+        return ALPS_SYNC_BAD;
+    }
+    
+    /* Bytes 2 - pktsize should have 0 in the highest bit */
+    if (priv->proto_version < ALPS_PROTO_V5 &&
+        count >= 2 && count <= (unsigned)priv->pktsize &&
+        (packet[count - 1] & 0x80)) {
+        return ALPS_SYNC_BAD;
+    }
+    
+    /* alps_is_valid_package_v7 */
+    if (priv->proto_version == ALPS_PROTO_V7 &&
+        (((count == 3) && ((packet[2] & 0x40) != 0x40)) ||
+         ((count == 4) && ((packet[3] & 0x48) != 0x48)) ||
+         ((count == 6) && ((packet[5] & 0x40) != 0x0)))) {
+        return ALPS_SYNC_BAD;
+    }
+    
+    /* alps_is_valid_package_ss4_v2 */
+    if (priv->proto_version == ALPS_PROTO_V8 &&
+        ((count == 4 && ((packet[3] & 0x08) != 0x08)) ||
+         (count == 6 && ((packet[5] & 0x10) != 0x0)))) {
+        return ALPS_SYNC_BAD;
+    }
+    
+    return ALPS_SYNC_OK;
+}
+
+unsigned alps_resync_offset(const struct alps_data *priv, const uint8_t *packet, unsigned count)
+{
+    for (unsigned skip = 1; skip < count; skip++) {
+        /* cheap reject before checking every prefix */
+        if ((packet[skip] & priv->mask0) != priv->byte0)
+            continue;
+        unsigned len = 1;
+        while (len <= count - skip &&
+               alps_check_packet_sync(priv, packet + skip, len) == ALPS_SYNC_OK)
+            len++;
+        if (len > count - skip)
+            return skip;
+    }
+    return count;
+}
+
+/* ============================================================================================== */
+/* ===================================||\\ Identification //||=================================== */
+/* ============================================================================================== */
+
+static const struct alps_model_info alps_model_data[] = {
+    /*
+     * XXX This entry is suspicious. First byte has zero lower nibble,
+     * which is what a normal mouse would report. Also, the value 0x0e
+     * isn't valid per PS/2 spec.
+     */
+    { { 0x20, 0x02, 0x0e }, { ALPS_PROTO_V2, 0xf8, 0xf8, ALPS_PASS | ALPS_DUALPOINT } },
+    
+    { { 0x22, 0x02, 0x0a }, { ALPS_PROTO_V2, 0xf8, 0xf8, ALPS_PASS | ALPS_DUALPOINT } },
+    { { 0x22, 0x02, 0x14 }, { ALPS_PROTO_V2, 0xff, 0xff, ALPS_PASS | ALPS_DUALPOINT } },    /* Dell Latitude D600 */
+    { { 0x32, 0x02, 0x14 }, { ALPS_PROTO_V2, 0xf8, 0xf8, ALPS_PASS | ALPS_DUALPOINT } },    /* Toshiba Salellite Pro M10 */
+    { { 0x33, 0x02, 0x0a }, { ALPS_PROTO_V1, 0x88, 0xf8, 0 } },                /* UMAX-530T */
+    { { 0x52, 0x01, 0x14 }, { ALPS_PROTO_V2, 0xff, 0xff,
+        ALPS_PASS | ALPS_DUALPOINT | ALPS_PS2_INTERLEAVED } },                /* Toshiba Tecra A11-11L */
+    { { 0x53, 0x02, 0x0a }, { ALPS_PROTO_V2, 0xf8, 0xf8, 0 } },
+    { { 0x53, 0x02, 0x14 }, { ALPS_PROTO_V2, 0xf8, 0xf8, 0 } },
+    { { 0x60, 0x03, 0xc8 }, { ALPS_PROTO_V2, 0xf8, 0xf8, 0 } },                /* HP ze1115 */
+    { { 0x62, 0x02, 0x14 }, { ALPS_PROTO_V2, 0xcf, 0xcf,
+        ALPS_PASS | ALPS_DUALPOINT | ALPS_PS2_INTERLEAVED } },                /* Dell Latitude E5500, E6400, E6500, Precision M4400 */
+    { { 0x63, 0x02, 0x0a }, { ALPS_PROTO_V2, 0xf8, 0xf8, 0 } },
+    { { 0x63, 0x02, 0x14 }, { ALPS_PROTO_V2, 0xf8, 0xf8, 0 } },
+    { { 0x63, 0x02, 0x28 }, { ALPS_PROTO_V2, 0xf8, 0xf8, ALPS_FW_BK_2 } },            /* Fujitsu Siemens S6010 */
+    { { 0x63, 0x02, 0x3c }, { ALPS_PROTO_V2, 0x8f, 0x8f, ALPS_WHEEL } },            /* Toshiba Satellite S2400-103 */
+    { { 0x63, 0x02, 0x50 }, { ALPS_PROTO_V2, 0xef, 0xef, ALPS_FW_BK_1 } },            /* NEC Versa L320 */
+    { { 0x63, 0x02, 0x64 }, { ALPS_PROTO_V2, 0xf8, 0xf8, 0 } },
+    { { 0x63, 0x03, 0xc8 }, { ALPS_PROTO_V2, 0xf8, 0xf8, ALPS_PASS | ALPS_DUALPOINT } },    /* Dell Latitude D800 */
+    { { 0x73, 0x00, 0x0a }, { ALPS_PROTO_V2, 0xf8, 0xf8, ALPS_DUALPOINT } },        /* ThinkPad R61 8918-5QG */
+    { { 0x73, 0x00, 0x14 }, { ALPS_PROTO_V6, 0xff, 0xff, ALPS_DUALPOINT } },        /* Dell XT2 */
+    { { 0x73, 0x02, 0x0a }, { ALPS_PROTO_V2, 0xf8, 0xf8, 0 } },
+    { { 0x73, 0x02, 0x14 }, { ALPS_PROTO_V2, 0xf8, 0xf8, ALPS_FW_BK_2 } },            /* Ahtec Laptop */
+    { { 0x73, 0x02, 0x50 }, { ALPS_PROTO_V2, 0xcf, 0xcf, ALPS_FOUR_BUTTONS } },        /* Dell Vostro 1400 */
+};
+
+static const char *alps_model_name(uint16_t version)
+{
+    switch (version) {
+        case ALPS_PROTO_V1:             return "V1";
+        case ALPS_PROTO_V2:             return "V2";
+        case ALPS_PROTO_V3_RUSHMORE:    return "V3 Rushmore";
+        case ALPS_PROTO_V4:             return "V4";
+        case ALPS_PROTO_V6:             return "V6";
+        default:                        return "unknown";
+    }
+}
+
+enum alps_id_match alps_identify(const uint8_t e7[3], const uint8_t ec[3],
+                                 struct alps_protocol_info *info, const char **name)
+{
+    for (unsigned i = 0; i < sizeof(alps_model_data) / sizeof(alps_model_data[0]); i++) {
+        const struct alps_model_info *model = &alps_model_data[i];
+        if (!memcmp(e7, model->signature, sizeof(model->signature))) {
+            *info = model->protocol_info;
+            *name = alps_model_name(info->version);
+            return ALPS_ID_MODEL;
+        }
+    }
+    
+    memset(info, 0, sizeof(*info));
+    if (e7[0] == 0x73 && e7[1] == 0x02 && e7[2] == 0x64 &&
+        ec[2] == 0x8a) {
+        info->version = ALPS_PROTO_V4;
+        *name = "V4";
+    } else if (e7[0] == 0x73 && e7[1] == 0x03 && e7[2] == 0x50 &&
+               ec[0] == 0x73 && (ec[1] == 0x01 || ec[1] == 0x02)) {
+        info->version = ALPS_PROTO_V5;
+        *name = "V5 Dolphin";
+    } else if (ec[0] == 0x88 &&
+               ((ec[1] & 0xf0) == 0xb0 || (ec[1] & 0xf0) == 0xc0)) {
+        info->version = ALPS_PROTO_V7;
+        *name = "V7";
+    } else if (ec[0] == 0x88 && ec[1] == 0x08) {
+        info->version = ALPS_PROTO_V3_RUSHMORE;
+        *name = "V3 Rushmore";
+    } else if (ec[0] == 0x88 && ec[1] == 0x07 &&
+               ec[2] >= 0x90 && ec[2] <= 0x9d) {
+        info->version = ALPS_PROTO_V3;
+        *name = "V3 Pinnacle";
+    } else if (e7[0] == 0x73 && e7[1] == 0x03 &&
+               (e7[2] == 0x14 || e7[2] == 0x28)) {
+        info->version = ALPS_PROTO_V8;
+        *name = "V8";
+    } else if (e7[0] == 0x73 && e7[1] == 0x03 && e7[2] == 0xc8) {
+        /* V9 is not supported yet, treated as V8 */
+        info->version = ALPS_PROTO_V8;
+        *name = "unsupported V9";
+    } else {
+        *name = "unknown";
+        return ALPS_ID_NONE;
+    }
+    return ALPS_ID_PROTOCOL;
+}
@@ -0,0 +1,442 @@
+/*
+ * Copyright (c) 2002 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * The contents of this file constitute Original Code as defined in and
+ * are subject to the Apple Public Source License Version 1.2 (the
+ * "License").  You may not use this file except in compliance with the
+ * License.  Please obtain a copy of the License at
+ * http://www.apple.com/publicsource and read it before using this file.
+ *
+ * This Original Code and all software distributed under the License are
+ * distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE OR NON-INFRINGEMENT.  Please see the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// ALPS packet decoding
+//
+// Pure packet decoders shared by the ALPS driver. Nothing in here may depend
+// on IOKit: the decoders only read packet bytes and the identified device
+// parameters in alps_data, so they can also be built with a plain host
+// compiler (c++ -std=c++11 -c alps_decode.cpp) to measure or check them
+// outside of the kernel; Host/Makefile does that.
+//
+
+#ifndef _ALPS_DECODE_H
+#define _ALPS_DECODE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(KERNEL) && defined(DEBUG_MSG)
+#include <IOKit/IOLib.h>
+#define ALPS_DECODE_LOG(args...)  do { IOLog(args); } while (0)
+#else
+#define ALPS_DECODE_LOG(args...)  do { } while (0)
+#endif
+
+#define ALPS_PROTO_V1             0x100
+#define ALPS_PROTO_V2             0x200
+#define ALPS_PROTO_V3             0x300
+#define ALPS_PROTO_V3_RUSHMORE    0x310
+#define ALPS_PROTO_V4             0x400
+#define ALPS_PROTO_V5             0x500
+#define ALPS_PROTO_V6             0x600
+#define ALPS_PROTO_V7             0x700    /* t3btl t4s */
+#define ALPS_PROTO_V8             0x800    /* SS4btl SS4s */
+#define ALPS_PROTO_V9             0x900    /* ss3btl */
+
+#define ALPS_DUALPOINT          0x02    /* touchpad has trackstick */
+#define ALPS_PASS               0x04    /* device has a pass-through port */
+
+#define ALPS_WHEEL              0x08    /* hardware wheel present */
+#define ALPS_FW_BK_1            0x10    /* front & back buttons present */
+#define ALPS_FW_BK_2            0x20    /* front & back buttons present */
+#define ALPS_FOUR_BUTTONS       0x40    /* 4 direction button present */
+#define ALPS_PS2_INTERLEAVED    0x80    /* 3-byte PS/2 packet interleaved with 6-byte ALPS packet */
+#define ALPS_STICK_BITS		    0x100	/* separate stick button bits */
+#define ALPS_BUTTONPAD		    0x200	/* device is a clickpad */
+#define ALPS_DUALPOINT_WITH_PRESSURE	0x400	/* device can report trackpoint pressure */
+
+#define ALPS_QUIRK_TRACKSTICK_BUTTONS	1 /* trakcstick buttons in trackstick packet */
+
+#define MAX_TOUCHES     5
+
+#define DOLPHIN_COUNT_PER_ELECTRODE	64
+#define DOLPHIN_PROFILE_XOFFSET		8	/* x-electrode offset */
+#define DOLPHIN_PROFILE_YOFFSET		1	/* y-electrode offset */
+
+/*
+ * enum SS4_PACKET_ID - defines the packet type for V8
+ * SS4_PACKET_ID_IDLE: There's no finger and no button activity.
+ * SS4_PACKET_ID_ONE: There's one finger on touchpad
+ *  or there's button activities.
+ * SS4_PACKET_ID_TWO: There's two or more fingers on touchpad
+ * SS4_PACKET_ID_MULTI: There's three or more fingers on touchpad
+ * SS4_PACKET_ID_STICK: A stick pointer packet
+ */
+enum SS4_PACKET_ID {
+    SS4_PACKET_ID_IDLE = 0,
+    SS4_PACKET_ID_ONE,
+    SS4_PACKET_ID_TWO,
+    SS4_PACKET_ID_MULTI,
+    SS4_PACKET_ID_STICK,
+};
+
+#define SS4_COUNT_PER_ELECTRODE        256
+#define SS4_NUMSENSOR_XOFFSET        7
+#define SS4_NUMSENSOR_YOFFSET        7
+#define SS4_MIN_PITCH_MM        50
+
+#define SS4_MASK_NORMAL_BUTTONS        0x07
+
+#define SS4PLUS_COUNT_PER_ELECTRODE    128
+#define SS4PLUS_NUMSENSOR_XOFFSET    16
+#define SS4PLUS_NUMSENSOR_YOFFSET    5
+#define SS4PLUS_MIN_PITCH_MM        37
+
+#define IS_SS4PLUS_DEV(_b)    (((_b[0]) == 0x73) &&    \
+                 ((_b[1]) == 0x03) &&    \
+                 ((_b[2]) == 0x28)        \
+                )
+
+#define SS4_IS_IDLE_V2(_b)    (((_b[0]) == 0x18) &&        \
+                 ((_b[1]) == 0x10) &&        \
+                 ((_b[2]) == 0x00) &&        \
+                 ((_b[3] & 0x88) == 0x08) &&    \
+                 ((_b[4]) == 0x10) &&        \
+                 ((_b[5]) == 0x00)        \
+                )
+
+#define SS4_1F_X_V2(_b)        (((_b[0]) & 0x0007) |        \
+                 ((_b[1] << 3) & 0x0078) |    \
+                 ((_b[1] << 2) & 0x0380) |    \
+                 ((_b[2] << 5) & 0x1C00)    \
+                )
+
+#define SS4_1F_Y_V2(_b)        (((_b[2]) & 0x000F) |        \
+                 ((_b[3] >> 2) & 0x0030) |    \
+                 ((_b[4] << 6) & 0x03C0) |    \
+                 ((_b[4] << 5) & 0x0C00)    \
+                )
+
+#define SS4_1F_Z_V2(_b)        (((_b[5]) & 0x0F) |        \
+                 ((_b[5] >> 1) & 0x70) |    \
+                 ((_b[4]) & 0x80)        \
+                )
+
+#define SS4_1F_LFB_V2(_b)    (((_b[2] >> 4) & 0x01) == 0x01)
+
+#define SS4_MF_LF_V2(_b, _i)    ((_b[1 + (_i) * 3] & 0x0004) == 0x0004)
+
+#define SS4_BTN_V2(_b)        ((_b[0] >> 5) & SS4_MASK_NORMAL_BUTTONS)
+
+#define SS4_STD_MF_X_V2(_b, _i)    (((_b[0 + (_i) * 3] << 5) & 0x00E0) |    \
+                 ((_b[1 + _i * 3]  << 5) & 0x1F00)    \
+                )
+
+#define SS4_PLUS_STD_MF_X_V2(_b, _i) (((_b[0 + (_i) * 3] << 4) & 0x0070) | \
+                 ((_b[1 + (_i) * 3]  << 4) & 0x0F80)    \
+                )
+
+#define SS4_STD_MF_Y_V2(_b, _i)    (((_b[1 + (_i) * 3] << 3) & 0x0010) |    \
+                 ((_b[2 + (_i) * 3] << 5) & 0x01E0) |    \
+                 ((_b[2 + (_i) * 3] << 4) & 0x0E00)    \
+                )
+
+#define SS4_BTL_MF_X_V2(_b, _i)    (SS4_STD_MF_X_V2(_b, _i) |        \
+                 ((_b[0 + (_i) * 3] >> 3) & 0x0010)    \
+                )
+
+#define SS4_PLUS_BTL_MF_X_V2(_b, _i) (SS4_PLUS_STD_MF_X_V2(_b, _i) |    \
+                 ((_b[0 + (_i) * 3] >> 4) & 0x0008)    \
+                )
+
+#define SS4_BTL_MF_Y_V2(_b, _i)    (SS4_STD_MF_Y_V2(_b, _i) | \
+                 ((_b[0 + (_i) * 3] >> 3) & 0x0008)    \
+                )
+
+#define SS4_MF_Z_V2(_b, _i)    (((_b[1 + (_i) * 3]) & 0x0001) |    \
+                 ((_b[1 + (_i) * 3] >> 1) & 0x0002)    \
+                )
+
+#define SS4_IS_MF_CONTINUE(_b)    ((_b[2] & 0x10) == 0x10)
+#define SS4_IS_5F_DETECTED(_b)    ((_b[2] & 0x10) == 0x10)
+
+#define SS4_TS_X_V2(_b)        (int)(                \
+                 ((_b[0] & 0x01) << 7) |    \
+                 (_b[1] & 0x7F)        \
+                )
+
+#define SS4_TS_Y_V2(_b)        -(int)(                \
+                 ((_b[3] & 0x01) << 7) |    \
+                 (_b[2] & 0x7F)        \
+                )
+
+#define SS4_TS_Z_V2(_b)        (int)(_b[4] & 0x7F)
+
+
+#define SS4_MFPACKET_NO_AX        8160    /* X-Coordinate value */
+#define SS4_MFPACKET_NO_AY        4080    /* Y-Coordinate value */
+#define SS4_MFPACKET_NO_AX_BL        8176    /* Buttonless X-Coord value */
+#define SS4_MFPACKET_NO_AY_BL        4088    /* Buttonless Y-Coord value */
+#define SS4_PLUS_MFPACKET_NO_AX        4080    /* SS4 PLUS, X */
+#define SS4_PLUS_MFPACKET_NO_AX_BL    4088    /* Buttonless SS4 PLUS, X */
+
+/*
+ * enum V7_PACKET_ID - defines the packet type for V7
+ * V7_PACKET_ID_IDLE: There's no finger and no button activity.
+ * V7_PACKET_ID_TWO: There's one or two non-resting fingers on touchpad
+ *  or there's button activities.
+ * V7_PACKET_ID_MULTI: There are at least three non-resting fingers.
+ * V7_PACKET_ID_NEW: The finger position in slot is not continues from
+ *  previous packet.
+ */
+enum V7_PACKET_ID {
+    V7_PACKET_ID_IDLE,
+    V7_PACKET_ID_TWO,
+    V7_PACKET_ID_MULTI,
+    V7_PACKET_ID_NEW,
+    V7_PACKET_ID_UNKNOWN,
+};
+
+/**
+ * struct alps_protocol_info - information about protocol used by a device
+ * @version: Indicates V1/V2/V3/...
+ * @byte0: Helps figure out whether a position report packet matches the
+ *   known format for this model.  The first byte of the report, ANDed with
+ *   mask0, should match byte0.
+ * @mask0: The mask used to check the first byte of the report.
+ * @flags: Additional device capabilities (passthrough port, trackstick, etc.).
+ */
+struct alps_protocol_info {
+    uint16_t version;
+    uint8_t byte0, mask0;
+    unsigned int flags;
+};
+
+/**
+ * struct alps_model_info - touchpad ID table
+ * @signature: E7 response string to match.
+ * @protocol_info: information about protocol used by the device.
+ *
+ * Many (but not all) ALPS touchpads can be identified by looking at the
+ * values returned in the "E7 report" and/or the "EC report."  This table
+ * lists a number of such touchpads.
+ */
+struct alps_model_info {
+    uint8_t signature[3];
+    struct alps_protocol_info protocol_info;
+};
+
+struct alps_nibble_commands;
+
+struct alps_bitmap_point {
+    int start_bit;
+    int num_bits;
+};
+
+struct input_mt_pos {
+    uint32_t x;
+    uint32_t y;
+};
+
+/**
+ * struct alps_fields - decoded version of the report packet
+ * @x_map: Bitmap of active X positions for MT.
+ * @y_map: Bitmap of active Y positions for MT.
+ * @fingers: Number of fingers for MT.
+ * @x_run: Widths in bits of the first and last X contact runs (0 if none).
+ * @y_run: Widths in bits of the first and last Y contact runs (0 if none).
+ * @pressure: Pressure.
+ * @st: position for ST.
+ * @mt: position for MT.
+ * @first_mp: Packet is the first of a multi-packet report.
+ * @is_mp: Packet is part of a multi-packet report.
+ * @left: Left touchpad button is active.
+ * @right: Right touchpad button is active.
+ * @middle: Middle touchpad button is active.
+ * @ts_left: Left trackstick button is active.
+ * @ts_right: Right trackstick button is active.
+ * @ts_middle: Middle trackstick button is active.
+ */
+struct alps_fields {
+    unsigned int x_map;
+    unsigned int y_map;
+    unsigned int fingers;
+    uint8_t x_run[2];
+    uint8_t y_run[2];
+
+    int pressure;
+    struct input_mt_pos st;
+    struct input_mt_pos mt[MAX_TOUCHES];
+
+    unsigned int first_mp:1;
+    unsigned int is_mp:1;
+
+    unsigned int left:1;
+    unsigned int right:1;
+    unsigned int middle:1;
+
+    unsigned int ts_left:1;
+    unsigned int ts_right:1;
+    unsigned int ts_middle:1;
+};
+
+/**
+ * struct alps_data - private data structure for the ALPS driver
+ * @nibble_commands: Command mapping used for touchpad register accesses.
+ * @addr_command: Command used to tell the touchpad that a register address
+ *   follows.
+ * @proto_version: Indicates V1/V2/V3/...
+ * @byte0: Helps figure out whether a position report packet matches the
+ *   known format for this model.  The first byte of the report, ANDed with
+ *   mask0, should match byte0.
+ * @mask0: The mask used to check the first byte of the report.
+ * @fw_ver: cached copy of firmware version (EC report)
+ * @flags: Additional device capabilities (passthrough port, trackstick, etc.).
+ * @x_max: Largest possible X position value.
+ * @y_max: Largest possible Y position value.
+ * @x_bits: Number of X bits in the MT bitmap.
+ * @y_bits: Number of Y bits in the MT bitmap.
+ * @x_bitmap_recip: ceil(2^32 / (2 * (x_bits - 1))), see alps_set_bitmap_scale.
+ * @y_bitmap_recip: ceil(2^32 / (2 * (y_bits - 1))), see alps_set_bitmap_scale.
+ * @prev_fin: Finger bit from previous packet.
+ * @multi_packet: Multi-packet data in progress.
+ * @multi_data: Saved multi-packet data.
+ * @f: Decoded packet data fields.
+ * @quirks: Bitmap of ALPS_QUIRK_*.
+ */
+struct alps_data {
+    /* these are autodetected when the device is identified */
+    const struct alps_nibble_commands *nibble_commands;
+    int32_t addr_command;
+    uint16_t proto_version;
+    uint8_t byte0, mask0;
+    uint8_t dev_id[3];
+    uint8_t fw_ver[3];
+    int flags;
+    int32_t x_max;
+    int32_t y_max;
+    int32_t x_bits;
+    int32_t y_bits;
+    uint32_t x_bitmap_recip;
+    uint32_t y_bitmap_recip;
+    unsigned int x_res;
+    unsigned int y_res;
+
+    int32_t prev_fin;
+    int32_t multi_packet;
+    int second_touch;
+    uint8_t multi_data[6];
+    struct alps_fields f;
+    uint8_t quirks;
+
+    int pktsize = 6;
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Decoder entry points
+//
+// The decoders share one signature (alps_decoder); set_protocol binds the
+// right one into process_packet as a template argument. They only fill in
+// @f; alps_process_bitmap additionally latches priv->second_touch for the
+// current 2 finger sequence.
+//
+
+bool alps_decode_buttons_v3(struct alps_fields *f, const uint8_t *p);
+
+bool alps_decode_pinnacle(const struct alps_data *priv, struct alps_fields *f, const uint8_t *p);
+
+bool alps_decode_rushmore(const struct alps_data *priv, struct alps_fields *f, const uint8_t *p);
+
+bool alps_decode_dolphin(const struct alps_data *priv, struct alps_fields *f, const uint8_t *p);
+
+int alps_process_bitmap(struct alps_data *priv, struct alps_fields *fields);
+
+/// Precomputes the bitmap reciprocals; call once x/y_max and x/y_bits are final
+void alps_set_bitmap_scale(struct alps_data *priv);
+
+bool alps_decode_v4(struct alps_data *priv, const uint8_t *p);
+
+unsigned char alps_get_packet_id_v7(const uint8_t *byte);
+
+void alps_get_finger_coordinate_v7(struct input_mt_pos *mt, const uint8_t *pkt, uint8_t pkt_id);
+
+int alps_get_mt_count(const struct input_mt_pos *mt);
+
+bool alps_decode_packet_v7(const struct alps_data *priv, struct alps_fields *f, const uint8_t *p);
+
+unsigned char alps_get_pkt_id_ss4_v2(const uint8_t *byte);
+
+/*
+ * The SS4 coordinate layout depends on SS4 vs SS4+ (dev_id) and buttonpad vs
+ * buttons (flags), both fixed once the device is identified, so the decoder is
+ * instantiated per variant. alps_select_decode_ss4_v2 picks the one matching
+ * @priv, as set_protocol does after the V8 defaults are read.
+ */
+template <bool plus, bool buttonpad>
+bool alps_decode_ss4_v2(const struct alps_data *priv, struct alps_fields *f, const uint8_t *p);
+
+typedef bool (*alps_decoder)(const struct alps_data *priv, struct alps_fields *f, const uint8_t *p);
+
+alps_decoder alps_select_decode_ss4_v2(const struct alps_data *priv);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Stream synchronization
+//
+// alps_check_packet_sync is called by interruptOccurred for every incoming byte,
+// after storing it, with @count bytes of the current packet received including
+// that one (as psmouse->pktcnt in Linux). It says whether the byte continues a
+// bare PS/2 packet, completes one, breaks sync, or fits the ALPS packet.
+//
+// With ALPS_PS2_INTERLEAVED, a PS/2 packet may sit in bytes 3-5 of an ALPS
+// packet. Which it was is only known from the 7th byte, so up to 7 bytes are
+// held (alps_handle_interleaved_ps2 in Linux).
+//
+
+enum alps_sync_result {
+    ALPS_SYNC_OK,               /* store byte, packet still plausible */
+    ALPS_SYNC_PS2,              /* store byte, bare PS/2 packet in progress */
+    ALPS_SYNC_PS2_DONE,         /* bare PS/2 packet complete */
+    ALPS_SYNC_BAD,              /* invalid byte, drop packet */
+    ALPS_SYNC_INTERLEAVED,      /* store byte, wait for the 7th */
+    ALPS_SYNC_INTERLEAVED_PS2,  /* bytes 3-5 are PS/2, the 7th is the ALPS 4th */
+    ALPS_SYNC_INTERLEAVED_NEXT, /* bytes 0-5 are ALPS, the 7th starts the next */
+};
+
+enum alps_sync_result alps_check_packet_sync(const struct alps_data *priv, const uint8_t *packet, unsigned count);
+
+// After ALPS_SYNC_BAD on the last of @count bytes, returns how many leading
+// bytes to drop so that the rest is the start of a plausible ALPS packet, or
+// @count when no suffix is. A bare PS/2 header does not count, for the same
+// reason alps_check_packet_sync only trusts it while in sync.
+unsigned alps_resync_offset(const struct alps_data *priv, const uint8_t *packet, unsigned count);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Identification
+//
+// alps_identify matches the E7/EC reports collected by ALPS::identify against
+// the model table and the per-protocol signatures. A model table hit fills in
+// all of @info; a protocol signature hit only sets info->version, the rest is
+// chosen by set_protocol. @name is a short label for logging.
+//
+
+enum alps_id_match {
+    ALPS_ID_NONE,
+    ALPS_ID_MODEL,
+    ALPS_ID_PROTOCOL,
+};
+
+enum alps_id_match alps_identify(const uint8_t e7[3], const uint8_t ec[3],
+                                 struct alps_protocol_info *info, const char **name);
+
+#endif /* _ALPS_DECODE_H */
@@ -0,0 +1,595 @@
+/*
+ * Copyright (c) 2002 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * The contents of this file constitute Original Code as defined in and
+ * are subject to the Apple Public Source License Version 1.2 (the
+ * "License").  You may not use this file except in compliance with the
+ * License.  Please obtain a copy of the License at
+ * http://www.apple.com/publicsource and read it before using this file.
+ *
+ * This Original Code and all software distributed under the License are
+ * distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE OR NON-INFRINGEMENT.  Please see the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include "alps_tracker.h"
+
+// port from VoodooPS2SynapticsTouchpad.cpp; huge credits to @usr-sse2
+
+#define sqr(x) ((x) * (x))
+
+// a coordinate difference small enough that the sum of two squares fits an int
+static inline int clampDelta(int d) {
+    return d > 32767 ? 32767 : d < -32767 ? -32767 : d;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+AlpsTracker::AlpsTracker() {
+    smoothing.filter = kSmoothingBox;
+    fingerGate = 1000000;
+    min_x = min_y = 0;
+    max_x = max_y = INT_MAX;
+    margin_x = margin_y = 0;
+    errors = 0;
+    clampedFingerCount = 0;
+    now = 0;
+    reset();
+}
+
+void AlpsTracker::reset() {
+    memset(&fingerStates, 0, sizeof(fingerStates));
+    lastFingerCount = 0;
+    hadLiftFinger = false;
+    wasSkipped = false;
+    for (int i = 0; i < MAX_TOUCHES; i++)
+        fingerStates.virtualFingerIndex[i] = -1;
+    
+    memset(&virtualFingers, 0, sizeof(virtualFingers));
+    virtualFingers.freeFingerTypes = kFreeFingerTypesAll;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/*
+ * Extrapolates the position at history entry @from by @horizon us, with the
+ * velocity and acceleration of it and the two entries before. A contact
+ * needs two entries before it is predicted at all, velocity alone is used
+ * with two. The acceleration term may at most double or cancel the
+ * velocity term, so a stopping finger is never predicted back past where
+ * it is. A gap of over 50 ms between entries turns prediction off.
+ */
+bool predictMotion(const motion_history& h, int from, uint64_t horizon, int& x, int& y)
+{
+    if (h.count - from < 2)
+        return false;
+    
+    int i0 = h.at(from), i1 = h.at(from + 1);
+    int64_t dt1 = h.time[i0] - h.time[i1];
+    if (dt1 <= 0 || dt1 > 50000)
+        return false;
+    
+    int64_t dt2 = 0;
+    int i2 = 0;
+    if (h.count - from >= 3) {
+        i2 = h.at(from + 2);
+        dt2 = h.time[i1] - h.time[i2];
+        if (dt2 <= 0 || dt2 > 50000)
+            dt2 = 0;
+    }
+    
+    const int* pos[2] = {h.x, h.y};
+    int* out[2] = {&x, &y};
+    int64_t hz = horizon;
+    for (int axis = 0; axis < 2; axis++) {
+        const int* p = pos[axis];
+        // 16.16 units per ms, and per ms^2
+        int64_t v1 = (int64_t)(p[i0] - p[i1]) * 65536 * 1000 / dt1;
+        int64_t move = v1 * hz / 1000;
+        if (dt2) {
+            int64_t v2 = (int64_t)(p[i1] - p[i2]) * 65536 * 1000 / dt2;
+            int64_t a = (v1 - v2) * 2000 / (dt1 + dt2);
+            int64_t accel = a * hz / 1000 * hz / 1000 / 2;
+            int64_t limit = move < 0 ? -move : move;
+            if (accel > limit)
+                accel = limit;
+            else if (accel < -limit)
+                accel = -limit;
+            move += accel;
+        }
+        *out[axis] = p[i0] + (int)((move + (1 << 15)) >> 16);
+    }
+    return true;
+}
+
+int AlpsTracker::dist(int physicalFinger, int virtualFinger) {
+    const auto &virt = virtualFingerStates[virtualFinger];
+    int x = virt.x_avg.newest();
+    int y = virt.y_avg.newest();
+    
+    // move the last position on by the motion since it was taken
+    const motion_history &h = virt.history;
+    if (virt.x_avg.count() && h.count) {
+        uint64_t last = h.time[h.at(0)];
+        int px, py;
+        if (now > last && now - last <= 50000 &&
+            predictMotion(h, 0, now - last, px, py)) {
+            x += px - h.x[h.at(0)];
+            y += py - h.y[h.at(0)];
+        }
+    }
+    // a prediction can land far off the pad
+    int dx = clampDelta(fingerStates.x[physicalFinger] - x);
+    int dy = clampDelta(fingerStates.y[physicalFinger] - y);
+    return sqr(dx) + sqr(dy);
+}
+
+void AlpsTracker::assignVirtualFinger(int physicalFinger) {
+    if (physicalFinger < 0 || physicalFinger >= MAX_TOUCHES) {
+        ALPS_TRACKER_ERROR("VoodooPS2AlpsTracker::assignVirtualFinger ERROR: invalid physical finger %d", physicalFinger);
+        return;
+    }
+    // lowest free virtual finger
+    int j = __builtin_ctz(~virtualFingers.touch);
+    if (j < MAX_TOUCHES) {
+        fingerStates.virtualFingerIndex[physicalFinger] = j;
+        virtualFingers.touch |= 1 << j;
+        virtualFingerStates[j].x_avg.reset();
+        virtualFingerStates[j].y_avg.reset();
+        assignFingerType(j);
+    }
+}
+
+void AlpsTracker::assignFingerType(int virtualFinger) {
+    // lowest free type from the index finger on
+    unsigned types = virtualFingers.freeFingerTypes & ~((1 << kMT2FingerTypeIndexFinger) - 1);
+    MT2FingerType type = kMT2FingerTypeUndefined;
+    if (types) {
+        type = (MT2FingerType)__builtin_ctz(types);
+        virtualFingers.freeFingerTypes &= ~(1 << type);
+    }
+    virtualFingers.fingerType[virtualFinger] = type;
+}
+
+void AlpsTracker::freeAndMarkVirtualFingers() {
+    // free up all virtual fingers
+    virtualFingers.touch = 0;
+    virtualFingers.freeFingerTypes = kFreeFingerTypesAll;
+    memset(virtualFingers.pressure, 0, sizeof(virtualFingers.pressure));
+    for (int i = 0; i < MAX_TOUCHES; i++) {
+        virtualFingerStates[i].x_avg.reset(); // maybe it should be done only for unpressed fingers?
+        virtualFingerStates[i].y_avg.reset();
+    }
+    for (int i = 0; i < clampedFingerCount; i++) { // mark virtual fingers as used
+        int j = fingerStates.virtualFingerIndex[i];
+        if (!isValidVirtualFinger(j)) {
+            ALPS_TRACKER_ERROR("alps_parse_hw_state: WTF!? Finger %d has no virtual finger", i);
+            continue;
+        }
+        virtualFingers.touch |= 1 << j;
+        if (isValidFingerType(virtualFingers.fingerType[j]))
+            virtualFingers.freeFingerTypes &= ~(1 << virtualFingers.fingerType[j]);
+    }
+    for (int i = 0; i < MAX_TOUCHES; i++) {
+        if (!(virtualFingers.touch & (1 << i)))
+            virtualFingers.fingerType[i] = kMT2FingerTypeUndefined;
+    }
+}
+
+static void clone(alps_hw_state &fingers, int dst, int src) {
+    fingers.x[dst] = fingers.x[src];
+    fingers.y[dst] = fingers.y[src];
+    fingers.z[dst] = fingers.z[src];
+}
+
+int AlpsTracker::upperFingerIndex() const {
+    return fingerStates.y[0] < fingerStates.y[1] ? 1 : 0;
+}
+
+void AlpsTracker::swapFingers(int dst, int src) {
+    int j = fingerStates.virtualFingerIndex[src];
+    if (!isValidVirtualFinger(j)) {
+        ALPS_TRACKER_ERROR("alps_parse_hw_state: WTF!? Finger %d has no virtual finger to swap", src);
+        assignVirtualFinger(dst);
+        return;
+    }
+    const auto &vfj = virtualFingerStates[j];
+    fingerStates.x[dst] = vfj.x_avg.average();
+    fingerStates.y[dst] = vfj.y_avg.average();
+    fingerStates.virtualFingerIndex[dst] = j;
+    assignVirtualFinger(src);
+}
+
+bool AlpsTracker::renumberFingers(uint64_t now_us, bool buttonDown) {
+    alps_hw_state &fs = fingerStates;
+    now = now_us;
+    
+    // The two reported fingers can come in either order. Keep each on the
+    // virtual finger it is nearest to, before anything follows their motion,
+    // but only swap them when both crossed pairs are within the gate.
+    if (clampedFingerCount == lastFingerCount && clampedFingerCount >= 2 &&
+        isValidVirtualFinger(fs.virtualFingerIndex[0]) && isValidVirtualFinger(fs.virtualFingerIndex[1])) {
+        FingerAssignment assignment(2, 2);
+        int virtuals[2] = {fs.virtualFingerIndex[0], fs.virtualFingerIndex[1]};
+        for (int i = 0; i < 2; i++)
+            for (int k = 0; k < 2; k++)
+                assignment.cost[i][k] = dist(i, virtuals[k]);
+        int match[MAX_TOUCHES];
+        assignment.solve(fingerGate, match);
+        if (match[0] == 1 && match[1] == 0) {
+            ALPS_TRACKER_LOG("alps_parse_hw_state: reported fingers swapped order");
+            fs.virtualFingerIndex[0] = virtuals[1];
+            fs.virtualFingerIndex[1] = virtuals[0];
+        }
+    }
+    
+    if (clampedFingerCount == lastFingerCount && clampedFingerCount >= 3) {
+        // update imaginary finger states
+        if (isValidVirtualFinger(fs.virtualFingerIndex[0]) && isValidVirtualFinger(fs.virtualFingerIndex[1])) {
+            if (clampedFingerCount >= 4) {
+                int i = upperFingerIndex();
+                const auto &fiv = virtualFingerStates[fs.virtualFingerIndex[i]];
+                int dx = fs.x[i] - fiv.x_avg.newest();
+                int dy = fs.y[i] - fiv.y_avg.newest();
+                for (int j = 2; j < clampedFingerCount; j++) {
+                    int x = fs.x[j] + dx;
+                    int y = fs.y[j] + dy;
+                    clip_no_update_limits(x, min_x, max_x, margin_x);
+                    clip_no_update_limits(y, min_y, max_y, margin_y);
+                    fs.x[j] = x;
+                    fs.y[j] = y;
+                    fs.z[j] = fs.z[i];
+                }
+            }
+            else if (clampedFingerCount == 3) {
+                const auto &f0v = virtualFingerStates[fs.virtualFingerIndex[0]];
+                const auto &f1v = virtualFingerStates[fs.virtualFingerIndex[1]];
+                int x = fs.x[2] + ((fs.x[0] - f0v.x_avg.newest()) + (fs.x[1] - f1v.x_avg.newest())) / 2;
+                int y = fs.y[2] + ((fs.y[0] - f0v.y_avg.newest()) + (fs.y[1] - f1v.y_avg.newest())) / 2;
+                clip_no_update_limits(x, min_x, max_x, margin_x);
+                clip_no_update_limits(y, min_y, max_y, margin_y);
+                fs.x[2] = x;
+                fs.y[2] = y;
+                fs.z[2] = (fs.z[0] + fs.z[1]) / 2;
+            }
+        }
+        else
+            ALPS_TRACKER_ERROR("alps_parse_hw_state: WTF - have %d fingers, but first 2 don't have virtual finger", clampedFingerCount);
+    }
+    
+    // We really need to send the "no touch" event
+    // multiple times, because if we don't do it and return,
+    // gestures like desktop switching or inertial scrolling
+    // got stuck midway until the next touch.
+    //if(!lastFingerCount && !clampedFingerCount) {
+    //    return 0;
+    //}
+    
+    // Finger type detection:
+    // We think that fingers are added beginning with the index finger,
+    // then middle, ring and little.
+    // However, when the finger count reaches 4, the lowest finger becomes thumb,
+    // but other fingers don't change their types.
+    // All fingers preserve their types during the gesture.
+    // Though it would be nice to see what MT2 does.
+    
+    if (clampedFingerCount == lastFingerCount && clampedFingerCount == 1 &&
+        isValidVirtualFinger(fs.virtualFingerIndex[0])) {
+        int i = 0;
+        int j = fs.virtualFingerIndex[i];
+        int d = dist(i, j);
+        if (d > fingerGate) {
+            // Prevent jumps by unpressing finger. Other way could be leaving the old finger pressed.
+            ALPS_TRACKER_LOG("alps_parse_hw_state: unpressing finger: dist is %d", d);
+            virtualFingerStates[j].x_avg.reset();
+            virtualFingerStates[j].y_avg.reset();
+            virtualFingers.pressure[j] = 0;
+            virtualFingers.fingerType[j] = kMT2FingerTypeUndefined;
+            clampedFingerCount = 0;
+        }
+    }
+    if (clampedFingerCount != lastFingerCount) {
+        if (clampedFingerCount > lastFingerCount && clampedFingerCount >= 3) {
+            // Skip sending touch data once because we need to wait for the next extended packet
+            if (wasSkipped)
+                wasSkipped = false;
+            else {
+                ALPS_TRACKER_LOG("alps_parse_hw_state: Skip sending touch data");
+                wasSkipped = true;
+                return false;
+            }
+        }
+        
+        if (lastFingerCount == 0) {
+            // Assign to identity mapping
+            for (int i = 0; i < clampedFingerCount; i++) {
+                fs.virtualFingerIndex[i] = i;
+                virtualFingers.touch |= 1 << i;
+                assignFingerType(i);
+                virtualFingerStates[i].x_avg.reset();
+                virtualFingerStates[i].y_avg.reset();
+                if (i >= 2) // more than 3 fingers added simultaneously
+                    clone(fs, i, upperFingerIndex()); // Copy from the upper finger
+            }
+        }
+        else if (clampedFingerCount > lastFingerCount && !hadLiftFinger) {
+            // First finger already exists
+            // Can add 1, 2 or 3 fingers at once
+            // Newly added finger is always in secondary finger packet
+            switch (clampedFingerCount - lastFingerCount) {
+                case 1:
+                    if (lastFingerCount >= 2)
+                        swapFingers(lastFingerCount, 1);
+                    else // lastFingerCount = 1
+                        assignVirtualFinger(1);
+                    break;
+                case 2:
+                    if (lastFingerCount == 1) { // added second and third
+                        assignVirtualFinger(1);
+                        clone(fs, 2, upperFingerIndex()); // We don't know better
+                        assignVirtualFinger(2);
+                    }
+                    else { // added third and fourth
+                        swapFingers(lastFingerCount, 1);
+                        
+                        // add fourth
+                        clone(fs, 3, upperFingerIndex());
+                        assignVirtualFinger(3);
+                    }
+                    break;
+                case 3:
+                    assignVirtualFinger(1);
+                    clone(fs, 2, upperFingerIndex());
+                    assignVirtualFinger(2);
+                    clone(fs, 3, upperFingerIndex());
+                    assignVirtualFinger(3);
+                    break;
+                case 4:
+                    assignVirtualFinger(1);
+                    clone(fs, 2, upperFingerIndex());
+                    assignVirtualFinger(2);
+                    clone(fs, 3, upperFingerIndex());
+                    assignVirtualFinger(3);
+                    clone(fs, 4, upperFingerIndex());
+                    assignVirtualFinger(4);
+                    break;
+                default:
+                    ALPS_TRACKER_ERROR("alps_parse_hw_state: WTF!? fc=%d lfc=%d", clampedFingerCount, lastFingerCount);
+            }
+        }
+        else if (clampedFingerCount > lastFingerCount && hadLiftFinger) {
+            for (int i = 0; i < MAX_TOUCHES; i++) // clean virtual finger numbers
+                fs.virtualFingerIndex[i] = -1;
+            
+            int maxMinDist = 0, maxMinDistIndex = -1;
+            int secondMaxMinDist = 0, secondMaxMinDistIndex = -1;
+            
+            // find new physical finger for each existing virtual finger, jointly
+            int virtuals[MAX_TOUCHES];
+            FingerAssignment assignment(0, lastFingerCount);
+            for (int j = 0; j < MAX_TOUCHES; j++)
+                if (virtualFingers.touch & (1 << j))
+                    virtuals[assignment.rows++] = j;
+            for (int k = 0; k < assignment.rows; k++)
+                for (int i = 0; i < lastFingerCount; i++)
+                    assignment.cost[k][i] = dist(i, virtuals[k]);
+            int match[MAX_TOUCHES];
+            assignment.solve(FingerAssignment::kForced, match);
+            
+            for (int k = 0; k < assignment.rows; k++) {
+                int i = match[k];
+                if (i < 0) {
+                    ALPS_TRACKER_ERROR("alps_parse_hw_state: WTF!? minIndex is -1");
+                    continue;
+                }
+                int d = (int)assignment.cost[k][i];
+                if (d > maxMinDist) {
+                    secondMaxMinDist = maxMinDist;
+                    secondMaxMinDistIndex = maxMinDistIndex;
+                    maxMinDist = d;
+                    maxMinDistIndex = i;
+                }
+                else if (d > secondMaxMinDist) {
+                    secondMaxMinDist = d;
+                    secondMaxMinDistIndex = i;
+                }
+                fs.virtualFingerIndex[i] = virtuals[k];
+            }
+            
+            // assign new virtual fingers for all new fingers
+            for (int i = 0; i < (clampedFingerCount < 2 ? clampedFingerCount : 2); i++) // third and fourth 'fingers' are handled separately
+                if (fs.virtualFingerIndex[i] == -1)
+                    assignVirtualFinger(i); // here OK
+            
+            if (clampedFingerCount == 3) {
+                ALPS_TRACKER_LOG("alps_parse_hw_state: adding third finger, maxMinDist=%d", maxMinDist);
+                fs.z[2] = (fs.z[0] + fs.z[1]) / 2;
+                if (maxMinDist > fingerGate && maxMinDistIndex >= 0) {
+                    // i-th physical finger was replaced, save its old coordinates to the 3rd physical finger and map it to a new virtual finger.
+                    // The third physical finger should now be mapped to the old fingerStates[i].virtualFingerIndex.
+                    swapFingers(2, maxMinDistIndex);
+                    ALPS_TRACKER_LOG("alps_parse_hw_state: swapped, saving location");
+                }
+                else {
+                    // existing fingers didn't change or were swapped, so we don't know the location of the third finger
+                    int j = upperFingerIndex();
+                    
+                    fs.x[2] = fs.x[j];
+                    fs.y[2] = fs.y[j];
+                    assignVirtualFinger(2);
+                    ALPS_TRACKER_LOG("alps_parse_hw_state: not swapped, taking upper finger position");
+                }
+            }
+            else if (clampedFingerCount >= 4) {
+                // Is it possible that both 0 and 1 fingers were swapped with 2 and 3?
+                ALPS_TRACKER_LOG("alps_parse_hw_state: adding third and fourth fingers, maxMinDist=%d, secondMaxMinDist=%d", maxMinDist, secondMaxMinDist);
+                fs.z[2] = fs.z[3] = (fs.z[0] + fs.z[1]) / 2;
+                
+                // Possible situations:
+                // 1. maxMinDist ≤ gate, lastFingerCount = 3 - no fingers swapped, just adding 4th finger
+                // 2. maxMinDist ≤ gate, lastFingerCount = 2 - no fingers swapped, just adding 3rd and 4th fingers
+                // 3. maxMinDist > gate, secondMaxMinDist ≤ gate, lastFingerCount = 3 - i'th finger was swapped with 4th, 3rd left in place (i∈{0,1}):
+                //      4th.xy = i'th.xy
+                //      p2v[2] = j
+                //      p2v[i] = next free
+                // 4. maxMinDist > gate, secondMaxMinDist > gate, lastFingerCount = 3 - i'th finger was swapped with 3rd and k'th finger was swapped with 4th (i,k∈{0,1}):
+                //      is it possible that only imaginary finger was left in place?!
+                // 5. maxMinDist > gate, secondMaxMinDist ≤ gate, lastFingerCount = 2 - one finger swapped, one finger left in place.
+                
+                
+                if (maxMinDist > fingerGate && maxMinDistIndex >= 0) {
+                    if (lastFingerCount < 3) {
+                        // i-th physical finger was replaced, save its old coordinates to the 3rd physical finger and map it to a new virtual finger.
+                        // The third physical finger should now be mapped to the old fingerStates[i].virtualFingerIndex.
+                        swapFingers(2, maxMinDistIndex);
+                        if (secondMaxMinDist > fingerGate && secondMaxMinDistIndex >= 0) {
+                            // both fingers were swapped with new ones
+                            // i-th physical finger was replaced, save its old coordinates to the 4th physical finger and map it to a new virtual finger.
+                            // The fourth physical finger should now be mapped to the old fingerStates[i].virtualFingerIndex.
+                            swapFingers(3, secondMaxMinDistIndex);
+                        }
+                        else {
+                            // fourth finger is new
+                            clone(fs, 3, upperFingerIndex());
+                            assignVirtualFinger(3);
+                        }
+                    }
+                    else {
+                        // i-th physical finger was replaced, save its old coordinates to the 4th physical finger and map it to a new virtual finger.
+                        // The fourth physical finger should now be mapped to the old fingerStates[i].virtualFingerIndex.
+                        swapFingers(3, maxMinDistIndex);
+                        if (secondMaxMinDist > fingerGate && secondMaxMinDistIndex >= 0) {
+                            // both replaced with the third kept: only the farther one moves to the fourth
+                            ALPS_TRACKER_LOG("alps_parse_hw_state: both fingers replaced: fc=%d, lfc=%d, mdi=%d(%d), smdi=%d(%d)", clampedFingerCount, lastFingerCount, maxMinDist, maxMinDistIndex, secondMaxMinDist, secondMaxMinDistIndex);
+                        }
+                    }
+                    ALPS_TRACKER_LOG("alps_parse_hw_state: swapped, saving location");
+                }
+                else {
+                    // existing fingers didn't change or were swapped, so we don't know the location of the third and fourth fingers
+                    int j = upperFingerIndex();
+                    clone(fs, 2, j);
+                    if (lastFingerCount < 3)
+                        assignVirtualFinger(2);
+                    clone(fs, 3, j);
+                    assignVirtualFinger(3);
+                    ALPS_TRACKER_LOG("alps_parse_hw_state: not swapped, cloning existing fingers");
+                }
+                if (clampedFingerCount >= 5) {
+                    // Don't bother with 5th finger, always clone
+                    clone(fs, 4, upperFingerIndex());
+                    assignVirtualFinger(4);
+                    ALPS_TRACKER_LOG("cloning 5th finger");
+                }
+            }
+            freeAndMarkVirtualFingers();
+        }
+        else if (clampedFingerCount < lastFingerCount) {
+            // Set hadLiftFinger if lifted some fingers
+            // Reset hadLiftFinger if lifted all fingers
+            hadLiftFinger = clampedFingerCount > 0;
+            
+            // some fingers removed, need renumbering
+            for (int i = 0; i < MAX_TOUCHES; i++) // clean virtual finger numbers
+                fs.virtualFingerIndex[i] = -1;
+            
+            // nearest virtual finger for each remaining finger, jointly
+            int virtuals[MAX_TOUCHES];
+            FingerAssignment assignment(clampedFingerCount, 0);
+            for (int j = 0; j < MAX_TOUCHES; j++)
+                if (virtualFingers.touch & (1 << j))
+                    virtuals[assignment.cols++] = j;
+            for (int i = 0; i < clampedFingerCount; i++)
+                for (int k = 0; k < assignment.cols; k++)
+                    assignment.cost[i][k] = dist(i, virtuals[k]);
+            int match[MAX_TOUCHES];
+            assignment.solve(fingerGate, match);
+            
+            unsigned used = 0;
+            for (int i = 0; i < clampedFingerCount; i++) {
+                if (match[i] >= 0) {
+                    fs.virtualFingerIndex[i] = virtuals[match[i]];
+                    used |= 1 << virtuals[match[i]];
+                }
+            }
+            // A finger beyond the gate of every remaining virtual finger is a
+            // new contact rather than one that jumped, so it gets its own.
+            unsigned added = 0;
+            for (int i = 0; i < clampedFingerCount; i++) {
+                if (fs.virtualFingerIndex[i] >= 0)
+                    continue;
+                int j = __builtin_ctz(~used);
+                ALPS_TRACKER_LOG("alps_parse_hw_state: finger %d is beyond the gate, new virtual finger %d", i, j);
+                fs.virtualFingerIndex[i] = j;
+                virtualFingers.fingerType[j] = kMT2FingerTypeUndefined;
+                used |= 1 << j;
+                added |= 1 << j;
+            }
+            freeAndMarkVirtualFingers();
+            for (int j = 0; j < MAX_TOUCHES; j++)
+                if (added & (1 << j))
+                    assignFingerType(j);
+        }
+    }
+    
+    for (int i = 0; i < clampedFingerCount; i++) {
+        int j = fs.virtualFingerIndex[i];
+        ALPS_TRACKER_LOG("alps_parse_hw_state: finger %d -> virtual finger %d", i, j);
+        if (!isValidVirtualFinger(j)) {
+            ALPS_TRACKER_ERROR("alps_parse_hw_state: ERROR: invalid physical finger %d", j);
+            continue;
+        }
+        virtual_finger_state &fiv = virtualFingerStates[j];
+        fiv.x_avg.filter(fs.x[i], now, smoothing);
+        fiv.y_avg.filter(fs.y[i], now, smoothing);
+        // a filter that was reset starts a new contact
+        if (fiv.x_avg.count() == 1)
+            fiv.history.reset();
+        fiv.history.push(fiv.x_avg.average(), fiv.y_avg.average(), now);
+        virtualFingers.pressure[j] = fs.z[i];
+        // Only use this if trackpad is a clickpad
+        if (buttonDown)
+            virtualFingers.button |= 1 << j;
+        else
+            virtualFingers.button &= ~(1 << j);
+    }
+    
+    // Thumb detection. Must happen after setting coordinates (filter)
+    // A finger that kept the thumb type through a lift stays the thumb.
+    if (clampedFingerCount > lastFingerCount && clampedFingerCount >= 4 &&
+        (virtualFingers.freeFingerTypes & (1 << kMT2FingerTypeThumb))) {
+        // find the lowest finger
+        int lowestFingerIndex = -1;
+        int min_y = INT_MAX;
+        for (int i = 0; i < MAX_TOUCHES; i++) {
+            bool touch = virtualFingers.touch & (1 << i);
+            int y = virtualFingerStates[i].y_avg.average();
+            ALPS_TRACKER_LOG("finger %d: touch %d, y %d", i, touch, y);
+            if (touch && y < min_y) {
+                lowestFingerIndex = i;
+                min_y = y;
+            }
+        }
+        ALPS_TRACKER_LOG("lowest finger: %d", lowestFingerIndex);
+        if (lowestFingerIndex == -1)
+            ALPS_TRACKER_ERROR("alps_parse_hw_state: WTF?! lowest finger not found!");
+        else {
+            uint8_t &type = virtualFingers.fingerType[lowestFingerIndex];
+            if (isValidFingerType(type) && type != kMT2FingerTypeUndefined)
+                virtualFingers.freeFingerTypes |= 1 << type;
+            type = kMT2FingerTypeThumb;
+            virtualFingers.freeFingerTypes &= ~(1 << kMT2FingerTypeThumb);
+        }
+    }
+    
+    ALPS_TRACKER_LOG("alps_parse_hw_state: lastFingerCount=%d clampedFingerCount=%d", lastFingerCount, clampedFingerCount);
+    return true;
+}
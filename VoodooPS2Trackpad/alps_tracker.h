@@ -0,0 +1,393 @@
+/*
+ * Copyright (c) 2002 Apple Computer, Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * The contents of this file constitute Original Code as defined in and
+ * are subject to the Apple Public Source License Version 1.2 (the
+ * "License").  You may not use this file except in compliance with the
+ * License.  Please obtain a copy of the License at
+ * http://www.apple.com/publicsource and read it before using this file.
+ *
+ * This Original Code and all software distributed under the License are
+ * distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE OR NON-INFRINGEMENT.  Please see the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// ALPS finger tracking
+//
+// Follows the physical fingers of each decoded frame with virtual fingers
+// that keep their identity, smoothing filter and finger type from frame to
+// frame. Like alps_decode it does not depend on IOKit, so Host/Makefile
+// builds it too and Host/alps_fuzz can drive it with arbitrary packets.
+//
+
+#ifndef _ALPS_TRACKER_H
+#define _ALPS_TRACKER_H
+
+#include <limits.h>
+#include <stdint.h>
+
+#include "alps_decode.h"
+
+#if defined(KERNEL)
+#include <IOKit/IOLib.h>
+#include "VoodooInputMultitouch/VoodooInputEvent.h"
+#define ALPS_TRACKER_ERROR(args...)  do { errors++; IOLog(args); } while (0)
+#else
+/* host builds, numbered as in VoodooInputTransducer.h */
+enum MT2FingerType {
+    kMT2FingerTypeUndefined = 0,
+    kMT2FingerTypeThumb,
+    kMT2FingerTypeIndexFinger,
+    kMT2FingerTypeMiddleFinger,
+    kMT2FingerTypeRingFinger,
+    kMT2FingerTypeLittleFinger,
+    kMT2FingerTypeCount
+};
+#define ALPS_TRACKER_ERROR(args...)  do { errors++; } while (0)
+#endif
+
+#if defined(KERNEL) && defined(DEBUG_MSG)
+#define ALPS_TRACKER_LOG(args...)  do { IOLog(args); } while (0)
+#else
+#define ALPS_TRACKER_LOG(args...)  do { } while (0)
+#endif
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// SimpleAverage Class Declaration
+//
+
+template <class T, int N>
+class SimpleAverage
+{
+private:
+    T m_buffer[N];
+    int m_count;
+    int m_sum;
+    int m_index;
+    
+public:
+    inline SimpleAverage() { reset(); }
+    T filter(T data)
+    {
+        // add new entry to sum
+        m_sum += data;
+        // if full buffer, then we are overwriting, so subtract old from sum
+        if (m_count == N)
+            m_sum -= m_buffer[m_index];
+        // new entry into buffer
+        m_buffer[m_index] = data;
+        // move index to next position with wrap around
+        if (++m_index >= N)
+            m_index = 0;
+        // keep count moving until buffer is full
+        if (m_count < N)
+            ++m_count;
+        // return average of current items
+        return m_sum / m_count;
+    }
+    inline void reset()
+    {
+        m_count = 0;
+        m_sum = 0;
+        m_index = 0;
+    }
+    inline int count() const { return m_count; }
+    inline int sum() const { return m_sum; }
+    T oldest() const
+    {
+        // undefined if nothing in here, return zero
+        if (m_count == 0)
+            return 0;
+        // if it is not full, oldest is at index 0
+        // if full, it is right where the next one goes
+        if (m_count < N)
+            return m_buffer[0];
+        else
+            return m_buffer[m_index];
+    }
+    T newest() const
+    {
+        // undefined if nothing in here, return zero
+        if (m_count == 0)
+            return 0;
+        // newest is index - 1, with wrap
+        int index = m_index;
+        if (--index < 0)
+            index = m_count-1;
+        return m_buffer[index];
+    }
+    T average() const
+    {
+        if (m_count == 0)
+            return 0;
+        return m_sum / m_count;
+    }
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// CoordinateFilter Class Declaration
+//
+
+enum SmoothingFilter {
+    kSmoothingBox = 0,          // SimpleAverage of the last 5 samples
+    kSmoothingOneEuro = 1,      // One-Euro: low-pass whose cutoff rises with speed
+    kSmoothingAlphaBeta = 2,    // alpha-beta tracker: position and velocity
+};
+
+/// Coefficients for all CoordinateFilters, precomputed from the plist
+/// (see setParamPropertiesGated)
+struct smoothing_params {
+    int filter;                 // SmoothingFilter
+    int64_t min_cutoff;         // One-Euro cutoff at rest, mHz
+    int64_t beta;               // One-Euro cutoff increase, mHz per unit/s
+    int64_t d_tau;              // One-Euro derivative time constant, us
+    int64_t alpha;              // alpha-beta position gain, 16.16
+    int64_t ab_beta;            // alpha-beta velocity gain, 16.16
+};
+
+class CoordinateFilter
+{
+private:
+    SimpleAverage<int, 5> m_box;
+    int m_newest;
+    int m_output;
+    int m_count;
+    int64_t m_x;                // position, 16.16
+    int64_t m_dx;               // speed in units/s, 16.16
+    uint64_t m_time;            // us
+    
+public:
+    inline CoordinateFilter() { reset(); }
+    int filter(int data, uint64_t time, const smoothing_params& params)
+    {
+        m_newest = data;
+        if (m_count < INT_MAX)
+            ++m_count;
+        
+        if (params.filter == kSmoothingBox)
+            return m_output = m_box.filter(data);
+        
+        int64_t x = (int64_t)data * 65536;
+        if (m_count == 1) {
+            m_x = x;
+            m_dx = 0;
+        } else {
+            int64_t dt = time > m_time ? time - m_time : 1;
+            if (dt > 1000000)
+                dt = 1000000;
+            if (params.filter == kSmoothingOneEuro) {
+                int64_t dx = (x - m_x) * 1000000 / dt;
+                m_dx += (dx - m_dx) * dt / (dt + params.d_tau);
+                int64_t speed = (m_dx < 0 ? -m_dx : m_dx) >> 16;
+                // tau = 1 / (2 pi cutoff), in us for a cutoff in mHz
+                int64_t tau = 159154943 / (params.min_cutoff + params.beta * speed);
+                m_x += (x - m_x) * dt / (dt + tau);
+            } else {
+                int64_t predicted = m_x + m_dx * dt / 1000000;
+                int64_t residual = x - predicted;
+                m_x = predicted + ((residual * params.alpha) >> 16);
+                m_dx += ((residual * params.ab_beta) >> 16) * 1000000 / dt;
+            }
+        }
+        m_time = time;
+        return m_output = (int)((m_x + (1 << 15)) >> 16);
+    }
+    inline void reset()
+    {
+        m_box.reset();
+        m_newest = 0;
+        m_output = 0;
+        m_count = 0;
+    }
+    inline int count() const { return m_count; }
+    inline int newest() const { return m_newest; }
+    inline int average() const { return m_output; }
+};
+
+/// Recent filtered positions of a virtual finger, for the predictor
+struct motion_history {
+    enum { kSize = 8 };
+    int x[kSize];
+    int y[kSize];
+    uint64_t time[kSize];       // us
+    int head;                   // newest entry
+    int count;
+    
+    inline void reset() { count = 0; }
+    inline void push(int px, int py, uint64_t t)
+    {
+        head = (head + 1) & (kSize - 1);
+        x[head] = px;
+        y[head] = py;
+        time[head] = t;
+        if (count < kSize)
+            ++count;
+    }
+    /// @k 0 is the newest entry, count-1 the oldest
+    inline int at(int k) const { return (head - k) & (kSize - 1); }
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// FingerAssignment Class Declaration
+//
+
+/// Minimum-cost matching of up to MAX_TOUCHES rows to up to MAX_TOUCHES
+/// columns. It is exact, a DP over the subsets of used columns, so a solve
+/// takes at most MAX_TOUCHES * 2^MAX_TOUCHES * (MAX_TOUCHES + 1) steps.
+class FingerAssignment
+{
+public:
+    /// cost of leaving a row unmatched when every match must be made
+    static const int64_t kForced = 1LL << 40;
+    
+    int64_t cost[MAX_TOUCHES][MAX_TOUCHES];
+    int rows;
+    int cols;
+    
+    inline FingerAssignment(int r, int c) : rows(r), cols(c) {}
+    
+    /// A row is left unmatched (-1 in @match) at a cost of @gate, so no pair
+    /// costing more than @gate is ever matched. kForced matches as many rows
+    /// as there are columns.
+    /// @return The total cost
+    int64_t solve(int64_t gate, int match[MAX_TOUCHES]) const
+    {
+        int64_t best[MAX_TOUCHES + 1][1 << MAX_TOUCHES];
+        int8_t choice[MAX_TOUCHES][1 << MAX_TOUCHES];
+        int masks = 1 << cols;
+        
+        for (int mask = 0; mask < masks; mask++)
+            best[rows][mask] = 0;
+        for (int i = rows - 1; i >= 0; i--) {
+            for (int mask = 0; mask < masks; mask++) {
+                int64_t b = gate + best[i + 1][mask];
+                int c = -1;
+                for (int j = 0; j < cols; j++) {
+                    if (mask & (1 << j) || cost[i][j] > gate)
+                        continue;
+                    int64_t v = cost[i][j] + best[i + 1][mask | (1 << j)];
+                    if (v < b) {
+                        b = v;
+                        c = j;
+                    }
+                }
+                best[i][mask] = b;
+                choice[i][mask] = c;
+            }
+        }
+        for (int i = 0, mask = 0; i < rows; i++) {
+            match[i] = choice[i][mask];
+            if (match[i] >= 0)
+                mask |= 1 << match[i];
+        }
+        return best[0][0];
+    }
+};
+
+/// Physical fingers of the current frame, one array per field
+struct alps_hw_state {
+     int16_t x[MAX_TOUCHES];
+     int16_t y[MAX_TOUCHES];
+     int16_t z[MAX_TOUCHES];
+     int8_t virtualFingerIndex[MAX_TOUCHES];
+ };
+
+/// What the tracking loops read of every virtual finger on every frame,
+/// one bit or one array entry per finger. Filters and motion history are
+/// in virtual_finger_state and only touched for fingers that are down.
+struct virtual_finger_set {
+     uint8_t touch;
+     uint8_t button;
+     uint16_t freeFingerTypes;              // bit per MT2FingerType
+     uint8_t pressure[MAX_TOUCHES];
+     uint8_t fingerType[MAX_TOUCHES];       // MT2FingerType
+ };
+
+#define kFreeFingerTypesAll (((1 << kMT2FingerTypeCount) - 1) & ~(1 << kMT2FingerTypeUndefined))
+
+struct virtual_finger_state {
+     CoordinateFilter x_avg;
+     CoordinateFilter y_avg;
+     motion_history history;
+ };
+
+static inline bool isValidVirtualFinger(int j) {
+    return j >= 0 && j < MAX_TOUCHES;
+}
+
+static inline bool isValidFingerType(int type) {
+    return type >= kMT2FingerTypeUndefined && type < kMT2FingerTypeCount;
+}
+
+template <typename TValue, typename TLimit, typename TMargin>
+static inline void clip_no_update_limits(TValue& value, TLimit minimum, TLimit maximum, TMargin)
+{
+    if (value < minimum)
+        value = minimum;
+    if (value > maximum)
+        value = maximum;
+}
+
+bool predictMotion(const motion_history& h, int from, uint64_t horizon, int& x, int& y);
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// AlpsTracker Class Declaration
+//
+
+class AlpsTracker
+{
+public:
+    // per-frame tracking state, 50 bytes together
+    struct alps_hw_state fingerStates;
+    struct virtual_finger_set virtualFingers;
+    struct virtual_finger_state virtualFingerStates[MAX_TOUCHES];
+    
+    static_assert(MAX_TOUCHES <= kMT2FingerTypeLittleFinger, "Too many fingers for one hand");
+    static_assert(MAX_TOUCHES <= 8 && kMT2FingerTypeCount <= 16, "Finger bitmasks too small");
+    
+    int clampedFingerCount;     // physical fingers of the current frame
+    int lastFingerCount;        // physical fingers of the last frame sent
+    bool hadLiftFinger;
+    bool wasSkipped;
+    
+    smoothing_params smoothing;
+    // a finger moving further than this between packets is a different finger
+    int64_t fingerGate;         // squared, as dist() returns
+    // the logical area the imaginary 3rd to 5th fingers are kept in
+    int min_x, max_x, min_y, max_y;
+    int margin_x, margin_y;
+    
+    // inconsistent states found and repaired, each one also logged
+    unsigned errors;
+    
+    AlpsTracker();
+    
+    /// Forgets all fingers, as after hardware init
+    void reset();
+    
+    /// Translates physical fingers into virtual fingers so that host software doesn't see 'jumps' and has coordinates for all fingers.
+    /// @now_us is the packet time, @buttonDown whether the clickpad button is down.
+    /// @return True if is ready to send finger state to host interface
+    bool renumberFingers(uint64_t now_us, bool buttonDown);
+    
+private:
+    uint64_t now;               // us, of the frame being tracked
+    
+    void freeAndMarkVirtualFingers();
+    int dist(int physicalFinger, int virtualFinger);
+    void assignVirtualFinger(int physicalFinger);
+    void assignFingerType(int virtualFinger);
+    int upperFingerIndex() const;
+    void swapFingers(int dst, int src);
+};
+
+#endif /* _ALPS_TRACKER_H */